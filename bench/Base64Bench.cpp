@@ -0,0 +1,96 @@
+// encodeBase64()/decodeBase64() on each kernel this cpu has: the scalar table code alone, SSSE3
+// and AVX2, each with the scalar code on the tail as the public functions run them.
+//
+// 4 MB of random bytes, so the per call cost does not show in the rates. Every kernel has to
+// give the scalar code's text and decode it back to the input, on the big buffer and on every
+// size up to 256 bytes so the tails and the padding are covered. Base64.cpp is compiled into
+// the bench to reach the kernels, GB/s is of the binary data both ways.
+
+#include "foundation/Base64.cpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+static const size_t DATA_SIZE = 4 * 1024 * 1024;
+static const size_t MAX_SMALL_SIZE = 256;
+static const int ROUNDS = 50;
+
+struct Kernel {
+    const char *name;
+    EncodeBase64Func encode;
+    DecodeBase64Func decode;
+};
+
+static bool roundTrip(const Kernel &kernel,
+                      const std::vector<uint8_t> &data,
+                      size_t size,
+                      std::string &text,
+                      std::vector<uint8_t> &decoded) {
+    std::string expected(base64EncodedSize(size), '\0');
+    encodeBase64With(encodeBase64C, data.data(), size, expected.data());
+
+    text.assign(base64EncodedSize(size), '\0');
+    size_t length = encodeBase64With(kernel.encode, data.data(), size, text.data());
+    if (length != text.size() || text != expected) {
+        printf("%s: encoding of %zu bytes differs from the scalar code\n", kernel.name, size);
+        return false;
+    }
+    decoded.assign(size, 0);
+    size_t decodedSize = 0;
+    if (!decodeBase64With(kernel.decode, text.data(), text.size(), decoded.data(),
+                          &decodedSize) ||
+        decodedSize != size || !std::equal(decoded.begin(), decoded.end(), data.begin())) {
+        printf("%s: %zu bytes do not decode back\n", kernel.name, size);
+        return false;
+    }
+    return true;
+}
+
+template <typename Func> static double measure(Func func) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ROUNDS; ++i) func();
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+    return (double)DATA_SIZE * ROUNDS / seconds.count() / 1e9;
+}
+
+int main() {
+    std::mt19937 rng(7);
+    std::vector<uint8_t> data(DATA_SIZE);
+    for (auto &byte : data) byte = (uint8_t)rng();
+
+    std::vector<Kernel> kernels = {{"scalar", encodeBase64C, decodeBase64C}};
+#if defined(CPU_X86)
+    if (cpuHasSSSE3()) kernels.push_back({"SSSE3", encodeBase64SSSE3, decodeBase64SSSE3});
+    if (cpuHasAVX2()) kernels.push_back({"AVX2", encodeBase64AVX2, decodeBase64AVX2});
+#endif
+
+    printf("%zu bytes, %d rounds\n", DATA_SIZE, ROUNDS);
+    printf("%-8s %12s %12s %10s %10s\n", "kernel", "enc GB/s", "dec GB/s", "enc x", "dec x");
+    std::string text;
+    std::vector<uint8_t> decoded;
+    double scalarEncode = 0, scalarDecode = 0;
+    for (auto &kernel : kernels) {
+        for (size_t size = 0; size <= MAX_SMALL_SIZE; ++size) {
+            if (!roundTrip(kernel, data, size, text, decoded)) return 1;
+        }
+        if (!roundTrip(kernel, data, DATA_SIZE, text, decoded)) return 1;
+
+        double encode = measure([&]() {
+            encodeBase64With(kernel.encode, data.data(), DATA_SIZE, text.data());
+        });
+        size_t decodedSize = 0;
+        double decode = measure([&]() {
+            decodeBase64With(kernel.decode, text.data(), text.size(), decoded.data(), &decodedSize);
+        });
+        if (kernel.encode == encodeBase64C) {
+            scalarEncode = encode;
+            scalarDecode = decode;
+        }
+        printf("%-8s %12.2f %12.2f %9.1fx %9.1fx\n", kernel.name, encode, decode,
+               encode / scalarEncode, decode / scalarDecode);
+    }
+    return 0;
+}
@@ -0,0 +1,105 @@
+// BitReader against the byte-wise 32-bit reservoir reader it replaced.
+//
+// Three workloads over random data: mixed width fixed fields, Exp-Golomb codes (what SPS and slice
+// headers are made of) and a fresh reader per 2 byte HEVC NAL header, the way the RTP code uses it.
+
+#include "bench/LegacyBitReader.h"
+#include "foundation/BitReader.h"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+static const size_t DATA_SIZE = 1 << 20;
+static const int ROUNDS = 50;
+static const size_t FIELD_WIDTHS[] = {1, 3, 5, 8, 12, 16, 24, 32};
+
+// what a caller had to write before readUE()
+static uint32_t readUE(LegacyBitReader &reader) {
+    int leadingZeros = 0;
+    while (reader.numBitsLeft() > 0 && reader.getBits(1) == 0) ++leadingZeros;
+    if (leadingZeros > 31) return 0;
+    return (uint32_t)(((uint64_t)1 << leadingZeros) - 1 + reader.getBits(leadingZeros));
+}
+
+static uint32_t readUE(BitReader &reader) {
+    return reader.readUE();
+}
+
+template <typename Reader>
+static uint64_t readFields(const std::vector<uint8_t> &data) {
+    uint64_t sum = 0;
+    Reader reader(data.data(), data.size());
+    size_t i = 0;
+    while (reader.numBitsLeft() >= 32) {
+        sum += reader.getBits(FIELD_WIDTHS[i++ & 7]);
+    }
+    return sum;
+}
+
+template <typename Reader>
+static uint64_t readExpGolomb(const std::vector<uint8_t> &data) {
+    uint64_t sum = 0;
+    Reader reader(data.data(), data.size());
+    while (reader.numBitsLeft() >= 64) sum += readUE(reader);
+    return sum;
+}
+
+template <typename Reader>
+static uint64_t readNalHeaders(const std::vector<uint8_t> &data) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i + 2 <= data.size(); i += 2) {
+        Reader reader(data.data() + i, 2);
+        reader.getBits(1);
+        sum += reader.getBits(6);
+        sum += reader.getBits(6);
+        sum += reader.getBits(3);
+    }
+    return sum;
+}
+
+// runs fn ROUNDS times, returns MB/s
+template <typename Fn>
+static double measure(const std::vector<uint8_t> &data, Fn fn, uint64_t &sum) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ROUNDS; ++i) sum += fn(data);
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+    return (double)data.size() * ROUNDS / seconds.count() / (1024 * 1024);
+}
+
+int main() {
+    std::vector<uint8_t> data(DATA_SIZE);
+    std::mt19937 random(1);
+    for (auto &byte : data) byte = (uint8_t)random();
+
+    // Exp-Golomb codes of small values, a sparse random stream would be mostly long codes
+    std::vector<uint8_t> golomb(DATA_SIZE);
+    for (size_t i = 0; i < golomb.size(); ++i) golomb[i] = (i % 3) ? 0xa5 : 0x4c;
+
+    struct Workload {
+        const char *name;
+        const std::vector<uint8_t> *data;
+        uint64_t (*legacy)(const std::vector<uint8_t> &);
+        uint64_t (*current)(const std::vector<uint8_t> &);
+    };
+    Workload workloads[] = {
+        {"fixed fields", &data, readFields<LegacyBitReader>, readFields<BitReader>},
+        {"exp-golomb", &golomb, readExpGolomb<LegacyBitReader>, readExpGolomb<BitReader>},
+        {"nal headers", &data, readNalHeaders<LegacyBitReader>, readNalHeaders<BitReader>},
+    };
+
+    printf("%-14s %12s %12s %8s\n", "workload", "legacy MB/s", "MB/s", "speedup");
+    for (auto &workload : workloads) {
+        uint64_t legacySum = 0;
+        uint64_t sum = 0;
+        double legacy = measure(*workload.data, workload.legacy, legacySum);
+        double current = measure(*workload.data, workload.current, sum);
+        if (legacySum != sum) {
+            printf("%s: results differ\n", workload.name);
+            return 1;
+        }
+        printf("%-14s %12.1f %12.1f %7.2fx\n", workload.name, legacy, current, current / legacy);
+    }
+    return 0;
+}
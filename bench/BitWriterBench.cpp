@@ -0,0 +1,100 @@
+// BitWriter against the byte-wise 32-bit reservoir writer it replaced.
+//
+// Three workloads: mixed width fixed fields into a 1 MB buffer, Exp-Golomb codes (the old writer
+// has no putUE(), a caller had to count the bits itself) and a fresh writer per 2 byte HEVC
+// payload header, the way the packetizers use it, where putFixedBits() is measured as well. Both
+// writers must produce the same bytes.
+
+#include "bench/LegacyBitWriter.h"
+#include "foundation/BitWriter.h"
+
+#include <bit>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+static const size_t DATA_SIZE = 1 << 20;
+static const int ROUNDS = 50;
+// the old writer cannot take 32 bits at once
+static const size_t FIELD_WIDTHS[] = {1, 3, 5, 8, 12, 16, 24, 7};
+
+static void putUE(LegacyBitWriter &writer, uint32_t x) {
+    uint64_t v = (uint64_t)x + 1;
+    int len = std::bit_width(v);
+    writer.putBits(0, len - 1);
+    writer.putBits((uint32_t)v, len);
+}
+
+static void putUE(BitWriter &writer, uint32_t x) {
+    writer.putUE(x);
+}
+
+template <typename Writer>
+static void writeFields(std::vector<uint8_t> &out) {
+    Writer writer(out.data(), out.size());
+    // 76 bits per round of widths
+    for (size_t i = 0; i < out.size() * 8 / 76 * 8; ++i) {
+        writer.putBits((uint32_t)(i * 0x9e3779b9), FIELD_WIDTHS[i & 7]);
+    }
+}
+
+template <typename Writer>
+static void writeExpGolomb(std::vector<uint8_t> &out) {
+    Writer writer(out.data(), out.size());
+    // codes of 1 to 9 bits, 92 bits per round of 16 values
+    for (size_t i = 0; i < out.size() * 8 / 92 * 16; ++i) putUE(writer, (uint32_t)(i & 15));
+}
+
+template <typename Writer>
+static void writeHeaders(std::vector<uint8_t> &out) {
+    for (size_t i = 0; i + 2 <= out.size(); i += 2) {
+        Writer writer(out.data() + i, 2);
+        writer.putBits(0, 1);
+        writer.putBits((uint32_t)(i >> 1) & 0x3f, 6);
+        writer.putBits(0, 6);
+        writer.putBits(1, 3);
+    }
+}
+
+static void writeFixedHeaders(std::vector<uint8_t> &out) {
+    for (size_t i = 0; i + 2 <= out.size(); i += 2) {
+        putFixedBits<1, 6, 6, 3>(out.data() + i, 0, (uint32_t)(i >> 1) & 0x3f, 0, 1);
+    }
+}
+
+// runs fn ROUNDS times, returns MB/s of output
+static double measure(std::vector<uint8_t> &out, void (*fn)(std::vector<uint8_t> &)) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ROUNDS; ++i) fn(out);
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+    return (double)out.size() * ROUNDS / seconds.count() / (1024 * 1024);
+}
+
+int main() {
+    struct Workload {
+        const char *name;
+        void (*legacy)(std::vector<uint8_t> &);
+        void (*current)(std::vector<uint8_t> &);
+    };
+    Workload workloads[] = {
+        {"fixed fields", writeFields<LegacyBitWriter>, writeFields<BitWriter>},
+        {"exp-golomb", writeExpGolomb<LegacyBitWriter>, writeExpGolomb<BitWriter>},
+        {"nal headers", writeHeaders<LegacyBitWriter>, writeHeaders<BitWriter>},
+        {"putFixedBits", writeHeaders<LegacyBitWriter>, writeFixedHeaders},
+    };
+
+    printf("%-14s %12s %12s %8s\n", "workload", "legacy MB/s", "MB/s", "speedup");
+    for (auto &workload : workloads) {
+        std::vector<uint8_t> legacyOut(DATA_SIZE, 0);
+        std::vector<uint8_t> out(DATA_SIZE, 0);
+        double legacy = measure(legacyOut, workload.legacy);
+        double current = measure(out, workload.current);
+        if (legacyOut != out) {
+            printf("%s: output differs\n", workload.name);
+            return 1;
+        }
+        printf("%-14s %12.1f %12.1f %7.2fx\n", workload.name, legacy, current, current / legacy);
+    }
+    return 0;
+}
@@ -0,0 +1,99 @@
+// nalToRbsp()/rbspToNal() against byte-at-a-time loops on a 4 MB IDR sized payload.
+//
+// Two payloads: random RBSP, where 00 00 0x is as rare as in real slice data, and one where a
+// quarter of the bytes are zero, so escapes come every few dozen bytes. Both implementations
+// must produce the same bytes.
+
+#include "foundation/CpuFeatures.h"
+#include "foundation/Startcode.h"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+static const size_t PAYLOAD_SIZE = 4 * 1024 * 1024;
+static const int ROUNDS = 50;
+
+static size_t scalarNalToRbsp(const uint8_t *src, size_t size, uint8_t *dst) {
+    uint8_t *out = dst;
+    int zeros = 0;
+    for (size_t i = 0; i < size; ++i) {
+        if (zeros >= 2 && src[i] == 3) {
+            zeros = 0;
+            continue;
+        }
+        *out++ = src[i];
+        zeros = src[i] ? 0 : zeros + 1;
+    }
+    return out - dst;
+}
+
+static size_t scalarRbspToNal(const uint8_t *src, size_t size, uint8_t *dst) {
+    uint8_t *out = dst;
+    int zeros = 0;
+    for (size_t i = 0; i < size; ++i) {
+        if (zeros >= 2 && src[i] <= 3) {
+            *out++ = 3;
+            zeros = 0;
+        }
+        *out++ = src[i];
+        zeros = src[i] ? 0 : zeros + 1;
+    }
+    if (out > dst && out[-1] == 0) *out++ = 3;
+    return out - dst;
+}
+
+using ConvertFunc = size_t (*)(const uint8_t *, size_t, uint8_t *);
+
+// converts src ROUNDS times, returns MB/s of input
+static double measure(ConvertFunc convert,
+                      const std::vector<uint8_t> &src,
+                      std::vector<uint8_t> &dst) {
+    dst.resize(rbspToNalMaxSize(src.size()));
+    size_t size = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ROUNDS; ++i) size = convert(src.data(), src.size(), dst.data());
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+    dst.resize(size);
+    return (double)src.size() * ROUNDS / seconds.count() / (1024 * 1024);
+}
+
+static bool run(const char *name, const std::vector<uint8_t> &rbsp) {
+    std::vector<uint8_t> scalarNal, nal, scalarOut, out;
+    double scalarEscape = measure(scalarRbspToNal, rbsp, scalarNal);
+    double escape = measure(rbspToNal, rbsp, nal);
+    double scalarUnescape = measure(scalarNalToRbsp, nal, scalarOut);
+    double unescape = measure(nalToRbsp, nal, out);
+    if (scalarNal != nal || scalarOut != out || out != rbsp) {
+        printf("%s: output differs\n", name);
+        return false;
+    }
+
+    printf("%s, %zu escapes\n", name, nal.size() - rbsp.size());
+    printf("  rbspToNal %8.1f MB/s, byte loop %8.1f MB/s  %.2fx\n", escape, scalarEscape,
+           escape / scalarEscape);
+    printf("  nalToRbsp %8.1f MB/s, byte loop %8.1f MB/s  %.2fx\n", unescape, scalarUnescape,
+           unescape / scalarUnescape);
+    return true;
+}
+
+int main() {
+    std::mt19937 random(1);
+    std::vector<uint8_t> rbsp(PAYLOAD_SIZE);
+    for (auto &byte : rbsp) byte = (uint8_t)random();
+    std::vector<uint8_t> zeroHeavy(PAYLOAD_SIZE);
+    for (auto &byte : zeroHeavy) byte = random() % 4 ? (uint8_t)random() : 0;
+    // the last byte decides whether a trailing 03 is appended, keep it nonzero so the
+    // round trip gives back the input
+    rbsp.back() = zeroHeavy.back() = 0x80;
+
+#if defined(CPU_X86)
+    printf("%s kernel\n", cpuHasAVX2() ? "AVX2" : "SSE2");
+#elif defined(CPU_NEON)
+    printf("NEON kernel\n");
+#endif
+    if (!run("random payload", rbsp)) return 1;
+    if (!run("zero heavy payload", zeroHeavy)) return 1;
+    return 0;
+}
@@ -0,0 +1,167 @@
+// Viewers joining a running program, with RtspProgram's GOP cache and without it: how long after
+// subscribe() the first video keyframe a late viewer gets is due. With catchUpRate 0 the cached
+// units go out at once, so that is how long the viewer waits for a picture.
+//
+// Usage: GopCacheBench <media file with H.264 or HEVC video>
+//
+// A first viewer keeps the program running and records every video access unit. Late viewers
+// then join one after another at random points of the GOP and read until their second keyframe.
+// What a late viewer gets has to start at a keyframe and be a gap free run of what the first
+// viewer got: the cached units, then the live ones. Each mode runs on its own program, read
+// from the start of the file, which has to last for the joins.
+
+#include "rtsp/server/RtspProgram.h"
+#include "foundation/TimerService.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+static const int JOINS = 5;
+static const int64_t MAX_JOIN_DELAY_US = 1000000;
+static const int64_t VIEWER_TIMEOUT_US = 10 * 1000000;
+static const size_t CACHE_SIZE = 4 * 1024 * 1024;
+// what RtspServerHelper gives a session
+static const QueueLimits VIEWER_LIMITS = {256, 8 * 1024 * 1024, 1000000};
+
+using PacketLists = std::vector<std::shared_ptr<RtpPacketList>>;
+
+struct FirstViewer {
+    std::shared_ptr<RtspSubscriber> subscriber;
+    std::mutex mutex;
+    PacketLists units;
+
+    void run(int streamId) {
+        auto queue = subscriber->getQueue(streamId);
+        std::shared_ptr<RtpPacketList> packetList;
+        while (queue->pop(packetList)) {
+            std::lock_guard<std::mutex> lock(mutex);
+            units.push_back(std::move(packetList));
+        }
+    }
+
+    // true when units follow each other in what this viewer got
+    bool contains(const PacketLists &run) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+        for (;;) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                auto it = std::find(units.begin(), units.end(), run.front());
+                if (it != units.end() && (size_t)(units.end() - it) >= run.size()) {
+                    return std::equal(run.begin(), run.end(), it);
+                }
+            }
+            if (std::chrono::steady_clock::now() > deadline) return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+};
+
+struct JoinResult {
+    bool ok = false;
+    int64_t waitUs = 0;
+    size_t cachedUnits = 0;
+};
+
+static JoinResult join(RtspProgram &program, int streamId, FirstViewer &first) {
+    JoinResult result;
+    int64_t joinUs = timerNowUs();
+    auto subscriber = program.subscribe({streamId}, VIEWER_LIMITS, []() {});
+    PacketLists units = subscriber->takeCached(streamId);
+    result.cachedUnits = units.size();
+
+    auto queue = subscriber->getQueue(streamId);
+    int keyframes = 0;
+    for (auto &packetList : units) keyframes += packetList->packetBuffer->isKeyFrame();
+    while (keyframes < 2 && timerNowUs() - joinUs < VIEWER_TIMEOUT_US) {
+        std::shared_ptr<RtpPacketList> packetList;
+        if (!queue->tryPop(packetList)) {
+            if (subscriber->isEnded()) break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        keyframes += packetList->packetBuffer->isKeyFrame();
+        units.push_back(std::move(packetList));
+    }
+    program.unsubscribe(subscriber);
+
+    if (keyframes < 2 || !units.front()->packetBuffer->isKeyFrame()) {
+        printf("a late viewer did not start at a keyframe or saw no second one\n");
+        return result;
+    }
+    if (!first.contains(units)) {
+        printf("a late viewer's units are not a gap free run of the program\n");
+        return result;
+    }
+    int64_t dueUs = program.getBaseTimeUs() + units.front()->packetBuffer->timeUs();
+    result.waitUs = std::max<int64_t>(dueUs - joinUs, 0);
+    result.ok = true;
+    return result;
+}
+
+static bool run(const char *name, const char *path, size_t cacheSize, std::mt19937 &rng) {
+    RtspProgram program(RtspProgram::RTSP_PROGRAM_FILE, "bench", path);
+    program.init();
+    program.setGopCacheLimit(cacheSize);
+    int streamId = 0;
+    while (streamId < 16 && program.getMediaType(streamId) != MEDIA_CODEC_TYPE_VIDEO) ++streamId;
+    if (streamId == 16 || program.getMime(streamId).empty()) {
+        printf("%s has no H.264 or HEVC video\n", path);
+        return false;
+    }
+
+    FirstViewer first;
+    first.subscriber = program.subscribe({streamId}, {4096, 0, 0}, []() {});
+    std::thread firstThread([&first, streamId]() { first.run(streamId); });
+
+    std::vector<JoinResult> results;
+    std::uniform_int_distribution<int64_t> delayUs(0, MAX_JOIN_DELAY_US);
+    for (int i = 0; i < JOINS; ++i) {
+        std::this_thread::sleep_for(std::chrono::microseconds(delayUs(rng)));
+        if (first.subscriber->isEnded()) break;
+        results.push_back(join(program, streamId, first));
+        if (!results.back().ok) break;
+    }
+    program.unsubscribe(first.subscriber);
+    firstThread.join();
+
+    bool ok = (int)results.size() == JOINS;
+    double waitSumUs = 0, cachedSum = 0;
+    int64_t waitMaxUs = 0;
+    for (auto &result : results) {
+        ok = ok && result.ok;
+        waitSumUs += (double)result.waitUs;
+        waitMaxUs = std::max(waitMaxUs, result.waitUs);
+        cachedSum += (double)result.cachedUnits;
+    }
+    if (!ok) {
+        printf("%s: %zu of %d joins, the file may be too short\n", name, results.size(), JOINS);
+        return false;
+    }
+    printf("%-12s %6d %14.1f %13.1f %13.1f\n", name, JOINS, waitSumUs / JOINS / 1000.0,
+           waitMaxUs / 1000.0, cachedSum / JOINS);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        printf("usage: %s <media file with H.264 or HEVC video>\n", argv[0]);
+        return 1;
+    }
+    if (FILE *file = fopen(argv[1], "rb")) {
+        fclose(file);
+    } else {
+        printf("can not open %s\n", argv[1]);
+        return 1;
+    }
+
+    std::mt19937 rng(11);
+    printf("%-12s %6s %14s %13s %13s\n", "mode", "joins", "wait mean ms", "wait max ms",
+           "cached units");
+    bool ok = run("cache 4 MB", argv[1], CACHE_SIZE, rng) && run("no cache", argv[1], 0, rng);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,30 @@
+#ifndef LEGACY_BIT_READER_H
+#define LEGACY_BIT_READER_H
+
+#include <cstddef>
+#include <cstdint>
+
+// BitReader as it was before the 64-bit reservoir, the baseline of BitReaderBench
+class LegacyBitReader {
+private:
+    const uint8_t *mpData;
+    size_t mSize;
+    uint32_t mReservoir;
+    uint32_t mNumBitsLeft;
+
+    bool fillReservoir();
+
+public:
+    LegacyBitReader(const uint8_t *data, size_t size);
+    LegacyBitReader(const LegacyBitReader &) = delete;
+    LegacyBitReader &operator=(const LegacyBitReader &) = delete;
+    ~LegacyBitReader();
+
+    bool getBitsGraceful(size_t n, uint32_t *out);
+    uint32_t getBits(size_t n);
+    bool skipBits(size_t n);
+    size_t numBitsLeft() const;
+    const uint8_t *data() const;
+};
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef LEGACY_BIT_WRITER_H
+#define LEGACY_BIT_WRITER_H
+
+#include <cstddef>
+#include <cstdint>
+
+// BitWriter as it was before the 64-bit accumulator, the baseline of BitWriterBench. One change:
+// the reservoir starts with 32 free bits, the original started at 0 and wrote four zero bytes
+// ahead of the data on the first putBits().
+class LegacyBitWriter {
+private:
+    uint8_t *mpData;
+    size_t mSize;
+    uint32_t mReservoir;
+    uint32_t mNumBitsLeft;
+
+public:
+    LegacyBitWriter(uint8_t *data, size_t size);
+    LegacyBitWriter(const LegacyBitWriter &) = delete;
+    LegacyBitWriter &operator=(const LegacyBitWriter &) = delete;
+    ~LegacyBitWriter();
+
+    void putBits(uint32_t x, size_t n);
+    void flush();
+};
+
+#endif
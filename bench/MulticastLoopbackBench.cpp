@@ -0,0 +1,184 @@
+// RtpServerStream::initMulticast() over loopback: one stream sends to a 239.255.x.x group with
+// 127.0.0.1 as the outgoing interface, two receivers on the same host join the group there with
+// IP_ADD_MEMBERSHIP. The server sends every packet once, each receiver has to get one copy of
+// it, in sequence.
+//
+// Access units are H.264, a 60 KB IDR every 25 frames and 6 KB P frames in between, packetized
+// by RtpServerH264Proto the way the program does it. First every access unit is waited for by
+// both receivers and the sequence numbers are checked, then the send rate is measured with the
+// receivers only counting.
+
+#include "rtsp/server/RtpServerStream.h"
+#include "foundation/TimerService.h"
+
+extern "C" {
+#include "libavcodec/packet.h"
+}
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+static const char *GROUP_ADDR = "239.255.42.1";
+static const char *INTERFACE_ADDR = "127.0.0.1";
+static const uint16_t GROUP_PORT = 30000;
+static const size_t IDR_SIZE = 60 * 1024;
+static const size_t P_SIZE = 6 * 1024;
+static const int GOP_SIZE = 25;
+static const int CHECKED_UNITS = 100;
+static const int ROUNDS = 2000;
+
+struct Receiver {
+    SOCKET socket = INVALID_SOCKET;
+    std::atomic<bool> stop{false};
+    std::atomic<int64_t> packets{0};
+    // a sequence number that is not the one after the last: lost, repeated or reordered
+    std::atomic<int64_t> seqErrors{0};
+
+    void run() {
+        std::vector<uint8_t> buffer(65536);
+        bool first = true;
+        uint16_t lastSeq = 0;
+        while (!stop.load()) {
+            int len = recv(socket, (char *)buffer.data(), (int)buffer.size(), 0);
+            if (len < RtpServerBaseProto::RTP_HEADER_SIZE) continue;
+            uint16_t seq = (uint16_t)(buffer[2] << 8 | buffer[3]);
+            if (!first && seq != (uint16_t)(lastSeq + 1)) seqErrors.fetch_add(1);
+            first = false;
+            lastSeq = seq;
+            packets.fetch_add(1);
+        }
+    }
+};
+
+static bool openReceiver(Receiver &receiver) {
+    SOCKET s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    receiver.socket = s;
+    int reuse = 1;
+    int recvBufferSize = 8 * 1024 * 1024;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse));
+    setsockopt(s, SOL_SOCKET, SO_RCVBUF, (const char *)&recvBufferSize, sizeof(recvBufferSize));
+#if defined(_WIN32)
+    DWORD timeoutMs = 100;
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeoutMs, sizeof(timeoutMs));
+#else
+    timeval timeout = {0, 100000};
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout, sizeof(timeout));
+#endif
+
+    SOCKADDR_IN addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(GROUP_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    ip_mreq membership = {};
+    inet_pton(AF_INET, GROUP_ADDR, &membership.imr_multiaddr);
+    inet_pton(AF_INET, INTERFACE_ADDR, &membership.imr_interface);
+    if (bind(s, (const SOCKADDR *)&addr, sizeof(addr)) == SOCKET_ERROR ||
+        setsockopt(s, IPPROTO_IP, IP_ADD_MEMBERSHIP, (const char *)&membership,
+                   sizeof(membership)) == SOCKET_ERROR) {
+        printf("failed to join %s on %s, error code:%d\n", GROUP_ADDR, INTERFACE_ADDR,
+               WSAGetLastError());
+        return false;
+    }
+    return true;
+}
+
+// one Annex B NALU per access unit, an IDR or a P slice
+static std::shared_ptr<AVPacketBuffer> makeAccessUnit(int index) {
+    bool keyFrame = index % GOP_SIZE == 0;
+    size_t size = keyFrame ? IDR_SIZE : P_SIZE;
+    auto packetBuffer = std::make_shared<AVPacketBuffer>();
+    AVPacket *packet = packetBuffer->get();
+    av_new_packet(packet, (int)size);
+    memset(packet->data, 0x5a, size);
+    packet->data[0] = packet->data[1] = packet->data[2] = 0;
+    packet->data[3] = 1;
+    packet->data[4] = keyFrame ? 0x65 : 0x41;
+    packet->dts = packet->pts = (int64_t)index * 3600;
+    packet->time_base = {1, 90000};
+    if (keyFrame) packet->flags |= AV_PKT_FLAG_KEY;
+    return packetBuffer;
+}
+
+static void waitFor(Receiver &receiver, int64_t packets) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (receiver.packets.load() < packets && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+int main() {
+#if defined(_WIN32)
+    WSADATA wsaData;
+    WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+    Receiver receivers[2];
+    for (auto &receiver : receivers) {
+        if (!openReceiver(receiver)) return 1;
+    }
+
+    RtpServerStream stream(0, 96, MEDIA_CODEC_TYPE_VIDEO, "H264");
+    if (!stream.initMulticast(GROUP_ADDR, GROUP_PORT, GROUP_PORT + 1, 1, INTERFACE_ADDR)) {
+        printf("initMulticast failed\n");
+        return 1;
+    }
+
+    auto proto = RtpServerBaseProto::create("H264", 96);
+    std::vector<std::shared_ptr<RtpPacketList>> units;
+    size_t gopPackets = 0;
+    for (int i = 0; i < GOP_SIZE; ++i) {
+        units.push_back(proto->packetize(makeAccessUnit(i)));
+        gopPackets += units.back()->packets.size();
+    }
+
+    std::vector<std::thread> threads;
+    for (auto &receiver : receivers) threads.emplace_back([&receiver]() { receiver.run(); });
+
+    printf("group %s:%u on %s, %d access units a GOP, %zu packets a GOP\n", GROUP_ADDR,
+           GROUP_PORT, INTERFACE_ADDR, GOP_SIZE, gopPackets);
+
+    // every access unit reaches both receivers before the next one is sent
+    bool ok = true;
+    int64_t sent = 0;
+    for (int i = 0; i < CHECKED_UNITS; ++i) {
+        auto &packetList = units[i % GOP_SIZE];
+        stream.sendPacketList(packetList, timerNowUs());
+        sent += (int64_t)packetList->packets.size();
+        for (auto &receiver : receivers) waitFor(receiver, sent);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    for (int i = 0; i < 2; ++i) {
+        int64_t packets = receivers[i].packets.load();
+        int64_t seqErrors = receivers[i].seqErrors.load();
+        printf("receiver %d: %lld of %lld packets, %lld out of sequence\n", i, (long long)packets,
+               (long long)sent, (long long)seqErrors);
+        if (packets != sent || seqErrors != 0) ok = false;
+    }
+    if (!ok) {
+        printf("a receiver did not get exactly one copy of every packet in sequence\n");
+    } else {
+        int64_t received[2] = {receivers[0].packets.load(), receivers[1].packets.load()};
+        int64_t packets = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < ROUNDS; ++i) {
+            auto &packetList = units[i % GOP_SIZE];
+            stream.sendPacketList(packetList, timerNowUs());
+            packets += (int64_t)packetList->packets.size();
+        }
+        std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+        for (auto &receiver : receivers) waitFor(receiver, sent + packets);
+
+        printf("%-10s %10s %12s %12s\n", "units", "pkt/s", "received 0", "received 1");
+        printf("%-10d %10.0f %11.1f%% %11.1f%%\n", ROUNDS, packets / seconds.count(),
+               100.0 * (receivers[0].packets.load() - received[0]) / packets,
+               100.0 * (receivers[1].packets.load() - received[1]) / packets);
+    }
+
+    for (auto &receiver : receivers) receiver.stop.store(true);
+    for (auto &thread : threads) thread.join();
+    for (auto &receiver : receivers) closesocket(receiver.socket);
+    return ok ? 0 : 1;
+}
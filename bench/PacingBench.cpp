@@ -0,0 +1,284 @@
+// RtpServerStream::sendPaced() starved by the egress budget, and RtpEgressBudget::tryTake(), the
+// process wide token bucket in the GCRA form.
+//
+// Pacing: 6 seconds of 25 fps H.264, a 60 KB IDR every 25 frames and 6 KB P frames, are paced to
+// loopback with an egress budget of half the stream's rate, so units queue up and the ones left
+// unsent for a second are dropped. A receiver rebuilds the access units from the RTP timestamps
+// and checks that the sequence numbers have no gaps, that every unit that arrives is whole, and
+// that after a missing unit nothing more of its GOP arrives: video waits for the next keyframe.
+//
+// Budget: on a virtual clock a full bucket lets out the burst and no more, a refused take goes
+// through at the retry time it was given and over 10 seconds no more than rate * time + burst is
+// taken. Then threads take from it on the real clock, the cost of a take is timed and the same
+// bound is checked.
+
+#include "rtsp/server/RtpServerStream.h"
+#include "foundation/Metrics.h"
+#include "foundation/TimerService.h"
+
+extern "C" {
+#include "libavcodec/packet.h"
+}
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+static const size_t IDR_SIZE = 60 * 1024;
+static const size_t P_SIZE = 6 * 1024;
+static const int GOP_SIZE = 25;
+static const int64_t FRAME_US = 40000;
+static const int UNITS = 150;
+static const uint32_t TICKS_PER_FRAME = 3600;
+static const size_t PACKET_SIZE = 1472;
+static const size_t BURST_SIZE = 64 * 1024;
+
+// one Annex B NALU per access unit, an IDR or a P slice
+static std::shared_ptr<AVPacketBuffer> makeAccessUnit(int index) {
+    bool keyFrame = index % GOP_SIZE == 0;
+    size_t size = keyFrame ? IDR_SIZE : P_SIZE;
+    auto packetBuffer = std::make_shared<AVPacketBuffer>();
+    AVPacket *packet = packetBuffer->get();
+    av_new_packet(packet, (int)size);
+    memset(packet->data, 0x5a, size);
+    packet->data[0] = packet->data[1] = packet->data[2] = 0;
+    packet->data[3] = 1;
+    packet->data[4] = keyFrame ? 0x65 : 0x41;
+    packet->dts = packet->pts = (int64_t)index * TICKS_PER_FRAME;
+    packet->time_base = {1, 90000};
+    if (keyFrame) packet->flags |= AV_PKT_FLAG_KEY;
+    return packetBuffer;
+}
+
+struct Receiver {
+    SOCKET socket = INVALID_SOCKET;
+    std::atomic<bool> stop{false};
+    std::mutex mutex;
+    std::map<int, int> unitPackets; // packets received per access unit
+    int64_t seqGaps = 0;
+
+    void run() {
+        std::vector<uint8_t> buffer(65536);
+        bool first = true;
+        uint16_t lastSeq = 0;
+        uint32_t firstTimestamp = 0;
+        while (!stop.load()) {
+            int len = recv(socket, (char *)buffer.data(), (int)buffer.size(), 0);
+            if (len < RtpServerBaseProto::RTP_HEADER_SIZE) continue;
+            uint16_t seq = (uint16_t)(buffer[2] << 8 | buffer[3]);
+            uint32_t timestamp = (uint32_t)buffer[4] << 24 | (uint32_t)buffer[5] << 16 |
+                                 (uint32_t)buffer[6] << 8 | buffer[7];
+            // the first unit goes out right away, its timestamp is the base
+            if (first) firstTimestamp = timestamp;
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!first && seq != (uint16_t)(lastSeq + 1)) ++seqGaps;
+            first = false;
+            lastSeq = seq;
+            ++unitPackets[(int)((timestamp - firstTimestamp) / TICKS_PER_FRAME)];
+        }
+    }
+};
+
+static bool checkPacing() {
+    Receiver receiver;
+    receiver.socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+#if defined(_WIN32)
+    DWORD timeoutMs = 100;
+    setsockopt(receiver.socket, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeoutMs,
+               sizeof(timeoutMs));
+#else
+    timeval timeout = {0, 100000};
+    setsockopt(receiver.socket, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout, sizeof(timeout));
+#endif
+    SOCKADDR_IN addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addrLen = sizeof(addr);
+    if (bind(receiver.socket, (const SOCKADDR *)&addr, sizeof(addr)) == SOCKET_ERROR ||
+        getsockname(receiver.socket, (SOCKADDR *)&addr, &addrLen) == SOCKET_ERROR) {
+        printf("failed to bind the receiver, error code:%d\n", WSAGetLastError());
+        return false;
+    }
+    uint16_t port = ntohs(addr.sin_port);
+
+    auto proto = RtpServerBaseProto::create("H264", 96);
+    std::vector<std::shared_ptr<RtpPacketList>> units;
+    int64_t unitBytes = 0;
+    for (int i = 0; i < UNITS; ++i) {
+        units.push_back(proto->packetize(makeAccessUnit(i)));
+        for (auto &packet : units.back()->packets) unitBytes += packet.size;
+    }
+    int64_t streamBytesPerSecond = unitBytes * 1000000 / (UNITS * FRAME_US);
+
+    RtpServerStream stream(0, 96, MEDIA_CODEC_TYPE_VIDEO, "H264");
+    RtpPacingConfig pacing;
+    pacing.frameFraction = 0.5;
+    stream.setPacing(pacing);
+    if (!stream.init("127.0.0.1", port, port + 1)) {
+        printf("failed to init the stream\n");
+        return false;
+    }
+    RtpEgressBudget::getInstance().setRate(streamBytesPerSecond / 2, BURST_SIZE);
+
+    std::thread receiverThread([&receiver]() { receiver.run(); });
+
+    // the pump of RtspStreamPump in short: a unit when it is due, sendPaced() in between
+    int64_t startUs = timerNowUs();
+    for (int i = 0; i <= UNITS; ++i) {
+        int64_t dueUs = startUs + i * FRAME_US;
+        for (;;) {
+            int64_t nowUs = timerNowUs();
+            if (i < UNITS && nowUs >= dueUs) break;
+            int64_t wakeUs = i < UNITS ? std::min(dueUs, stream.nextPaceUs()) : stream.nextPaceUs();
+            if (wakeUs == INT64_MAX) break;
+            if (wakeUs > nowUs) {
+                std::this_thread::sleep_for(std::chrono::microseconds(wakeUs - nowUs));
+            } else {
+                stream.sendPaced(nowUs);
+            }
+        }
+        if (i < UNITS) stream.sendPacketList(units[i], dueUs);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    receiver.stop.store(true);
+    receiverThread.join();
+    closesocket(receiver.socket);
+    RtpEgressBudget::getInstance().setRate(0, 0);
+
+    uint64_t dropped =
+        MetricsRegistry::getInstance().counter("rtsp.server.pacing_dropped_packets").value();
+    uint64_t keyframeSkips =
+        MetricsRegistry::getInstance().counter("rtsp.server.pacing_keyframe_skips").value();
+
+    bool ok = receiver.seqGaps == 0;
+    int received = 0, partial = 0, afterGap = 0, resumed = 0;
+    int64_t expectedPackets = 0, receivedPackets = 0;
+    for (int gop = 0; gop < UNITS / GOP_SIZE; ++gop) {
+        bool gap = false;
+        for (int i = gop * GOP_SIZE; i < (gop + 1) * GOP_SIZE; ++i) {
+            int packets = (int)units[i]->packets.size();
+            expectedPackets += packets;
+            auto it = receiver.unitPackets.find(i);
+            if (it == receiver.unitPackets.end()) {
+                gap = true;
+                continue;
+            }
+            ++received;
+            receivedPackets += it->second;
+            if (it->second != packets) ++partial;
+            if (gap) ++afterGap;
+        }
+        // a GOP that starts whole after one that lost units
+        if (gop > 0 && receiver.unitPackets.count(gop * GOP_SIZE) &&
+            receiver.unitPackets.count(gop * GOP_SIZE - 1) == 0) {
+            ++resumed;
+        }
+    }
+    printf("stream %lld B/s, egress budget %lld B/s\n", (long long)streamBytesPerSecond,
+           (long long)streamBytesPerSecond / 2);
+    printf("units %d received %d partial %d after a gap %d, GOPs resumed at the IDR %d\n", UNITS,
+           received, partial, afterGap, resumed);
+    printf("packets %lld received %lld dropped %llu, keyframe skips %llu, sequence gaps %lld\n",
+           (long long)expectedPackets, (long long)receivedPackets, (unsigned long long)dropped,
+           (unsigned long long)keyframeSkips, (long long)receiver.seqGaps);
+    if (partial || afterGap || !ok || receivedPackets + (int64_t)dropped != expectedPackets) {
+        printf("pacing dropped part of a unit or sent units of a GOP after a gap\n");
+        return false;
+    }
+    if (!dropped || !keyframeSkips || !resumed) {
+        printf("the budget did not starve the stream, nothing was checked\n");
+        return false;
+    }
+    return true;
+}
+
+static bool checkBudgetVirtualClock() {
+    RtpEgressBudget &budget = RtpEgressBudget::getInstance();
+    const int64_t rate = 1000000;
+    budget.setRate(rate, BURST_SIZE);
+    // ahead of the real clock, nothing taken before counts
+    int64_t nowUs = timerNowUs() + 3600 * 1000000LL;
+    int64_t retryUs = 0;
+
+    size_t burst = 0;
+    while (budget.tryTake(PACKET_SIZE, nowUs, retryUs)) burst += PACKET_SIZE;
+    bool burstOk = burst <= BURST_SIZE && burst + PACKET_SIZE > BURST_SIZE;
+    int64_t costUs = (int64_t)PACKET_SIZE * 1000000 / rate;
+    int64_t retryAfterUs = retryUs - nowUs;
+    bool retryOk = retryAfterUs > 0 && retryAfterUs <= costUs + 1 &&
+                   budget.tryTake(PACKET_SIZE, nowUs + retryAfterUs, retryUs);
+
+    // as fast as the bucket lets: 10 s at the rate plus what the full bucket held
+    int64_t startUs = nowUs + 10 * 1000000LL;
+    int64_t endUs = startUs + 10 * 1000000LL;
+    int64_t taken = 0;
+    for (nowUs = startUs; nowUs < endUs;) {
+        if (budget.tryTake(PACKET_SIZE, nowUs, retryUs)) {
+            taken += PACKET_SIZE;
+        } else {
+            nowUs = retryUs;
+        }
+    }
+    int64_t bound = rate * (endUs - startUs) / 1000000 + (int64_t)BURST_SIZE;
+    bool rateOk = taken <= bound && taken > bound - 2 * (int64_t)PACKET_SIZE;
+    budget.setRate(0, 0);
+
+    printf("virtual clock: burst %zu of %zu, retry after %lld us, 10 s took %lld of %lld bytes\n",
+           burst, BURST_SIZE, (long long)retryAfterUs, (long long)taken, (long long)bound);
+    if (!burstOk || !retryOk || !rateOk) {
+        printf("the budget let out more or less than its rate and burst\n");
+        return false;
+    }
+    return true;
+}
+
+static bool checkBudgetThreads(int threads) {
+    RtpEgressBudget &budget = RtpEgressBudget::getInstance();
+    const int64_t rate = 50 * 1000 * 1000;
+    budget.setRate(rate, BURST_SIZE);
+
+    std::atomic<int64_t> calls{0}, taken{0};
+    int64_t startUs = timerNowUs();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&]() {
+            int64_t localCalls = 0, localTaken = 0, retryUs = 0, nowUs;
+            while ((nowUs = timerNowUs()) - startUs < 200000) {
+                if (budget.tryTake(PACKET_SIZE, nowUs, retryUs)) localTaken += PACKET_SIZE;
+                ++localCalls;
+            }
+            calls.fetch_add(localCalls);
+            taken.fetch_add(localTaken);
+        });
+    }
+    for (auto &worker : workers) worker.join();
+    int64_t elapsedUs = timerNowUs() - startUs;
+    budget.setRate(0, 0);
+
+    int64_t bound = rate * elapsedUs / 1000000 + (int64_t)BURST_SIZE;
+    printf("%-8d %12.1f %14lld %14lld\n", threads, elapsedUs * 1000.0 * threads / calls.load(),
+           (long long)taken.load(), (long long)bound);
+    if (taken.load() > bound) {
+        printf("%d threads took more than rate * time + burst\n", threads);
+        return false;
+    }
+    return true;
+}
+
+int main() {
+#if defined(_WIN32)
+    WSADATA wsaData;
+    WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+    // the real clock first, the virtual clock runs the bucket's state into the future
+    bool ok = checkPacing();
+    printf("%-8s %12s %14s %14s\n", "threads", "ns/take", "bytes taken", "rate*t+burst");
+    ok = ok && checkBudgetThreads(1) && checkBudgetThreads(4);
+    ok = ok && checkBudgetVirtualClock();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,100 @@
+// RingQueue against CountingQueue under producer contention.
+//
+// Every producer pushes ITEMS shared_ptr items (what the media queues carry) through a queue of
+// QUEUE_SIZE slots into one consumer, the shape of the demux/decode/render pipeline. Prints the
+// throughput of each queue for 1 (SPSC) and several (MPSC) producers, then the cost of a push and
+// pop pair on one thread, where neither queue ever blocks.
+
+#include "foundation/CountingQueue.h"
+#include "foundation/RingQueue.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
+
+static const size_t QUEUE_SIZE = 16;
+static const int ITEMS = 1000000;
+
+struct Payload {
+    int producer;
+    int index;
+};
+
+using Item = std::shared_ptr<Payload>;
+
+// pushes from producer threads, pops on the calling thread, returns items per second
+template <typename Queue>
+static double run(Queue &queue, int producers) {
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&queue, p]() {
+            for (int i = 0; i < ITEMS; ++i) {
+                Item item = std::make_shared<Payload>(Payload{p, i});
+                queue.push(std::move(item));
+            }
+        });
+    }
+
+    // items of one producer must come out in order
+    std::vector<int> next(producers, 0);
+    Item item;
+    for (int n = 0; n < producers * ITEMS; ++n) {
+        if (!queue.pop(item) || item->index != next[item->producer]++) {
+            fprintf(stderr, "queue out of order\n");
+            exit(1);
+        }
+    }
+    for (auto &thread : threads) thread.join();
+
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+    return producers * ITEMS / seconds.count();
+}
+
+// fills and drains the queue on the calling thread, returns nanoseconds per push and pop pair
+template <typename Queue>
+static double runUncontended(Queue &queue) {
+    Item item = std::make_shared<Payload>(Payload{0, 0});
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ITEMS / (int)QUEUE_SIZE; ++i) {
+        for (size_t n = 0; n < QUEUE_SIZE; ++n) queue.push(Item(item));
+        for (size_t n = 0; n < QUEUE_SIZE; ++n) queue.pop(item);
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / (ITEMS / QUEUE_SIZE * QUEUE_SIZE);
+}
+
+int main(int argc, char *argv[]) {
+    int maxProducers = argc > 1 ? atoi(argv[1]) : 4;
+
+    // with fewer cores than threads producer and consumer take turns, say which case this is
+    printf("%d items per producer, %zu slots, %u hardware threads\n", ITEMS, QUEUE_SIZE,
+           std::thread::hardware_concurrency());
+    printf("%-10s %16s %16s %8s\n", "producers", "CountingQueue/s", "RingQueue/s", "speedup");
+    for (int producers = 1; producers <= maxProducers; producers *= 2) {
+        CountingQueue<Item> countingQueue(QUEUE_SIZE);
+        double counting = run(countingQueue, producers);
+
+        double ring;
+        if (producers == 1) {
+            SpscRingQueue<Item> ringQueue(QUEUE_SIZE);
+            ring = run(ringQueue, producers);
+        } else {
+            MpscRingQueue<Item> ringQueue(QUEUE_SIZE);
+            ring = run(ringQueue, producers);
+        }
+
+        printf("%-10d %16.0f %16.0f %7.2fx\n", producers, counting, ring, ring / counting);
+    }
+
+    CountingQueue<Item> countingQueue(QUEUE_SIZE);
+    SpscRingQueue<Item> ringQueue(QUEUE_SIZE);
+    double counting = runUncontended(countingQueue);
+    double ring = runUncontended(ringQueue);
+    printf("%-10s %14.1fns %14.1fns %7.2fx\n", "1 thread", counting, ring, counting / ring);
+    return 0;
+}
@@ -0,0 +1,323 @@
+// The pure parts of the RTP server: RtpServerBaseProto::packetize() for H.264 and HEVC, and
+// RtcpServerProto's sender reports and report parsing. Everything is checked before the
+// packetizers are timed.
+//
+// Packetize: 3000 random access units per codec, of 1 to 12 NALUs each. The NALUs are tiny,
+// ordinary, right at the 1460 byte payload limit or large enough to be fragmented, behind 3 or
+// 4 byte start codes. The packets are depacketized again (single NAL unit, STAP-A/AP and
+// FU-A/FU) and have to give back the same NALUs, with the access unit's timestamp and the
+// marker bit on the last packet only.
+//
+// RTCP: sender reports and BYE with random sender info and CNAMEs of up to 300 chars go out
+// byte exact and parse as reports without blocks. Compound SR/RR/SDES packets with random
+// report blocks parse back to the same blocks, truncated or malformed ones are refused.
+
+#include "rtsp/server/RtpServerProto.h"
+#include "rtsp/server/RtcpServerProto.h"
+
+extern "C" {
+#include "libavcodec/packet.h"
+}
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+static const int UNITS = 3000;
+static const int MAX_NALUS = 12;
+static const int ROUNDS = 20;
+static const int RTCP_PACKETS = 3000;
+static const int PAYLOAD_TYPE = 96;
+// RtpServerBaseProto's payload limit
+static const size_t MAX_PAYLOAD_SIZE = 1460;
+
+using Nalu = std::vector<uint8_t>;
+
+struct AccessUnit {
+    std::shared_ptr<AVPacketBuffer> packetBuffer;
+    std::vector<Nalu> nalus;
+};
+
+// a NALU with a valid header, the rest nonzero so it holds no start code
+static Nalu makeNalu(bool hevc, std::mt19937 &rng) {
+    static const size_t MIN_SIZES[] = {2, 100, 1440, 1500};
+    static const size_t MAX_SIZES[] = {40, 1400, 1480, 20000};
+    int kind = (int)(rng() % 4);
+    size_t size = MIN_SIZES[kind] + rng() % (MAX_SIZES[kind] - MIN_SIZES[kind] + 1);
+
+    Nalu nalu(size);
+    for (auto &byte : nalu) byte = (uint8_t)(1 + rng() % 255);
+    if (hevc) {
+        // type 1-40, layer 0, tid 1-7: the aggregation and fragmentation headers carry layer 0
+        nalu[0] = (uint8_t)((1 + rng() % 40) << 1);
+        nalu[1] = (uint8_t)(1 + rng() % 7);
+    } else {
+        // nri and type 1-23
+        nalu[0] = (uint8_t)((rng() % 4) << 5 | (1 + rng() % 23));
+    }
+    return nalu;
+}
+
+static AccessUnit makeAccessUnit(bool hevc, int64_t dts, std::mt19937 &rng) {
+    AccessUnit unit;
+    int count = 1 + (int)(rng() % MAX_NALUS);
+    std::vector<uint8_t> data;
+    for (int i = 0; i < count; ++i) {
+        unit.nalus.push_back(makeNalu(hevc, rng));
+        if (rng() % 2) data.push_back(0);
+        data.insert(data.end(), {0, 0, 1});
+        data.insert(data.end(), unit.nalus.back().begin(), unit.nalus.back().end());
+    }
+
+    unit.packetBuffer = std::make_shared<AVPacketBuffer>();
+    AVPacket *packet = unit.packetBuffer->get();
+    av_new_packet(packet, (int)data.size());
+    memcpy(packet->data, data.data(), data.size());
+    packet->dts = packet->pts = dts;
+    packet->time_base = {1, 90000};
+    return unit;
+}
+
+// the bytes of one packet, its buffers one after the other
+static std::vector<uint8_t> gather(const RtpPacketList &packetList, size_t index) {
+    auto &packet = packetList.packets[index];
+    std::vector<uint8_t> bytes;
+    for (uint32_t i = 0; i < packet.bufferCount; ++i) {
+        auto &buffer = packetList.buffers[packet.firstBuffer + i];
+        const uint8_t *data = (const uint8_t *)buffer.data;
+        bytes.insert(bytes.end(), data, data + buffer.size);
+    }
+    return bytes;
+}
+
+// RFC 6184 and RFC 7798 receiver side, false on anything the packetizers should not send
+static bool depacketize(bool hevc,
+                        const std::vector<uint8_t> &packet,
+                        std::vector<Nalu> &nalus,
+                        Nalu &fragment) {
+    const size_t headerSize = hevc ? 2 : 1;
+    const uint8_t *payload = packet.data() + RtpServerBaseProto::RTP_HEADER_SIZE;
+    size_t size = packet.size() - RtpServerBaseProto::RTP_HEADER_SIZE;
+    if (size < headerSize) return false;
+
+    int type = hevc ? (payload[0] >> 1) & 0x3f : payload[0] & 0x1f;
+    if (type == (hevc ? 48 : 24)) {
+        // STAP-A/AP: 16 bit size, NALU, ...
+        for (size_t offset = headerSize; offset < size;) {
+            if (size - offset < 2) return false;
+            size_t naluSize = (size_t)(payload[offset] << 8 | payload[offset + 1]);
+            offset += 2;
+            if (naluSize == 0 || size - offset < naluSize) return false;
+            nalus.emplace_back(payload + offset, payload + offset + naluSize);
+            offset += naluSize;
+        }
+        return fragment.empty();
+    }
+    if (type == (hevc ? 49 : 28)) {
+        // FU-A/FU: the NALU header is rebuilt from the payload and FU headers
+        if (size <= headerSize + 1) return false;
+        uint8_t fuHeader = payload[headerSize];
+        bool start = fuHeader & 0x80;
+        bool end = fuHeader & 0x40;
+        if (start != fragment.empty()) return false;
+        if (start) {
+            if (hevc) {
+                fragment.push_back((uint8_t)((payload[0] & 0x81) | (fuHeader & 0x3f) << 1));
+                fragment.push_back(payload[1]);
+            } else {
+                fragment.push_back((uint8_t)((payload[0] & 0xe0) | (fuHeader & 0x1f)));
+            }
+        }
+        fragment.insert(fragment.end(), payload + headerSize + 1, payload + size);
+        if (end) {
+            nalus.push_back(std::move(fragment));
+            fragment.clear();
+        }
+        return true;
+    }
+    if (!fragment.empty()) return false;
+    nalus.emplace_back(payload, payload + size);
+    return true;
+}
+
+static bool checkPacketize(bool hevc, const char *name, std::mt19937 &rng) {
+    auto proto = RtpServerBaseProto::create(hevc ? "HEVC" : "H264", PAYLOAD_TYPE);
+    std::vector<AccessUnit> units;
+    int64_t bytes = 0;
+    for (int i = 0; i < UNITS; ++i) {
+        units.push_back(makeAccessUnit(hevc, (int64_t)i * 3000 + rng() % 3000, rng));
+        bytes += units.back().packetBuffer->size();
+    }
+
+    uint16_t seq = (uint16_t)rng();
+    int64_t packets = 0;
+    for (int i = 0; i < UNITS; ++i) {
+        auto packetList = proto->packetize(units[i].packetBuffer);
+        std::vector<Nalu> nalus;
+        Nalu fragment;
+        bool ok = !packetList->packets.empty();
+        for (size_t p = 0; ok && p < packetList->packets.size(); ++p) {
+            std::vector<uint8_t> packet = gather(*packetList, p);
+            // what a session sends
+            RtpServerBaseProto::patchHeader(packet.data(), ++seq, 1000, 0x12345678);
+            uint32_t timestamp = (uint32_t)packet[4] << 24 | (uint32_t)packet[5] << 16 |
+                                 (uint32_t)packet[6] << 8 | packet[7];
+            bool marker = packet[1] & 0x80;
+            ok = packet.size() == packetList->packets[p].size &&
+                 packet.size() <= RtpServerBaseProto::RTP_HEADER_SIZE + MAX_PAYLOAD_SIZE &&
+                 packet[0] == 0x80 && (packet[1] & 0x7f) == PAYLOAD_TYPE &&
+                 marker == (p + 1 == packetList->packets.size()) &&
+                 (uint16_t)(packet[2] << 8 | packet[3]) == seq &&
+                 timestamp == (uint32_t)units[i].packetBuffer->dts() + 1000 &&
+                 packet[8] == 0x12 && packet[11] == 0x78 &&
+                 depacketize(hevc, packet, nalus, fragment);
+        }
+        if (!ok || !fragment.empty() || nalus != units[i].nalus) {
+            printf("%s: access unit %d of %zu NALUs does not depacketize back\n", name, i,
+                   units[i].nalus.size());
+            return false;
+        }
+        packets += (int64_t)packetList->packets.size();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < ROUNDS; ++round) {
+        for (auto &unit : units) proto->packetize(unit.packetBuffer);
+    }
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+    printf("%-8s %8d %10lld %10.2f %10.2f\n", name, UNITS, (long long)packets,
+           (double)packets / UNITS, (double)bytes * ROUNDS / seconds.count() / 1e6);
+    return true;
+}
+
+static uint32_t read32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static void write32(std::vector<uint8_t> &out, uint32_t v) {
+    out.insert(out.end(), {(uint8_t)(v >> 24), (uint8_t)(v >> 16), (uint8_t)(v >> 8), (uint8_t)v});
+}
+
+// an SR or RR with count report blocks, as a client would send it
+static void appendReport(std::vector<uint8_t> &out,
+                         bool sr,
+                         const std::vector<RtcpReportBlock> &blocks) {
+    size_t words = (sr ? 7 : 2) + blocks.size() * 6;
+    out.push_back((uint8_t)(0x80 | blocks.size()));
+    out.push_back(sr ? RtcpServerProto::RTCP_PACKET_SR : RtcpServerProto::RTCP_PACKET_RR);
+    out.push_back((uint8_t)((words - 1) >> 8));
+    out.push_back((uint8_t)(words - 1));
+    for (size_t i = 1; i < (sr ? 7u : 2u); ++i) write32(out, 0x01020304u * (uint32_t)i);
+    for (auto &block : blocks) {
+        write32(out, block.ssrc);
+        uint32_t lost = (uint32_t)block.cumulativeLost & 0xffffff;
+        write32(out, (uint32_t)block.fractionLost << 24 | lost);
+        write32(out, block.highestSeq);
+        write32(out, block.jitter);
+        write32(out, block.lastSr);
+        write32(out, block.delaySinceLastSr);
+    }
+}
+
+static bool sameBlock(const RtcpReportBlock &a, const RtcpReportBlock &b) {
+    return a.ssrc == b.ssrc && a.fractionLost == b.fractionLost &&
+           a.cumulativeLost == b.cumulativeLost && a.highestSeq == b.highestSeq &&
+           a.jitter == b.jitter && a.lastSr == b.lastSr &&
+           a.delaySinceLastSr == b.delaySinceLastSr;
+}
+
+static bool checkSenderReports(std::mt19937 &rng) {
+    uint8_t data[RtcpServerProto::RTCP_MAX_PACKET_SIZE];
+    for (int i = 0; i < RTCP_PACKETS; ++i) {
+        RtcpSenderInfo info = {(uint32_t)rng(), (uint64_t)rng() << 32 | rng(), (uint32_t)rng(),
+                               (uint32_t)rng(), (uint32_t)rng()};
+        std::string cname(rng() % 301, 'x');
+        for (auto &c : cname) c = (char)('a' + rng() % 26);
+        size_t cnameSize = std::min<size_t>(cname.size(), 255);
+
+        bool bye = i % 2;
+        size_t size = bye ? RtcpServerProto::buildBye(info, cname, data, sizeof(data))
+                          : RtcpServerProto::buildSenderReport(info, cname, data, sizeof(data));
+        size_t sdesSize = 4 + ((4 + 2 + cnameSize + 1 + 3) & ~(size_t)3);
+        const uint8_t *sdes = data + 28;
+        bool ok = size == 28 + sdesSize + (bye ? 8 : 0) && read32(data) == (0x80c8u << 16 | 6) &&
+                  read32(data + 4) == info.ssrc &&
+                  ((uint64_t)read32(data + 8) << 32 | read32(data + 12)) == info.ntpTimestamp &&
+                  read32(data + 16) == info.rtpTimestamp && read32(data + 20) == info.packetCount &&
+                  read32(data + 24) == info.octetCount && sdes[0] == 0x81 &&
+                  sdes[1] == RtcpServerProto::RTCP_PACKET_SDES &&
+                  (size_t)(sdes[2] << 8 | sdes[3]) == sdesSize / 4 - 1 &&
+                  read32(sdes + 4) == info.ssrc && sdes[8] == 1 && sdes[9] == cnameSize &&
+                  memcmp(sdes + 10, cname.data(), cnameSize) == 0 && sdes[10 + cnameSize] == 0;
+        if (ok && bye) {
+            const uint8_t *p = data + 28 + sdesSize;
+            ok = read32(p) == (0x81cbu << 16 | 1) && read32(p + 4) == info.ssrc;
+        }
+        std::vector<RtcpReportBlock> blocks;
+        if (!ok || !RtcpServerProto::parseReports(data, size, blocks) || !blocks.empty()) {
+            printf("sender report %d with a %zu char CNAME is not as built\n", i, cname.size());
+            return false;
+        }
+    }
+    // no room for it
+    RtcpSenderInfo info = {};
+    return RtcpServerProto::buildSenderReport(info, "cname", data, 28) == 0;
+}
+
+static bool checkReports(std::mt19937 &rng) {
+    for (int i = 0; i < RTCP_PACKETS; ++i) {
+        // an RR or SR with blocks, an SDES, sometimes a second report
+        std::vector<uint8_t> packet;
+        std::vector<RtcpReportBlock> expected;
+        int reports = 1 + (int)(rng() % 2);
+        for (int r = 0; r < reports; ++r) {
+            std::vector<RtcpReportBlock> blocks(rng() % 32);
+            for (auto &block : blocks) {
+                block = {(uint32_t)rng(), (uint8_t)rng(), (int32_t)(rng() % (1 << 24)) - (1 << 23),
+                         (uint32_t)rng(), (uint32_t)rng(), (uint32_t)rng(), (uint32_t)rng()};
+            }
+            appendReport(packet, rng() % 2, blocks);
+            expected.insert(expected.end(), blocks.begin(), blocks.end());
+            packet.insert(packet.end(), {0x81, RtcpServerProto::RTCP_PACKET_SDES, 0, 2});
+            write32(packet, (uint32_t)rng());
+            write32(packet, 0x01000000); // an empty CNAME and the end item
+        }
+
+        std::vector<RtcpReportBlock> blocks;
+        bool ok = RtcpServerProto::parseReports(packet.data(), packet.size(), blocks) &&
+                  blocks.size() == expected.size() &&
+                  std::equal(blocks.begin(), blocks.end(), expected.begin(), sameBlock);
+
+        // cut inside the last packet, a version other than 2, more blocks than fit
+        std::vector<RtcpReportBlock> ignored;
+        size_t cut = 1 + rng() % 3;
+        ok = ok && !RtcpServerProto::parseReports(packet.data(), packet.size() - cut, ignored);
+        std::vector<uint8_t> bad = packet;
+        bad[0] = (uint8_t)((bad[0] & 0x3f) | 0x40);
+        ok = ok && !RtcpServerProto::parseReports(bad.data(), bad.size(), ignored);
+        bad = packet;
+        bad[0] = (uint8_t)((bad[0] & 0xe0) | 31);
+        size_t words = (size_t)(bad[2] << 8 | bad[3]) + 1;
+        ok = ok && (words * 4 >= (bad[1] == RtcpServerProto::RTCP_PACKET_SR ? 28u : 8u) + 31 * 24 ||
+                    !RtcpServerProto::parseReports(bad.data(), bad.size(), ignored));
+        if (!ok) {
+            printf("compound report %d with %zu blocks does not parse as built\n", i,
+                   expected.size());
+            return false;
+        }
+    }
+    return true;
+}
+
+int main() {
+    std::mt19937 rng(5);
+    printf("%-8s %8s %10s %10s %10s\n", "codec", "units", "packets", "pkt/unit", "MB/s");
+    bool ok = checkPacketize(false, "H.264", rng) && checkPacketize(true, "HEVC", rng);
+    ok = ok && checkSenderReports(rng) && checkReports(rng);
+    if (ok) printf("RTCP: %d sender reports and %d compound reports as built\n", RTCP_PACKETS,
+                   RTCP_PACKETS);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,138 @@
+// Start code scanning over 4K HEVC sized keyframes: the scalar loop findStartcode() used to be
+// (copied from libavformat) against findNalus() on the kernel picked for this cpu.
+//
+// The frames are random RBSP escaped with rbspToNal(), so the payload has no start codes and
+// the 00 00 03 density of real slice data, split into VPS/SPS/PPS/SEI and a few slice NALs.
+
+#include "foundation/CpuFeatures.h"
+#include "foundation/Startcode.h"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <utility>
+#include <vector>
+
+static const size_t FRAME_SIZE = 2 * 1024 * 1024;
+static const int SLICES = 8;
+static const int ROUNDS = 100;
+
+// findStartcode() before the SIMD kernels
+static const uint8_t *legacyFindStartcodeInternal(const uint8_t *p, const uint8_t *end) {
+    const uint8_t *a = p + 4 - ((intptr_t)p & 3);
+
+    for (end -= 3; p < a && p < end; p++) {
+        if (p[0] == 0 && p[1] == 0 && p[2] == 1) return p;
+    }
+
+    for (end -= 3; p < end; p += 4) {
+        uint32_t x = *(const uint32_t *)p;
+        if ((x - 0x01010101) & (~x) & 0x80808080) { // generic
+            if (p[1] == 0) {
+                if (p[0] == 0 && p[2] == 1) return p;
+                if (p[2] == 0 && p[3] == 1) return p + 1;
+            }
+            if (p[3] == 0) {
+                if (p[2] == 0 && p[4] == 1) return p + 2;
+                if (p[4] == 0 && p[5] == 1) return p + 3;
+            }
+        }
+    }
+
+    for (end += 3; p < end; p++) {
+        if (p[0] == 0 && p[1] == 0 && p[2] == 1) return p;
+    }
+
+    return end + 3;
+}
+
+static const uint8_t *legacyFindStartcode(const uint8_t *p, const uint8_t *end) {
+    const uint8_t *out = legacyFindStartcodeInternal(p, end);
+    if (p < out && out < end && !out[-1]) out--;
+    return out;
+}
+
+// the split loop of findNalus() over the legacy scanner
+static void legacyFindNalus(const uint8_t *data,
+                            int length,
+                            std::vector<std::pair<int, int>> &nalus) {
+    const uint8_t *pEnd = data + length;
+    const uint8_t *pNaluStart = legacyFindStartcode(data, pEnd);
+    while (pNaluStart < pEnd) {
+        while (pNaluStart < pEnd && !*pNaluStart) pNaluStart++;
+        if (pEnd - pNaluStart <= 1) break;
+        pNaluStart++;
+
+        const uint8_t *pNaluEnd = legacyFindStartcode(pNaluStart, pEnd);
+        if (pNaluEnd > pNaluStart)
+            nalus.emplace_back((int)(pNaluStart - data), (int)(pNaluEnd - pNaluStart));
+        pNaluStart = pNaluEnd;
+    }
+}
+
+static void appendNalu(std::vector<uint8_t> &frame,
+                       uint8_t type,
+                       size_t rbspSize,
+                       std::mt19937 &random) {
+    std::vector<uint8_t> rbsp(rbspSize);
+    for (auto &byte : rbsp) byte = (uint8_t)random();
+    rbsp[0] = (uint8_t)(type << 1);
+    rbsp[1] = 1;
+
+    std::vector<uint8_t> nal(rbspToNalMaxSize(rbspSize));
+    nal.resize(rbspToNal(rbsp.data(), rbsp.size(), nal.data()));
+    frame.insert(frame.end(), {0, 0, 0, 1});
+    frame.insert(frame.end(), nal.begin(), nal.end());
+}
+
+static std::vector<uint8_t> makeKeyframe(std::mt19937 &random) {
+    std::vector<uint8_t> frame;
+    appendNalu(frame, 32, 24, random);  // VPS
+    appendNalu(frame, 33, 64, random);  // SPS
+    appendNalu(frame, 34, 12, random);  // PPS
+    appendNalu(frame, 39, 600, random); // SEI
+    for (int i = 0; i < SLICES; ++i) appendNalu(frame, 19, FRAME_SIZE / SLICES, random);
+    return frame;
+}
+
+// splits the frame ROUNDS times, returns MB/s
+static double measure(const std::vector<uint8_t> &frame,
+                      void (*split)(const uint8_t *, int, std::vector<std::pair<int, int>> &),
+                      std::vector<std::pair<int, int>> &nalus) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ROUNDS; ++i) {
+        nalus.clear();
+        split(frame.data(), (int)frame.size(), nalus);
+    }
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+    return (double)frame.size() * ROUNDS / seconds.count() / (1024 * 1024);
+}
+
+int main() {
+    std::mt19937 random(1);
+    std::vector<uint8_t> frame = makeKeyframe(random);
+
+    const char *kernel = "scalar";
+#if defined(CPU_X86)
+    if (cpuHasAVX2())
+        kernel = "AVX2";
+    else if (cpuHasSSE2())
+        kernel = "SSE2";
+#elif defined(CPU_NEON)
+    if (cpuHasNEON()) kernel = "NEON";
+#endif
+
+    std::vector<std::pair<int, int>> legacyNalus;
+    std::vector<std::pair<int, int>> nalus;
+    double legacy = measure(frame, legacyFindNalus, legacyNalus);
+    double current = measure(frame, findNalus, nalus);
+    if (legacyNalus != nalus || nalus.size() != 4 + SLICES) {
+        printf("NAL units differ\n");
+        return 1;
+    }
+
+    printf("%zu byte keyframe, %zu NAL units, %s kernel\n", frame.size(), nalus.size(), kernel);
+    printf("legacy scalar %8.1f MB/s\n", legacy);
+    printf("findNalus     %8.1f MB/s  %.2fx\n", current, current / legacy);
+    return 0;
+}
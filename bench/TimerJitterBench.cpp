@@ -0,0 +1,81 @@
+// Wakeup error of TimerService against a plain OS sleep.
+//
+// Every mode waits for SAMPLES deadlines spaced PERIOD_US apart (absolute deadlines, like the
+// packet sender) and records how late the wakeup was. Prints the distribution per mode.
+
+#include "foundation/TimerService.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+static const int SAMPLES = 2000;
+static const int64_t PERIOD_US = 1000;
+
+static void print(const char *name, std::vector<int64_t> &lateUs) {
+    std::sort(lateUs.begin(), lateUs.end());
+    auto at = [&lateUs](double q) { return lateUs[(size_t)(q * (lateUs.size() - 1))]; };
+    printf("%-22s %8lld %8lld %8lld %8lld %8lld\n", name, (long long)at(0), (long long)at(0.5),
+           (long long)at(0.9), (long long)at(0.99), (long long)lateUs.back());
+}
+
+static std::vector<int64_t> runOsSleep() {
+    std::vector<int64_t> lateUs;
+    int64_t deadlineUs = timerNowUs();
+    for (int i = 0; i < SAMPLES; ++i) {
+        deadlineUs += PERIOD_US;
+        std::this_thread::sleep_for(std::chrono::microseconds(deadlineUs - timerNowUs()));
+        lateUs.emplace_back(timerNowUs() - deadlineUs);
+    }
+    return lateUs;
+}
+
+// spinUs < 0 keeps the platform default
+static std::vector<int64_t> runSleepUntil(int64_t spinUs) {
+    TimerService &timers = TimerService::getInstance();
+    if (spinUs >= 0) timers.setSpinUs(spinUs);
+
+    std::vector<int64_t> lateUs;
+    int64_t deadlineUs = timerNowUs();
+    for (int i = 0; i < SAMPLES; ++i) {
+        deadlineUs += PERIOD_US;
+        timers.sleepUntil(deadlineUs);
+        lateUs.emplace_back(timerNowUs() - deadlineUs);
+    }
+    return lateUs;
+}
+
+static std::vector<int64_t> runCallbacks() {
+    TimerService &timers = TimerService::getInstance();
+
+    std::vector<int64_t> lateUs(SAMPLES);
+    std::atomic<int> fired(0);
+    int64_t startUs = timerNowUs();
+    for (int i = 0; i < SAMPLES; ++i) {
+        int64_t deadlineUs = startUs + (i + 1) * PERIOD_US;
+        timers.schedule(deadlineUs, [&lateUs, &fired, i, deadlineUs]() {
+            lateUs[i] = timerNowUs() - deadlineUs;
+            fired.fetch_add(1);
+        });
+    }
+    while (fired.load() < SAMPLES) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    return lateUs;
+}
+
+int main() {
+    printf("%d deadlines %lldus apart, lateness in us\n", SAMPLES, (long long)PERIOD_US);
+    printf("%-22s %8s %8s %8s %8s %8s\n", "mode", "min", "p50", "p90", "p99", "max");
+
+    std::vector<int64_t> lateUs = runOsSleep();
+    print("os sleep", lateUs);
+    lateUs = runSleepUntil(-1);
+    print("sleepUntil", lateUs);
+    lateUs = runSleepUntil(0);
+    print("sleepUntil, no spin", lateUs);
+    lateUs = runCallbacks();
+    print("schedule callbacks", lateUs);
+    return 0;
+}
@@ -0,0 +1,225 @@
+// The RTP send paths of RtpServerStream over loopback: one send per packet, one socketSendBatch()
+// per access unit, and socketSendBatch() with runs of equal sized packets as UDP GSO datagrams.
+//
+// A 200 KB IDR is cut into 1400 byte payloads behind 12 byte RTP headers, header and payload in
+// separate buffers the way the packetizers leave them. A receiver thread checks that a first
+// access unit per mode arrives whole and in order, then only counts while the send rate is
+// measured. Outside Linux the batch modes fall back to one send per packet.
+
+#include "foundation/Socket.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+static const size_t FRAME_SIZE = 200 * 1024;
+static const size_t PAYLOAD_SIZE = 1400;
+static const size_t HEADER_SIZE = 12;
+static const int ROUNDS = 2000;
+
+enum SendMode {
+    SEND_PER_PACKET,
+    SEND_BATCH,
+    SEND_SEGMENTED,
+};
+
+struct AccessUnit {
+    std::vector<uint8_t> headers;
+    std::vector<uint8_t> payload;
+    std::vector<SocketBuffer> buffers; // header and payload of each packet
+    std::vector<size_t> sizes;
+};
+
+static AccessUnit makeAccessUnit() {
+    AccessUnit unit;
+    size_t packets = (FRAME_SIZE + PAYLOAD_SIZE - 1) / PAYLOAD_SIZE;
+    unit.headers.resize(packets * HEADER_SIZE);
+    unit.payload.resize(FRAME_SIZE);
+    for (size_t i = 0; i < FRAME_SIZE; ++i) unit.payload[i] = (uint8_t)(i * 7);
+    for (size_t i = 0; i < packets; ++i) {
+        uint8_t *header = unit.headers.data() + i * HEADER_SIZE;
+        header[0] = 0x80;
+        header[1] = 96;
+        header[2] = (uint8_t)(i >> 8);
+        header[3] = (uint8_t)i;
+        size_t offset = i * PAYLOAD_SIZE;
+        size_t size = std::min(PAYLOAD_SIZE, FRAME_SIZE - offset);
+        unit.buffers.push_back({header, HEADER_SIZE});
+        unit.buffers.push_back({unit.payload.data() + offset, size});
+        unit.sizes.push_back(HEADER_SIZE + size);
+    }
+    return unit;
+}
+
+// the same runs RtpServerStream::buildDatagrams() makes
+static std::vector<SocketDatagram> makeDatagrams(const AccessUnit &unit, bool segmented) {
+    std::vector<SocketDatagram> datagrams;
+    for (size_t i = 0; i < unit.sizes.size();) {
+        size_t length = unit.sizes[i];
+        size_t last = i + 1;
+        if (segmented) {
+            size_t maxSegments =
+                std::min<size_t>(SOCKET_MAX_SEGMENTS, SOCKET_MAX_SEGMENTED_SIZE / length);
+            while (last < unit.sizes.size() && last - i < maxSegments &&
+                   unit.sizes[last] <= length) {
+                if (unit.sizes[last++] != length) break;
+            }
+        }
+        uint16_t segmentSize = last - i > 1 ? (uint16_t)length : 0;
+        datagrams.push_back({&unit.buffers[i * 2], (int)(last - i) * 2, segmentSize});
+        i = last;
+    }
+    return datagrams;
+}
+
+// returns the send calls made
+static int sendUnit(SOCKET s,
+                    const SOCKADDR_IN &addr,
+                    const AccessUnit &unit,
+                    const std::vector<SocketDatagram> &datagrams,
+                    SendMode mode) {
+    if (mode == SEND_PER_PACKET) {
+        for (size_t i = 0; i < unit.sizes.size(); ++i) {
+            socketSendGather(s, &unit.buffers[i * 2], 2, &addr);
+        }
+        return (int)unit.sizes.size();
+    }
+    int calls = 0;
+    for (int sent = 0; sent < (int)datagrams.size(); ++calls) {
+        int ret = socketSendBatch(s, datagrams.data() + sent, (int)datagrams.size() - sent, &addr);
+        if (ret == SOCKET_ERROR) return -1;
+        sent += ret;
+    }
+    return calls;
+}
+
+struct Receiver {
+    SOCKET socket = INVALID_SOCKET;
+    std::atomic<bool> stop{false};
+    std::atomic<int64_t> packets{0};
+    std::atomic<int64_t> errors{0};
+    // packets expected in order and checked byte for byte, 0 only counts
+    std::atomic<int> checkPackets{0};
+    const AccessUnit *unit = nullptr;
+
+    void run() {
+        std::vector<uint8_t> buffer(65536);
+        int next = 0;
+        while (!stop.load()) {
+            int len = recv(socket, (char *)buffer.data(), (int)buffer.size(), 0);
+            if (len <= 0) continue;
+            if (checkPackets.load() > 0) {
+                size_t offset = next * PAYLOAD_SIZE;
+                bool ok = len == (int)unit->sizes[next] &&
+                          buffer[2] == (uint8_t)(next >> 8) && buffer[3] == (uint8_t)next &&
+                          std::equal(buffer.begin() + HEADER_SIZE, buffer.begin() + len,
+                                     unit->payload.begin() + offset);
+                if (!ok) errors.fetch_add(1);
+                if (++next == checkPackets.load()) {
+                    next = 0;
+                    checkPackets.store(0);
+                }
+            }
+            packets.fetch_add(1);
+        }
+    }
+};
+
+static void waitFor(Receiver &receiver, int64_t packets) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (receiver.packets.load() < packets && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+static bool run(const char *name,
+                SOCKET s,
+                const SOCKADDR_IN &addr,
+                const AccessUnit &unit,
+                SendMode mode,
+                Receiver &receiver) {
+    std::vector<SocketDatagram> datagrams = makeDatagrams(unit, mode == SEND_SEGMENTED);
+    int64_t packets = (int64_t)unit.sizes.size();
+
+    // one checked access unit
+    int64_t received = receiver.packets.load();
+    receiver.checkPackets.store((int)packets);
+    if (sendUnit(s, addr, unit, datagrams, mode) < 0) {
+        printf("%s: send failed, error code:%d\n", name, WSAGetLastError());
+        return false;
+    }
+    waitFor(receiver, received + packets);
+    if (receiver.checkPackets.load() != 0 || receiver.errors.load() != 0) {
+        printf("%s: access unit not received intact\n", name);
+        return false;
+    }
+
+    received = receiver.packets.load();
+    int64_t calls = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ROUNDS; ++i) calls += sendUnit(s, addr, unit, datagrams, mode);
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+    waitFor(receiver, received + packets * ROUNDS);
+
+    double sentPackets = (double)packets * ROUNDS;
+    printf("%-16s %10.0f %10.2f %10.1f %9.1f%%\n", name, sentPackets / seconds.count(),
+           sentPackets * (HEADER_SIZE + PAYLOAD_SIZE) * 8 / seconds.count() / 1e9,
+           (double)calls / ROUNDS,
+           100.0 * (receiver.packets.load() - received) / sentPackets);
+    return true;
+}
+
+int main() {
+#if defined(_WIN32)
+    WSADATA wsaData;
+    WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+    SOCKADDR_IN addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    Receiver receiver;
+    receiver.socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    int recvBufferSize = 8 * 1024 * 1024;
+    setsockopt(receiver.socket, SOL_SOCKET, SO_RCVBUF, (const char *)&recvBufferSize,
+               sizeof(recvBufferSize));
+#if defined(_WIN32)
+    DWORD timeoutMs = 100;
+    setsockopt(receiver.socket, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeoutMs,
+               sizeof(timeoutMs));
+#else
+    timeval timeout = {0, 100000};
+    setsockopt(receiver.socket, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout, sizeof(timeout));
+#endif
+    socklen_t addrLen = sizeof(addr);
+    if (bind(receiver.socket, (const SOCKADDR *)&addr, sizeof(addr)) == SOCKET_ERROR ||
+        getsockname(receiver.socket, (SOCKADDR *)&addr, &addrLen) == SOCKET_ERROR) {
+        printf("failed to bind the receiver, error code:%d\n", WSAGetLastError());
+        return 1;
+    }
+
+    AccessUnit unit = makeAccessUnit();
+    receiver.unit = &unit;
+    std::thread receiverThread([&receiver]() { receiver.run(); });
+
+    SOCKET s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    printf("%zu byte access unit, %zu packets, %d rounds\n", FRAME_SIZE, unit.sizes.size(),
+           ROUNDS);
+    printf("%-16s %10s %10s %10s %10s\n", "mode", "pkt/s", "Gbit/s", "calls/AU", "received");
+    bool ok = run("per packet", s, addr, unit, SEND_PER_PACKET, receiver) &&
+              run("batch", s, addr, unit, SEND_BATCH, receiver);
+    if (ok && socketSupportsSegmentation(s)) {
+        ok = run("batch + GSO", s, addr, unit, SEND_SEGMENTED, receiver);
+    } else if (ok) {
+        printf("batch + GSO      not supported on this socket\n");
+    }
+
+    receiver.stop.store(true);
+    receiverThread.join();
+    closesocket(s);
+    closesocket(receiver.socket);
+    return ok ? 0 : 1;
+}
@@ -1,123 +1,343 @@
 #include "Base64.h"
+#include "CpuFeatures.h"
 
-// copy from AOSP frameworks/av/media/module/foundation/base64.cpp
+#if defined(CPU_X86)
+#include <immintrin.h>
+#endif
 
-bool decodeBase64(const char *s, size_t *inOutBufSize, uint8_t *out) {
-    size_t n = std::strlen(s);
+// scalar code based on AOSP frameworks/av/media/module/foundation/base64.cpp, vector kernels
+// after Muła and Lemire, "Faster Base64 Encoding and Decoding Using AVX2 Instructions"
 
-    if ((n % 4) != 0) return false;
+using EncodeBase64Func = size_t (*)(const uint8_t *data, size_t size, char *out);
+using DecodeBase64Func = size_t (*)(const char *s, size_t length, uint8_t *out);
 
-    size_t padding = 0;
-    if (n >= 1 && s[n - 1] == '=') {
-        padding = 1;
+static const char ENCODE_TABLE[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
-        if (n >= 2 && s[n - 2] == '=') {
-            padding = 2;
+// -1 for chars outside the alphabet, '-' and '_' are accepted as in the url safe alphabet
+struct DecodeTable {
+    int8_t values[256];
 
-            if (n >= 3 && s[n - 3] == '=') {
-                padding = 3;
-            }
-        }
+    constexpr DecodeTable() : values() {
+        for (int i = 0; i < 256; ++i) values[i] = -1;
+        for (int i = 0; i < 64; ++i) values[(uint8_t)ENCODE_TABLE[i]] = (int8_t)i;
+        values['-'] = 62;
+        values['_'] = 63;
     }
+};
 
-    // We divide first to avoid overflow. It's OK to do this because we already made sure that n % 4
-    // == 0.
-    size_t outLen = (n / 4) * 3 - padding;
-
-    if (out == nullptr || *inOutBufSize < outLen) return false;
-
-    size_t j = 0;
-    uint32_t accum = 0;
-    for (size_t i = 0; i < n; ++i) {
-        char c = s[i];
-        unsigned int value;
-        if (c >= 'A' && c <= 'Z') {
-            value = c - 'A';
-        } else if (c >= 'a' && c <= 'z') {
-            value = 26 + c - 'a';
-        } else if (c >= '0' && c <= '9') {
-            value = 52 + c - '0';
-        } else if (c == '+' || c == '-') {
-            value = 62;
-        } else if (c == '/' || c == '_') {
-            value = 63;
-        } else if (c != '=') {
-            return false;
-        } else {
-            if (i < n - padding) {
-                return false;
-            }
-            value = 0;
-        }
+static constexpr DecodeTable DECODE_TABLE;
 
-        accum = (accum << 6) | value;
+static inline void encodeTriple(const uint8_t *data, char *out) {
+    uint32_t accum = (uint32_t)data[0] << 16 | (uint32_t)data[1] << 8 | data[2];
+    out[0] = ENCODE_TABLE[accum >> 18];
+    out[1] = ENCODE_TABLE[(accum >> 12) & 0x3F];
+    out[2] = ENCODE_TABLE[(accum >> 6) & 0x3F];
+    out[3] = ENCODE_TABLE[accum & 0x3F];
+}
 
-        if (((i + 1) % 4) == 0) {
-            if (j < outLen) {
-                out[j++] = (accum >> 16);
-            }
-            if (j < outLen) {
-                out[j++] = (accum >> 8) & 0xFF;
-            }
-            if (j < outLen) {
-                out[j++] = accum & 0xFF;
-            }
+static inline bool decodeQuad(const char *s, uint8_t *out) {
+    int a = DECODE_TABLE.values[(uint8_t)s[0]];
+    int b = DECODE_TABLE.values[(uint8_t)s[1]];
+    int c = DECODE_TABLE.values[(uint8_t)s[2]];
+    int d = DECODE_TABLE.values[(uint8_t)s[3]];
+    if ((a | b | c | d) < 0) return false;
 
-            accum = 0;
-        }
+    uint32_t accum = (uint32_t)a << 18 | (uint32_t)b << 12 | (uint32_t)c << 6 | (uint32_t)d;
+    out[0] = (uint8_t)(accum >> 16);
+    out[1] = (uint8_t)(accum >> 8);
+    out[2] = (uint8_t)accum;
+    return true;
+}
+
+// The kernels only cover whole blocks and return how much input they consumed, the rest is left
+// to the scalar code.
+static size_t encodeBase64C(const uint8_t *, size_t, char *) {
+    return 0;
+}
+
+static size_t decodeBase64C(const char *, size_t, uint8_t *) {
+    return 0;
+}
+
+#if defined(CPU_X86)
+// 12 bytes -> 16 sextets, one per byte
+TARGET_SSSE3 static inline __m128i unpackSextets(__m128i in) {
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(t1, t3);
+}
+
+// sextet -> ascii, the range of the sextet selects the offset to add
+TARGET_SSSE3 static inline __m128i sextetsToAscii(__m128i indices) {
+    const __m128i shiftLut = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    range = _mm_or_si128(range, _mm_and_si128(upper, _mm_set1_epi8(13)));
+    return _mm_add_epi8(_mm_shuffle_epi8(shiftLut, range), indices);
+}
+
+TARGET_SSSE3 static size_t encodeBase64SSSE3(const uint8_t *data, size_t size, char *out) {
+    size_t i = 0;
+    // loads 16 bytes and uses 12 of them
+    for (; size - i >= 16; i += 12, out += 16) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(data + i));
+        _mm_storeu_si128((__m128i *)out, sextetsToAscii(unpackSextets(in)));
+    }
+    return i;
+}
+
+// validates 16 chars and maps them to sextets, false if any char is outside the alphabet
+TARGET_SSSE3 static inline bool asciiToSextets(__m128i in, __m128i &values) {
+    const __m128i lutLo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                        0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lutHi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10,
+                                        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lutRoll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0,
+                                          0);
+    const __m128i nibbleMask = _mm_set1_epi8(0x0F);
+
+    __m128i hiNibbles = _mm_and_si128(_mm_srli_epi32(in, 4), nibbleMask);
+    __m128i loNibbles = _mm_and_si128(in, nibbleMask);
+    __m128i hi = _mm_shuffle_epi8(lutHi, hiNibbles);
+    __m128i lo = _mm_shuffle_epi8(lutLo, loNibbles);
+    if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128()))) {
+        return false;
     }
 
-    *inOutBufSize = j;
+    __m128i eq2F = _mm_cmpeq_epi8(in, _mm_set1_epi8('/'));
+    __m128i roll = _mm_shuffle_epi8(lutRoll, _mm_add_epi8(eq2F, hiNibbles));
+    values = _mm_add_epi8(in, roll);
     return true;
 }
 
-static char encode6Bit(unsigned int x) {
-    if (x <= 25) {
-        return 'A' + x;
-    } else if (x <= 51) {
-        return 'a' + x - 26;
-    } else if (x <= 61) {
-        return '0' + x - 52;
-    } else if (x == 62) {
-        return '+';
-    } else {
-        return '/';
+// 16 sextets -> 12 bytes in the low part of the register
+TARGET_SSSE3 static inline __m128i packSextets(__m128i values) {
+    __m128i merged = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    merged = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+    return _mm_shuffle_epi8(merged,
+                            _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+TARGET_SSSE3 static size_t decodeBase64SSSE3(const char *s, size_t length, uint8_t *out) {
+    size_t i = 0;
+    // stores 16 bytes for 12, the next 8 chars make sure the extra 4 still belong to out
+    for (; length - i >= 16 + 8; i += 16, out += 12) {
+        __m128i values;
+        if (!asciiToSextets(_mm_loadu_si128((const __m128i *)(s + i)), values)) break;
+        _mm_storeu_si128((__m128i *)out, packSextets(values));
+    }
+    return i;
+}
+
+TARGET_AVX2 static size_t encodeBase64AVX2(const uint8_t *data, size_t size, char *out) {
+    const __m256i shuffle = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                            10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m256i shiftLut = _mm256_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0, 'a' - 26, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63,
+        'A', 0, 0);
+
+    size_t i = 0;
+    // two 12 byte groups, one per lane, the second load reads up to data + i + 28
+    for (; size - i >= 28; i += 24, out += 32) {
+        __m128i lo = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i hi = _mm_loadu_si128((const __m128i *)(data + i + 12));
+        __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        in = _mm256_shuffle_epi8(in, shuffle);
+
+        __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+        __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+        __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        __m256i indices = _mm256_or_si256(t1, t3);
+
+        __m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        __m256i upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+        range = _mm256_or_si256(range, _mm256_and_si256(upper, _mm256_set1_epi8(13)));
+        __m256i ascii = _mm256_add_epi8(_mm256_shuffle_epi8(shiftLut, range), indices);
+        _mm256_storeu_si256((__m256i *)out, ascii);
     }
+    return i + encodeBase64SSSE3(data + i, size - i, out);
 }
 
-void encodeBase64(const uint8_t *data, size_t size, char *out) {
-    int j = 0;
-    size_t i;
-    for (i = 0; i < (size / 3) * 3; i += 3) {
-        uint8_t x1 = data[i];
-        uint8_t x2 = data[i + 1];
-        uint8_t x3 = data[i + 2];
+TARGET_AVX2 static size_t decodeBase64AVX2(const char *s, size_t length, uint8_t *out) {
+    const __m256i lutLo = _mm256_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B,
+        0x1A, 0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B,
+        0x1B, 0x1A);
+    const __m256i lutHi = _mm256_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10);
+    const __m256i lutRoll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0,
+                                             0, 0, 0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0,
+                                             0, 0, 0, 0);
+    const __m256i nibbleMask = _mm256_set1_epi8(0x0F);
+    const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                          2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+    size_t i = 0;
+    // stores 32 bytes for 24, the next 12 chars make sure the extra 8 still belong to out
+    for (; length - i >= 32 + 12; i += 32, out += 24) {
+        __m256i in = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i hiNibbles = _mm256_and_si256(_mm256_srli_epi32(in, 4), nibbleMask);
+        __m256i loNibbles = _mm256_and_si256(in, nibbleMask);
+        __m256i hi = _mm256_shuffle_epi8(lutHi, hiNibbles);
+        __m256i lo = _mm256_shuffle_epi8(lutLo, loNibbles);
+        if (!_mm256_testz_si256(lo, hi)) break;
 
-        out[j++] = encode6Bit(x1 >> 2);
-        out[j++] = encode6Bit((x1 << 4 | x2 >> 4) & 0x3F);
-        out[j++] = encode6Bit((x2 << 2 | x3 >> 6) & 0x3F);
-        out[j++] = encode6Bit(x3 & 0x3F);
+        __m256i eq2F = _mm256_cmpeq_epi8(in, _mm256_set1_epi8('/'));
+        __m256i roll = _mm256_shuffle_epi8(lutRoll, _mm256_add_epi8(eq2F, hiNibbles));
+        __m256i values = _mm256_add_epi8(in, roll);
+
+        __m256i merged = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+        merged = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+        merged = _mm256_shuffle_epi8(merged, pack);
+        // 12 bytes per lane -> 24 contiguous bytes
+        merged = _mm256_permutevar8x32_epi32(merged, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+        _mm256_storeu_si256((__m256i *)out, merged);
     }
+    return i + decodeBase64SSSE3(s + i, length - i, out);
+}
+#endif
+
+static EncodeBase64Func selectEncodeBase64() {
+#if defined(CPU_X86)
+    if (cpuHasAVX2()) return encodeBase64AVX2;
+    if (cpuHasSSSE3()) return encodeBase64SSSE3;
+#endif
+    return encodeBase64C;
+}
 
-    switch (size % 3) {
+static DecodeBase64Func selectDecodeBase64() {
+#if defined(CPU_X86)
+    if (cpuHasAVX2()) return decodeBase64AVX2;
+    if (cpuHasSSSE3()) return decodeBase64SSSE3;
+#endif
+    return decodeBase64C;
+}
+
+size_t base64DecodedSize(const char *s, size_t length) {
+    if (length == 0 || (length % 4) != 0) return 0;
+
+    size_t padding = 0;
+    while (padding < 3 && s[length - 1 - padding] == '=') ++padding;
+
+    // We divide first to avoid overflow. It's OK to do this because we already made sure that
+    // length % 4 == 0.
+    return (length / 4) * 3 - padding;
+}
+
+// the kernel takes the whole blocks, the scalar code the rest
+static size_t encodeBase64With(EncodeBase64Func func, const uint8_t *data, size_t size, char *out) {
+    size_t i = func(data, size, out);
+    size_t j = i / 3 * 4;
+    for (; size - i >= 3; i += 3, j += 4) encodeTriple(data + i, out + j);
+
+    switch (size - i) {
         case 0:
             break;
         case 2: {
             uint8_t x1 = data[i];
             uint8_t x2 = data[i + 1];
-            out[j++] = encode6Bit(x1 >> 2);
-            out[j++] = encode6Bit((x1 << 4 | x2 >> 4) & 0x3F);
-            out[j++] = encode6Bit((x2 << 2) & 0x3F);
+            out[j++] = ENCODE_TABLE[x1 >> 2];
+            out[j++] = ENCODE_TABLE[(x1 << 4 | x2 >> 4) & 0x3F];
+            out[j++] = ENCODE_TABLE[(x2 << 2) & 0x3F];
             out[j++] = '=';
             break;
         }
         default: {
             uint8_t x1 = data[i];
-            out[j++] = encode6Bit(x1 >> 2);
-            out[j++] = encode6Bit((x1 << 4) & 0x3F);
+            out[j++] = ENCODE_TABLE[x1 >> 2];
+            out[j++] = ENCODE_TABLE[(x1 << 4) & 0x3F];
             out[j++] = '=';
             out[j++] = '=';
             break;
         }
     }
+    return j;
+}
+
+size_t encodeBase64(const uint8_t *data, size_t size, char *out) {
+    static const EncodeBase64Func func = selectEncodeBase64();
+    return encodeBase64With(func, data, size, out);
+}
+
+std::string encodeBase64(const uint8_t *data, size_t size) {
+    std::string str(base64EncodedSize(size), '\0');
+    encodeBase64(data, size, str.data());
+    return str;
+}
+
+static bool decodeBase64With(
+    DecodeBase64Func func, const char *s, size_t length, uint8_t *out, size_t *outSize) {
+    if (length == 0) {
+        *outSize = 0;
+        return true;
+    }
+    if ((length % 4) != 0) return false;
+
+    // everything but the last quad, which may carry padding
+    size_t body = length - 4;
+    size_t i = 0;
+    while (i < body) {
+        i += func(s + i, body - i, out + i / 4 * 3);
+        // the kernel stops at a block with chars it does not handle, decode a quad in between
+        if (i < body) {
+            if (!decodeQuad(s + i, out + i / 4 * 3)) return false;
+            i += 4;
+        }
+    }
+
+    size_t outLen = base64DecodedSize(s, length);
+    // bytes carried by the last quad, the rest of it is padding
+    size_t tail = outLen - body / 4 * 3;
+    char quad[4];
+    for (size_t k = 0; k < 4; ++k) {
+        quad[k] = s[body + k];
+        if (quad[k] == '=') {
+            // '=' is only allowed as padding
+            if (k <= tail) return false;
+            quad[k] = 'A';
+        }
+    }
+    uint8_t last[3];
+    if (!decodeQuad(quad, last)) return false;
+    std::memcpy(out + body / 4 * 3, last, tail);
+
+    *outSize = outLen;
+    return true;
+}
+
+bool decodeBase64(const char *s, size_t length, uint8_t *out, size_t *outSize) {
+    static const DecodeBase64Func func = selectDecodeBase64();
+    return decodeBase64With(func, s, length, out, outSize);
+}
+
+bool decodeBase64(const char *s, size_t *inOutBufSize, uint8_t *out) {
+    size_t n = std::strlen(s);
+    if ((n % 4) != 0) return false;
+    if (out == nullptr || *inOutBufSize < base64DecodedSize(s, n)) return false;
+
+    return decodeBase64(s, n, out, inOutBufSize);
+}
+
+bool decodeBase64(const std::string &s, std::vector<uint8_t> &out) {
+    size_t offset = out.size();
+    out.resize(offset + base64DecodedSize(s.data(), s.size()));
+
+    size_t size = 0;
+    if (!decodeBase64(s.data(), s.size(), out.data() + offset, &size)) {
+        out.resize(offset);
+        return false;
+    }
+    out.resize(offset + size);
+    return true;
 }
@@ -3,8 +3,27 @@
 
 #include <cstring>
 #include <cstdint>
+#include <string>
+#include <vector>
 
+// size of the padded base64 text of size bytes, without terminator
+inline size_t base64EncodedSize(size_t size) {
+    return (size + 2) / 3 * 4;
+}
+
+// size of the data encoded in length chars of s, 0 when length is not a multiple of 4
+size_t base64DecodedSize(const char *s, size_t length);
+
+// out needs base64EncodedSize(size) chars and is not null terminated, returns the chars written.
+// SSSE3/AVX2 kernels are picked at runtime.
+size_t encodeBase64(const uint8_t *data, size_t size, char *out);
+std::string encodeBase64(const uint8_t *data, size_t size);
+
+// s is null terminated, *inOutBufSize is the size of out on input and the decoded size on output
 bool decodeBase64(const char *s, size_t *inOutBufSize, uint8_t *out);
-void encodeBase64(const uint8_t *data, size_t size, char *out);
+// out needs base64DecodedSize(s, length) bytes, *outSize is set to the decoded size
+bool decodeBase64(const char *s, size_t length, uint8_t *out, size_t *outSize);
+// appends the decoded data to out
+bool decodeBase64(const std::string &s, std::vector<uint8_t> &out);
 
 #endif
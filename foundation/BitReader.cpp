@@ -1,67 +1,70 @@
 #include "BitReader.h"
 
-BitReader::BitReader(const uint8_t *data, size_t size)
-    : mpData(data), mSize(size), mReservoir(0), mNumBitsLeft(0) {}
+#include <cstring>
 
-BitReader::~BitReader() {}
+#if defined(_MSC_VER)
+#include <stdlib.h>
+#endif
 
-bool BitReader::fillReservoir() {
-    if (mSize == 0) return false;
+static inline uint64_t loadBE64(const uint8_t *p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+#if defined(_MSC_VER)
+    return _byteswap_uint64(v);
+#else
+    return __builtin_bswap64(v);
+#endif
+}
+
+void BitReader::fillReservoir() {
+    if (mSize >= 8) {
+        // whole bytes that fit below the valid bits
+        size_t bytes = (64 - mNumBitsLeft) / 8;
+        mReservoir |= loadBE64(mpData) >> mNumBitsLeft;
+        mNumBitsLeft += (uint32_t)(bytes * 8);
+        if (mNumBitsLeft < 64) mReservoir &= ~0ULL << (64 - mNumBitsLeft);
+        mpData += bytes;
+        mSize -= bytes;
+        return;
+    }
 
-    mReservoir = 0;
-    int i = 0;
-    for (; i < 4 && mSize > 0; ++i) {
-        mReservoir = (mReservoir << 8) | *mpData;
+    // tail
+    while (mNumBitsLeft <= 56 && mSize > 0) {
+        mReservoir |= (uint64_t)*mpData << (56 - mNumBitsLeft);
         ++mpData;
         --mSize;
+        mNumBitsLeft += 8;
     }
-    mNumBitsLeft = 8 * i;
-    mReservoir <<= (32 - 8 * i);
-    return true;
 }
 
 bool BitReader::getBitsGraceful(size_t n, uint32_t *out) {
     if (n > 32) return false;
-
-    uint32_t ret = 0;
-    while (n > 0) {
-        if (mNumBitsLeft == 0) {
-            if (!fillReservoir()) return false;
-        }
-
-        size_t m = n;
-        if (m > mNumBitsLeft) m = mNumBitsLeft;
-        ret = (ret << m) | (mReservoir >> (32 - m));
-        mReservoir <<= m;
-        n -= m;
-        mNumBitsLeft -= m;
+    if (numBitsLeft() < n) {
+        skipBits(numBitsLeft());
+        return false;
     }
 
-    *out = ret;
+    *out = getBits(n);
     return true;
 }
 
-uint32_t BitReader::getBits(size_t n) {
-    uint32_t ret = 0;
-    getBitsGraceful(n, &ret);
-    return ret;
-}
-
 bool BitReader::skipBits(size_t n) {
-    uint32_t ret;
-    while (n > 32) {
-        if (!getBitsGraceful(32, &ret)) return false;
-        n -= 32;
+    if (n <= mNumBitsLeft) {
+        consumeBits(n);
+        return true;
     }
 
-    if (n > 0) return getBitsGraceful(n, &ret);
-    return true;
-}
+    bool ret = n <= numBitsLeft();
+    n -= mNumBitsLeft;
+    consumeBits(mNumBitsLeft);
 
-size_t BitReader::numBitsLeft() const {
-    return mSize * 8 + mNumBitsLeft;
-}
+    // bulk skip whole bytes without touching the reservoir
+    size_t bytes = n / 8;
+    if (bytes > mSize) bytes = mSize;
+    mpData += bytes;
+    mSize -= bytes;
+    n -= bytes * 8;
 
-const uint8_t *BitReader::data() const {
-    return mpData - (mNumBitsLeft + 7) / 8;
+    if (ret && n > 0) getBits(n);
+    return ret;
 }
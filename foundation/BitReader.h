@@ -1,28 +1,78 @@
 #ifndef BIT_READER_H
 #define BIT_READER_H
 
+#include <bit>
+#include <cstddef>
 #include <cstdint>
 
+// MSB-first bit reader over a 64-bit reservoir, refilled with one unaligned big-endian load.
+// getBits()/peekBits() are inline and unchecked: bits past the end read as zero, callers that
+// need to detect truncation use getBitsGraceful() or numBitsLeft().
 class BitReader {
 private:
     const uint8_t *mpData;
-    size_t mSize;
-    uint32_t mReservoir;
+    size_t mSize;        // bytes not loaded into the reservoir yet
+    uint64_t mReservoir; // left aligned, bits below the valid ones are zero
     uint32_t mNumBitsLeft;
 
-    bool fillReservoir();
+    void fillReservoir();
+
+    void consumeBits(size_t n) {
+        if (n < mNumBitsLeft) {
+            mReservoir <<= n;
+            mNumBitsLeft -= (uint32_t)n;
+        } else {
+            mReservoir = 0;
+            mNumBitsLeft = 0;
+        }
+    }
 
 public:
-    BitReader(const uint8_t *data, size_t size);
+    BitReader(const uint8_t *data, size_t size)
+        : mpData(data), mSize(size), mReservoir(0), mNumBitsLeft(0) {}
     BitReader(const BitReader &) = delete;
     BitReader &operator=(const BitReader &) = delete;
-    ~BitReader();
+    ~BitReader() = default;
+
+    // n <= 32
+    uint32_t peekBits(size_t n) {
+        if (n == 0) return 0;
+        if (mNumBitsLeft < n) fillReservoir();
+        return (uint32_t)(mReservoir >> (64 - n));
+    }
+
+    // n <= 32
+    uint32_t getBits(size_t n) {
+        uint32_t ret = peekBits(n);
+        consumeBits(n);
+        return ret;
+    }
+
+    // unsigned Exp-Golomb, returns 0 for codes longer than 32 bits
+    uint32_t readUE() {
+        if (mNumBitsLeft < 32) fillReservoir();
+        int leadingZeros = std::countl_zero(mReservoir);
+        if (leadingZeros > 31) {
+            consumeBits(leadingZeros);
+            return 0;
+        }
+        consumeBits(leadingZeros);
+        return (uint32_t)(((uint64_t)getBits(leadingZeros + 1)) - 1);
+    }
+
+    // signed Exp-Golomb
+    int32_t readSE() {
+        uint32_t k = readUE();
+        return (k & 1) ? (int32_t)((k >> 1) + 1) : -(int32_t)(k >> 1);
+    }
 
     bool getBitsGraceful(size_t n, uint32_t *out);
-    uint32_t getBits(size_t n);
     bool skipBits(size_t n);
-    size_t numBitsLeft() const;
-    const uint8_t *data() const;
+    bool skipBytes(size_t n) { return skipBits(n * 8); }
+    // skip to the next byte boundary
+    void byteAlign() { consumeBits(mNumBitsLeft % 8); }
+    size_t numBitsLeft() const { return mSize * 8 + mNumBitsLeft; }
+    const uint8_t *data() const { return mpData - (mNumBitsLeft + 7) / 8; }
 };
 
 #endif
@@ -1,37 +1,79 @@
 #include "BitWriter.h"
 
-BitWriter::BitWriter(uint8_t *data, size_t size)
-    : mpData(data), mSize(size), mReservoir(0), mNumBitsLeft(0) {}
+#include <bit>
+#include <cstring>
 
-BitWriter::~BitWriter() {
-    flush();
+#if defined(_MSC_VER)
+#include <stdlib.h>
+#endif
+
+static inline void storeBE32(uint8_t *p, uint32_t v) {
+#if defined(_MSC_VER)
+    v = _byteswap_ulong(v);
+#else
+    v = __builtin_bswap32(v);
+#endif
+    std::memcpy(p, &v, sizeof(v));
+}
+
+void BitWriter::flushWord() {
+    if (mSize >= 4) {
+        storeBE32(mpData, (uint32_t)(mAccumulator >> 32));
+        mpData += 4;
+        mSize -= 4;
+    } else {
+        for (int i = 0; i < 4 && mSize > 0; ++i) {
+            *mpData = (uint8_t)(mAccumulator >> (56 - 8 * i));
+            ++mpData;
+            --mSize;
+        }
+    }
+    mAccumulator <<= 32;
+    mNumBits -= 32;
+}
+
+void BitWriter::putExpGolomb(uint64_t v) {
+    int len = std::bit_width(v);
+    putBits(0, len - 1);
+    if (len > 32) {
+        putBits((uint32_t)(v >> 32), len - 32);
+        putBits((uint32_t)v, 32);
+    } else {
+        putBits((uint32_t)v, len);
+    }
 }
 
-void BitWriter::putBits(uint32_t x, size_t n) {
-    while (n > 0) {
-        size_t m = n;
-        if (m > mNumBitsLeft) m = mNumBitsLeft;
+void BitWriter::putUE(uint32_t x) {
+    putExpGolomb((uint64_t)x + 1);
+}
 
-        mReservoir = (mReservoir << m) | ((x >> (n - m)) & (~(0xFFFFFFFF << m)));
-        mNumBitsLeft -= m;
-        n -= m;
+void BitWriter::putSE(int32_t x) {
+    // 1 -> 1, -1 -> 2, 2 -> 3, ..., INT32_MIN -> 2^32, one past what putUE() takes
+    int64_t k = x > 0 ? (int64_t)x * 2 - 1 : -(int64_t)x * 2;
+    putExpGolomb((uint64_t)k + 1);
+}
 
-        if (mNumBitsLeft == 0) flush();
+void BitWriter::putBytes(const uint8_t *data, size_t size) {
+    if (mNumBits % 8) {
+        for (size_t i = 0; i < size; ++i) putBits(data[i], 8);
+        return;
     }
+
+    flush();
+    if (size > mSize) size = mSize;
+    std::memcpy(mpData, data, size);
+    mpData += size;
+    mSize -= size;
 }
 
 void BitWriter::flush() {
-    while (mNumBitsLeft <= 24 && mSize > 0) {
-        *mpData = (uint8_t)(mReservoir >> (24 - mNumBitsLeft));
+    while (mNumBits > 0 && mSize > 0) {
+        *mpData = (uint8_t)(mAccumulator >> 56);
         ++mpData;
         --mSize;
-        mNumBitsLeft += 8;
+        mAccumulator <<= 8;
+        mNumBits = mNumBits > 8 ? mNumBits - 8 : 0;
     }
-    if (mNumBitsLeft < 32 && mSize > 0) {
-        size_t m = 32 - mNumBitsLeft;
-        *mpData = (uint8_t)(mReservoir << (8 - m));
-        ++mpData;
-        --mSize;
-        mNumBitsLeft += m;
-    }
-}
\ No newline at end of file
+    mAccumulator = 0;
+    mNumBits = 0;
+}
@@ -1,23 +1,60 @@
 #ifndef BIT_WRITER_H
 #define BIT_WRITER_H
 
+#include <cstddef>
 #include <cstdint>
 
+// MSB-first bit writer over a 64-bit accumulator, pending bits are stored a 32-bit word at a
+// time. Writes past the end of the buffer are dropped. flush() pads the last byte with zeros.
 class BitWriter {
 private:
     uint8_t *mpData;
-    size_t mSize;
-    uint32_t mReservoir;
-    uint32_t mNumBitsLeft;
+    size_t mSize;          // bytes left in the output
+    uint64_t mAccumulator; // left aligned
+    uint32_t mNumBits;     // pending bits, < 32 between calls
+
+    void flushWord();
+    // Exp-Golomb code of v - 1, v up to 2^32 + 1
+    void putExpGolomb(uint64_t v);
 
 public:
-    BitWriter(uint8_t *data, size_t size);
+    BitWriter(uint8_t *data, size_t size)
+        : mpData(data), mSize(size), mAccumulator(0), mNumBits(0) {}
     BitWriter(const BitWriter &) = delete;
     BitWriter &operator=(const BitWriter &) = delete;
-    ~BitWriter();
+    ~BitWriter() { flush(); }
+
+    // n <= 32
+    void putBits(uint32_t x, size_t n) {
+        if (n == 0) return;
+        uint64_t v = x & (~0ULL >> (64 - n));
+        mAccumulator |= v << (64 - mNumBits - n);
+        mNumBits += (uint32_t)n;
+        if (mNumBits >= 32) flushWord();
+    }
+
+    // Exp-Golomb
+    void putUE(uint32_t x);
+    void putSE(int32_t x);
+
+    // bulk copy, memcpy when byte aligned
+    void putBytes(const uint8_t *data, size_t size);
 
-    void putBits(uint32_t x, size_t n);
     void flush();
 };
 
+// Packs a fixed-layout header at compile time, Widths are the field sizes in bits (MSB first).
+// e.g. HEVC payload header: putFixedBits<1, 6, 6, 3>(out, 0, type, 0, tid)
+template <size_t... Widths, typename... Values>
+inline void putFixedBits(uint8_t *out, Values... values) {
+    static_assert(sizeof...(Widths) == sizeof...(Values), "one value per field");
+    constexpr size_t totalBits = (Widths + ...);
+    static_assert(totalBits % 8 == 0 && totalBits <= 64, "fields must fill whole bytes");
+
+    uint64_t packed = 0;
+    ((packed = (packed << Widths) | ((uint64_t)values & (~0ULL >> (64 - Widths)))), ...);
+    for (size_t i = 0; i < totalBits / 8; i++)
+        out[i] = (uint8_t)(packed >> (totalBits - 8 * (i + 1)));
+}
+
 #endif
@@ -0,0 +1,87 @@
+#include "CpuFeatures.h"
+
+#if defined(CPU_X86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace {
+
+struct CpuFeatures {
+    bool sse2 = false;
+    bool ssse3 = false;
+    bool avx2 = false;
+    bool neon = false;
+};
+
+#if defined(CPU_X86)
+void cpuid(int leaf, int subleaf, unsigned int regs[4]) {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuidex(info, leaf, subleaf);
+    for (int i = 0; i < 4; i++) regs[i] = (unsigned int)info[i];
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+unsigned long long xgetbv0() {
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    unsigned int eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((unsigned long long)edx << 32) | eax;
+#endif
+}
+#endif
+
+CpuFeatures detect() {
+    CpuFeatures features;
+#if defined(CPU_X86)
+    unsigned int regs[4];
+    cpuid(0, 0, regs);
+    unsigned int maxLeaf = regs[0];
+
+    cpuid(1, 0, regs);
+    features.sse2 = regs[3] & (1u << 26);
+    features.ssse3 = regs[2] & (1u << 9);
+    // the OS has to save the ymm state as well
+    bool osxsave = regs[2] & (1u << 27);
+    bool ymmEnabled = osxsave && (xgetbv0() & 0x6) == 0x6;
+
+    if (maxLeaf >= 7) {
+        cpuid(7, 0, regs);
+        features.avx2 = ymmEnabled && (regs[1] & (1u << 5));
+    }
+#elif defined(CPU_NEON)
+    features.neon = true;
+#endif
+    return features;
+}
+
+const CpuFeatures &getFeatures() {
+    static const CpuFeatures features = detect();
+    return features;
+}
+
+} // namespace
+
+bool cpuHasSSE2() {
+    return getFeatures().sse2;
+}
+
+bool cpuHasSSSE3() {
+    return getFeatures().ssse3;
+}
+
+bool cpuHasAVX2() {
+    return getFeatures().avx2;
+}
+
+bool cpuHasNEON() {
+    return getFeatures().neon;
+}
@@ -0,0 +1,26 @@
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CPU_X86 1
+#elif defined(_M_ARM64) || defined(__aarch64__) || defined(__ARM_NEON)
+#define CPU_NEON 1
+#endif
+
+// kernels built for a higher ISA than the compiler baseline (gcc/clang need the attribute,
+// msvc accepts the intrinsics anywhere)
+#if defined(CPU_X86) && !defined(_MSC_VER)
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSSE3
+#define TARGET_AVX2
+#endif
+
+// runtime cpu features, detected once
+bool cpuHasSSE2();
+bool cpuHasSSSE3();
+bool cpuHasAVX2();
+bool cpuHasNEON();
+
+#endif // CPU_FEATURES_H
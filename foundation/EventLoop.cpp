@@ -0,0 +1,311 @@
+#include "EventLoop.h"
+#include "Log.h"
+
+#include <algorithm>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#elif !defined(_WIN32)
+#include <poll.h>
+#endif
+
+#if defined(__linux__)
+class EventLoop::Poller {
+public:
+    Poller() { mEpollFd = epoll_create1(EPOLL_CLOEXEC); }
+    ~Poller() {
+        if (mEpollFd >= 0) close(mEpollFd);
+    }
+
+    bool add(SOCKET s, int events) { return control(EPOLL_CTL_ADD, s, events); }
+    bool modify(SOCKET s, int events) { return control(EPOLL_CTL_MOD, s, events); }
+    void remove(SOCKET s) { epoll_ctl(mEpollFd, EPOLL_CTL_DEL, s, nullptr); }
+
+    void wait(std::vector<std::pair<SOCKET, int>> &ready, int timeoutMs) {
+        int n = epoll_wait(mEpollFd, mEvents, MAX_EVENTS, timeoutMs);
+        for (int i = 0; i < n; ++i) {
+            uint32_t revents = mEvents[i].events;
+            int events = 0;
+            if (revents & (EPOLLIN | EPOLLHUP | EPOLLRDHUP)) events |= EVENT_READ;
+            if (revents & EPOLLOUT) events |= EVENT_WRITE;
+            if (revents & (EPOLLERR | EPOLLHUP)) events |= EVENT_ERROR;
+            ready.emplace_back((SOCKET)mEvents[i].data.fd, events);
+        }
+    }
+
+private:
+    static const int MAX_EVENTS = 256;
+
+    int mEpollFd;
+    epoll_event mEvents[MAX_EVENTS];
+
+    bool control(int op, SOCKET s, int events) {
+        epoll_event event = {};
+        event.events = EPOLLRDHUP;
+        if (events & EVENT_READ) event.events |= EPOLLIN;
+        if (events & EVENT_WRITE) event.events |= EPOLLOUT;
+        event.data.fd = s;
+        return epoll_ctl(mEpollFd, op, s, &event) == 0;
+    }
+};
+#else
+// poll() on POSIX systems, WSAPoll() on Windows
+class EventLoop::Poller {
+public:
+    bool add(SOCKET s, int events) {
+        if (mIndex.count(s)) return false;
+        mIndex[s] = mFds.size();
+        mFds.push_back({s, toPollEvents(events), 0});
+        return true;
+    }
+
+    bool modify(SOCKET s, int events) {
+        auto iter = mIndex.find(s);
+        if (iter == mIndex.end()) return false;
+        mFds[iter->second].events = toPollEvents(events);
+        return true;
+    }
+
+    void remove(SOCKET s) {
+        auto iter = mIndex.find(s);
+        if (iter == mIndex.end()) return;
+        size_t index = iter->second;
+        mIndex.erase(iter);
+        if (index != mFds.size() - 1) {
+            mFds[index] = mFds.back();
+            mIndex[mFds[index].fd] = index;
+        }
+        mFds.pop_back();
+    }
+
+    void wait(std::vector<std::pair<SOCKET, int>> &ready, int timeoutMs) {
+#if defined(_WIN32)
+        int n = WSAPoll(mFds.data(), (ULONG)mFds.size(), timeoutMs);
+#else
+        int n = poll(mFds.data(), mFds.size(), timeoutMs);
+#endif
+        for (size_t i = 0; i < mFds.size() && n > 0; ++i) {
+            short revents = mFds[i].revents;
+            if (!revents) continue;
+            --n;
+            int events = 0;
+            if (revents & (POLLIN | POLLHUP)) events |= EVENT_READ;
+            if (revents & POLLOUT) events |= EVENT_WRITE;
+            if (revents & (POLLERR | POLLHUP | POLLNVAL)) events |= EVENT_ERROR;
+            ready.emplace_back(mFds[i].fd, events);
+        }
+    }
+
+private:
+#if defined(_WIN32)
+    std::vector<WSAPOLLFD> mFds;
+#else
+    std::vector<pollfd> mFds;
+#endif
+    std::unordered_map<SOCKET, size_t> mIndex;
+
+    static short toPollEvents(int events) {
+        short pollEvents = 0;
+        if (events & EVENT_READ) pollEvents |= POLLIN;
+        if (events & EVENT_WRITE) pollEvents |= POLLOUT;
+        return pollEvents;
+    }
+};
+#endif
+
+// Tasks posted from other threads. The loop is woken by an eventfd on Linux and by a datagram
+// sent to a loopback UDP socket elsewhere (WSAPoll can only wait for sockets).
+struct EventLoop::TaskQueue {
+    std::mutex mutex;
+    std::vector<Task> tasks;
+    bool closed = false;
+#if defined(__linux__)
+    int wakeFd;
+#else
+    SOCKET wakeSocket;
+    SOCKADDR_IN wakeAddr;
+#endif
+
+    TaskQueue() {
+#if defined(__linux__)
+        wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+#else
+        wakeSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        wakeAddr = {};
+        wakeAddr.sin_family = AF_INET;
+        wakeAddr.sin_port = htons(0);
+        wakeAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(wakeAddr);
+        if (bind(wakeSocket, (SOCKADDR *)&wakeAddr, sizeof(wakeAddr)) == SOCKET_ERROR ||
+            getsockname(wakeSocket, (SOCKADDR *)&wakeAddr, &len) == SOCKET_ERROR) {
+            LOGE("%s Failed to create wakeup socket, error code:%d\n", __PRETTY_FUNCTION__,
+                 WSAGetLastError());
+        }
+        socketSetNonBlocking(wakeSocket);
+#endif
+    }
+    ~TaskQueue() {
+#if defined(__linux__)
+        if (wakeFd >= 0) close(wakeFd);
+#else
+        if (wakeSocket != INVALID_SOCKET) closesocket(wakeSocket);
+#endif
+    }
+
+    SOCKET handle() const {
+#if defined(__linux__)
+        return wakeFd;
+#else
+        return wakeSocket;
+#endif
+    }
+
+    bool push(Task task) {
+        bool wasEmpty;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (closed) return false;
+            wasEmpty = tasks.empty();
+            tasks.emplace_back(std::move(task));
+        }
+        // the loop swaps the whole vector out, one wakeup covers every task queued meanwhile
+        if (wasEmpty) wake();
+        return true;
+    }
+
+    void wake() {
+#if defined(__linux__)
+        uint64_t one = 1;
+        (void)!write(wakeFd, &one, sizeof(one));
+#else
+        char byte = 0;
+        sendto(wakeSocket, &byte, 1, 0, (SOCKADDR *)&wakeAddr, sizeof(wakeAddr));
+#endif
+    }
+
+    void drain() {
+#if defined(__linux__)
+        uint64_t value;
+        (void)!read(wakeFd, &value, sizeof(value));
+#else
+        char buf[64];
+        while (recv(wakeSocket, buf, sizeof(buf), 0) > 0) {
+        }
+#endif
+    }
+};
+
+EventLoop::EventLoop() : mStop(false) {
+    mpPoller = std::make_unique<Poller>();
+    mpTasks = std::make_shared<TaskQueue>();
+    mpPoller->add(mpTasks->handle(), EVENT_READ);
+}
+
+EventLoop::~EventLoop() {
+    std::unique_lock<std::mutex> lock(mpTasks->mutex);
+    mpTasks->closed = true;
+    mpTasks->tasks.clear();
+}
+
+void EventLoop::run() {
+    mThreadId = std::this_thread::get_id();
+
+    std::vector<std::pair<SOCKET, int>> ready;
+    while (!mStop.load()) {
+        ready.clear();
+        mpPoller->wait(ready, -1);
+        for (auto &[s, events] : ready) {
+            if (s == mpTasks->handle()) {
+                mpTasks->drain();
+                continue;
+            }
+            // a handler may remove itself or others, keep it alive while it runs
+            auto iter = mHandlers.find(s);
+            if (iter == mHandlers.end()) continue;
+            std::shared_ptr<Handler> handler = iter->second;
+            (*handler)(events);
+        }
+        runTasks();
+    }
+}
+
+void EventLoop::stop() {
+    mStop = true;
+    mpTasks->push([]() {});
+}
+
+void EventLoop::post(Task task) {
+    mpTasks->push(std::move(task));
+}
+
+void EventLoop::dispatch(Task task) {
+    if (isInLoopThread()) {
+        task();
+    } else {
+        post(std::move(task));
+    }
+}
+
+bool EventLoop::add(SOCKET s, int events, Handler handler) {
+    if (!mpPoller->add(s, events)) {
+        LOGE("%s Failed to watch socket, error code:%d\n", __PRETTY_FUNCTION__, WSAGetLastError());
+        return false;
+    }
+    mHandlers[s] = std::make_shared<Handler>(std::move(handler));
+    return true;
+}
+
+bool EventLoop::modify(SOCKET s, int events) {
+    return mpPoller->modify(s, events);
+}
+
+void EventLoop::remove(SOCKET s) {
+    mpPoller->remove(s);
+    mHandlers.erase(s);
+}
+
+TimerService::TimerId EventLoop::runAt(int64_t deadlineUs, Task task) {
+    std::weak_ptr<TaskQueue> weakTasks = mpTasks;
+    return TimerService::getInstance().schedule(deadlineUs, [weakTasks, task]() {
+        if (auto tasks = weakTasks.lock()) tasks->push(task);
+    });
+}
+
+TimerService::TimerId EventLoop::runAfter(int64_t delayUs, Task task) {
+    return runAt(timerNowUs() + delayUs, std::move(task));
+}
+
+bool EventLoop::cancel(TimerService::TimerId id) {
+    return TimerService::getInstance().cancel(id);
+}
+
+void EventLoop::runTasks() {
+    std::vector<Task> tasks;
+    {
+        std::unique_lock<std::mutex> lock(mpTasks->mutex);
+        tasks.swap(mpTasks->tasks);
+    }
+    for (auto &task : tasks) task();
+}
+
+EventLoopGroup::EventLoopGroup(int threads) : mNext(0) {
+    if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 0; i < threads; ++i) mLoops.emplace_back(std::make_unique<EventLoop>());
+    for (auto &loop : mLoops) mThreads.emplace_back(&EventLoop::run, loop.get());
+}
+
+EventLoopGroup::~EventLoopGroup() {
+    stop();
+}
+
+void EventLoopGroup::stop() {
+    for (auto &loop : mLoops) loop->stop();
+    for (auto &thread : mThreads) {
+        if (thread.joinable()) thread.join();
+    }
+}
+
+EventLoop *EventLoopGroup::next() {
+    return mLoops[mNext.fetch_add(1, std::memory_order_relaxed) % mLoops.size()].get();
+}
@@ -0,0 +1,90 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include "Socket.h"
+#include "TimerService.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Reactor on one thread: waits for socket readiness (epoll on Linux, poll/WSAPoll elsewhere,
+// level triggered) and runs the registered handlers, tasks posted from other threads and
+// timers. Timers are TimerService timers whose callback posts the task to the loop.
+//
+// add/modify/remove and the handlers run on the loop thread only, post() and the timer calls
+// are thread safe.
+class EventLoop {
+public:
+    enum {
+        EVENT_READ = 1,
+        EVENT_WRITE = 2,
+        EVENT_ERROR = 4, // reported only, hangup or socket error
+    };
+    using Handler = std::function<void(int events)>;
+    using Task = std::function<void()>;
+
+    EventLoop();
+    EventLoop(const EventLoop &) = delete;
+    EventLoop &operator=(const EventLoop &) = delete;
+    virtual ~EventLoop();
+
+    // runs on the calling thread until stop()
+    void run();
+    void stop();
+    bool isInLoopThread() const { return std::this_thread::get_id() == mThreadId.load(); }
+
+    void post(Task task);
+    // runs task right away on the loop thread, posts it otherwise
+    void dispatch(Task task);
+
+    bool add(SOCKET s, int events, Handler handler);
+    bool modify(SOCKET s, int events);
+    void remove(SOCKET s);
+
+    TimerService::TimerId runAt(int64_t deadlineUs, Task task);
+    TimerService::TimerId runAfter(int64_t delayUs, Task task);
+    bool cancel(TimerService::TimerId id);
+
+private:
+    class Poller;
+    // the task queue outlives the loop for timers that fire during destruction
+    struct TaskQueue;
+
+    std::unique_ptr<Poller> mpPoller;
+    std::shared_ptr<TaskQueue> mpTasks;
+    std::unordered_map<SOCKET, std::shared_ptr<Handler>> mHandlers;
+    std::atomic<bool> mStop;
+    std::atomic<std::thread::id> mThreadId;
+
+    void runTasks();
+};
+
+// N loops on their own threads, connections are spread round robin
+class EventLoopGroup {
+public:
+    // 0 picks the number of hardware threads
+    explicit EventLoopGroup(int threads = 0);
+    EventLoopGroup(const EventLoopGroup &) = delete;
+    EventLoopGroup &operator=(const EventLoopGroup &) = delete;
+    virtual ~EventLoopGroup();
+
+    // stops and joins every loop, their sockets and handlers are left in place
+    void stop();
+
+    EventLoop *next();
+    EventLoop *at(size_t index) { return mLoops[index].get(); }
+    size_t size() const { return mLoops.size(); }
+
+private:
+    std::vector<std::unique_ptr<EventLoop>> mLoops;
+    std::vector<std::thread> mThreads;
+    std::atomic<size_t> mNext;
+};
+
+#endif // EVENT_LOOP_H
@@ -3,6 +3,7 @@
 extern "C" {
 #include "libavcodec/packet.h"
 #include "libavutil/frame.h"
+#include "libavutil/mathematics.h"
 }
 
 AVPacketBuffer::AVPacketBuffer() {
@@ -41,6 +42,23 @@ int AVPacketBuffer::timescale() const {
     return mpPacket->time_base.den;
 }
 
+bool AVPacketBuffer::isKeyFrame() const {
+    return mpPacket->flags & AV_PKT_FLAG_KEY;
+}
+
+size_t AVPacketBuffer::byteSize() const {
+    return mpPacket->size > 0 ? mpPacket->size : 0;
+}
+
+int64_t AVPacketBuffer::timeUs() const {
+    if (mpPacket->dts == AV_NOPTS_VALUE || mpPacket->time_base.num <= 0) return QUEUE_NO_TIME;
+    return av_rescale_q(mpPacket->dts, mpPacket->time_base, {1, 1000000});
+}
+
+uint64_t AVPacketBuffer::flowId() const {
+    return (uint64_t)(uintptr_t)mpPacket->opaque;
+}
+
 AVFrameBuffer::AVFrameBuffer() {
     mpFrame = av_frame_alloc();
 }
@@ -59,4 +77,16 @@ AVFrame &AVFrameBuffer::operator*() const {
 
 AVFrame *AVFrameBuffer::operator->() {
     return mpFrame;
+}
+
+size_t AVFrameBuffer::byteSize() const {
+    size_t size = 0;
+    for (int i = 0; i < AV_NUM_DATA_POINTERS && mpFrame->buf[i]; i++) size += mpFrame->buf[i]->size;
+    for (int i = 0; i < mpFrame->nb_extended_buf; i++) size += mpFrame->extended_buf[i]->size;
+    return size;
+}
+
+int64_t AVFrameBuffer::timeUs() const {
+    if (mpFrame->pts == AV_NOPTS_VALUE || mpFrame->time_base.num <= 0) return QUEUE_NO_TIME;
+    return av_rescale_q(mpFrame->pts, mpFrame->time_base, {1, 1000000});
 }
\ No newline at end of file
@@ -1,7 +1,10 @@
 #ifndef FFBUFFER_H
 #define FFBUFFER_H
 
+#include "RingQueue.h"
+
 #include <cstdint>
+#include <memory>
 
 struct AVPacket;
 struct AVFrame;
@@ -21,6 +24,12 @@ public:
     int size() const;
     int64_t dts() const;
     int timescale() const;
+    bool isKeyFrame() const;
+    // payload bytes and dts in microseconds (QUEUE_NO_TIME without dts or time_base)
+    size_t byteSize() const;
+    int64_t timeUs() const;
+    // trace flow id stored in the packet opaque, 0 if none
+    uint64_t flowId() const;
 };
 
 class AVFrameBuffer {
@@ -34,6 +43,25 @@ public:
     AVFrame *get();
     AVFrame &operator*() const;
     AVFrame *operator->();
+    // bytes of the referenced data buffers and pts in microseconds
+    size_t byteSize() const;
+    int64_t timeUs() const;
+};
+
+template <>
+struct QueueItemTraits<std::shared_ptr<AVPacketBuffer>> {
+    static size_t bytes(const std::shared_ptr<AVPacketBuffer> &p) { return p ? p->byteSize() : 0; }
+    static int64_t timeUs(const std::shared_ptr<AVPacketBuffer> &p) {
+        return p ? p->timeUs() : QUEUE_NO_TIME;
+    }
+};
+
+template <>
+struct QueueItemTraits<std::shared_ptr<AVFrameBuffer>> {
+    static size_t bytes(const std::shared_ptr<AVFrameBuffer> &p) { return p ? p->byteSize() : 0; }
+    static int64_t timeUs(const std::shared_ptr<AVFrameBuffer> &p) {
+        return p ? p->timeUs() : QUEUE_NO_TIME;
+    }
 };
 
 #endif
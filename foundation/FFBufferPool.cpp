@@ -0,0 +1,257 @@
+#include "FFBufferPool.h"
+#include "Log.h"
+
+extern "C" {
+#include "libavcodec/packet.h"
+#include "libavutil/buffer.h"
+#include "libavutil/frame.h"
+#include "libavutil/imgutils.h"
+#include "libavutil/samplefmt.h"
+}
+
+namespace {
+
+// idle wrappers kept per type, the rest is freed
+const size_t kMaxIdleBuffers = 256;
+const int kPayloadAlign = 32;
+const int kPayloadPadding = 64;
+
+enum PayloadKind {
+    PAYLOAD_VIDEO,
+    PAYLOAD_AUDIO,
+};
+
+// recycles the shared_ptr control blocks as well, one free list per block type
+template <typename T>
+struct ControlBlockAllocator {
+    using value_type = T;
+
+    ControlBlockAllocator() = default;
+    template <typename U>
+    ControlBlockAllocator(const ControlBlockAllocator<U> &) {}
+
+    static std::mutex &freeMutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+    static std::vector<void *> &freeBlocks() {
+        static std::vector<void *> *blocks = new std::vector<void *>();
+        return *blocks;
+    }
+
+    T *allocate(size_t n) {
+        if (n == 1) {
+            std::lock_guard<std::mutex> lock(freeMutex());
+            auto &blocks = freeBlocks();
+            if (!blocks.empty()) {
+                void *p = blocks.back();
+                blocks.pop_back();
+                return static_cast<T *>(p);
+            }
+        }
+        return static_cast<T *>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t n) {
+        if (n == 1) {
+            std::lock_guard<std::mutex> lock(freeMutex());
+            auto &blocks = freeBlocks();
+            if (blocks.size() < kMaxIdleBuffers) {
+                blocks.push_back(p);
+                return;
+            }
+        }
+        ::operator delete(p);
+    }
+
+    template <typename U>
+    bool operator==(const ControlBlockAllocator<U> &) const {
+        return true;
+    }
+    template <typename U>
+    bool operator!=(const ControlBlockAllocator<U> &) const {
+        return false;
+    }
+};
+
+} // namespace
+
+FFBufferPool &FFBufferPool::getInstance() {
+    // never destroyed, buffers may be released after static destruction started
+    static FFBufferPool *pool = new FFBufferPool();
+    return *pool;
+}
+
+FFBufferPool::FFBufferPool() {
+    mPackets.items.reserve(kMaxIdleBuffers);
+    mFrames.items.reserve(kMaxIdleBuffers);
+}
+
+FFBufferPool::~FFBufferPool() {
+    for (auto p : mPackets.items) delete p;
+    for (auto p : mFrames.items) delete p;
+    // av_buffer_pool_uninit() defers the free until outstanding buffers come back
+    for (auto &[key, pool] : mPayloadPools) av_buffer_pool_uninit(&pool);
+}
+
+std::shared_ptr<AVPacketBuffer> FFBufferPool::acquirePacket() {
+    AVPacketBuffer *pPacket = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mPackets.mutex);
+        if (!mPackets.items.empty()) {
+            pPacket = mPackets.items.back();
+            mPackets.items.pop_back();
+        }
+    }
+
+    if (pPacket) {
+        mPackets.hits++;
+    } else {
+        mPackets.misses++;
+        pPacket = new AVPacketBuffer();
+    }
+    mPackets.outstanding++;
+
+    return std::shared_ptr<AVPacketBuffer>(
+        pPacket, [this](AVPacketBuffer *p) { recyclePacket(p); },
+        ControlBlockAllocator<AVPacketBuffer>());
+}
+
+std::shared_ptr<AVFrameBuffer> FFBufferPool::acquireFrame() {
+    AVFrameBuffer *pFrame = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mFrames.mutex);
+        if (!mFrames.items.empty()) {
+            pFrame = mFrames.items.back();
+            mFrames.items.pop_back();
+        }
+    }
+
+    if (pFrame) {
+        mFrames.hits++;
+    } else {
+        mFrames.misses++;
+        pFrame = new AVFrameBuffer();
+    }
+    mFrames.outstanding++;
+
+    return std::shared_ptr<AVFrameBuffer>(
+        pFrame, [this](AVFrameBuffer *p) { recycleFrame(p); },
+        ControlBlockAllocator<AVFrameBuffer>());
+}
+
+std::shared_ptr<AVFrameBuffer> FFBufferPool::acquireVideoFrame(int width, int height, int format) {
+    int size = av_image_get_buffer_size((AVPixelFormat)format, width, height, kPayloadAlign);
+    if (size < 0) {
+        LOGE("%s invalid video frame %dx%d format:%d\n", __PRETTY_FUNCTION__, width, height,
+             format);
+        return nullptr;
+    }
+
+    AVBufferPool *pPool =
+        getPayloadPool({PAYLOAD_VIDEO, width, height, format}, size + kPayloadPadding);
+    AVBufferRef *pBuf = pPool ? av_buffer_pool_get(pPool) : nullptr;
+    if (!pBuf) return nullptr;
+
+    auto pFrame = acquireFrame();
+    AVFrame *frame = pFrame->get();
+    frame->width = width;
+    frame->height = height;
+    frame->format = format;
+    frame->buf[0] = pBuf;
+    av_image_fill_arrays(frame->data, frame->linesize, pBuf->data, (AVPixelFormat)format, width,
+                         height, kPayloadAlign);
+    return pFrame;
+}
+
+std::shared_ptr<AVFrameBuffer> FFBufferPool::acquireAudioFrame(int nbSamples,
+                                                               int format,
+                                                               const AVChannelLayout *layout) {
+    int channels = layout->nb_channels;
+    // planar layouts with more planes than data[] need extended_data, leave them to ffmpeg
+    if (av_sample_fmt_is_planar((AVSampleFormat)format) && channels > AV_NUM_DATA_POINTERS) {
+        auto pFrame = acquireFrame();
+        AVFrame *frame = pFrame->get();
+        frame->nb_samples = nbSamples;
+        frame->format = format;
+        av_channel_layout_copy(&frame->ch_layout, layout);
+        if (av_frame_get_buffer(frame, 0) < 0) return nullptr;
+        return pFrame;
+    }
+
+    int linesize = 0;
+    int size = av_samples_get_buffer_size(&linesize, channels, nbSamples, (AVSampleFormat)format,
+                                          kPayloadAlign);
+    if (size < 0) {
+        LOGE("%s invalid audio frame samples:%d format:%d channels:%d\n", __PRETTY_FUNCTION__,
+             nbSamples, format, channels);
+        return nullptr;
+    }
+
+    AVBufferPool *pPool =
+        getPayloadPool({PAYLOAD_AUDIO, nbSamples, channels, format}, size + kPayloadPadding);
+    AVBufferRef *pBuf = pPool ? av_buffer_pool_get(pPool) : nullptr;
+    if (!pBuf) return nullptr;
+
+    auto pFrame = acquireFrame();
+    AVFrame *frame = pFrame->get();
+    frame->nb_samples = nbSamples;
+    frame->format = format;
+    av_channel_layout_copy(&frame->ch_layout, layout);
+    frame->buf[0] = pBuf;
+    av_samples_fill_arrays(frame->data, frame->linesize, pBuf->data, channels, nbSamples,
+                           (AVSampleFormat)format, kPayloadAlign);
+    frame->extended_data = frame->data;
+    return pFrame;
+}
+
+FFBufferPool::Stats FFBufferPool::getPacketStats() const {
+    return {mPackets.hits.load(), mPackets.misses.load(), mPackets.outstanding.load()};
+}
+
+FFBufferPool::Stats FFBufferPool::getFrameStats() const {
+    return {mFrames.hits.load(), mFrames.misses.load(), mFrames.outstanding.load()};
+}
+
+AVBufferPool *FFBufferPool::getPayloadPool(const PayloadKey &key, size_t size) {
+    std::lock_guard<std::mutex> lock(mPayloadMutex);
+    auto it = mPayloadPools.find(key);
+    if (it != mPayloadPools.end()) return it->second;
+
+    AVBufferPool *pPool = av_buffer_pool_init(size, nullptr);
+    if (!pPool) {
+        LOGE("%s failed to create buffer pool, size:%zu\n", __PRETTY_FUNCTION__, size);
+        return nullptr;
+    }
+    mPayloadPools[key] = pPool;
+    return pPool;
+}
+
+void FFBufferPool::recyclePacket(AVPacketBuffer *pPacket) {
+    av_packet_unref(pPacket->get());
+    mPackets.outstanding--;
+
+    {
+        std::lock_guard<std::mutex> lock(mPackets.mutex);
+        if (mPackets.items.size() < kMaxIdleBuffers) {
+            mPackets.items.push_back(pPacket);
+            return;
+        }
+    }
+    delete pPacket;
+}
+
+void FFBufferPool::recycleFrame(AVFrameBuffer *pFrame) {
+    // returns pooled payloads to their AVBufferPool
+    av_frame_unref(pFrame->get());
+    mFrames.outstanding--;
+
+    {
+        std::lock_guard<std::mutex> lock(mFrames.mutex);
+        if (mFrames.items.size() < kMaxIdleBuffers) {
+            mFrames.items.push_back(pFrame);
+            return;
+        }
+    }
+    delete pFrame;
+}
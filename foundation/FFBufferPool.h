@@ -0,0 +1,72 @@
+#ifndef FFBUFFER_POOL_H
+#define FFBUFFER_POOL_H
+
+#include "FFBuffer.h"
+
+#include <cstdint>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+struct AVBufferPool;
+struct AVChannelLayout;
+
+// Recycles AVPacketBuffer/AVFrameBuffer objects. The shared_ptr deleter unrefs the packet or
+// frame and puts the wrapper back on a free list, and frame payloads come from AVBufferPools
+// kept per resolution/format, so steady-state playback and recording do not touch malloc.
+class FFBufferPool {
+public:
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        int64_t outstanding;
+    };
+
+    static FFBufferPool &getInstance();
+
+    FFBufferPool(const FFBufferPool &) = delete;
+    FFBufferPool &operator=(const FFBufferPool &) = delete;
+
+    // empty packet/frame, e.g. for av_read_frame()/avcodec_receive_frame()
+    std::shared_ptr<AVPacketBuffer> acquirePacket();
+    std::shared_ptr<AVFrameBuffer> acquireFrame();
+    // frame with pooled data buffers, nullptr on failure
+    std::shared_ptr<AVFrameBuffer> acquireVideoFrame(int width, int height, int format);
+    std::shared_ptr<AVFrameBuffer> acquireAudioFrame(int nbSamples,
+                                                     int format,
+                                                     const AVChannelLayout *layout);
+
+    Stats getPacketStats() const;
+    Stats getFrameStats() const;
+
+private:
+    // kind (video/audio), width/samples, height/channels, format
+    using PayloadKey = std::tuple<int, int, int, int>;
+
+    template <typename T>
+    struct FreeList {
+        std::mutex mutex;
+        std::vector<T *> items;
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> misses{0};
+        std::atomic<int64_t> outstanding{0};
+    };
+
+    FreeList<AVPacketBuffer> mPackets;
+    FreeList<AVFrameBuffer> mFrames;
+
+    std::mutex mPayloadMutex;
+    std::map<PayloadKey, AVBufferPool *> mPayloadPools;
+
+    FFBufferPool();
+    virtual ~FFBufferPool();
+
+    AVBufferPool *getPayloadPool(const PayloadKey &key, size_t size);
+    void recyclePacket(AVPacketBuffer *pPacket);
+    void recycleFrame(AVFrameBuffer *pFrame);
+};
+
+#endif // FFBUFFER_POOL_H
@@ -1,44 +1,276 @@
 #include "Log.h"
+#include "RingQueue.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <ctime>
 #include <chrono>
+#include <memory>
 #include <mutex>
-#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
 
-#include <windows.h>
+namespace {
 
-static std::mutex logMutex;
-static char buf[100];
+const size_t LOG_RING_SIZE = 256;
+const size_t LOG_TEXT_SIZE = 480;
 
-void LOGD(const char *fmt, ...) {
-#if 1
-    std::unique_lock<std::mutex> lock(logMutex);
-    auto now = std::chrono::system_clock::now();
-    auto t = std::chrono::system_clock::to_time_t(now);
-    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch());
-    std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", std::localtime(&t));
+const char LOG_LEVEL_TAGS[] = "VDIWE";
+const char *const LOG_CATEGORY_NAMES[LOG_CAT_COUNT] = {"", "player", "render", "recorder", "rtsp"};
 
-    printf("[T%5d][%s.%03lld] ", GetCurrentThreadId(), buf, duration.count() % 1000);
-    va_list arg;
-    va_start(arg, fmt);
-    vprintf(fmt, arg);
-    va_end(arg);
-#endif
+struct LogRecord {
+    int64_t timeNs; // steady clock, taken at the call site
+    uint32_t threadId;
+    uint16_t length;
+    uint8_t level;
+    uint8_t category;
+    char text[LOG_TEXT_SIZE];
+};
+
+// one per logging thread, the thread is the only producer and the logger the only consumer
+struct LogRing {
+    explicit LogRing(uint32_t id) : threadId(id), queue(LOG_RING_SIZE) {}
+
+    uint32_t threadId;
+    SpscRingQueue<LogRecord> queue;
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<bool> closed{false};
+    uint64_t reportedDropped = 0;
+};
+
+// marks the ring closed when its thread exits, the logger drops it once drained
+struct ThreadRing {
+    std::shared_ptr<LogRing> ring;
+
+    ~ThreadRing() {
+        if (ring) ring->closed.store(true, std::memory_order_release);
+    }
+};
+
+int64_t steadyNowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+class AsyncLogger {
+public:
+    static AsyncLogger &getInstance() {
+        // never destroyed, threads may log during static destruction
+        static AsyncLogger *logger = new AsyncLogger();
+        return *logger;
+    }
+
+    AsyncLogger(const AsyncLogger &) = delete;
+    AsyncLogger &operator=(const AsyncLogger &) = delete;
+
+    void write(int level, int category, const char *fmt, va_list args) {
+        LogRing *ring = getThreadRing();
+
+        LogRecord record;
+        record.timeNs = steadyNowNs();
+        record.threadId = ring->threadId;
+        record.level = (uint8_t)level;
+        record.category = (uint8_t)category;
+        int n = std::vsnprintf(record.text, sizeof(record.text), fmt, args);
+        if (n < 0) return;
+        if ((size_t)n >= sizeof(record.text)) {
+            // truncated, keep the line break
+            n = sizeof(record.text) - 1;
+            record.text[n - 1] = '\n';
+        }
+        record.length = (uint16_t)n;
+
+        if (!ring->queue.tryPush(std::move(record))) {
+            ring->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        mEpoch.fetch_add(1);
+        if (mSleeping.load()) mEpoch.notify_one();
+    }
+
+    // drains all rings and writes the records ordered by time, returns the number written
+    size_t flush() {
+        std::unique_lock<std::mutex> drainLock(mDrainMutex);
+
+        std::vector<std::shared_ptr<LogRing>> rings;
+        {
+            std::unique_lock<std::mutex> lock(mRingsMutex);
+            rings = mRings;
+        }
+
+        mBatch.clear();
+        std::string &out = mOutput;
+        out.clear();
+        for (auto &ring : rings) {
+            bool closed = ring->closed.load(std::memory_order_acquire);
+            LogRecord record;
+            while (ring->queue.tryPop(record)) mBatch.emplace_back(std::move(record));
+
+            uint64_t dropped = ring->dropped.load(std::memory_order_relaxed);
+            if (dropped > ring->reportedDropped) {
+                char line[64];
+                std::snprintf(line, sizeof(line), "dropped %llu log records\n",
+                              (unsigned long long)(dropped - ring->reportedDropped));
+                appendLine(out, steadyNowNs(), ring->threadId, LOG_LEVEL_WARN, LOG_CAT_DEFAULT,
+                           line, std::strlen(line));
+                ring->reportedDropped = dropped;
+            }
+
+            if (closed && ring->queue.empty()) {
+                std::unique_lock<std::mutex> lock(mRingsMutex);
+                mClosedDropped += dropped;
+                mRings.erase(std::find(mRings.begin(), mRings.end(), ring));
+            }
+        }
+
+        std::stable_sort(mBatch.begin(), mBatch.end(), [](const LogRecord &a, const LogRecord &b) {
+            return a.timeNs < b.timeNs;
+        });
+        for (auto &record : mBatch) {
+            appendLine(out, record.timeNs, record.threadId, record.level, record.category,
+                       record.text, record.length);
+        }
+
+        if (!out.empty()) {
+            std::fwrite(out.data(), 1, out.size(), stdout);
+            std::fflush(stdout);
+        }
+        return mBatch.size();
+    }
+
+    uint64_t droppedCount() {
+        uint64_t dropped = 0;
+        std::unique_lock<std::mutex> lock(mRingsMutex);
+        for (auto &ring : mRings) dropped += ring->dropped.load(std::memory_order_relaxed);
+        return dropped + mClosedDropped;
+    }
+
+    void stop() { mStop.store(true); }
+
+private:
+    std::mutex mRingsMutex;
+    std::vector<std::shared_ptr<LogRing>> mRings;
+    uint64_t mClosedDropped;
+    std::atomic<uint32_t> mNextThreadId;
+
+    // wakes the writer thread, it only sleeps when every ring was empty
+    std::atomic<uint32_t> mEpoch;
+    std::atomic<bool> mSleeping;
+    std::atomic<bool> mStop;
+
+    std::mutex mDrainMutex;
+    std::vector<LogRecord> mBatch;
+    std::string mOutput;
+    int64_t mWallOffsetNs;
+    int64_t mCachedSecond;
+    char mCachedTime[32];
+
+    AsyncLogger()
+        : mClosedDropped(0), mNextThreadId(1), mEpoch(0), mSleeping(false), mStop(false),
+          mCachedSecond(-1) {
+        mWallOffsetNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::system_clock::now().time_since_epoch())
+                            .count() -
+                        steadyNowNs();
+        mCachedTime[0] = '\0';
+
+        std::thread(&AsyncLogger::run, this).detach();
+        std::atexit([] {
+            AsyncLogger &logger = AsyncLogger::getInstance();
+            logger.stop();
+            logger.flush();
+        });
+    }
+    virtual ~AsyncLogger() {}
+
+    LogRing *getThreadRing() {
+        thread_local ThreadRing holder;
+        if (!holder.ring) {
+            holder.ring = std::make_shared<LogRing>(mNextThreadId.fetch_add(1));
+            std::unique_lock<std::mutex> lock(mRingsMutex);
+            mRings.push_back(holder.ring);
+        }
+        return holder.ring.get();
+    }
+
+    void appendLine(std::string &out,
+                    int64_t timeNs,
+                    uint32_t threadId,
+                    int level,
+                    int category,
+                    const char *text,
+                    size_t length) {
+        int64_t wallNs = timeNs + mWallOffsetNs;
+        int64_t second = wallNs / 1000000000;
+        if (second != mCachedSecond) {
+            std::time_t t = (std::time_t)second;
+            std::strftime(mCachedTime, sizeof(mCachedTime), "%Y-%m-%d %H:%M:%S",
+                          std::localtime(&t));
+            mCachedSecond = second;
+        }
+
+        char prefix[96];
+        int n = std::snprintf(prefix, sizeof(prefix), "[T%5u][%s.%03lld][%c]%s%s%s ", threadId,
+                              mCachedTime, (long long)(wallNs / 1000000 % 1000),
+                              LOG_LEVEL_TAGS[level], category ? "[" : "",
+                              LOG_CATEGORY_NAMES[category], category ? "]" : "");
+        out.append(prefix, n);
+        out.append(text, length);
+    }
+
+    void run() {
+        while (!mStop.load()) {
+            uint32_t epoch = mEpoch.load();
+            if (flush() > 0) continue;
+
+            mSleeping.store(true);
+            if (mEpoch.load() == epoch && !mStop.load()) mEpoch.wait(epoch);
+            mSleeping.store(false);
+        }
+    }
+};
+
+} // namespace
+
+std::atomic<int> gLogLevels[LOG_CAT_COUNT] = {LOG_LEVEL_DEBUG, LOG_LEVEL_DEBUG, LOG_LEVEL_DEBUG,
+                                              LOG_LEVEL_DEBUG, LOG_LEVEL_DEBUG};
+
+void logSetLevel(LogLevel level) {
+    for (auto &categoryLevel : gLogLevels) categoryLevel.store(level, std::memory_order_relaxed);
 }
 
-void LOGE(const char *fmt, ...) {
-#if 1
-    std::unique_lock<std::mutex> lock(logMutex);
-    auto now = std::chrono::system_clock::now();
-    auto t = std::chrono::system_clock::to_time_t(now);
-    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch());
-    std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", std::localtime(&t));
+void logSetLevel(LogCategory category, LogLevel level) {
+    gLogLevels[category].store(level, std::memory_order_relaxed);
+}
+
+bool logRateLimit(std::atomic<int64_t> &lastNs, int64_t intervalMs) {
+    int64_t now = steadyNowNs();
+    int64_t last = lastNs.load(std::memory_order_relaxed);
+    if (last != INT64_MIN && now - last < intervalMs * 1000000) return false;
+    // one thread wins when several hit the same call site
+    return lastNs.compare_exchange_strong(last, now, std::memory_order_relaxed);
+}
+
+void logPrint(int level, int category, const char *fmt, ...) {
+    if (level < LOG_LEVEL_VERBOSE || level >= LOG_LEVEL_NONE) return;
+    if (category < 0 || category >= LOG_CAT_COUNT) category = LOG_CAT_DEFAULT;
 
-    printf("[T%5d][%s.%03lld] ", GetCurrentThreadId(), buf, duration.count() % 1000);
     va_list arg;
     va_start(arg, fmt);
-    vprintf(fmt, arg);
+    AsyncLogger::getInstance().write(level, category, fmt, arg);
     va_end(arg);
-#endif
+}
+
+void logFlush() {
+    AsyncLogger::getInstance().flush();
+}
+
+uint64_t logDroppedCount() {
+    return AsyncLogger::getInstance().droppedCount();
 }
@@ -1,11 +1,91 @@
 #ifndef LOG_H
 #define LOG_H
 
+#include <atomic>
+#include <cstdint>
+
 #if defined(_MSC_VER)
 #    define __PRETTY_FUNCTION__ __FUNCSIG__
 #endif
 
-void LOGD(const char *fmt, ...);
-void LOGE(const char *fmt, ...);
+enum LogLevel {
+    LOG_LEVEL_VERBOSE = 0,
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_NONE,
+};
+
+enum LogCategory {
+    LOG_CAT_DEFAULT = 0,
+    LOG_CAT_PLAYER,
+    LOG_CAT_RENDER,
+    LOG_CAT_RECORDER,
+    LOG_CAT_RTSP,
+    LOG_CAT_COUNT,
+};
+
+// calls below this level are compiled out, their arguments are never evaluated
+#ifndef LOG_COMPILE_LEVEL
+#    define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+// runtime level per category, defaults to LOG_LEVEL_DEBUG
+extern std::atomic<int> gLogLevels[LOG_CAT_COUNT];
+
+inline bool logEnabled(int level, int category) {
+    return level >= gLogLevels[category].load(std::memory_order_relaxed);
+}
+
+void logSetLevel(LogLevel level);
+void logSetLevel(LogCategory category, LogLevel level);
+
+// true at most once per intervalMs for the call site owning lastNs
+bool logRateLimit(std::atomic<int64_t> &lastNs, int64_t intervalMs);
+
+// The calling thread only renders the message into a record of its own ring (no lock, no I/O),
+// a background thread timestamps, formats and writes the records in batches.
+void logPrint(int level, int category, const char *fmt, ...);
+
+// writes everything queued so far, also runs at exit
+void logFlush();
+// records lost because the ring of the logging thread was full
+uint64_t logDroppedCount();
+
+#define LOG_PRINT(level, category, fmt, ...)                                                       \
+    do {                                                                                           \
+        if constexpr ((level) >= LOG_COMPILE_LEVEL) {                                              \
+            if (logEnabled((level), (category)))                                                   \
+                logPrint((level), (category), fmt, ##__VA_ARGS__);                                 \
+        }                                                                                          \
+    } while (0)
+
+// logs the 1st, (n+1)th, (2n+1)th ... enabled call of this call site
+#define LOG_EVERY_N(level, category, n, fmt, ...)                                                  \
+    do {                                                                                           \
+        if constexpr ((level) >= LOG_COMPILE_LEVEL) {                                              \
+            static std::atomic<uint32_t> logCount{0};                                              \
+            if (logEnabled((level), (category)) &&                                                 \
+                logCount.fetch_add(1, std::memory_order_relaxed) % (n) == 0)                       \
+                logPrint((level), (category), fmt, ##__VA_ARGS__);                                 \
+        }                                                                                          \
+    } while (0)
+
+// logs this call site at most once per ms milliseconds
+#define LOG_EVERY_MS(level, category, ms, fmt, ...)                                                \
+    do {                                                                                           \
+        if constexpr ((level) >= LOG_COMPILE_LEVEL) {                                              \
+            static std::atomic<int64_t> logLastNs{INT64_MIN};                                      \
+            if (logEnabled((level), (category)) && logRateLimit(logLastNs, (ms)))                  \
+                logPrint((level), (category), fmt, ##__VA_ARGS__);                                 \
+        }                                                                                          \
+    } while (0)
+
+#define LOGV(fmt, ...) LOG_PRINT(LOG_LEVEL_VERBOSE, LOG_CAT_DEFAULT, fmt, ##__VA_ARGS__)
+#define LOGD(fmt, ...) LOG_PRINT(LOG_LEVEL_DEBUG, LOG_CAT_DEFAULT, fmt, ##__VA_ARGS__)
+#define LOGI(fmt, ...) LOG_PRINT(LOG_LEVEL_INFO, LOG_CAT_DEFAULT, fmt, ##__VA_ARGS__)
+#define LOGW(fmt, ...) LOG_PRINT(LOG_LEVEL_WARN, LOG_CAT_DEFAULT, fmt, ##__VA_ARGS__)
+#define LOGE(fmt, ...) LOG_PRINT(LOG_LEVEL_ERROR, LOG_CAT_DEFAULT, fmt, ##__VA_ARGS__)
 
 #endif // LOG_H
@@ -0,0 +1,213 @@
+#include "Metrics.h"
+#include "Log.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <filesystem>
+
+MetricHistogram::MetricHistogram() : mCount(0), mSum(0), mMax(0) {
+    for (auto &bucket : mBuckets) bucket.store(0, std::memory_order_relaxed);
+}
+
+int MetricHistogram::bucketIndex(uint64_t value) {
+    if (value < SUB_BUCKETS) return (int)value;
+    int exponent = std::bit_width(value) - 1;
+    int sub = (int)((value >> (exponent - SUB_BITS)) & (SUB_BUCKETS - 1));
+    return (exponent - SUB_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+int64_t MetricHistogram::bucketHighest(int index) {
+    if (index < SUB_BUCKETS) return index;
+    int shift = index / SUB_BUCKETS - 1;
+    uint64_t lowest = (uint64_t)(SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+    return (int64_t)(lowest + (1ull << shift) - 1);
+}
+
+void MetricHistogram::record(int64_t value) {
+    if (value < 0) value = 0;
+    mBuckets[bucketIndex((uint64_t)value)].fetch_add(1, std::memory_order_relaxed);
+    mSum.fetch_add(value, std::memory_order_relaxed);
+    int64_t max = mMax.load(std::memory_order_relaxed);
+    while (value > max && !mMax.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+    }
+    // counted last, a concurrent reader sees at most count() samples in the buckets
+    mCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+double MetricHistogram::mean() const {
+    uint64_t n = count();
+    return n ? (double)sum() / n : 0.0;
+}
+
+int64_t MetricHistogram::percentile(double p) const {
+    uint64_t n = count();
+    if (n == 0) return 0;
+
+    p = std::clamp(p, 0.0, 100.0);
+    uint64_t rank = std::max<uint64_t>((uint64_t)(p / 100.0 * n + 0.5), 1);
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; ++i) {
+        seen += mBuckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank) return std::min(bucketHighest(i), max());
+    }
+    return max();
+}
+
+MetricsRegistry &MetricsRegistry::getInstance() {
+    // never destroyed, metrics are updated until the very end
+    static MetricsRegistry *registry = new MetricsRegistry();
+    return *registry;
+}
+
+MetricsRegistry::MetricsRegistry() : mDumpStop(false) {}
+
+MetricsRegistry::~MetricsRegistry() {
+    stopPeriodicDump();
+}
+
+MetricCounter &MetricsRegistry::counter(const std::string &name) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    auto &metric = mCounters[name];
+    if (!metric) metric = std::make_unique<MetricCounter>();
+    return *metric;
+}
+
+MetricGauge &MetricsRegistry::gauge(const std::string &name) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    auto &metric = mGauges[name];
+    if (!metric) metric = std::make_unique<MetricGauge>();
+    return *metric;
+}
+
+MetricHistogram &MetricsRegistry::histogram(const std::string &name) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    auto &metric = mHistograms[name];
+    if (!metric) metric = std::make_unique<MetricHistogram>();
+    return *metric;
+}
+
+std::string MetricsRegistry::dumpText(const std::string &prefix) {
+    std::string out;
+    char line[256];
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    for (auto &[name, metric] : mCounters) {
+        if (!name.starts_with(prefix)) continue;
+        std::snprintf(line, sizeof(line), "%s %" PRIu64 "\n", name.c_str(), metric->value());
+        out += line;
+    }
+    for (auto &[name, metric] : mGauges) {
+        if (!name.starts_with(prefix)) continue;
+        std::snprintf(line, sizeof(line), "%s %" PRId64 "\n", name.c_str(), metric->value());
+        out += line;
+    }
+    for (auto &[name, metric] : mHistograms) {
+        if (!name.starts_with(prefix)) continue;
+        std::snprintf(line, sizeof(line),
+                      "%s count=%" PRIu64 " mean=%.1f p50=%" PRId64 " p90=%" PRId64
+                      " p99=%" PRId64 " max=%" PRId64 "\n",
+                      name.c_str(), metric->count(), metric->mean(), metric->percentile(50),
+                      metric->percentile(90), metric->percentile(99), metric->max());
+        out += line;
+    }
+    return out;
+}
+
+std::string MetricsRegistry::dumpJson(const std::string &prefix) {
+    std::string out = "{\"counters\":{";
+    char field[256];
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    const char *separator = "";
+    for (auto &[name, metric] : mCounters) {
+        if (!name.starts_with(prefix)) continue;
+        std::snprintf(field, sizeof(field), "%s\"%s\":%" PRIu64, separator, name.c_str(),
+                      metric->value());
+        out += field;
+        separator = ",";
+    }
+    out += "},\"gauges\":{";
+    separator = "";
+    for (auto &[name, metric] : mGauges) {
+        if (!name.starts_with(prefix)) continue;
+        std::snprintf(field, sizeof(field), "%s\"%s\":%" PRId64, separator, name.c_str(),
+                      metric->value());
+        out += field;
+        separator = ",";
+    }
+    out += "},\"histograms\":{";
+    separator = "";
+    for (auto &[name, metric] : mHistograms) {
+        if (!name.starts_with(prefix)) continue;
+        std::snprintf(field, sizeof(field),
+                      "%s\"%s\":{\"count\":%" PRIu64 ",\"mean\":%.1f,\"p50\":%" PRId64
+                      ",\"p90\":%" PRId64 ",\"p99\":%" PRId64 ",\"max\":%" PRId64 "}",
+                      separator, name.c_str(), metric->count(), metric->mean(),
+                      metric->percentile(50), metric->percentile(90), metric->percentile(99),
+                      metric->max());
+        out += field;
+        separator = ",";
+    }
+    out += "}}\n";
+    return out;
+}
+
+void MetricsRegistry::startPeriodicDump(int64_t intervalMs, const std::string &path) {
+    stopPeriodicDump();
+    if (intervalMs <= 0) return;
+
+    mDumpStop = false;
+    mDumpThread =
+        std::make_unique<std::thread>(&MetricsRegistry::dumpThread, this, intervalMs, path);
+}
+
+void MetricsRegistry::stopPeriodicDump() {
+    if (!mDumpThread) return;
+    {
+        std::unique_lock<std::mutex> lock(mDumpMutex);
+        mDumpStop = true;
+    }
+    mDumpCv.notify_all();
+    if (mDumpThread->joinable()) mDumpThread->join();
+    mDumpThread.reset();
+}
+
+void MetricsRegistry::dumpThread(int64_t intervalMs, std::string path) {
+    auto deadline = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(mDumpMutex);
+    while (true) {
+        deadline += std::chrono::milliseconds(intervalMs);
+        if (mDumpCv.wait_until(lock, deadline, [this]() { return mDumpStop; })) break;
+
+        lock.unlock();
+        if (path.empty()) {
+            // a line per record, a log record holds a few hundred characters only
+            std::string text = dumpText();
+            size_t begin = 0;
+            while (begin < text.size()) {
+                size_t end = text.find('\n', begin);
+                LOGI("metric %.*s\n", (int)(end - begin), text.c_str() + begin);
+                begin = end + 1;
+            }
+        } else if (!writeFile(path, dumpJson())) {
+            LOGE("%s failed to write %s\n", __PRETTY_FUNCTION__, path.c_str());
+        }
+        lock.lock();
+    }
+}
+
+bool MetricsRegistry::writeFile(const std::string &path, const std::string &content) {
+    std::string tmpPath = path + ".tmp";
+    FILE *file = std::fopen(tmpPath.c_str(), "wb");
+    if (!file) return false;
+    bool ok = std::fwrite(content.data(), 1, content.size(), file) == content.size();
+    ok = std::fclose(file) == 0 && ok;
+    if (!ok) return false;
+
+    std::error_code ec;
+    std::filesystem::rename(tmpPath, path, ec);
+    return !ec;
+}
@@ -0,0 +1,120 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class MetricCounter {
+public:
+    MetricCounter() : mValue(0) {}
+    MetricCounter(const MetricCounter &) = delete;
+    MetricCounter &operator=(const MetricCounter &) = delete;
+
+    void add(uint64_t n = 1) { mValue.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t value() const { return mValue.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> mValue;
+};
+
+class MetricGauge {
+public:
+    MetricGauge() : mValue(0) {}
+    MetricGauge(const MetricGauge &) = delete;
+    MetricGauge &operator=(const MetricGauge &) = delete;
+
+    void set(int64_t value) { mValue.store(value, std::memory_order_relaxed); }
+    void add(int64_t n) { mValue.fetch_add(n, std::memory_order_relaxed); }
+    // keeps the larger value, for high-water marks
+    void setMax(int64_t value) {
+        int64_t current = mValue.load(std::memory_order_relaxed);
+        while (value > current &&
+               !mValue.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+        }
+    }
+    int64_t value() const { return mValue.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> mValue;
+};
+
+// Log-linear histogram in the style of HdrHistogram: values below 16 have a bucket each, above
+// that every power of two is split into 16 buckets, so a percentile is off by at most 1/16.
+// Negative values count as 0. Recording is a handful of relaxed atomics.
+class MetricHistogram {
+public:
+    MetricHistogram();
+    MetricHistogram(const MetricHistogram &) = delete;
+    MetricHistogram &operator=(const MetricHistogram &) = delete;
+
+    void record(int64_t value);
+
+    uint64_t count() const { return mCount.load(std::memory_order_relaxed); }
+    int64_t sum() const { return mSum.load(std::memory_order_relaxed); }
+    int64_t max() const { return mMax.load(std::memory_order_relaxed); }
+    double mean() const;
+    // highest value of the bucket holding the p-th percentile (0..100), 0 when empty
+    int64_t percentile(double p) const;
+
+private:
+    static const int SUB_BITS = 4;
+    static const int SUB_BUCKETS = 1 << SUB_BITS;
+    static const int BUCKETS = (64 - SUB_BITS) * SUB_BUCKETS;
+
+    std::atomic<uint64_t> mBuckets[BUCKETS];
+    std::atomic<uint64_t> mCount;
+    std::atomic<int64_t> mSum;
+    std::atomic<int64_t> mMax;
+
+    static int bucketIndex(uint64_t value);
+    static int64_t bucketHighest(int index);
+};
+
+// Process-wide named metrics. Lookups take a lock, call sites keep the returned reference
+// (metrics are never removed), e.g.
+//     static MetricCounter &sent = MetricsRegistry::getInstance().counter("rtsp.rtp_sent");
+class MetricsRegistry {
+public:
+    static MetricsRegistry &getInstance();
+
+    MetricsRegistry(const MetricsRegistry &) = delete;
+    MetricsRegistry &operator=(const MetricsRegistry &) = delete;
+
+    MetricCounter &counter(const std::string &name);
+    MetricGauge &gauge(const std::string &name);
+    MetricHistogram &histogram(const std::string &name);
+
+    // one metric per line, sorted by name, only names starting with prefix
+    std::string dumpText(const std::string &prefix = "");
+    std::string dumpJson(const std::string &prefix = "");
+
+    // dumps every intervalMs to the log, or as JSON to path (replaced atomically, so a scraper
+    // never reads a partial file)
+    void startPeriodicDump(int64_t intervalMs, const std::string &path = "");
+    void stopPeriodicDump();
+
+private:
+    std::mutex mMutex;
+    std::map<std::string, std::unique_ptr<MetricCounter>> mCounters;
+    std::map<std::string, std::unique_ptr<MetricGauge>> mGauges;
+    std::map<std::string, std::unique_ptr<MetricHistogram>> mHistograms;
+
+    std::mutex mDumpMutex;
+    std::condition_variable mDumpCv;
+    bool mDumpStop;
+    std::unique_ptr<std::thread> mDumpThread;
+
+    MetricsRegistry();
+    virtual ~MetricsRegistry();
+
+    void dumpThread(int64_t intervalMs, std::string path);
+    bool writeFile(const std::string &path, const std::string &content);
+};
+
+#endif // METRICS_H
@@ -1,18 +1,129 @@
 #include "PacketBuffer.h"
 
-PacketBuffer::PacketBuffer(size_t capacity) {
-    mRangeOffset = 0;
-    mData = new uint8_t[capacity];
-    if (mData == nullptr) {
-        mCapacity = 0;
-        mRangeLength = 0;
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace {
+
+// size classes 256 bytes .. 4MB, larger slabs bypass the free lists
+const int kMinSlabShift = 8;
+const int kSizeClasses = 15;
+// idle bytes kept per size class
+const size_t kMaxIdleBytes = 8 * 1024 * 1024;
+
+const int kSlabDirect = -1;
+const int kSlabAdopted = -2;
+
+struct SlabFreeList {
+    std::mutex mutex;
+    std::vector<PacketBuffer::Slab *> slabs;
+};
+
+SlabFreeList *getFreeLists() {
+    // never destroyed, buffers may be released during static destruction
+    static SlabFreeList *freeLists = new SlabFreeList[kSizeClasses];
+    return freeLists;
+}
+
+int getSizeClass(size_t capacity) {
+    for (int i = 0; i < kSizeClasses; i++) {
+        if (capacity <= ((size_t)1 << (kMinSlabShift + i))) return i;
+    }
+    return kSlabDirect;
+}
+
+size_t getClassSize(int sizeClass) {
+    return (size_t)1 << (kMinSlabShift + sizeClass);
+}
+
+} // namespace
+
+struct PacketBuffer::Slab {
+    std::atomic<int> refs;
+    int sizeClass;
+    uint8_t *data;
+};
+
+static PacketBuffer::Slab *createSlab(int sizeClass, size_t size) {
+    // header and payload in one allocation
+    void *p = ::operator new(sizeof(PacketBuffer::Slab) + size);
+    PacketBuffer::Slab *slab = new (p) PacketBuffer::Slab();
+    slab->sizeClass = sizeClass;
+    slab->data = (uint8_t *)(slab + 1);
+    return slab;
+}
+
+static void destroySlab(PacketBuffer::Slab *slab) {
+    if (slab->sizeClass == kSlabAdopted) {
+        delete[] slab->data;
+        delete slab;
+        return;
+    }
+    slab->~Slab();
+    ::operator delete(slab);
+}
+
+static PacketBuffer::Slab *acquireSlab(size_t capacity) {
+    PacketBuffer::Slab *slab = nullptr;
+    int sizeClass = getSizeClass(capacity);
+    if (sizeClass == kSlabDirect) {
+        slab = createSlab(kSlabDirect, capacity);
     } else {
-        mCapacity = capacity;
-        mRangeLength = capacity;
+        SlabFreeList &freeList = getFreeLists()[sizeClass];
+        {
+            std::lock_guard<std::mutex> lock(freeList.mutex);
+            if (!freeList.slabs.empty()) {
+                slab = freeList.slabs.back();
+                freeList.slabs.pop_back();
+            }
+        }
+        if (!slab) slab = createSlab(sizeClass, getClassSize(sizeClass));
+    }
+    slab->refs.store(1, std::memory_order_relaxed);
+    return slab;
+}
+
+static void releaseSlab(PacketBuffer::Slab *slab) {
+    if (slab->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+
+    if (slab->sizeClass >= 0) {
+        SlabFreeList &freeList = getFreeLists()[slab->sizeClass];
+        size_t maxIdle = kMaxIdleBytes / getClassSize(slab->sizeClass);
+        if (maxIdle < 2) maxIdle = 2;
+
+        std::lock_guard<std::mutex> lock(freeList.mutex);
+        if (freeList.slabs.size() < maxIdle) {
+            freeList.slabs.push_back(slab);
+            return;
+        }
     }
+    destroySlab(slab);
+}
+
+PacketBuffer::PacketBuffer(size_t capacity) {
+    mSlab = acquireSlab(capacity);
+    mData = mSlab->data;
+    mCapacity = capacity;
+    mRangeOffset = 0;
+    mRangeLength = capacity;
 }
 
 PacketBuffer::PacketBuffer(void *data, size_t capacity) {
+    mSlab = new Slab();
+    mSlab->refs.store(1, std::memory_order_relaxed);
+    mSlab->sizeClass = kSlabAdopted;
+    mSlab->data = (uint8_t *)data;
+    mData = mSlab->data;
+    mCapacity = capacity;
+    mRangeOffset = 0;
+    mRangeLength = capacity;
+}
+
+PacketBuffer::PacketBuffer(Slab *slab, uint8_t *data, size_t capacity) {
+    mSlab = slab;
+    mSlab->refs.fetch_add(1, std::memory_order_relaxed);
     mData = data;
     mCapacity = capacity;
     mRangeOffset = 0;
@@ -20,9 +131,9 @@ PacketBuffer::PacketBuffer(void *data, size_t capacity) {
 }
 
 PacketBuffer::~PacketBuffer() {
-    if (mData != nullptr) {
-        delete[] (uint8_t *)mData;
-        mData = nullptr;
+    if (mSlab != nullptr) {
+        releaseSlab(mSlab);
+        mSlab = nullptr;
     }
 }
 
@@ -32,3 +143,8 @@ void PacketBuffer::setRange(size_t offset, size_t size) {
     mRangeOffset = offset;
     mRangeLength = size;
 }
+
+std::shared_ptr<PacketBuffer> PacketBuffer::slice(size_t offset, size_t length) {
+    if (offset > mRangeLength || length > mRangeLength - offset) return nullptr;
+    return std::shared_ptr<PacketBuffer>(new PacketBuffer(mSlab, data() + offset, length));
+}
@@ -1,26 +1,40 @@
 #ifndef PACKET_BUFFER_H
 #define PACKET_BUFFER_H
 
+#include <cstddef>
 #include <cstdint>
+#include <memory>
 
+// Byte buffer backed by a ref-counted slab. Slabs come from size-classed free lists and go back
+// there when the last buffer referencing them is released, slice() hands out views that share
+// the slab instead of copying.
 class PacketBuffer {
 public:
     explicit PacketBuffer(size_t capacity);
+    // takes ownership of data allocated with new uint8_t[]
     PacketBuffer(void *data, size_t capacity);
     PacketBuffer(const PacketBuffer &) = delete;
     PacketBuffer &operator=(const PacketBuffer &) = delete;
     virtual ~PacketBuffer();
 
-    uint8_t *base() { return (uint8_t *)mData; }
-    uint8_t *data() { return (uint8_t *)mData + mRangeOffset; }
+    uint8_t *base() { return mData; }
+    uint8_t *data() { return mData + mRangeOffset; }
     size_t capacity() const { return mCapacity; }
     size_t size() const { return mRangeLength; }
     size_t offset() const { return mRangeOffset; }
 
     void setRange(size_t offset, size_t size);
 
+    // view of [offset, offset + length) relative to the current range, nullptr when out of range
+    std::shared_ptr<PacketBuffer> slice(size_t offset, size_t length);
+
+    struct Slab;
+
 private:
-    void *mData;
+    PacketBuffer(Slab *slab, uint8_t *data, size_t capacity);
+
+    Slab *mSlab;
+    uint8_t *mData;
     size_t mCapacity;
     size_t mRangeOffset;
     size_t mRangeLength;
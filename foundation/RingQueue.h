@@ -0,0 +1,331 @@
+#ifndef RING_QUEUE_H
+#define RING_QUEUE_H
+
+#include "Metrics.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+
+const int64_t QUEUE_NO_TIME = INT64_MIN;
+
+// Limits of a RingQueue. maxCount sizes the preallocated ring, maxBytes and maxDurationUs (0 means
+// unbounded) budget memory and latency directly. A queue always accepts one item when empty.
+struct QueueLimits {
+    size_t maxCount = 10;
+    size_t maxBytes = 0;
+    int64_t maxDurationUs = 0;
+};
+
+// Byte size and presentation time (microseconds) of a queued item, used by the byte and duration
+// bounds. Specialize next to the media buffer types.
+template <typename T>
+struct QueueItemTraits {
+    static size_t bytes(const T &) { return 0; }
+    static int64_t timeUs(const T &) { return QUEUE_NO_TIME; }
+};
+
+// Bounded lock-free ring queue with preallocated slots (Vyukov style per-slot sequence numbers).
+// Single consumer, single or multiple producers. Items are moved in and out, and a thread only
+// blocks (C++20 atomic wait) while the ring is full or empty.
+//
+// Besides the slot count the queue can be bounded by total bytes and by the time span between
+// the newest pushed and the last popped item (one item granularity).
+//
+// abort()/init() follow CountingQueue: abort() drops what is queued, wakes every waiter and makes
+// push/pop fail, init() drops whatever a racing push still got in and re-arms the queue. The pop
+// end claims slots with a compare and swap, so both may drain from any thread.
+//
+// A queue constructed with a name also records into the MetricsRegistry: queue.<name>.push_wait_us
+// and pop_wait_us (time blocked in push()/pop(), 0 when an item or slot was ready), residence_us
+// (push to pop of every item) and high_water (largest item count). Queues sharing a name share
+// the metrics, MetricsRegistry::dumpText("queue.") dumps them.
+template <typename T, bool MultiProducer>
+class RingQueue {
+private:
+    struct Slot {
+        std::atomic<size_t> seq;
+        size_t bytes;
+        int64_t pushUs; // telemetry only
+        T value;
+    };
+
+    struct Telemetry {
+        MetricHistogram &pushWaitUs;
+        MetricHistogram &popWaitUs;
+        MetricHistogram &residenceUs;
+        MetricGauge &highWater;
+    };
+
+    // keep producer and consumer indexes on different cache lines
+    alignas(64) std::atomic<size_t> mTail;
+    alignas(64) std::atomic<size_t> mHead;
+
+    alignas(64) std::atomic<uint32_t> mPushEpoch;
+    std::atomic<uint32_t> mPopWaiters;
+    alignas(64) std::atomic<uint32_t> mPopEpoch;
+    std::atomic<uint32_t> mPushWaiters;
+
+    std::atomic<bool> mAbort;
+
+    std::atomic<size_t> mMaxBytes;
+    std::atomic<int64_t> mMaxDurationUs;
+    std::atomic<int64_t> mBytes;
+    std::atomic<int64_t> mLastPushTimeUs;
+    std::atomic<int64_t> mLastPopTimeUs;
+
+    size_t mCapacity;
+    size_t mMask;
+    std::unique_ptr<Slot[]> mpSlots;
+    // null unless the queue was given a name
+    std::unique_ptr<Telemetry> mpTelemetry;
+
+    static int64_t nowUs() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    // waiters counts threads that may sleep since the last wake. The waker clears it, so a run of
+    // pushes (or pops) wakes a sleeper once instead of once per item while it is being scheduled.
+    static void signal(std::atomic<uint32_t> &epoch, std::atomic<uint32_t> &waiters) {
+        epoch.fetch_add(1);
+        if (waiters.load() > 0 && waiters.exchange(0) > 0) epoch.notify_all();
+    }
+
+    // a count left behind by a wait that returned at once only costs one spare wake
+    static void waitFor(std::atomic<uint32_t> &epoch,
+                        std::atomic<uint32_t> &waiters,
+                        uint32_t observed) {
+        waiters.fetch_add(1);
+        epoch.wait(observed);
+    }
+
+    bool overBudget() const {
+        if (size() == 0) return false;
+
+        size_t maxBytes = mMaxBytes.load(std::memory_order_relaxed);
+        if (maxBytes > 0 && mBytes.load(std::memory_order_relaxed) >= (int64_t)maxBytes)
+            return true;
+
+        int64_t maxDurationUs = mMaxDurationUs.load(std::memory_order_relaxed);
+        return maxDurationUs > 0 && durationUs() >= maxDurationUs;
+    }
+
+public:
+    // maxCount is rounded up to a power of two
+    explicit RingQueue(size_t maxCount) : RingQueue(QueueLimits{maxCount}) {}
+
+    explicit RingQueue(const QueueLimits &limits) {
+        mCapacity = 2;
+        while (mCapacity < limits.maxCount) mCapacity <<= 1;
+        mMask = mCapacity - 1;
+        mpSlots = std::make_unique<Slot[]>(mCapacity);
+        for (size_t i = 0; i < mCapacity; ++i) mpSlots[i].seq.store(i, std::memory_order_relaxed);
+
+        mTail = 0;
+        mHead = 0;
+        mPushEpoch = 0;
+        mPopWaiters = 0;
+        mPopEpoch = 0;
+        mPushWaiters = 0;
+        mAbort = false;
+
+        mMaxBytes = limits.maxBytes;
+        mMaxDurationUs = limits.maxDurationUs;
+        mBytes = 0;
+        mLastPushTimeUs = QUEUE_NO_TIME;
+        mLastPopTimeUs = QUEUE_NO_TIME;
+    }
+    // an empty name disables telemetry
+    RingQueue(const QueueLimits &limits, const std::string &name) : RingQueue(limits) {
+        if (name.empty()) return;
+
+        MetricsRegistry &metrics = MetricsRegistry::getInstance();
+        std::string prefix = "queue." + name + ".";
+        mpTelemetry.reset(new Telemetry{metrics.histogram(prefix + "push_wait_us"),
+                                        metrics.histogram(prefix + "pop_wait_us"),
+                                        metrics.histogram(prefix + "residence_us"),
+                                        metrics.gauge(prefix + "high_water")});
+    }
+    RingQueue(const RingQueue &) = delete;
+    RingQueue &operator=(const RingQueue &) = delete;
+    ~RingQueue() { abort(); }
+
+    // value is left untouched when the queue is full
+    bool tryPush(T &&value) {
+        if (overBudget()) return false;
+
+        size_t pos = mTail.load(std::memory_order_relaxed);
+        Slot *slot = nullptr;
+        for (;;) {
+            slot = &mpSlots[pos & mMask];
+            size_t seq = slot->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if constexpr (MultiProducer) {
+                    if (mTail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+                } else {
+                    mTail.store(pos + 1, std::memory_order_relaxed);
+                    break;
+                }
+            } else if (diff < 0) {
+                return false; // full
+            } else {
+                pos = mTail.load(std::memory_order_relaxed);
+            }
+        }
+
+        int64_t timeUs = QueueItemTraits<T>::timeUs(value);
+        slot->bytes = QueueItemTraits<T>::bytes(value);
+        if (mpTelemetry) slot->pushUs = nowUs();
+        slot->value = std::move(value);
+        mBytes.fetch_add((int64_t)slot->bytes, std::memory_order_relaxed);
+        if (timeUs != QUEUE_NO_TIME) {
+            int64_t none = QUEUE_NO_TIME;
+            mLastPopTimeUs.compare_exchange_strong(none, timeUs, std::memory_order_relaxed);
+            mLastPushTimeUs.store(timeUs, std::memory_order_relaxed);
+        }
+        slot->seq.store(pos + 1, std::memory_order_release);
+        signal(mPushEpoch, mPopWaiters);
+        if (mpTelemetry) mpTelemetry->highWater.setMax((int64_t)size());
+        return true;
+    }
+
+    // blocks while full, returns false (and drops value) once aborted
+    bool push(T &&value) {
+        int64_t waitStartUs = -1;
+        while (true) {
+            uint32_t epoch = mPopEpoch.load();
+            if (mAbort.load(std::memory_order_acquire)) return false;
+            if (tryPush(std::move(value))) {
+                if (mpTelemetry) {
+                    mpTelemetry->pushWaitUs.record(waitStartUs < 0 ? 0 : nowUs() - waitStartUs);
+                }
+                return true;
+            }
+            if (mpTelemetry && waitStartUs < 0) waitStartUs = nowUs();
+            waitFor(mPopEpoch, mPushWaiters, epoch);
+        }
+    }
+
+    bool tryPop(T &value) {
+        // claimed with a compare and swap so abort() can drain while the consumer pops
+        size_t pos = mHead.load(std::memory_order_relaxed);
+        Slot *slot = nullptr;
+        for (;;) {
+            slot = &mpSlots[pos & mMask];
+            size_t seq = slot->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (mHead.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false; // empty
+            } else {
+                pos = mHead.load(std::memory_order_relaxed);
+            }
+        }
+
+        value = std::move(slot->value);
+        if (mpTelemetry) mpTelemetry->residenceUs.record(nowUs() - slot->pushUs);
+        mBytes.fetch_sub((int64_t)slot->bytes, std::memory_order_relaxed);
+        int64_t timeUs = QueueItemTraits<T>::timeUs(value);
+        if (timeUs != QUEUE_NO_TIME) mLastPopTimeUs.store(timeUs, std::memory_order_relaxed);
+        slot->seq.store(pos + mCapacity, std::memory_order_release);
+        signal(mPopEpoch, mPushWaiters);
+        return true;
+    }
+
+    // blocks while empty, returns false once aborted
+    bool pop(T &value) {
+        int64_t waitStartUs = -1;
+        while (true) {
+            uint32_t epoch = mPushEpoch.load();
+            if (mAbort.load(std::memory_order_acquire)) return false;
+            if (tryPop(value)) {
+                if (mpTelemetry) {
+                    mpTelemetry->popWaitUs.record(waitStartUs < 0 ? 0 : nowUs() - waitStartUs);
+                }
+                return true;
+            }
+            if (mpTelemetry && waitStartUs < 0) waitStartUs = nowUs();
+            waitFor(mPushEpoch, mPopWaiters, epoch);
+        }
+    }
+
+    // blocks until at least one item is available, then pops up to maxCount items
+    size_t popN(T *values, size_t maxCount) {
+        if (maxCount == 0 || !pop(values[0])) return 0;
+
+        size_t count = 1;
+        while (count < maxCount && tryPop(values[count])) ++count;
+        return count;
+    }
+
+    bool empty() const { return size() == 0; }
+
+    size_t size() const {
+        size_t head = mHead.load(std::memory_order_acquire);
+        size_t tail = mTail.load(std::memory_order_acquire);
+        return tail > head ? tail - head : 0;
+    }
+
+    size_t capacity() const { return mCapacity; }
+
+    // total bytes of the queued items
+    size_t bytes() const {
+        int64_t bytes = mBytes.load(std::memory_order_relaxed);
+        return bytes > 0 ? (size_t)bytes : 0;
+    }
+
+    // time span of the queued items in microseconds
+    int64_t durationUs() const {
+        int64_t pushTimeUs = mLastPushTimeUs.load(std::memory_order_relaxed);
+        int64_t popTimeUs = mLastPopTimeUs.load(std::memory_order_relaxed);
+        if (pushTimeUs == QUEUE_NO_TIME || popTimeUs == QUEUE_NO_TIME || size() == 0) return 0;
+        return pushTimeUs > popTimeUs ? pushTimeUs - popTimeUs : 0;
+    }
+
+    // the slot count is fixed at construction, byte and duration limits can change at any time
+    void setLimits(size_t maxBytes, int64_t maxDurationUs) {
+        mMaxBytes.store(maxBytes, std::memory_order_relaxed);
+        mMaxDurationUs.store(maxDurationUs, std::memory_order_relaxed);
+        // let blocked producers re-check against the new budget
+        signal(mPopEpoch, mPushWaiters);
+    }
+
+    void init() {
+        T value;
+        while (tryPop(value)) {
+        }
+        mLastPushTimeUs.store(QUEUE_NO_TIME, std::memory_order_relaxed);
+        mLastPopTimeUs.store(QUEUE_NO_TIME, std::memory_order_relaxed);
+        mAbort.store(false, std::memory_order_release);
+    }
+
+    // drops what is queued, like CountingQueue::abort(), so aborted frames are released now
+    void abort() {
+        mAbort.store(true, std::memory_order_release);
+        T value;
+        while (tryPop(value)) {
+        }
+        mPushEpoch.fetch_add(1);
+        mPushEpoch.notify_all();
+        mPopEpoch.fetch_add(1);
+        mPopEpoch.notify_all();
+    }
+
+    bool isAbort() const { return mAbort.load(std::memory_order_acquire); }
+};
+
+template <typename T>
+using SpscRingQueue = RingQueue<T, false>;
+
+template <typename T>
+using MpscRingQueue = RingQueue<T, true>;
+
+#endif // RING_QUEUE_H
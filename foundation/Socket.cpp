@@ -0,0 +1,94 @@
+#include "Socket.h"
+
+#include <algorithm>
+#include <vector>
+
+#if defined(__linux__)
+#include <netinet/udp.h>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+
+namespace {
+
+// most messages handed to one sendmmsg call (UIO_MAXIOV)
+const int MAX_BATCH = 1024;
+
+struct BatchStorage {
+    std::vector<mmsghdr> msgs;
+    std::vector<iovec> iovs;
+    std::vector<uint8_t> controls;
+};
+
+} // namespace
+
+int socketSendBatch(SOCKET s, const SocketDatagram *datagrams, int count, const SOCKADDR_IN *addr) {
+    // the event loop threads send on their own, keep the scratch space per thread
+    thread_local BatchStorage storage;
+
+    const size_t controlSize = CMSG_SPACE(sizeof(uint16_t));
+    int sent = 0;
+    while (sent < count) {
+        int batch = std::min(count - sent, MAX_BATCH);
+
+        size_t iovCount = 0;
+        for (int i = 0; i < batch; ++i) iovCount += datagrams[sent + i].count;
+        storage.msgs.assign(batch, mmsghdr{});
+        storage.iovs.resize(iovCount);
+        storage.controls.assign(batch * controlSize, 0);
+
+        iovec *iov = storage.iovs.data();
+        for (int i = 0; i < batch; ++i) {
+            const SocketDatagram &datagram = datagrams[sent + i];
+            msghdr &msg = storage.msgs[i].msg_hdr;
+            msg.msg_name = (void *)addr;
+            msg.msg_namelen = addr ? sizeof(*addr) : 0;
+            msg.msg_iov = iov;
+            msg.msg_iovlen = datagram.count;
+            for (int j = 0; j < datagram.count; ++j, ++iov) {
+                iov->iov_base = (void *)datagram.buffers[j].data;
+                iov->iov_len = datagram.buffers[j].size;
+            }
+
+            if (datagram.segmentSize) {
+                msg.msg_control = storage.controls.data() + i * controlSize;
+                msg.msg_controllen = controlSize;
+                cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+                cmsg->cmsg_level = SOL_UDP;
+                cmsg->cmsg_type = UDP_SEGMENT;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                *(uint16_t *)CMSG_DATA(cmsg) = datagram.segmentSize;
+            }
+        }
+
+        // a short count means the next message failed, the next round reports its error
+        int ret = sendmmsg(s, storage.msgs.data(), batch, MSG_NOSIGNAL);
+        if (ret <= 0) return sent ? sent : SOCKET_ERROR;
+        sent += ret;
+    }
+    return sent;
+}
+
+bool socketSupportsSegmentation(SOCKET s) {
+    int segmentSize = 0;
+    socklen_t len = sizeof(segmentSize);
+    return getsockopt(s, SOL_UDP, UDP_SEGMENT, &segmentSize, &len) == 0;
+}
+#else
+int socketSendBatch(SOCKET s, const SocketDatagram *datagrams, int count, const SOCKADDR_IN *addr) {
+    int sent = 0;
+    for (; sent < count; ++sent) {
+        const SocketDatagram &datagram = datagrams[sent];
+        if (socketSendGather(s, datagram.buffers, datagram.count, addr) == SOCKET_ERROR) break;
+    }
+    return sent ? sent : SOCKET_ERROR;
+}
+
+bool socketSupportsSegmentation(SOCKET s) {
+    return false;
+}
+#endif
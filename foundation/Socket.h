@@ -0,0 +1,129 @@
+#ifndef SOCKET_H
+#define SOCKET_H
+
+// The network code is written against winsock names (SOCKET, SOCKADDR_IN, closesocket, ...),
+// on POSIX systems they are mapped to the BSD socket API here.
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+typedef int SOCKET;
+typedef struct sockaddr SOCKADDR;
+typedef struct sockaddr_in SOCKADDR_IN;
+
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+
+inline int closesocket(SOCKET s) {
+    return close(s);
+}
+
+inline int WSAGetLastError() {
+    return errno;
+}
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+inline bool socketSetNonBlocking(SOCKET s) {
+#if defined(_WIN32)
+    u_long mode = 1;
+    return ioctlsocket(s, FIONBIO, &mode) == 0;
+#else
+    int flags = fcntl(s, F_GETFL, 0);
+    return flags >= 0 && fcntl(s, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+// one piece of a gather send
+struct SocketBuffer {
+    const void *data;
+    size_t size;
+};
+
+const int SOCKET_MAX_BUFFERS = 64;
+
+// Sends count buffers as one datagram (to addr) or as one write on a connected socket (addr
+// nullptr), without joining them first. Returns the bytes sent or SOCKET_ERROR. More than
+// SOCKET_MAX_BUFFERS buffers fail with EMSGSIZE rather than sending a truncated message.
+inline int socketSendGather(SOCKET s,
+                            const SocketBuffer *buffers,
+                            int count,
+                            const SOCKADDR_IN *addr = nullptr) {
+    if (count > SOCKET_MAX_BUFFERS) {
+#if defined(_WIN32)
+        WSASetLastError(WSAEMSGSIZE);
+#else
+        errno = EMSGSIZE;
+#endif
+        return SOCKET_ERROR;
+    }
+#if defined(_WIN32)
+    WSABUF wsaBuffers[SOCKET_MAX_BUFFERS];
+    for (int i = 0; i < count; ++i) {
+        wsaBuffers[i].buf = (CHAR *)buffers[i].data;
+        wsaBuffers[i].len = (ULONG)buffers[i].size;
+    }
+    DWORD sent = 0;
+    if (WSASendTo(s, wsaBuffers, count, &sent, 0, (const SOCKADDR *)addr,
+                  addr ? sizeof(*addr) : 0, nullptr, nullptr) == SOCKET_ERROR) {
+        return SOCKET_ERROR;
+    }
+    return (int)sent;
+#else
+    iovec iov[SOCKET_MAX_BUFFERS];
+    for (int i = 0; i < count; ++i) {
+        iov[i].iov_base = (void *)buffers[i].data;
+        iov[i].iov_len = buffers[i].size;
+    }
+    msghdr msg = {};
+    msg.msg_name = (void *)addr;
+    msg.msg_namelen = addr ? sizeof(*addr) : 0;
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+    return (int)sendmsg(s, &msg, MSG_NOSIGNAL);
+#endif
+}
+
+// One datagram of a batch send. With segmentSize set the kernel cuts it into datagrams of that
+// many bytes, the last one may be shorter (UDP GSO, only where socketSupportsSegmentation).
+struct SocketDatagram {
+    const SocketBuffer *buffers;
+    int count;
+    uint16_t segmentSize;
+};
+
+// most segments the kernel takes in one UDP GSO send, and most bytes in all of them together
+// (a segmented datagram still has to fit one IP packet before it is cut)
+const int SOCKET_MAX_SEGMENTS = 64;
+const int SOCKET_MAX_SEGMENTED_SIZE = 65000;
+
+// Sends the datagrams to addr with as few system calls as the platform has, sendmmsg on Linux
+// and one send per datagram elsewhere. Returns how many were sent, stopping at the first
+// failure, or SOCKET_ERROR when not even the first one went out.
+int socketSendBatch(SOCKET s, const SocketDatagram *datagrams, int count, const SOCKADDR_IN *addr);
+
+// whether the socket takes segmented datagrams (UDP_SEGMENT, Linux 4.18 and later)
+bool socketSupportsSegmentation(SOCKET s);
+
+// the last socket call failed only because it would have blocked
+inline bool socketWouldBlock() {
+#if defined(_WIN32)
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+#endif // SOCKET_H
@@ -0,0 +1,213 @@
+#include "Startcode.h"
+#include "CpuFeatures.h"
+
+#include <bit>
+#include <cstring>
+
+#if defined(CPU_X86)
+#include <immintrin.h>
+#elif defined(CPU_NEON)
+#include <arm_neon.h>
+#endif
+
+using FindPatternFunc = const uint8_t *(*)(const uint8_t *p, const uint8_t *end);
+
+// All three scans look for 00 00 X: X == 1 is a start code, X == 3 an emulation prevention
+// byte and X <= 3 a spot where rbspToNal has to insert one.
+template <uint8_t Last, bool OrBelow> static inline bool isPattern(const uint8_t *p) {
+    return p[0] == 0 && p[1] == 0 && (OrBelow ? p[2] <= Last : p[2] == Last);
+}
+
+// copy from ffmpeg libavformat/avc.c
+template <uint8_t Last, bool OrBelow>
+static const uint8_t *findPatternC(const uint8_t *p, const uint8_t *end) {
+    if (end - p < 3) return end;
+
+    const uint8_t *a = p + 4 - ((intptr_t)p & 3);
+
+    for (end -= 3; p < a && p < end; p++) {
+        if (isPattern<Last, OrBelow>(p)) return p;
+    }
+
+    for (end -= 3; p < end; p += 4) {
+        uint32_t x = *(const uint32_t *)p;
+        //      if ((x - 0x01000100) & (~x) & 0x80008000) // little endian
+        //      if ((x - 0x00010001) & (~x) & 0x00800080) // big endian
+        if ((x - 0x01010101) & (~x) & 0x80808080) { // generic
+            if (p[1] == 0) {
+                if (isPattern<Last, OrBelow>(p)) return p;
+                if (isPattern<Last, OrBelow>(p + 1)) return p + 1;
+            }
+            if (p[3] == 0) {
+                if (isPattern<Last, OrBelow>(p + 2)) return p + 2;
+                if (isPattern<Last, OrBelow>(p + 3)) return p + 3;
+            }
+        }
+    }
+
+    // <= so that a start code in the last 3 bytes is found as well (ffmpeg stops one short)
+    for (end += 3; p <= end; p++) {
+        if (isPattern<Last, OrBelow>(p)) return p;
+    }
+
+    return end + 3;
+}
+
+// The vector kernels compare p[i], p[i + 1] and p[i + 2] against 00 00 X for a whole block of
+// i at once and leave the tail (< block + 2 bytes) to the scalar loop.
+#if defined(CPU_X86)
+template <uint8_t Last, bool OrBelow>
+static const uint8_t *findPatternSSE2(const uint8_t *p, const uint8_t *end) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i last = _mm_set1_epi8((char)Last);
+
+    while (end - p >= 16 + 2) {
+        __m128i a = _mm_loadu_si128((const __m128i *)p);
+        __m128i b = _mm_loadu_si128((const __m128i *)(p + 1));
+        __m128i c = _mm_loadu_si128((const __m128i *)(p + 2));
+        // c <= last is min(c, last) == c
+        __m128i tail = OrBelow ? _mm_cmpeq_epi8(_mm_min_epu8(c, last), c) : _mm_cmpeq_epi8(c, last);
+        __m128i hit = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(a, zero), _mm_cmpeq_epi8(b, zero)),
+                                    tail);
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(hit);
+        if (mask) return p + std::countr_zero(mask);
+        p += 16;
+    }
+
+    return findPatternC<Last, OrBelow>(p, end);
+}
+
+template <uint8_t Last, bool OrBelow>
+TARGET_AVX2 static const uint8_t *findPatternAVX2(const uint8_t *p, const uint8_t *end) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i last = _mm256_set1_epi8((char)Last);
+
+    while (end - p >= 32 + 2) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)p);
+        __m256i b = _mm256_loadu_si256((const __m256i *)(p + 1));
+        __m256i c = _mm256_loadu_si256((const __m256i *)(p + 2));
+        __m256i tail = OrBelow ? _mm256_cmpeq_epi8(_mm256_min_epu8(c, last), c)
+                               : _mm256_cmpeq_epi8(c, last);
+        __m256i hit = _mm256_and_si256(
+            _mm256_and_si256(_mm256_cmpeq_epi8(a, zero), _mm256_cmpeq_epi8(b, zero)), tail);
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(hit);
+        if (mask) return p + std::countr_zero(mask);
+        p += 32;
+    }
+
+    return findPatternSSE2<Last, OrBelow>(p, end);
+}
+#elif defined(CPU_NEON)
+template <uint8_t Last, bool OrBelow>
+static const uint8_t *findPatternNEON(const uint8_t *p, const uint8_t *end) {
+    const uint8x16_t zero = vdupq_n_u8(0);
+    const uint8x16_t last = vdupq_n_u8(Last);
+
+    while (end - p >= 16 + 2) {
+        uint8x16_t a = vld1q_u8(p);
+        uint8x16_t b = vld1q_u8(p + 1);
+        uint8x16_t c = vld1q_u8(p + 2);
+        uint8x16_t tail = OrBelow ? vcleq_u8(c, last) : vceqq_u8(c, last);
+        uint8x16_t hit = vandq_u8(vandq_u8(vceqq_u8(a, zero), vceqq_u8(b, zero)), tail);
+        // narrow to 4 bits per lane to get a 64-bit mask
+        uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(hit), 4);
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
+        if (mask) return p + std::countr_zero(mask) / 4;
+        p += 16;
+    }
+
+    return findPatternC<Last, OrBelow>(p, end);
+}
+#endif
+
+template <uint8_t Last, bool OrBelow> static FindPatternFunc selectFindPattern() {
+#if defined(CPU_X86)
+    if (cpuHasAVX2()) return findPatternAVX2<Last, OrBelow>;
+    if (cpuHasSSE2()) return findPatternSSE2<Last, OrBelow>;
+#elif defined(CPU_NEON)
+    if (cpuHasNEON()) return findPatternNEON<Last, OrBelow>;
+#endif
+    return findPatternC<Last, OrBelow>;
+}
+
+static const uint8_t *findStartcodeInternal(const uint8_t *p, const uint8_t *end) {
+    static const FindPatternFunc func = selectFindPattern<1, false>();
+    return func(p, end);
+}
+
+static const uint8_t *findEmulationPrevention(const uint8_t *p, const uint8_t *end) {
+    static const FindPatternFunc func = selectFindPattern<3, false>();
+    return func(p, end);
+}
+
+static const uint8_t *findEscapeCandidate(const uint8_t *p, const uint8_t *end) {
+    static const FindPatternFunc func = selectFindPattern<3, true>();
+    return func(p, end);
+}
+
+const uint8_t *findStartcode(const uint8_t *p, const uint8_t *end) {
+    const uint8_t *out = findStartcodeInternal(p, end);
+    if (p < out && out < end && !out[-1]) out--;
+    return out;
+}
+
+void findNalus(const uint8_t *data, int length, std::vector<std::pair<int, int>> &nalus) {
+    const uint8_t *pEnd = data + length;
+    const uint8_t *pNaluStart = findStartcode(data, pEnd);
+    while (pNaluStart < pEnd) {
+        // skip the start code
+        while (pNaluStart < pEnd && !*pNaluStart) pNaluStart++;
+        if (pEnd - pNaluStart <= 1) break;
+        pNaluStart++;
+
+        const uint8_t *pNaluEnd = findStartcode(pNaluStart, pEnd);
+        if (pNaluEnd > pNaluStart)
+            nalus.emplace_back((int)(pNaluStart - data), (int)(pNaluEnd - pNaluStart));
+        pNaluStart = pNaluEnd;
+    }
+}
+
+size_t nalToRbsp(const uint8_t *src, size_t size, uint8_t *dst) {
+    const uint8_t *p = src;
+    const uint8_t *end = src + size;
+    uint8_t *out = dst;
+    while (p < end) {
+        const uint8_t *epb = findEmulationPrevention(p, end);
+        // 00 00 are kept, 03 dropped. memmove as dst may alias src, it never runs ahead of p
+        size_t n = epb < end ? epb + 2 - p : end - p;
+        if (out != p) std::memmove(out, p, n);
+        out += n;
+        p += epb < end ? n + 1 : n;
+    }
+    return out - dst;
+}
+
+size_t rbspToNal(const uint8_t *src, size_t size, uint8_t *dst) {
+    const uint8_t *p = src;
+    const uint8_t *end = src + size;
+    uint8_t *out = dst;
+    while (p < end) {
+        const uint8_t *esc = findEscapeCandidate(p, end);
+        size_t n = esc < end ? esc + 2 - p : end - p;
+        std::memcpy(out, p, n);
+        out += n;
+        p += n;
+        // the zero count restarts after the inserted byte, so the search can resume at p
+        if (esc < end) *out++ = 0x03;
+    }
+    // a trailing zero (cabac_zero_words) is protected as well
+    if (out > dst && out[-1] == 0) *out++ = 0x03;
+    return out - dst;
+}
+
+std::shared_ptr<PacketBuffer> nalToRbsp(const uint8_t *data, size_t size) {
+    auto pBuffer = std::make_shared<PacketBuffer>(size);
+    pBuffer->setRange(0, nalToRbsp(data, size, pBuffer->data()));
+    return pBuffer;
+}
+
+std::shared_ptr<PacketBuffer> rbspToNal(const uint8_t *data, size_t size) {
+    auto pBuffer = std::make_shared<PacketBuffer>(rbspToNalMaxSize(size));
+    pBuffer->setRange(0, rbspToNal(data, size, pBuffer->data()));
+    return pBuffer;
+}
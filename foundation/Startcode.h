@@ -0,0 +1,36 @@
+#ifndef STARTCODE_H
+#define STARTCODE_H
+
+#include "PacketBuffer.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// position of the next Annex-B start code (including one leading zero of a 4 byte start code),
+// end if none. SSE2/AVX2/NEON kernels are picked at runtime.
+const uint8_t *findStartcode(const uint8_t *p, const uint8_t *end);
+
+// splits an Annex-B buffer in one pass, appends offset-length pairs of the NAL units without
+// their start codes
+void findNalus(const uint8_t *data, int length, std::vector<std::pair<int, int>> &nalus);
+
+// strips the emulation prevention bytes (00 00 03 -> 00 00) of a NAL unit, returns the RBSP size.
+// dst needs size bytes and may be src itself.
+size_t nalToRbsp(const uint8_t *src, size_t size, uint8_t *dst);
+
+// inserts emulation prevention bytes in front of 00 00 0x (x <= 3) and after a trailing 00,
+// returns the NAL unit size. dst needs rbspToNalMaxSize(size) bytes and must not overlap src.
+size_t rbspToNal(const uint8_t *src, size_t size, uint8_t *dst);
+
+inline size_t rbspToNalMaxSize(size_t size) {
+    return size + size / 2 + 1;
+}
+
+// same as above, into a pooled buffer
+std::shared_ptr<PacketBuffer> nalToRbsp(const uint8_t *data, size_t size);
+std::shared_ptr<PacketBuffer> rbspToNal(const uint8_t *data, size_t size);
+
+#endif // STARTCODE_H
@@ -0,0 +1,336 @@
+#include "TimerService.h"
+
+#include <algorithm>
+#include <chrono>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <cerrno>
+#include <ctime>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#endif
+
+#if defined(_WIN32)
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+// high resolution timers need Windows 10 1803, older systems fall back to a 1ms timer period
+static HANDLE createWaitableTimer() {
+    HANDLE timer = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION,
+                                          TIMER_ALL_ACCESS);
+    if (timer) return timer;
+
+    static std::once_flag periodFlag;
+    std::call_once(periodFlag, []() { timeBeginPeriod(1); });
+    return CreateWaitableTimerW(nullptr, FALSE, nullptr);
+}
+
+// false when the deadline has already passed
+static bool armTimer(HANDLE timer, int64_t deadlineUs) {
+    int64_t delayUs = deadlineUs - timerNowUs();
+    if (delayUs <= 0) return false;
+
+    LARGE_INTEGER due;
+    due.QuadPart = -delayUs * 10; // relative, 100ns units
+    return SetWaitableTimer(timer, &due, 0, nullptr, nullptr, FALSE);
+}
+
+struct TimerService::Platform {
+    HANDLE timer;
+    HANDLE wakeEvent;
+
+    Platform() {
+        timer = createWaitableTimer();
+        wakeEvent = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    }
+    ~Platform() {
+        if (timer) CloseHandle(timer);
+        if (wakeEvent) CloseHandle(wakeEvent);
+    }
+
+    void wait(int64_t deadlineUs) {
+        HANDLE handles[2] = {wakeEvent, timer};
+        DWORD count = 1;
+        if (deadlineUs != INT64_MAX) {
+            if (!armTimer(timer, deadlineUs)) return;
+            count = 2;
+        }
+        WaitForMultipleObjects(count, handles, FALSE, INFINITE);
+    }
+    void wake() { SetEvent(wakeEvent); }
+};
+
+static void sleepUntilCoarse(int64_t deadlineUs) {
+    struct ThreadTimer {
+        HANDLE handle = createWaitableTimer();
+        ~ThreadTimer() {
+            if (handle) CloseHandle(handle);
+        }
+    };
+    thread_local ThreadTimer threadTimer;
+
+    if (threadTimer.handle) {
+        if (armTimer(threadTimer.handle, deadlineUs)) {
+            WaitForSingleObject(threadTimer.handle, INFINITE);
+        }
+    } else {
+        int64_t delayUs = deadlineUs - timerNowUs();
+        if (delayUs >= 1000) Sleep((DWORD)(delayUs / 1000));
+    }
+}
+
+int64_t timerNowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+#else
+static timespec toTimespec(int64_t us) {
+    timespec ts;
+    ts.tv_sec = us / 1000000;
+    ts.tv_nsec = (us % 1000000) * 1000;
+    return ts;
+}
+
+struct TimerService::Platform {
+    int timerFd;
+    int wakeFd;
+
+    Platform() {
+        timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    }
+    ~Platform() {
+        if (timerFd >= 0) close(timerFd);
+        if (wakeFd >= 0) close(wakeFd);
+    }
+
+    void wait(int64_t deadlineUs) {
+        // a zero it_value disarms the timer
+        itimerspec spec = {};
+        if (deadlineUs != INT64_MAX) {
+            if (deadlineUs <= timerNowUs()) return;
+            spec.it_value = toTimespec(deadlineUs);
+        }
+        timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+
+        pollfd fds[2] = {{timerFd, POLLIN, 0}, {wakeFd, POLLIN, 0}};
+        if (poll(fds, 2, -1) <= 0) return;
+
+        uint64_t value;
+        if (fds[0].revents & POLLIN) (void)!read(timerFd, &value, sizeof(value));
+        if (fds[1].revents & POLLIN) (void)!read(wakeFd, &value, sizeof(value));
+    }
+
+    void wake() {
+        uint64_t one = 1;
+        (void)!write(wakeFd, &one, sizeof(one));
+    }
+};
+
+static void sleepUntilCoarse(int64_t deadlineUs) {
+    timespec ts = toTimespec(deadlineUs);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {
+    }
+}
+
+int64_t timerNowUs() {
+    // CLOCK_MONOTONIC, the clock of timerfd and clock_nanosleep
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+#endif
+
+TimerService &TimerService::getInstance() {
+    // never destroyed, timers may be cancelled after static destruction started
+    static TimerService *service = new TimerService();
+    return *service;
+}
+
+TimerService::TimerService() {
+    for (auto &level : mWheel) {
+        for (auto &slot : level) slot = nullptr;
+    }
+    mNextId = 1;
+    mStartUs = timerNowUs();
+    mCurrentTick = 0;
+    mWakeTick = UINT64_MAX;
+#if defined(_WIN32)
+    mSpinUs = 1000;
+#else
+    mSpinUs = 100;
+#endif
+    mStop = false;
+    mpPlatform = std::make_unique<Platform>();
+    mThread = std::make_unique<std::thread>(&TimerService::run, this);
+}
+
+TimerService::~TimerService() {
+    mStop = true;
+    mpPlatform->wake();
+    if (mThread && mThread->joinable()) mThread->join();
+}
+
+TimerService::TimerId TimerService::schedule(int64_t deadlineUs, std::function<void()> callback) {
+    if (!callback || mStop) return 0;
+
+    auto timer = std::make_unique<Timer>();
+    timer->callback = std::move(callback);
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    int64_t offsetUs = deadlineUs - mStartUs;
+    // round up, a callback never runs before its deadline
+    timer->tick = offsetUs <= 0 ? 0 : (uint64_t)((offsetUs + TICK_US - 1) / TICK_US);
+    timer->id = mNextId++;
+    addTimer(timer.get());
+
+    TimerId id = timer->id;
+    uint64_t tick = std::max(timer->tick, mCurrentTick);
+    mTimers.emplace(id, std::move(timer));
+
+    // only wake the timer thread when it sleeps past the new deadline
+    if (tick < mWakeTick) {
+        mWakeTick = tick;
+        lock.unlock();
+        mpPlatform->wake();
+    }
+    return id;
+}
+
+TimerService::TimerId TimerService::scheduleAfter(int64_t delayUs, std::function<void()> callback) {
+    return schedule(timerNowUs() + delayUs, std::move(callback));
+}
+
+bool TimerService::cancel(TimerId id) {
+    std::unique_ptr<Timer> timer;
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        auto iter = mTimers.find(id);
+        if (iter == mTimers.end()) return false;
+        unlinkTimer(iter->second.get());
+        timer = std::move(iter->second);
+        mTimers.erase(iter);
+    }
+    // the callback (and whatever it captured) is destroyed outside the lock
+    return true;
+}
+
+void TimerService::sleepUntil(int64_t deadlineUs) {
+    int64_t coarseUs = deadlineUs - mSpinUs.load(std::memory_order_relaxed);
+    if (coarseUs > timerNowUs()) sleepUntilCoarse(coarseUs);
+    while (timerNowUs() < deadlineUs) std::this_thread::yield();
+}
+
+void TimerService::sleepFor(int64_t delayUs) {
+    sleepUntil(timerNowUs() + delayUs);
+}
+
+void TimerService::setSpinUs(int64_t spinUs) {
+    mSpinUs.store(spinUs > 0 ? spinUs : 0, std::memory_order_relaxed);
+}
+
+void TimerService::addTimer(Timer *timer) {
+    const uint64_t range = 1ull << (WHEEL_BITS * WHEEL_LEVELS);
+
+    uint64_t tick = std::max(timer->tick, mCurrentTick);
+    uint64_t delta = tick - mCurrentTick;
+    // beyond the top level: park in the last slot, expireTick() re-adds it until it is due
+    if (delta >= range) tick = mCurrentTick + range - 1;
+
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= (1ull << (WHEEL_BITS * (level + 1)))) ++level;
+
+    Timer **slot = &mWheel[level][(tick >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)];
+    timer->slot = slot;
+    timer->prev = nullptr;
+    timer->next = *slot;
+    if (*slot) (*slot)->prev = timer;
+    *slot = timer;
+}
+
+void TimerService::unlinkTimer(Timer *timer) {
+    if (timer->prev) {
+        timer->prev->next = timer->next;
+    } else {
+        *timer->slot = timer->next;
+    }
+    if (timer->next) timer->next->prev = timer->prev;
+    timer->slot = nullptr;
+    timer->prev = nullptr;
+    timer->next = nullptr;
+}
+
+void TimerService::cascade(int level, int index) {
+    Timer *timer = mWheel[level][index];
+    mWheel[level][index] = nullptr;
+    while (timer) {
+        Timer *next = timer->next;
+        addTimer(timer);
+        timer = next;
+    }
+}
+
+void TimerService::expireTick(std::vector<std::unique_ptr<Timer>> &expired) {
+    uint64_t tick = mCurrentTick;
+    if ((tick & (WHEEL_SLOTS - 1)) == 0) {
+        for (int level = 1; level < WHEEL_LEVELS; ++level) {
+            int index = (int)((tick >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1));
+            cascade(level, index);
+            if (index != 0) break;
+        }
+    }
+
+    Timer *timer = mWheel[0][tick & (WHEEL_SLOTS - 1)];
+    mWheel[0][tick & (WHEEL_SLOTS - 1)] = nullptr;
+    mCurrentTick = tick + 1;
+    while (timer) {
+        Timer *next = timer->next;
+        if (timer->tick > tick) {
+            // parked beyond the wheel range
+            addTimer(timer);
+        } else {
+            auto iter = mTimers.find(timer->id);
+            expired.emplace_back(std::move(iter->second));
+            mTimers.erase(iter);
+        }
+        timer = next;
+    }
+}
+
+uint64_t TimerService::nextWakeTick() {
+    if (mTimers.empty()) return UINT64_MAX;
+
+    // first non-empty slot of level 0, or the next cascade (which may be mCurrentTick itself)
+    for (uint64_t tick = mCurrentTick;; ++tick) {
+        if ((tick & (WHEEL_SLOTS - 1)) == 0 || mWheel[0][tick & (WHEEL_SLOTS - 1)]) return tick;
+    }
+}
+
+void TimerService::run() {
+    std::vector<std::unique_ptr<Timer>> expired;
+    while (!mStop) {
+        int64_t deadlineUs = INT64_MAX;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            uint64_t nowTick = (uint64_t)((timerNowUs() - mStartUs) / TICK_US);
+            while (mCurrentTick <= nowTick) expireTick(expired);
+
+            mWakeTick = expired.empty() ? nextWakeTick() : mCurrentTick;
+            if (mWakeTick != UINT64_MAX) deadlineUs = mStartUs + (int64_t)mWakeTick * TICK_US;
+        }
+
+        if (!expired.empty()) {
+            for (auto &timer : expired) timer->callback();
+            expired.clear();
+            // callbacks may have taken a while, look at the wheel again before sleeping
+            continue;
+        }
+        mpPlatform->wait(deadlineUs);
+    }
+}
@@ -0,0 +1,90 @@
+#ifndef TIMER_SERVICE_H
+#define TIMER_SERVICE_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// monotonic clock in microseconds, the time base of every deadline below
+int64_t timerNowUs();
+
+// Callback timers on one dedicated thread. Timers live in a hierarchical wheel (4 levels of 64
+// slots, 100us ticks, cascading like the classic kernel wheel) so schedule/cancel are O(1), and
+// the thread blocks on timerfd (Linux) or a high resolution waitable timer (Windows) until the
+// next non-empty slot. Callbacks run on the timer thread and must not block.
+//
+// sleepUntil()/sleepFor() block the calling thread itself (clock_nanosleep or a waitable timer)
+// until spinUs before the deadline and yield-spin the rest, which keeps the wakeup error well
+// below the OS sleep granularity.
+class TimerService {
+public:
+    using TimerId = uint64_t;
+
+    static TimerService &getInstance();
+
+    TimerService(const TimerService &) = delete;
+    TimerService &operator=(const TimerService &) = delete;
+
+    // callback runs once deadlineUs (timerNowUs() based) has passed, returns 0 on failure
+    TimerId schedule(int64_t deadlineUs, std::function<void()> callback);
+    TimerId scheduleAfter(int64_t delayUs, std::function<void()> callback);
+    // false if the timer already fired or was cancelled
+    bool cancel(TimerId id);
+
+    void sleepUntil(int64_t deadlineUs);
+    void sleepFor(int64_t delayUs);
+
+    // length of the final busy phase of sleepUntil()
+    void setSpinUs(int64_t spinUs);
+
+private:
+    static const int WHEEL_LEVELS = 4;
+    static const int WHEEL_BITS = 6;
+    static const int WHEEL_SLOTS = 1 << WHEEL_BITS;
+    static const int64_t TICK_US = 100;
+
+    struct Timer {
+        TimerId id;
+        uint64_t tick;
+        std::function<void()> callback;
+        Timer **slot;
+        Timer *prev;
+        Timer *next;
+    };
+
+    std::mutex mMutex;
+    std::unordered_map<TimerId, std::unique_ptr<Timer>> mTimers;
+    Timer *mWheel[WHEEL_LEVELS][WHEEL_SLOTS];
+    TimerId mNextId;
+    int64_t mStartUs;
+    // next tick to expire
+    uint64_t mCurrentTick;
+    // tick the timer thread sleeps until, UINT64_MAX when idle
+    uint64_t mWakeTick;
+
+    std::atomic<int64_t> mSpinUs;
+    std::atomic<bool> mStop;
+    std::unique_ptr<std::thread> mThread;
+
+    struct Platform;
+    std::unique_ptr<Platform> mpPlatform;
+
+    TimerService();
+    virtual ~TimerService();
+
+    void addTimer(Timer *timer);
+    void unlinkTimer(Timer *timer);
+    void cascade(int level, int index);
+    // moves the timers of mCurrentTick into expired and advances it
+    void expireTick(std::vector<std::unique_ptr<Timer>> &expired);
+    // tick to wake up at, UINT64_MAX when no timer is pending
+    uint64_t nextWakeTick();
+    void run();
+};
+
+#endif // TIMER_SERVICE_H
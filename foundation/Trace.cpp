@@ -0,0 +1,252 @@
+#include "Trace.h"
+
+#if defined(ENABLE_TRACE)
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+const size_t TRACE_BUFFER_EVENTS = 1 << 16;
+
+struct TraceRecord {
+    const char *name;
+    int64_t timeNs;
+    int64_t value; // duration for complete events
+    uint64_t id;
+    char phase;
+};
+
+// one per tracing thread, only the thread writes, the exporter reads up to the published count
+struct TraceBuffer {
+    explicit TraceBuffer(uint32_t id) : threadId(id) {}
+
+    uint32_t threadId;
+    std::atomic<const char *> threadName{nullptr};
+    // allocated by the first event, a thread that only names itself costs nothing
+    std::unique_ptr<TraceRecord[]> events;
+    std::atomic<uint32_t> session{0};
+    std::atomic<size_t> count{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<bool> closed{false};
+};
+
+struct ThreadBuffer {
+    std::shared_ptr<TraceBuffer> buffer;
+
+    ~ThreadBuffer() {
+        if (buffer) buffer->closed.store(true, std::memory_order_release);
+    }
+};
+
+void appendJsonString(std::string &out, const char *s) {
+    out += '"';
+    for (; *s; ++s) {
+        if (*s == '"' || *s == '\\') out += '\\';
+        if ((unsigned char)*s >= 0x20) out += *s;
+    }
+    out += '"';
+}
+
+class TraceRecorder {
+public:
+    static TraceRecorder &getInstance() {
+        // never destroyed, threads may trace during static destruction
+        static TraceRecorder *recorder = new TraceRecorder();
+        return *recorder;
+    }
+
+    TraceRecorder(const TraceRecorder &) = delete;
+    TraceRecorder &operator=(const TraceRecorder &) = delete;
+
+    void start() {
+        std::unique_lock<std::mutex> lock(mMutex);
+        // buffers of exited threads only hold events of the previous session
+        mBuffers.erase(std::remove_if(mBuffers.begin(), mBuffers.end(),
+                                      [](const std::shared_ptr<TraceBuffer> &buffer) {
+                                          return buffer->closed.load(std::memory_order_acquire);
+                                      }),
+                       mBuffers.end());
+        mStartNs = traceNowNs();
+        mSession.fetch_add(1, std::memory_order_release);
+        gTraceEnabled.store(true, std::memory_order_release);
+    }
+
+    void stop() { gTraceEnabled.store(false, std::memory_order_release); }
+
+    void append(TracePhase phase, const char *name, int64_t timeNs, int64_t value, uint64_t id) {
+        TraceBuffer *buffer = getThreadBuffer();
+        uint32_t session = mSession.load(std::memory_order_acquire);
+        if (buffer->session.load(std::memory_order_relaxed) != session) {
+            // first event of this thread in a new session, count is published before session
+            buffer->count.store(0, std::memory_order_relaxed);
+            buffer->dropped.store(0, std::memory_order_relaxed);
+            buffer->session.store(session, std::memory_order_release);
+        }
+
+        size_t count = buffer->count.load(std::memory_order_relaxed);
+        if (count >= TRACE_BUFFER_EVENTS) {
+            buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        if (!buffer->events) buffer->events.reset(new TraceRecord[TRACE_BUFFER_EVENTS]);
+        buffer->events[count] = {name, timeNs, value, id, (char)phase};
+        buffer->count.store(count + 1, std::memory_order_release);
+    }
+
+    void setThreadName(const char *name) {
+        getThreadBuffer()->threadName.store(name, std::memory_order_release);
+    }
+
+    bool exportJson(const std::string &path) {
+        FILE *file = std::fopen(path.c_str(), "wb");
+        if (!file) return false;
+
+        std::unique_lock<std::mutex> lock(mMutex);
+        uint32_t session = mSession.load(std::memory_order_acquire);
+        std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        bool first = true;
+        for (auto &buffer : mBuffers) {
+            const char *threadName = buffer->threadName.load(std::memory_order_acquire);
+            if (threadName) {
+                appendSeparator(out, first);
+                appendEventHeader(out, "thread_name", 'M', buffer->threadId);
+                out += ",\"args\":{\"name\":";
+                appendJsonString(out, threadName);
+                out += "}}";
+            }
+
+            if (buffer->session.load(std::memory_order_acquire) != session) continue;
+            size_t count = buffer->count.load(std::memory_order_acquire);
+            for (size_t i = 0; i < count; ++i) {
+                appendSeparator(out, first);
+                appendRecord(out, buffer->events[i], buffer->threadId);
+            }
+            if (out.size() >= 1 << 20) {
+                std::fwrite(out.data(), 1, out.size(), file);
+                out.clear();
+            }
+        }
+        out += "\n]}\n";
+        std::fwrite(out.data(), 1, out.size(), file);
+        return std::fclose(file) == 0;
+    }
+
+    uint64_t droppedCount() {
+        uint64_t dropped = 0;
+        std::unique_lock<std::mutex> lock(mMutex);
+        uint32_t session = mSession.load(std::memory_order_acquire);
+        for (auto &buffer : mBuffers) {
+            if (buffer->session.load(std::memory_order_acquire) != session) continue;
+            dropped += buffer->dropped.load(std::memory_order_relaxed);
+        }
+        return dropped;
+    }
+
+private:
+    std::mutex mMutex;
+    std::vector<std::shared_ptr<TraceBuffer>> mBuffers;
+    std::atomic<uint32_t> mNextThreadId;
+    std::atomic<uint32_t> mSession;
+    int64_t mStartNs;
+
+    TraceRecorder() : mNextThreadId(1), mSession(0), mStartNs(0) {}
+    virtual ~TraceRecorder() {}
+
+    TraceBuffer *getThreadBuffer() {
+        thread_local ThreadBuffer holder;
+        if (!holder.buffer) {
+            holder.buffer = std::make_shared<TraceBuffer>(mNextThreadId.fetch_add(1));
+            std::unique_lock<std::mutex> lock(mMutex);
+            mBuffers.push_back(holder.buffer);
+        }
+        return holder.buffer.get();
+    }
+
+    static void appendSeparator(std::string &out, bool &first) {
+        if (!first) out += ",\n";
+        first = false;
+    }
+
+    static void appendEventHeader(std::string &out, const char *name, char phase, uint32_t tid) {
+        char fields[64];
+        out += "{\"name\":";
+        appendJsonString(out, name);
+        int n = std::snprintf(fields, sizeof(fields), ",\"ph\":\"%c\",\"pid\":1,\"tid\":%u", phase,
+                              tid);
+        out.append(fields, n);
+    }
+
+    void appendRecord(std::string &out, const TraceRecord &record, uint32_t tid) {
+        char fields[128];
+        int n = 0;
+        // spans opened before traceStart() are clipped to the session
+        int64_t timeNs = std::max<int64_t>(record.timeNs - mStartNs, 0);
+        appendEventHeader(out, record.name, record.phase, tid);
+        n = std::snprintf(fields, sizeof(fields), ",\"ts\":%" PRId64 ".%03d", timeNs / 1000,
+                          (int)(timeNs % 1000));
+        out.append(fields, n);
+
+        switch (record.phase) {
+        case TRACE_PHASE_COMPLETE:
+            n = std::snprintf(fields, sizeof(fields), ",\"dur\":%" PRId64 ".%03d}",
+                              record.value / 1000, (int)(record.value % 1000));
+            break;
+        case TRACE_PHASE_INSTANT:
+            n = std::snprintf(fields, sizeof(fields), ",\"s\":\"t\"}");
+            break;
+        case TRACE_PHASE_COUNTER:
+            n = std::snprintf(fields, sizeof(fields), ",\"args\":{\"value\":%" PRId64 "}}",
+                              record.value);
+            break;
+        default:
+            // flows: the end binds to the enclosing span rather than the next one
+            n = std::snprintf(fields, sizeof(fields),
+                              ",\"cat\":\"flow\",\"id\":\"0x%" PRIx64 "\"%s}", record.id,
+                              record.phase == TRACE_PHASE_FLOW_END ? ",\"bp\":\"e\"" : "");
+            break;
+        }
+        out.append(fields, n);
+    }
+};
+
+} // namespace
+
+std::atomic<bool> gTraceEnabled{false};
+
+void traceStart() {
+    TraceRecorder::getInstance().start();
+}
+
+void traceStop() {
+    TraceRecorder::getInstance().stop();
+}
+
+bool traceExport(const std::string &path) {
+    return TraceRecorder::getInstance().exportJson(path);
+}
+
+uint64_t traceDroppedCount() {
+    return TraceRecorder::getInstance().droppedCount();
+}
+
+int64_t traceNowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void traceEvent(TracePhase phase, const char *name, int64_t timeNs, int64_t value, uint64_t id) {
+    TraceRecorder::getInstance().append(phase, name, timeNs, value, id);
+}
+
+void traceSetThreadName(const char *name) {
+    TraceRecorder::getInstance().setThreadName(name);
+}
+
+#endif // ENABLE_TRACE
@@ -0,0 +1,127 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Pipeline tracing, exported as Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev).
+// Every thread appends fixed-size events to a buffer of its own, recording takes no lock and does
+// no allocation once the buffer exists. Names must be string literals, only the pointer is kept.
+//
+// Without ENABLE_TRACE (xmake f --trace=y) the TRACE_* macros expand to nothing and their
+// arguments are never evaluated.
+
+#if defined(ENABLE_TRACE)
+
+enum TracePhase {
+    TRACE_PHASE_COMPLETE = 'X',
+    TRACE_PHASE_INSTANT = 'i',
+    TRACE_PHASE_COUNTER = 'C',
+    TRACE_PHASE_FLOW_BEGIN = 's',
+    TRACE_PHASE_FLOW_STEP = 't',
+    TRACE_PHASE_FLOW_END = 'f',
+};
+
+// starts a new session, the events of the previous one are discarded
+void traceStart();
+void traceStop();
+
+extern std::atomic<bool> gTraceEnabled;
+
+inline bool traceIsEnabled() {
+    return gTraceEnabled.load(std::memory_order_relaxed);
+}
+
+// writes the events of the current session, false if the file can not be written
+bool traceExport(const std::string &path);
+// events lost because a thread buffer was full
+uint64_t traceDroppedCount();
+
+int64_t traceNowNs();
+void traceEvent(TracePhase phase, const char *name, int64_t timeNs, int64_t value, uint64_t id);
+void traceSetThreadName(const char *name);
+
+// records a complete event covering its own lifetime
+class TraceScope {
+public:
+    explicit TraceScope(const char *name)
+        : mName(name), mStartNs(traceIsEnabled() ? traceNowNs() : -1) {}
+    ~TraceScope() {
+        if (mStartNs >= 0) {
+            traceEvent(TRACE_PHASE_COMPLETE, mName, mStartNs, traceNowNs() - mStartNs, 0);
+        }
+    }
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+    const char *mName;
+    int64_t mStartNs;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_INSTANT(name)                                                                        \
+    do {                                                                                           \
+        if (traceIsEnabled()) traceEvent(TRACE_PHASE_INSTANT, (name), traceNowNs(), 0, 0);         \
+    } while (0)
+#define TRACE_COUNTER(name, value)                                                                 \
+    do {                                                                                           \
+        if (traceIsEnabled())                                                                      \
+            traceEvent(TRACE_PHASE_COUNTER, (name), traceNowNs(), (int64_t)(value), 0);            \
+    } while (0)
+// flow ids are a process wide sequence, a packet takes one when it enters the pipeline and
+// carries it in the opaque field of its AVPacket/AVFrame. 0 is never handed out, flow events
+// with id 0 (a packet that never got one) are not recorded.
+inline uint64_t traceNextFlowId() {
+    static std::atomic<uint64_t> nextId{1};
+    return nextId.fetch_add(1, std::memory_order_relaxed);
+}
+
+// flow events bind to the span enclosing them on the same thread
+#define TRACE_FLOW(phase, name, id)                                                                \
+    do {                                                                                           \
+        uint64_t traceId = (id);                                                                   \
+        if (traceIsEnabled() && traceId) traceEvent((phase), (name), traceNowNs(), 0, traceId);    \
+    } while (0)
+// stores a new flow id in a void * field
+#define TRACE_FLOW_NEW_ID(opaque) ((opaque) = (void *)(uintptr_t)traceNextFlowId())
+#define TRACE_FLOW_BEGIN(name, id) TRACE_FLOW(TRACE_PHASE_FLOW_BEGIN, name, id)
+#define TRACE_FLOW_STEP(name, id) TRACE_FLOW(TRACE_PHASE_FLOW_STEP, name, id)
+#define TRACE_FLOW_END(name, id) TRACE_FLOW(TRACE_PHASE_FLOW_END, name, id)
+#define TRACE_THREAD_NAME(name) traceSetThreadName(name)
+
+#else
+
+#define TRACE_SCOPE(name)                                                                          \
+    do {                                                                                           \
+    } while (0)
+#define TRACE_INSTANT(name)                                                                        \
+    do {                                                                                           \
+    } while (0)
+#define TRACE_COUNTER(name, value)                                                                 \
+    do {                                                                                           \
+    } while (0)
+#define TRACE_FLOW_BEGIN(name, id)                                                                 \
+    do {                                                                                           \
+    } while (0)
+#define TRACE_FLOW_STEP(name, id)                                                                  \
+    do {                                                                                           \
+    } while (0)
+#define TRACE_FLOW_END(name, id)                                                                   \
+    do {                                                                                           \
+    } while (0)
+#define TRACE_FLOW_NEW_ID(opaque)                                                                  \
+    do {                                                                                           \
+    } while (0)
+#define TRACE_THREAD_NAME(name)                                                                    \
+    do {                                                                                           \
+    } while (0)
+
+#endif // ENABLE_TRACE
+
+#endif // TRACE_H
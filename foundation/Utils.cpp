@@ -1,10 +1,9 @@
 #include "Utils.h"
 #include "BitReader.h"
+#include "TimerService.h"
 
 #include <algorithm>
 #include <memory>
-#include <mutex>
-#include <condition_variable>
 
 #include <winsock2.h>
 #include <ws2tcpip.h>
@@ -55,43 +54,6 @@ bool isIPv6(std::string addr) {
     return InetPton(AF_INET6, addr.c_str(), &testAddr.sin6_addr) == 1;
 }
 
-// copy from ffmpeg libavformat/avc.c
-static const uint8_t *findStartcodeInternal(const uint8_t *p, const uint8_t *end) {
-    const uint8_t *a = p + 4 - ((intptr_t)p & 3);
-
-    for (end -= 3; p < a && p < end; p++) {
-        if (p[0] == 0 && p[1] == 0 && p[2] == 1) return p;
-    }
-
-    for (end -= 3; p < end; p += 4) {
-        uint32_t x = *(const uint32_t *)p;
-        //      if ((x - 0x01000100) & (~x) & 0x80008000) // little endian
-        //      if ((x - 0x00010001) & (~x) & 0x00800080) // big endian
-        if ((x - 0x01010101) & (~x) & 0x80808080) { // generic
-            if (p[1] == 0) {
-                if (p[0] == 0 && p[2] == 1) return p;
-                if (p[2] == 0 && p[3] == 1) return p + 1;
-            }
-            if (p[3] == 0) {
-                if (p[2] == 0 && p[4] == 1) return p + 2;
-                if (p[4] == 0 && p[5] == 1) return p + 3;
-            }
-        }
-    }
-
-    for (end += 3; p < end; p++) {
-        if (p[0] == 0 && p[1] == 0 && p[2] == 1) return p;
-    }
-
-    return end + 3;
-}
-
-const uint8_t *findStartcode(const uint8_t *p, const uint8_t *end) {
-    const uint8_t *out = findStartcodeInternal(p, end);
-    if (p < out && out < end && !out[-1]) out--;
-    return out;
-}
-
 static const char *AUDIO_OBJECT_TYPE[] = {
     "Null",     // 0
     "AAC Main", // 1
@@ -192,16 +154,11 @@ void parseCsdAVC(const uint8_t *data,
         // skip spsExt
     } else {
         // split by {0x00 0x00 0x00 0x01}
-        const uint8_t *pStart = data;
-        const uint8_t *pEnd = data + length;
-
-        const uint8_t *pNaluStart = findStartcode(pStart, pEnd);
-        const uint8_t *pNaluEnd = nullptr;
-        while (true) {
-            while (pNaluStart && (pNaluStart < pEnd) && !*(pNaluStart++))
-                ;
-            if (pNaluStart == pEnd) break;
-            pNaluEnd = findStartcode(pNaluStart, pEnd);
+        std::vector<std::pair<int, int>> nalus;
+        findNalus(data, length, nalus);
+        for (auto &nalu : nalus) {
+            const uint8_t *pNaluStart = data + nalu.first;
+            const uint8_t *pNaluEnd = pNaluStart + nalu.second;
             BitReader br(pNaluStart, 1);
             br.skipBits(3);
             uint8_t naluType = br.getBits(5);
@@ -219,7 +176,6 @@ void parseCsdAVC(const uint8_t *data,
                 default:
                     break;
             }
-            pNaluStart = pNaluEnd;
         }
     }
 }
@@ -281,16 +237,11 @@ void parseCsdHEVC(const uint8_t *data,
         }
     } else {
         // split by {0x00 0x00 0x00 0x01}
-        const uint8_t *pStart = data;
-        const uint8_t *pEnd = data + length;
-
-        const uint8_t *pNaluStart = findStartcode(pStart, pEnd);
-        const uint8_t *pNaluEnd = nullptr;
-        while (true) {
-            while (pNaluStart && (pNaluStart < pEnd) && !*(pNaluStart++))
-                ;
-            if (pNaluStart == pEnd) break;
-            pNaluEnd = findStartcode(pNaluStart, pEnd);
+        std::vector<std::pair<int, int>> nalus;
+        findNalus(data, length, nalus);
+        for (auto &nalu : nalus) {
+            const uint8_t *pNaluStart = data + nalu.first;
+            const uint8_t *pNaluEnd = pNaluStart + nalu.second;
             BitReader br(pNaluStart, 2);
             br.skipBits(1);
             uint8_t naluType = br.getBits(6);
@@ -318,7 +269,6 @@ void parseCsdHEVC(const uint8_t *data,
                 default:
                     break;
             }
-            pNaluStart = pNaluEnd;
         }
     }
 }
@@ -330,27 +280,6 @@ int64_t rescaleTimeStamp(int64_t timeStamp, int inTimeScale, int outTimeScale) {
     return (t / inTimeScale);
 }
 
-struct TimerContext {
-    TimerContext() { timerIsUp = false; }
-    bool timerIsUp;
-    std::mutex timerMutex;
-    std::condition_variable timerCv;
-};
-
-static void callback(UINT, UINT, DWORD_PTR dwUser, DWORD_PTR, DWORD_PTR) {
-    TimerContext *pCtx = (TimerContext *)dwUser;
-    std::unique_lock<std::mutex> lk(pCtx->timerMutex);
-    pCtx->timerIsUp = true;
-    pCtx->timerCv.notify_all();
-}
-
 void msleep(int ms) {
-    timeBeginPeriod(1);
-    TimerContext ctx;
-    ctx.timerIsUp = false;
-    UINT timerId = timeSetEvent(ms, 1, callback, (DWORD_PTR)&ctx, TIME_ONESHOT);
-    std::unique_lock<std::mutex> lk(ctx.timerMutex);
-    ctx.timerCv.wait(lk, [&ctx]() { return ctx.timerIsUp; });
-    timeKillEvent(timerId);
-    timeEndPeriod(1);
+    TimerService::getInstance().sleepFor((int64_t)ms * 1000);
 }
@@ -5,6 +5,8 @@
 #include <string>
 #include <vector>
 
+#include "Startcode.h"
+
 enum MediaCodecType {
     MEDIA_CODEC_TYPE_UNKNOWN,
     MEDIA_CODEC_TYPE_AUDIO,
@@ -15,8 +17,6 @@ std::string &trim(std::string &str);
 // substr between first char b and first char e
 std::string substr(std::string &s, const char b, const char e);
 
-const uint8_t *findStartcode(const uint8_t *p, const uint8_t *end);
-
 bool isIPv4(std::string addr);
 bool isIPv6(std::string addr);
 
@@ -35,6 +35,7 @@ void parseCsdHEVC(const uint8_t *data,
 
 int64_t rescaleTimeStamp(int64_t timeStamp, int inTimeScale, int outTimeScale);
 
+// deadline based, see TimerService::sleepFor()
 void msleep(int ms);
 
 #endif
@@ -2,6 +2,10 @@
 #include <QtGui/QScreen>
 
 #include "ui/MainWindow.h"
+#include "foundation/Metrics.h"
+#include "foundation/Trace.h"
+
+#include <cstdlib>
 
 #include <windows.h>
 
@@ -19,5 +23,24 @@ int main(int argc, char *argv[]) {
            (pScreen->size().height() - w.height()) / 2);
     w.show();
 
-    return app.exec();
+    // VTB_METRICS_FILE=metrics.json rewrites the file every second for external scrapers
+    const char *metricsFile = std::getenv("VTB_METRICS_FILE");
+    if (metricsFile) MetricsRegistry::getInstance().startPeriodicDump(1000, metricsFile);
+
+#if defined(ENABLE_TRACE)
+    // VTB_TRACE_FILE=trace.json records the whole run, open it in ui.perfetto.dev
+    const char *traceFile = std::getenv("VTB_TRACE_FILE");
+    if (traceFile) traceStart();
+#endif
+
+    int ret = app.exec();
+
+#if defined(ENABLE_TRACE)
+    if (traceFile) {
+        traceStop();
+        if (!traceExport(traceFile)) printf("Failed to write trace %s\n", traceFile);
+    }
+#endif
+    MetricsRegistry::getInstance().stopPeriodicDump();
+    return ret;
 }
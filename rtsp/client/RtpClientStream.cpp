@@ -2,6 +2,7 @@
 #include "foundation/BitReader.h"
 #include "foundation/BitWriter.h"
 #include "foundation/Log.h"
+#include "foundation/Metrics.h"
 
 void RtpClientBaseProto::processRtcpPackage(const uint8_t *data, int length) {}
 
@@ -31,12 +32,12 @@ void RtpClientMPEG4Proto::processRtpPackage(const uint8_t *data, int length) {
     data += auHeaderCount * 2;
     length -= auHeaderCount * 2;
 
+    // AUs are handed out as views into the rtp package
     for (int i = 0; i < auHeaderCount; ++i) {
-        mData.insert(mData.end(), data, data + auSizes[i]);
+        if (auSizes[i] > length) break;
+        if (mBufferReadyCB) mBufferReadyCB(data, auSizes[i]);
         data += auSizes[i];
         length -= auSizes[i];
-        if (mBufferReadyCB) mBufferReadyCB(mData.data(), mData.size());
-        mData.clear();
     }
 }
 
@@ -57,9 +58,8 @@ void RtpClientLATMProto::processRtpPackage(const uint8_t *data, int length) {
     size += *data;
     ++data;
     --length;
-    mData.insert(mData.end(), data, data + size);
-    if (mBufferReadyCB) mBufferReadyCB(mData.data(), mData.size());
-    mData.clear();
+    if (size > length) return;
+    if (mBufferReadyCB) mBufferReadyCB(data, size);
 }
 
 const std::string RtpClientH264Proto::MIME = "H264;AVC";
@@ -123,13 +123,7 @@ void RtpClientH264Proto::processRtpPackage(const uint8_t *data, int length) {
                 br.skipBits(1); // F bit
                 uint8_t naluType = br.getBits(5);
                 uint8_t naluHeader[1] = {0};
-                {
-                    BitWriter bw(naluHeader, sizeof(naluHeader));
-                    bw.putBits(0, 1);
-                    bw.putBits(nri, 2);
-                    bw.putBits(naluType, 5);
-                    bw.flush();
-                }
+                putFixedBits<1, 2, 5>(naluHeader, 0, nri, naluType);
                 data += sizeof(FUAHeader);
                 length -= sizeof(FUAHeader);
 
@@ -211,14 +205,7 @@ void RtpClientHEVCProto::processRtpPackage(const uint8_t *data, int length) {
                 uint8_t end = br.getBits(1);
                 uint8_t naluType = br.getBits(6);
                 uint8_t naluHeader[2] = {0};
-                {
-                    BitWriter bw(naluHeader, sizeof(naluHeader));
-                    bw.putBits(0, 1);
-                    bw.putBits(naluType, 6);
-                    bw.putBits(0, 6);
-                    bw.putBits(tid, 3);
-                    bw.flush();
-                }
+                putFixedBits<1, 6, 6, 3>(naluHeader, 0, naluType, 0, tid);
                 data += sizeof(FUHeader);
                 length -= sizeof(FUHeader);
 
@@ -335,6 +322,13 @@ void RtpClientStream::receiveThread() {
     int recvBufLength = 1024 * 2;
     char *pRecvBuf = new char[recvBufLength];
 
+    MetricsRegistry &metrics = MetricsRegistry::getInstance();
+    MetricCounter &packetsReceived = metrics.counter("rtsp.client.rtp_packets_received");
+    MetricCounter &bytesReceived = metrics.counter("rtsp.client.rtp_bytes_received");
+    // packets missing from the sequence, reordered packets are not told apart
+    MetricCounter &packetsLost = metrics.counter("rtsp.client.rtp_packets_lost");
+    int lastSeq = -1;
+
     FD_SET fds;
     while (true) {
         FD_ZERO(&fds);
@@ -354,6 +348,15 @@ void RtpClientStream::receiveThread() {
                      WSAGetLastError());
                 break;
             }
+            packetsReceived.add();
+            bytesReceived.add(recvLen);
+            if (recvLen >= 4) {
+                int seq = ((uint8_t)pRecvBuf[2] << 8) | (uint8_t)pRecvBuf[3];
+                uint16_t gap = (uint16_t)(seq - lastSeq - 1);
+                // a jump backwards (gap close to 65535) is a reordered or repeated packet
+                if (lastSeq >= 0 && gap > 0 && gap < 0x8000) packetsLost.add(gap);
+                lastSeq = seq;
+            }
             if (mRtpProto) mRtpProto->processRtpPackage((const uint8_t *)pRecvBuf, recvLen);
         }
 
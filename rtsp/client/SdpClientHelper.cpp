@@ -162,25 +162,17 @@ void SdpClientH264Stream::parseFmtp(std::string fmtp) {
             mProfileIdc = profileIdc;
             mProfileIop = profileIop;
             mLevelIdc = levelIdc;
-        } else if (token.starts_with("sprop-parameter-sets")) {
-            char param[256];
-            if (std::sscanf(token.c_str(), "sprop-parameter-sets=%s", param) != 1) return;
-            size_t spsSize = 0, ppsSize = 0, ppsOffset = 0;
-            char *p = param;
-            while (*p++ != ';') ++spsSize;
-            param[spsSize] = '\0';
-            ppsOffset = spsSize + 1;
-            p = param + ppsOffset;
-            while (*p++ != '\0') ++ppsSize;
-
-            uint8_t csd[256];
-            size_t csdSize = sizeof(csd);
-            decodeBase64(param, &csdSize, csd);
-            mSps.insert(mSps.end(), csd, csd + csdSize);
-
-            csdSize = sizeof(csd);
-            decodeBase64(param + ppsOffset, &csdSize, csd);
-            mPps.insert(mPps.end(), csd, csd + csdSize);
+        } else if (token.starts_with("sprop-parameter-sets=")) {
+            if (token.ends_with(';')) token.pop_back();
+            // sprop-parameter-sets=<sps>,<pps>
+            std::string param = token.substr(std::strlen("sprop-parameter-sets="));
+            size_t comma = param.find(',');
+            if (comma == std::string::npos) return;
+            if (!decodeBase64(param.substr(0, comma), mSps) ||
+                !decodeBase64(param.substr(comma + 1), mPps)) {
+                LOGE("SdpClientH264Stream failed to decode sprop-parameter-sets\n");
+                return;
+            }
         }
     }
 }
@@ -223,27 +215,25 @@ void SdpClientHEVCStream::parseFmtp(std::string fmtp) {
 
     std::stringstream ss(fmtp.substr(pos, fmtp.size() - pos));
     std::string token;
-    char param[256];
-    uint8_t csd[256];
-    size_t csdSize = sizeof(csd);
     while (std::getline(ss, token, ' ')) {
         if (token.ends_with(';')) token = token.substr(0, token.size() - 1);
 
-        if (token.starts_with("sprop-sps")) {
-            if (std::sscanf(token.c_str(), "sprop-sps=%s", param) != 1) return;
-            csdSize = sizeof(csd);
-            decodeBase64(param, &csdSize, csd);
-            mSps.insert(mSps.end(), csd, csd + csdSize);
-        } else if (token.starts_with("sprop-pps")) {
-            if (std::sscanf(token.c_str(), "sprop-pps=%s", param) != 1) return;
-            csdSize = sizeof(csd);
-            decodeBase64(param, &csdSize, csd);
-            mPps.insert(mPps.end(), csd, csd + csdSize);
-        } else if (token.starts_with("sprop-vps")) {
-            if (std::sscanf(token.c_str(), "sprop-vps=%s", param) != 1) return;
-            csdSize = sizeof(csd);
-            decodeBase64(param, &csdSize, csd);
-            mVps.insert(mVps.end(), csd, csd + csdSize);
+        size_t eq = token.find('=');
+        if (eq == std::string::npos) continue;
+        std::string name = token.substr(0, eq);
+        std::string param = token.substr(eq + 1);
+
+        std::vector<uint8_t> *csd = nullptr;
+        if (name == "sprop-sps") {
+            csd = &mSps;
+        } else if (name == "sprop-pps") {
+            csd = &mPps;
+        } else if (name == "sprop-vps") {
+            csd = &mVps;
+        }
+        if (csd && !decodeBase64(param, *csd)) {
+            LOGE("SdpClientHEVCStream failed to decode %s\n", name.c_str());
+            return;
         }
     }
 }
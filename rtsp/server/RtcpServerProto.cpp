@@ -0,0 +1,116 @@
+#include "RtcpServerProto.h"
+
+#include <algorithm>
+#include <chrono>
+
+// seconds from 1900, the NTP epoch, to 1970
+static const uint64_t NTP_UNIX_OFFSET_S = 2208988800ull;
+
+static void write16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+static void write32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static uint32_t read32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// version 2, no padding, count and type, length in 32 bit words minus one
+static void writeHeader(uint8_t *p, int count, int packetType, size_t size) {
+    p[0] = (uint8_t)(0x80 | count);
+    p[1] = (uint8_t)packetType;
+    write16(p + 2, (uint16_t)(size / 4 - 1));
+}
+
+size_t RtcpServerProto::buildSenderReport(const RtcpSenderInfo &info,
+                                          const std::string &cname,
+                                          uint8_t *data,
+                                          size_t capacity) {
+    size_t cnameSize = std::min<size_t>(cname.size(), 255);
+    // ssrc, CNAME item, end item, padded to a word
+    size_t sdesSize = 4 + ((4 + 2 + cnameSize + 1 + 3) & ~(size_t)3);
+    size_t size = 28 + sdesSize;
+    if (size > capacity) return 0;
+
+    writeHeader(data, 0, RTCP_PACKET_SR, 28);
+    write32(data + 4, info.ssrc);
+    write32(data + 8, (uint32_t)(info.ntpTimestamp >> 32));
+    write32(data + 12, (uint32_t)info.ntpTimestamp);
+    write32(data + 16, info.rtpTimestamp);
+    write32(data + 20, info.packetCount);
+    write32(data + 24, info.octetCount);
+
+    uint8_t *sdes = data + 28;
+    std::fill(sdes, sdes + sdesSize, 0);
+    writeHeader(sdes, 1, RTCP_PACKET_SDES, sdesSize);
+    write32(sdes + 4, info.ssrc);
+    sdes[8] = 1; // CNAME
+    sdes[9] = (uint8_t)cnameSize;
+    std::copy(cname.begin(), cname.begin() + cnameSize, sdes + 10);
+    return size;
+}
+
+size_t RtcpServerProto::buildBye(const RtcpSenderInfo &info,
+                                 const std::string &cname,
+                                 uint8_t *data,
+                                 size_t capacity) {
+    size_t size = buildSenderReport(info, cname, data, capacity);
+    if (!size || size + 8 > capacity) return 0;
+
+    writeHeader(data + size, 1, RTCP_PACKET_BYE, 8);
+    write32(data + size + 4, info.ssrc);
+    return size + 8;
+}
+
+bool RtcpServerProto::parseReports(const uint8_t *data,
+                                   size_t size,
+                                   std::vector<RtcpReportBlock> &blocks) {
+    while (size) {
+        if (size < 4 || (data[0] >> 6) != 2) return false;
+        size_t packetSize = ((size_t)((data[2] << 8) | data[3]) + 1) * 4;
+        if (packetSize > size) return false;
+
+        int count = data[0] & 0x1f;
+        size_t blockOffset = 0;
+        if (data[1] == RTCP_PACKET_SR) {
+            blockOffset = 28;
+        } else if (data[1] == RTCP_PACKET_RR) {
+            blockOffset = 8;
+        }
+        if (blockOffset) {
+            if (blockOffset + count * 24 > packetSize) return false;
+            for (int i = 0; i < count; ++i) {
+                const uint8_t *p = data + blockOffset + i * 24;
+                RtcpReportBlock block;
+                block.ssrc = read32(p);
+                block.fractionLost = p[4];
+                // sign extend the 24 bit count
+                block.cumulativeLost = (int32_t)(read32(p + 4) << 8) >> 8;
+                block.highestSeq = read32(p + 8);
+                block.jitter = read32(p + 12);
+                block.lastSr = read32(p + 16);
+                block.delaySinceLastSr = read32(p + 20);
+                blocks.emplace_back(block);
+            }
+        }
+
+        data += packetSize;
+        size -= packetSize;
+    }
+    return true;
+}
+
+uint64_t RtcpServerProto::ntpNow() {
+    auto sinceEpoch = std::chrono::system_clock::now().time_since_epoch();
+    uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(sinceEpoch).count();
+    uint64_t seconds = us / 1000000 + NTP_UNIX_OFFSET_S;
+    uint64_t fraction = ((us % 1000000) << 32) / 1000000;
+    return (seconds << 32) | fraction;
+}
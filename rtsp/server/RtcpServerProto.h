@@ -0,0 +1,65 @@
+#ifndef RTCP_SERVER_PROTO_H
+#define RTCP_SERVER_PROTO_H
+
+#include <cstdint>
+#include <cstddef>
+
+#include <string>
+#include <vector>
+
+// sender side of a stream, RFC 3550 6.4.1
+struct RtcpSenderInfo {
+    uint32_t ssrc;
+    uint64_t ntpTimestamp; // 32.32 fixed point seconds since 1900
+    uint32_t rtpTimestamp; // the same instant on the stream's RTP clock
+    uint32_t packetCount;
+    uint32_t octetCount; // payload only
+};
+
+// what a receiver reports about one source, RFC 3550 6.4.1
+struct RtcpReportBlock {
+    uint32_t ssrc;             // source reported on
+    uint8_t fractionLost;      // of 256, since the receiver's previous report
+    int32_t cumulativeLost;    // 24 bit signed, duplicates can make it negative
+    uint32_t highestSeq;       // extended with the cycle count
+    uint32_t jitter;           // RTP timestamp units
+    uint32_t lastSr;           // middle 32 bits of the NTP timestamp of the last SR received
+    uint32_t delaySinceLastSr; // 1/65536 seconds
+};
+
+// RTCP as far as the server needs it: compound sender reports (SR and SDES CNAME) and BYE
+// going out, the report blocks of receiver and sender reports coming in.
+class RtcpServerProto {
+public:
+    enum RtcpPacketType {
+        RTCP_PACKET_SR = 200,
+        RTCP_PACKET_RR = 201,
+        RTCP_PACKET_SDES = 202,
+        RTCP_PACKET_BYE = 203,
+    };
+
+    // enough for any packet built here with a CNAME of up to 255 bytes
+    const static size_t RTCP_MAX_PACKET_SIZE = 28 + 268 + 8;
+
+    // SR without report blocks followed by the SDES CNAME, returns the size
+    static size_t buildSenderReport(const RtcpSenderInfo &info,
+                                    const std::string &cname,
+                                    uint8_t *data,
+                                    size_t capacity);
+    // SR, SDES and BYE, the compound packet sent when a stream stops
+    static size_t buildBye(const RtcpSenderInfo &info,
+                           const std::string &cname,
+                           uint8_t *data,
+                           size_t capacity);
+    // report blocks of every SR and RR in a compound packet, false when it is malformed
+    static bool parseReports(const uint8_t *data,
+                             size_t size,
+                             std::vector<RtcpReportBlock> &blocks);
+
+    // wall clock as an NTP timestamp
+    static uint64_t ntpNow();
+    // the form LSR and DLSR use
+    static uint32_t ntpMiddle32(uint64_t ntpTimestamp) { return (uint32_t)(ntpTimestamp >> 16); }
+};
+
+#endif
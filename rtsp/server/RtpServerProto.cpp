@@ -3,38 +3,123 @@
 #include "foundation/BitReader.h"
 #include "foundation/Utils.h"
 
-#include <cstring>
+#include <algorithm>
 
-#include <random>
-
-#include <winsock2.h>
+#include "foundation/Socket.h"
 
 RtpServerBaseProto::RtpServerBaseProto()
-    : mPayloadType(0), mIsFirstPack(true), mIsLastPack(false), mOffset(0), mPayloadSize(0),
-      mPacketTimestamp(0) {
-    mpBuffer = new uint8_t[RTP_MAX_FRAME_SIZE];
+    : mPayloadType(0), mIsFirstPack(true), mOffset(0), mPayloadSize(0), mPacketTimestamp(0),
+      mpPacketList(nullptr) {}
+
+RtpServerBaseProto::~RtpServerBaseProto() {}
+
+std::shared_ptr<RtpServerBaseProto> RtpServerBaseProto::create(const std::string &mime,
+                                                               int payloadType) {
+    if (mime.empty()) return nullptr;
+    if (RtpServerAACProto::MIME.find(mime) != std::string::npos) {
+        return std::make_shared<RtpServerAACProto>(payloadType);
+    } else if (RtpServerH264Proto::MIME.find(mime) != std::string::npos) {
+        return std::make_shared<RtpServerH264Proto>(payloadType);
+    } else if (RtpServerHEVCProto::MIME.find(mime) != std::string::npos) {
+        return std::make_shared<RtpServerHEVCProto>(payloadType);
+    }
+    return nullptr;
+}
+
+void RtpServerBaseProto::patchHeader(uint8_t *header,
+                                     uint16_t seq,
+                                     uint32_t timestampOffset,
+                                     uint32_t ssrc) {
+    RtpHeader *rtpHeader = (RtpHeader *)header;
+    rtpHeader->seq = htons(seq);
+    rtpHeader->timestamp = htonl(ntohl(rtpHeader->timestamp) + timestampOffset);
+    rtpHeader->ssrc = htonl(ssrc);
+}
+
+std::shared_ptr<RtpPacketList>
+RtpServerBaseProto::packetize(std::shared_ptr<AVPacketBuffer> packetBuffer) {
+    auto packetList = std::make_shared<RtpPacketList>();
+    packetList->packetBuffer = packetBuffer;
+    packetList->headers.reserve(packetBuffer->size() / 64 + 64);
+    mpPacketList = packetList.get();
+    mPieces.clear();
 
-    std::mt19937 engine(std::random_device{}());
+    prepare(packetBuffer);
+    while (buildRtpPackage()) {
+    }
+    mpPacketList = nullptr;
+
+    // headers is complete, the header pieces can point into it now
+    packetList->buffers.reserve(mPieces.size());
+    for (auto &piece : mPieces) {
+        const uint8_t *data = piece.data ? piece.data : packetList->headers.data() + piece.offset;
+        packetList->buffers.push_back({data, piece.size});
+    }
 
-    mSeqNum = engine() % (USHRT_MAX);
-    mSSRC = engine();
-    mBaseTimestamp = engine();
+    // RFC 6184/7798 mark the last packet of the access unit
+    if (!packetList->packets.empty()) {
+        uint8_t *header = packetList->headers.data() + packetList->packets.back().headerOffset;
+        ((RtpHeader *)header)->marker = 1;
+    }
+
+    return packetList;
 }
 
-RtpServerBaseProto::~RtpServerBaseProto() {
-    delete[] mpBuffer;
+void RtpServerBaseProto::beginPacket() {
+    // RTP headers start 4 byte aligned
+    auto &headers = mpPacketList->headers;
+    headers.resize((headers.size() + 3) & ~(size_t)3);
+
+    RtpPacketList::Packet packet;
+    packet.headerOffset = (uint32_t)headers.size();
+    packet.firstBuffer = (uint32_t)mPieces.size();
+    packet.bufferCount = 0;
+    packet.size = 0;
+    mpPacketList->packets.push_back(packet);
+
+    RtpHeader *header = (RtpHeader *)appendHeader(RTP_HEADER_SIZE);
+    header->version = 2;
+    header->padding = 0;
+    header->ext = 0;
+    header->cc = 0;
+    header->marker = 0;
+    header->payload = mPayloadType;
+    // per session, see patchHeader()
+    header->seq = 0;
+    header->timestamp = htonl((uint32_t)mPacketTimestamp);
+    header->ssrc = 0;
+}
+
+uint8_t *RtpServerBaseProto::appendHeader(uint32_t n) {
+    auto &packet = mpPacketList->packets.back();
+    auto &headers = mpPacketList->headers;
+    uint32_t offset = (uint32_t)headers.size();
+    headers.resize(offset + n);
+
+    // the RTP header stays a buffer of its own, the sessions send a patched copy instead
+    if (packet.bufferCount > 1 && !mPieces.back().data) {
+        mPieces.back().size += n;
+    } else {
+        mPieces.push_back({nullptr, offset, n});
+        packet.bufferCount++;
+    }
+    packet.size += n;
+    return headers.data() + offset;
+}
+
+void RtpServerBaseProto::appendPayload(const uint8_t *data, uint32_t n) {
+    if (!n) return;
+    auto &packet = mpPacketList->packets.back();
+    mPieces.push_back({data, 0, n});
+    packet.bufferCount++;
+    packet.size += n;
 }
 
 void RtpServerBaseProto::prepareInternal() {
     mIsFirstPack = true;
-    mIsLastPack = false;
     mOffset = 0;
 }
 
-int RtpServerBaseProto::buildRtcpPakcage() {
-    return 0;
-}
-
 std::string RtpServerAACProto::MIME = "AAC";
 
 RtpServerAACProto::RtpServerAACProto(int payloadType) : mpData(nullptr), mSize(0) {
@@ -56,42 +141,17 @@ void RtpServerAACProto::prepare(std::shared_ptr<AVPacketBuffer> packetBuffer) {
     prepareInternal();
 }
 
-int RtpServerAACProto::buildRtpPackage(uint8_t **out) {
-    int bufferedSize = 0;
-    uint8_t marker = 0;
-
-    RtpHeader *header = (RtpHeader *)mpBuffer;
-
-    if (mSize > 0) {
-        // ADTS package
-        BitWriter bw(mpBuffer + RTP_HEADER_SIZE, 4); // single package
-        bw.putBits(sizeof(uint16_t) * 8, 16);        // AU-headers-length in bits
-        bw.putBits(mSize, 13);                       // AU-header
-        bw.putBits(0, 3);
-        bw.flush();
-        bufferedSize += 4;
-
-        std::memcpy(mpBuffer + RTP_HEADER_SIZE + bufferedSize, mpData, mSize);
-        bufferedSize += mSize;
-        mSize = 0;
-        marker = 1;
-    }
+bool RtpServerAACProto::buildRtpPackage() {
+    if (mSize <= 0) return false;
 
-    *out = mpBuffer;
-    if (bufferedSize) {
-        header->version = 2;
-        header->padding = 0;
-        header->ext = 0;
-        header->cc = 0;
-        header->marker = marker;
-        header->payload = mPayloadType;
-        header->seq = htons(++mSeqNum);
-        header->timestamp = htonl((uint32_t)(mBaseTimestamp + mPacketTimestamp));
-        header->ssrc = htonl(mSSRC);
-        return bufferedSize + RTP_HEADER_SIZE;
-    }
+    // ADTS package
+    // single package: AU-headers-length in bits, AU-header (size, index)
+    beginPacket();
+    putFixedBits<16, 13, 3>(appendHeader(4), sizeof(uint16_t) * 8, mSize, 0);
+    appendPayload(mpData, mSize);
+    mSize = 0;
 
-    return bufferedSize;
+    return true;
 }
 
 std::string RtpServerH264Proto::MIME = "H264;AVC";
@@ -134,20 +194,7 @@ void RtpServerH264Proto::prepare(std::shared_ptr<AVPacketBuffer> packetBuffer) {
         }
     } else {
         // split NALUs
-        const uint8_t *pStart = data;
-        const uint8_t *pEnd = data + size;
-
-        const uint8_t *pNaluStart = findStartcode(pStart, pEnd);
-        const uint8_t *pNaluEnd = nullptr;
-        while (true) {
-            while (pNaluStart && (pNaluStart < pEnd) && !*(pNaluStart++))
-                ;
-            if (pNaluStart == pEnd) break;
-            pNaluEnd = findStartcode(pNaluStart, pEnd);
-            mNalus.emplace_back(
-                std::make_pair((int)(pNaluStart - pStart), (int)(pNaluEnd - pNaluStart)));
-            pNaluStart = pNaluEnd;
-        }
+        findNalus(data, size, mNalus);
     }
 
     mCurrNalu = mNalus.cbegin();
@@ -155,107 +202,70 @@ void RtpServerH264Proto::prepare(std::shared_ptr<AVPacketBuffer> packetBuffer) {
     prepareInternal();
 }
 
-int RtpServerH264Proto::buildRtpPackage(uint8_t **out) {
-    int bufferedSize = 0;
-    int bufferedNalus = 0;
-    int headerSize = 0;
-    int payloadSize = 0;
-    uint8_t marker = 0;
-
-    RtpHeader *header = (RtpHeader *)mpBuffer;
-
-    for (; mCurrNalu != mNalus.cend(); ++mCurrNalu) {
-        mCurrNaluType = ((const RtpPayloadHeader *)(mpData + mCurrNalu->first))->type;
-        mCurrNRI = ((const RtpPayloadHeader *)(mpData + mCurrNalu->first))->nri;
-        payloadSize = mCurrNalu->second;
-        if (payloadSize <= RTP_MAX_PAYLOAD_SIZE) {
-            // try STAP-A
-            if (bufferedSize == 0)
-                headerSize = sizeof(RtpPayloadHeader);
-            else
-                headerSize = 0;
-
-            if (bufferedSize + headerSize + 2 + payloadSize <= RTP_MAX_PAYLOAD_SIZE) {
-                // build in current package
-                if (headerSize) {
-                    RtpPayloadHeader *payloadHeader =
-                        (RtpPayloadHeader *)(mpBuffer + RTP_HEADER_SIZE);
-                    payloadHeader->f = 0;
-                    payloadHeader->nri = mCurrNRI;
-                    payloadHeader->type = RTP_PAYLOAD_STAP_A;
-                    bufferedSize += sizeof(RtpPayloadHeader);
-                }
-                *(uint16_t *)(mpBuffer + RTP_HEADER_SIZE + bufferedSize) = htons(payloadSize);
-                bufferedSize += 2;
-                std::memcpy(mpBuffer + RTP_HEADER_SIZE + bufferedSize, mpData + mCurrNalu->first,
-                            payloadSize);
-                bufferedSize += payloadSize;
-
-                bufferedNalus += 1;
-            } else {
-                // build in next package
-                break;
-            }
+bool RtpServerH264Proto::buildRtpPackage() {
+    if (mCurrNalu == mNalus.cend()) return false;
+
+    const uint8_t *nalu = mpData + mCurrNalu->first;
+    int naluSize = mCurrNalu->second;
+    mCurrNaluType = ((const RtpPayloadHeader *)nalu)->type;
+    mCurrNRI = ((const RtpPayloadHeader *)nalu)->nri;
+
+    beginPacket();
+    if (naluSize <= RTP_MAX_PAYLOAD_SIZE) {
+        // the following NALUs that fit go into a STAP-A with it
+        auto end = mCurrNalu + 1;
+        int aggregatedSize = sizeof(RtpPayloadHeader) + 2 + naluSize;
+        while (end != mNalus.cend() && end - mCurrNalu < RTP_MAX_AGGREGATED_NALUS &&
+               aggregatedSize + 2 + end->second <= RTP_MAX_PAYLOAD_SIZE) {
+            aggregatedSize += 2 + end->second;
+            ++end;
+        }
+
+        if (end - mCurrNalu == 1) {
+            // Single NAL unit packet
+            appendPayload(nalu, naluSize);
         } else {
-            if (bufferedSize > 0) break;
-
-            // FU-A
-            FUAHeader *fuHeader = (FUAHeader *)(mpBuffer + RTP_HEADER_SIZE);
-            fuHeader->indicator.f = 0;
-            fuHeader->indicator.nri = mCurrNRI;
-            fuHeader->indicator.type = RTP_PAYLOAD_FU_A;
-            fuHeader->f = 0;
-            fuHeader->type = mCurrNaluType;
-            if (mIsFirstPack) {
-                fuHeader->start = 1;
-                mOffset = mCurrNalu->first + sizeof(RtpPayloadHeader);
-                mPayloadSize = payloadSize - sizeof(RtpPayloadHeader);
-                mIsFirstPack = false;
-            } else
-                fuHeader->start = 0;
-            fuHeader->end = 0;
-            bufferedSize += sizeof(FUAHeader);
-
-            if (bufferedSize + mPayloadSize <= RTP_MAX_PAYLOAD_SIZE) {
-                std::memcpy(mpBuffer + RTP_HEADER_SIZE + bufferedSize, mpData + mOffset,
-                            mPayloadSize);
-                bufferedSize += mPayloadSize;
-                marker = 1;
-                fuHeader->end = 1;
-            } else {
-                int copySize = RTP_MAX_PAYLOAD_SIZE - bufferedSize;
-                std::memcpy(mpBuffer + RTP_HEADER_SIZE + bufferedSize, mpData + mOffset, copySize);
-                bufferedSize += copySize;
-                mOffset += copySize;
-                mPayloadSize -= copySize;
-                break;
+            RtpPayloadHeader *payloadHeader =
+                (RtpPayloadHeader *)appendHeader(sizeof(RtpPayloadHeader));
+            payloadHeader->f = 0;
+            payloadHeader->nri = mCurrNRI;
+            payloadHeader->type = RTP_PAYLOAD_STAP_A;
+            for (; mCurrNalu != end; ++mCurrNalu) {
+                uint8_t *naluSize = appendHeader(2);
+                naluSize[0] = (uint8_t)(mCurrNalu->second >> 8);
+                naluSize[1] = (uint8_t)mCurrNalu->second;
+                appendPayload(mpData + mCurrNalu->first, mCurrNalu->second);
             }
         }
+        mCurrNalu = end;
+    } else {
+        // FU-A
+        if (mIsFirstPack) {
+            mOffset = mCurrNalu->first + sizeof(RtpPayloadHeader);
+            mPayloadSize = naluSize - sizeof(RtpPayloadHeader);
+        }
+        uint32_t size = std::min<uint32_t>(mPayloadSize, RTP_MAX_PAYLOAD_SIZE - sizeof(FUAHeader));
+
+        FUAHeader *fuHeader = (FUAHeader *)appendHeader(sizeof(FUAHeader));
+        fuHeader->indicator.f = 0;
+        fuHeader->indicator.nri = mCurrNRI;
+        fuHeader->indicator.type = RTP_PAYLOAD_FU_A;
+        fuHeader->f = 0;
+        fuHeader->type = mCurrNaluType;
+        fuHeader->start = mIsFirstPack;
+        fuHeader->end = size == mPayloadSize;
+        appendPayload(mpData + mOffset, size);
+
+        mIsFirstPack = false;
+        mOffset += size;
+        mPayloadSize -= size;
+        if (!mPayloadSize) {
+            mIsFirstPack = true;
+            ++mCurrNalu;
+        }
     }
 
-    // need change from STAP-A to Single NAL unit packet
-    if (bufferedNalus == 1) {
-        int naluSize = ntohs(*(uint16_t *)(mpBuffer + RTP_HEADER_SIZE + sizeof(RtpPayloadHeader)));
-        std::memmove(mpBuffer + RTP_HEADER_SIZE,
-                     mpBuffer + RTP_HEADER_SIZE + sizeof(RtpPayloadHeader) + 2, naluSize);
-        bufferedSize = naluSize;
-    }
-
-    *out = mpBuffer;
-    if (bufferedSize) {
-        header->version = 2;
-        header->padding = 0;
-        header->ext = 0;
-        header->cc = 0;
-        header->marker = marker;
-        header->payload = mPayloadType;
-        header->seq = htons(++mSeqNum);
-        header->timestamp = htonl((uint32_t)(mBaseTimestamp + mPacketTimestamp));
-        header->ssrc = htonl(mSSRC);
-        return bufferedSize + RTP_HEADER_SIZE;
-    }
-
-    return bufferedSize;
+    return true;
 }
 
 std::string RtpServerHEVCProto::MIME = "H265;HEVC";
@@ -298,20 +308,7 @@ void RtpServerHEVCProto::prepare(std::shared_ptr<AVPacketBuffer> packetBuffer) {
         }
     } else {
         // split NALUs
-        const uint8_t *pStart = data;
-        const uint8_t *pEnd = data + size;
-
-        const uint8_t *pNaluStart = findStartcode(pStart, pEnd);
-        const uint8_t *pNaluEnd = nullptr;
-        while (true) {
-            while (pNaluStart && (pNaluStart < pEnd) && !*(pNaluStart++))
-                ;
-            if (pNaluStart == pEnd) break;
-            pNaluEnd = findStartcode(pNaluStart, pEnd);
-            mNalus.emplace_back(
-                std::make_pair((int)(pNaluStart - pStart), (int)(pNaluEnd - pNaluStart)));
-            pNaluStart = pNaluEnd;
-        }
+        findNalus(data, size, mNalus);
     }
 
     mCurrNalu = mNalus.cbegin();
@@ -319,113 +316,68 @@ void RtpServerHEVCProto::prepare(std::shared_ptr<AVPacketBuffer> packetBuffer) {
     prepareInternal();
 }
 
-int RtpServerHEVCProto::buildRtpPackage(uint8_t **out) {
-    int bufferedSize = 0;
-    int bufferedNalus = 0;
-    int headerSize = 0;
-    int payloadSize = 0;
-    uint8_t marker = 0;
-
-    RtpHeader *header = (RtpHeader *)mpBuffer;
+bool RtpServerHEVCProto::buildRtpPackage() {
+    if (mCurrNalu == mNalus.cend()) return false;
+
+    const uint8_t *nalu = mpData + mCurrNalu->first;
+    int naluSize = mCurrNalu->second;
+    BitReader br(nalu, sizeof(RtpPayloadHeader));
+    br.skipBits(1);
+    mCurrNaluType = br.getBits(6);
+    br.skipBits(6);
+    mCurrTid = br.getBits(3);
+
+    beginPacket();
+    if (naluSize <= RTP_MAX_PAYLOAD_SIZE) {
+        // the following NALUs that fit go into an AP with it
+        auto end = mCurrNalu + 1;
+        int aggregatedSize = sizeof(RtpPayloadHeader) + 2 + naluSize;
+        while (end != mNalus.cend() && end - mCurrNalu < RTP_MAX_AGGREGATED_NALUS &&
+               aggregatedSize + 2 + end->second <= RTP_MAX_PAYLOAD_SIZE) {
+            aggregatedSize += 2 + end->second;
+            ++end;
+        }
 
-    for (; mCurrNalu != mNalus.cend(); ++mCurrNalu) {
-        BitReader br(mpData + mCurrNalu->first, sizeof(RtpPayloadHeader));
-        br.skipBits(1);
-        mCurrNaluType = br.getBits(6);
-        br.skipBits(6);
-        mCurrTid = br.getBits(3);
-        payloadSize = mCurrNalu->second;
-
-        if (payloadSize <= RTP_MAX_PAYLOAD_SIZE) {
-            // try APs
-            if (bufferedSize == 0)
-                headerSize = sizeof(RtpPayloadHeader);
-            else
-                headerSize = 0;
-
-            if (bufferedSize + headerSize + 2 + payloadSize <= RTP_MAX_PAYLOAD_SIZE) {
-                // build in current package
-                if (headerSize) {
-                    BitWriter bw(mpBuffer + RTP_HEADER_SIZE, sizeof(RtpPayloadHeader));
-                    bw.putBits(0, 1);               // F bit
-                    bw.putBits(RTP_PAYLOAD_APS, 6); // type
-                    bw.putBits(0, 6);               // layer ID
-                    bw.putBits(mCurrTid, 3);        // tid
-                    bw.flush();
-                    bufferedSize += sizeof(RtpPayloadHeader);
-                }
-                *(uint16_t *)(mpBuffer + RTP_HEADER_SIZE + bufferedSize) = htons(payloadSize);
-                bufferedSize += 2;
-                std::memcpy(mpBuffer + RTP_HEADER_SIZE + bufferedSize, mpData + mCurrNalu->first,
-                            payloadSize);
-                bufferedSize += payloadSize;
-
-                bufferedNalus += 1;
-            } else {
-                // build in next package
-                break;
-            }
+        if (end - mCurrNalu == 1) {
+            // Single NAL unit packet
+            appendPayload(nalu, naluSize);
         } else {
-            if (bufferedSize > 0) break;
-
-            // FU
-            FUHeader *fuHeader = (FUHeader *)(mpBuffer + RTP_HEADER_SIZE);
-            BitWriter bw(mpBuffer + RTP_HEADER_SIZE, sizeof(FUHeader::indicator));
-            bw.putBits(0, 1);              // F bit
-            bw.putBits(RTP_PAYLOAD_FU, 6); // type
-            bw.putBits(0, 6);              // layer ID
-            bw.putBits(mCurrTid, 3);       // tid
-            bw.flush();
-            fuHeader->type = mCurrNaluType;
-            if (mIsFirstPack) {
-                fuHeader->start = 1;
-                mOffset = mCurrNalu->first + sizeof(RtpPayloadHeader);
-                mPayloadSize = payloadSize - sizeof(RtpPayloadHeader);
-                mIsFirstPack = false;
-            } else
-                fuHeader->start = 0;
-            fuHeader->end = 0;
-
-            bufferedSize += sizeof(FUHeader);
-
-            if (bufferedSize + mPayloadSize <= RTP_MAX_PAYLOAD_SIZE) {
-                std::memcpy(mpBuffer + RTP_HEADER_SIZE + bufferedSize, mpData + mOffset,
-                            mPayloadSize);
-                bufferedSize += mPayloadSize;
-                marker = 1;
-                fuHeader->end = 1;
-            } else {
-                int copySize = RTP_MAX_PAYLOAD_SIZE - bufferedSize;
-                std::memcpy(mpBuffer + RTP_HEADER_SIZE + bufferedSize, mpData + mOffset, copySize);
-                bufferedSize += copySize;
-                mOffset += copySize;
-                mPayloadSize -= copySize;
-                break;
+            // F bit, type, layer ID, tid
+            putFixedBits<1, 6, 6, 3>(appendHeader(sizeof(RtpPayloadHeader)), 0, RTP_PAYLOAD_APS,
+                                     0, mCurrTid);
+            for (; mCurrNalu != end; ++mCurrNalu) {
+                uint8_t *naluSize = appendHeader(2);
+                naluSize[0] = (uint8_t)(mCurrNalu->second >> 8);
+                naluSize[1] = (uint8_t)mCurrNalu->second;
+                appendPayload(mpData + mCurrNalu->first, mCurrNalu->second);
             }
         }
+        mCurrNalu = end;
+    } else {
+        // FU
+        if (mIsFirstPack) {
+            mOffset = mCurrNalu->first + sizeof(RtpPayloadHeader);
+            mPayloadSize = naluSize - sizeof(RtpPayloadHeader);
+        }
+        uint32_t size = std::min<uint32_t>(mPayloadSize, RTP_MAX_PAYLOAD_SIZE - sizeof(FUHeader));
+
+        uint8_t *header = appendHeader(sizeof(FUHeader));
+        FUHeader *fuHeader = (FUHeader *)header;
+        // F bit, type, layer ID, tid
+        putFixedBits<1, 6, 6, 3>(header, 0, RTP_PAYLOAD_FU, 0, mCurrTid);
+        fuHeader->type = mCurrNaluType;
+        fuHeader->start = mIsFirstPack;
+        fuHeader->end = size == mPayloadSize;
+        appendPayload(mpData + mOffset, size);
+
+        mIsFirstPack = false;
+        mOffset += size;
+        mPayloadSize -= size;
+        if (!mPayloadSize) {
+            mIsFirstPack = true;
+            ++mCurrNalu;
+        }
     }
 
-    // need change from APs to Single NAL unit packet
-    if (bufferedNalus == 1) {
-        int naluSize = ntohs(*(uint16_t *)(mpBuffer + RTP_HEADER_SIZE + sizeof(RtpPayloadHeader)));
-        std::memmove(mpBuffer + RTP_HEADER_SIZE,
-                     mpBuffer + RTP_HEADER_SIZE + sizeof(RtpPayloadHeader) + 2, naluSize);
-        bufferedSize = naluSize;
-    }
-
-    *out = mpBuffer;
-    if (bufferedSize) {
-        header->version = 2;
-        header->padding = 0;
-        header->ext = 0;
-        header->cc = 0;
-        header->marker = marker;
-        header->payload = mPayloadType;
-        header->seq = htons(++mSeqNum);
-        header->timestamp = htonl((uint32_t)(mBaseTimestamp + mPacketTimestamp));
-        header->ssrc = htonl(mSSRC);
-        return bufferedSize + RTP_HEADER_SIZE;
-    }
-
-    return bufferedSize;
-}
\ No newline at end of file
+    return true;
+}
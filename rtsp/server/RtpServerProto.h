@@ -2,6 +2,7 @@
 #define RTP_SERVER_PROTO_H
 
 #include "foundation/FFBuffer.h"
+#include "foundation/Socket.h"
 
 #include <cstdint>
 
@@ -9,7 +10,40 @@
 #include <string>
 #include <vector>
 
+// An access unit split into RTP packets, once per program stream, and shared read only by every
+// session sending it. Nothing of the payload is copied: a packet is a run of buffers, its RTP
+// header and the payload headers (FU, STAP/AP sizes) live in headers, the NALU bytes are pointers
+// into the AVPacket, kept alive by packetBuffer. The RTP headers carry version, marker, payload
+// type and the packet's own RTP timestamp; sequence number, SSRC and the session's timestamp
+// offset are patched into a copy per send.
+struct RtpPacketList {
+    struct Packet {
+        uint32_t headerOffset; // RTP header in headers
+        uint32_t firstBuffer;  // buffers[firstBuffer] is the RTP header
+        uint32_t bufferCount;
+        uint32_t size; // header included
+    };
+
+    std::shared_ptr<AVPacketBuffer> packetBuffer;
+    std::vector<uint8_t> headers;
+    std::vector<SocketBuffer> buffers;
+    std::vector<Packet> packets;
+};
+
+template <>
+struct QueueItemTraits<std::shared_ptr<RtpPacketList>> {
+    static size_t bytes(const std::shared_ptr<RtpPacketList> &p) {
+        return p ? p->packetBuffer->size() + p->headers.size() : 0;
+    }
+    static int64_t timeUs(const std::shared_ptr<RtpPacketList> &p) {
+        return p ? p->packetBuffer->timeUs() : QUEUE_NO_TIME;
+    }
+};
+
 class RtpServerBaseProto {
+public:
+    const static int RTP_HEADER_SIZE = 12;
+
 protected:
     // 12 bytes
     struct RtpHeader {
@@ -28,34 +62,56 @@ protected:
     // IP Header: 20 bytes
     // UDP Header: 8 bytes -> max frame size = 1472 bytes
     // RTP Header: 12 bytes -> max payload size = 1460 bytes
-    const static int RTP_HEADER_SIZE = 12;
     const static int RTP_MAX_FRAME_SIZE = 1472;
     const static int RTP_MAX_PAYLOAD_SIZE = 1460;
+    // NALUs per STAP-A/AP, so a packet with the session's header stays in SOCKET_MAX_BUFFERS
+    const static int RTP_MAX_AGGREGATED_NALUS = (SOCKET_MAX_BUFFERS - 1) / 2;
 
     int mPayloadType;
 
-    uint8_t *mpBuffer;
     bool mIsFirstPack;
-    bool mIsLastPack;
     uint32_t mOffset;
     uint32_t mPayloadSize;
 
-    uint16_t mSeqNum;
-    uint32_t mSSRC;
-    uint32_t mBaseTimestamp;
     int64_t mPacketTimestamp;
 
+    // packet under construction, see packetize()
+    void beginPacket();
+    // room for n header bytes, valid until the next append
+    uint8_t *appendHeader(uint32_t n);
+    // referenced, not copied
+    void appendPayload(const uint8_t *data, uint32_t n);
+
+private:
+    // header pieces are kept as offsets until headers stops growing
+    struct Piece {
+        const uint8_t *data; // nullptr for header bytes
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    RtpPacketList *mpPacketList;
+    std::vector<Piece> mPieces;
+
 public:
     RtpServerBaseProto();
     RtpServerBaseProto(const RtpServerBaseProto &) = delete;
     RtpServerBaseProto &operator=(const RtpServerBaseProto &) = delete;
     virtual ~RtpServerBaseProto();
 
+    // packetizer for the mime, nullptr when it is not supported
+    static std::shared_ptr<RtpServerBaseProto> create(const std::string &mime, int payloadType);
+    // fills the per-session fields of a header copied out of an RtpPacketList
+    static void patchHeader(uint8_t *header, uint16_t seq, uint32_t timestampOffset, uint32_t ssrc);
+
+    // whole access unit at once, the marker bit is set on its last packet
+    std::shared_ptr<RtpPacketList> packetize(std::shared_ptr<AVPacketBuffer> packetBuffer);
+
     void prepareInternal();
     virtual void parseCsd(const uint8_t *data, int length) = 0;
     virtual void prepare(std::shared_ptr<AVPacketBuffer> packetBuffer) = 0;
-    virtual int buildRtpPackage(uint8_t **out) = 0;
-    int buildRtcpPakcage();
+    // builds the next packet with beginPacket()/append*(), false when the access unit is done
+    virtual bool buildRtpPackage() = 0;
 };
 
 class RtpServerAACProto : public RtpServerBaseProto {
@@ -73,7 +129,7 @@ public:
 
     virtual void parseCsd(const uint8_t *data, int length) override;
     virtual void prepare(std::shared_ptr<AVPacketBuffer> packetBuffer) override;
-    virtual int buildRtpPackage(uint8_t **out) override;
+    virtual bool buildRtpPackage() override;
 };
 
 class RtpServerH264Proto : public RtpServerBaseProto {
@@ -125,7 +181,7 @@ public:
 
     virtual void parseCsd(const uint8_t *data, int length) override;
     virtual void prepare(std::shared_ptr<AVPacketBuffer> packetBuffer) override;
-    virtual int buildRtpPackage(uint8_t **out) override;
+    virtual bool buildRtpPackage() override;
 };
 
 class RtpServerHEVCProto : public RtpServerBaseProto {
@@ -175,7 +231,7 @@ public:
 
     virtual void parseCsd(const uint8_t *data, int length) override;
     virtual void prepare(std::shared_ptr<AVPacketBuffer> packetBuffer) override;
-    virtual int buildRtpPackage(uint8_t **out) override;
+    virtual bool buildRtpPackage() override;
 };
 
 #endif
@@ -1,5 +1,77 @@
 #include "RtpServerStream.h"
 #include "foundation/Log.h"
+#include "foundation/Metrics.h"
+#include "foundation/Trace.h"
+#include "foundation/TimerService.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <random>
+
+// RFC 3550 6.2 minimum, randomized by half either way so sessions do not report in step
+static const int64_t RTCP_REPORT_INTERVAL_US = 5000000;
+
+static int64_t nextReportDelayUs() {
+    thread_local std::minstd_rand engine(std::random_device{}());
+    std::uniform_int_distribution<int64_t> delay(RTCP_REPORT_INTERVAL_US / 2,
+                                                 RTCP_REPORT_INTERVAL_US * 3 / 2);
+    return delay(engine);
+}
+
+// frame interval assumed before a stream's second access unit, and the range trusted after
+static const int64_t PACE_DEFAULT_INTERVAL_US = 40000;
+static const int64_t PACE_MIN_INTERVAL_US = 1000;
+static const int64_t PACE_MAX_INTERVAL_US = 100000;
+// an access unit held back longer than this, behind the egress budget, is dropped before its
+// first packet goes out
+static const int64_t PACE_MAX_DELAY_US = 1000000;
+
+RtpEgressBudget &RtpEgressBudget::getInstance() {
+    static RtpEgressBudget budget;
+    return budget;
+}
+
+RtpEgressBudget::RtpEgressBudget() : mBytesPerSecond(0), mBurstNs(0), mTatNs(0) {}
+
+void RtpEgressBudget::setRate(int64_t bytesPerSecond, size_t burstBytes) {
+    int64_t rate = std::max<int64_t>(bytesPerSecond, 0);
+    mBurstNs.store(rate ? (int64_t)burstBytes * 1000000000 / rate : 0,
+                   std::memory_order_relaxed);
+    mBytesPerSecond.store(rate, std::memory_order_relaxed);
+    mTatNs.store(0, std::memory_order_relaxed);
+}
+
+bool RtpEgressBudget::tryTake(size_t bytes, int64_t nowUs, int64_t &retryUs) {
+    int64_t rate = mBytesPerSecond.load(std::memory_order_relaxed);
+    if (!rate) return true;
+
+    int64_t costNs = (int64_t)bytes * 1000000000 / rate;
+    int64_t burstNs = std::max(mBurstNs.load(std::memory_order_relaxed), costNs);
+    int64_t nowNs = nowUs * 1000;
+    int64_t tatNs = mTatNs.load(std::memory_order_relaxed);
+    for (;;) {
+        int64_t nextNs = std::max(tatNs, nowNs) + costNs;
+        if (nextNs - nowNs > burstNs) {
+            retryUs = (nextNs - burstNs) / 1000 + 1;
+            return false;
+        }
+        if (mTatNs.compare_exchange_weak(tatNs, nextNs, std::memory_order_relaxed)) return true;
+    }
+}
+
+// one CNAME for all streams, so a client can tie audio and video together for lip sync
+static const std::string &rtcpCname() {
+    static const std::string cname = []() {
+        char host[256] = {0};
+        if (gethostname(host, sizeof(host) - 1) == SOCKET_ERROR || !host[0]) {
+            return std::string("rtsp@localhost");
+        }
+        return std::string("rtsp@") + host;
+    }();
+    return cname;
+}
 
 RtpServerStream::RtpServerStream(int streamId,
                                  int payloadType,
@@ -8,16 +80,49 @@ RtpServerStream::RtpServerStream(int streamId,
     : mStreamId(streamId), mPayloadType(payloadType), mIsSkipAdtsHeader(false),
       mMediaType(mediaType), mMime(mime) {
 
-    mRtpSocket = 0;
+    mRtpSocket = INVALID_SOCKET;
     mRemoteRtpAddr = {0};
     mLocalRtpPort = 0;
 
-    mRtcpSocket = 0;
+    mRtcpSocket = INVALID_SOCKET;
     mRemoteRtcpAddr = {0};
     mLocalRtcpPort = 0;
+
+    mpInterleavedSink = nullptr;
+    mRtpChannel = 0;
+    mRtcpChannel = 0;
+
+    std::mt19937 engine(std::random_device{}());
+
+    mSeqNum = engine() % (USHRT_MAX);
+    mSSRC = engine();
+    mBaseTimestamp = engine();
+
+    mPacketCount = 0;
+    mOctetCount = 0;
+    mClockRate = 0;
+    mLastRtpTimestamp = mBaseTimestamp;
+    mLastDueUs = 0;
+    mNextReportUs = 0;
+
+    mPaceQueuedBytes = 0;
+    mPaceQueuedPackets = 0;
+    mPaceBytesPerSecond = 0;
+    mPaceTatNs = 0;
+    mNextPaceUs = INT64_MAX;
+    mPaceSkipToKeyframe = false;
+
+    mUseSegmentation = false;
 }
 
-RtpServerStream::~RtpServerStream() {}
+RtpServerStream::~RtpServerStream() {
+    static MetricGauge &paceQueuePackets =
+        MetricsRegistry::getInstance().gauge("rtsp.server.pacing_queue_packets");
+    paceQueuePackets.add(-(int64_t)mPaceQueuedPackets);
+
+    if (mRtpSocket != INVALID_SOCKET) closesocket(mRtpSocket);
+    if (mRtcpSocket != INVALID_SOCKET) closesocket(mRtcpSocket);
+}
 
 bool RtpServerStream::init(std::string ipAddr, uint16_t rtpPort, uint16_t rtcpPort) {
     bool initDone = false;
@@ -39,7 +144,7 @@ bool RtpServerStream::init(std::string ipAddr, uint16_t rtpPort, uint16_t rtcpPo
         SOCKADDR_IN rtpSendAddr;
         rtpSendAddr.sin_family = AF_INET;
         rtpSendAddr.sin_port = htons(0);
-        rtpSendAddr.sin_addr.S_un.S_addr = INADDR_ANY;
+        rtpSendAddr.sin_addr.s_addr = INADDR_ANY;
         if (bind(rtpSocket, (SOCKADDR *)&rtpSendAddr, sizeof(rtpSendAddr)) == SOCKET_ERROR) {
             LOGE("%s Failed to bind rtp socket, error code:%d\n", __PRETTY_FUNCTION__,
                  WSAGetLastError());
@@ -49,7 +154,7 @@ bool RtpServerStream::init(std::string ipAddr, uint16_t rtpPort, uint16_t rtcpPo
         }
 
         SOCKADDR_IN testAddr;
-        int len = sizeof(testAddr);
+        socklen_t len = sizeof(testAddr);
         if (getsockname(rtpSocket, (SOCKADDR *)&testAddr, &len) == SOCKET_ERROR) {
             LOGE("%s Failed to get rtp socket name, error code:%d\n", __PRETTY_FUNCTION__,
                  WSAGetLastError());
@@ -68,7 +173,7 @@ bool RtpServerStream::init(std::string ipAddr, uint16_t rtpPort, uint16_t rtcpPo
         SOCKADDR_IN rtcpSendAddr;
         rtcpSendAddr.sin_family = AF_INET;
         rtcpSendAddr.sin_port = htons(port + 1);
-        rtcpSendAddr.sin_addr.S_un.S_addr = INADDR_ANY;
+        rtcpSendAddr.sin_addr.s_addr = INADDR_ANY;
         if (bind(rtcpSocket, (SOCKADDR *)&rtcpSendAddr, sizeof(rtcpSendAddr)) == SOCKET_ERROR) {
             LOGE("%s Failed to bind rtcp socket, error code:%d\n", __PRETTY_FUNCTION__,
                  WSAGetLastError());
@@ -90,23 +195,54 @@ bool RtpServerStream::init(std::string ipAddr, uint16_t rtpPort, uint16_t rtcpPo
         closesocket(sock);
     }
 
-    if (RtpServerAACProto::MIME.find(mMime) != std::string::npos) {
-        mRtpProto = std::make_shared<RtpServerAACProto>(mPayloadType);
-    } else if (RtpServerH264Proto::MIME.find(mMime) != std::string::npos) {
-        mRtpProto = std::make_shared<RtpServerH264Proto>(mPayloadType);
-    } else if (RtpServerHEVCProto::MIME.find(mMime) != std::string::npos) {
-        mRtpProto = std::make_shared<RtpServerHEVCProto>(mPayloadType);
+    if (initDone) {
+        mUseSegmentation = socketSupportsSegmentation(mRtpSocket);
+        // receiver reports are read from the event loop
+        socketSetNonBlocking(mRtcpSocket);
     }
 
-    if (!mRtpProto) initDone = false;
+    // the program packetizes, only check that it can
+    if (!RtpServerBaseProto::create(mMime, mPayloadType)) initDone = false;
 
     return initDone;
 }
 
-void RtpServerStream::parseCsd(const uint8_t *data, int length) {
-    if (mRtpProto && data && length > 0) {
-        mRtpProto->parseCsd(data, length);
+bool RtpServerStream::initMulticast(std::string groupAddr,
+                                    uint16_t rtpPort,
+                                    uint16_t rtcpPort,
+                                    int ttl,
+                                    const std::string &interfaceAddr) {
+    if (!init(groupAddr, rtpPort, rtcpPort)) return false;
+
+    // looped back copies let viewers on this host join too
+    int multicastTtl = ttl;
+    int multicastLoop = 1;
+    in_addr interface = {};
+    if (!interfaceAddr.empty()) inet_pton(AF_INET, interfaceAddr.c_str(), &interface);
+    for (SOCKET s : {mRtpSocket, mRtcpSocket}) {
+        if (setsockopt(s, IPPROTO_IP, IP_MULTICAST_TTL, (const char *)&multicastTtl,
+                       sizeof(multicastTtl)) == SOCKET_ERROR ||
+            setsockopt(s, IPPROTO_IP, IP_MULTICAST_LOOP, (const char *)&multicastLoop,
+                       sizeof(multicastLoop)) == SOCKET_ERROR ||
+            (!interfaceAddr.empty() &&
+             setsockopt(s, IPPROTO_IP, IP_MULTICAST_IF, (const char *)&interface,
+                        sizeof(interface)) == SOCKET_ERROR)) {
+            LOGE("%s Failed to set multicast options, error code:%d\n", __PRETTY_FUNCTION__,
+                 WSAGetLastError());
+            return false;
+        }
     }
+    return true;
+}
+
+bool RtpServerStream::initInterleaved(RtpInterleavedSink *sink,
+                                      uint8_t rtpChannel,
+                                      uint8_t rtcpChannel) {
+    mpInterleavedSink = sink;
+    mRtpChannel = rtpChannel;
+    mRtcpChannel = rtcpChannel;
+
+    return RtpServerBaseProto::create(mMime, mPayloadType) != nullptr;
 }
 
 void RtpServerStream::skipAdtsHeader() {
@@ -115,20 +251,363 @@ void RtpServerStream::skipAdtsHeader() {
 
 void RtpServerStream::sendCsd() {}
 
-void RtpServerStream::sendPacket(std::shared_ptr<AVPacketBuffer> packetBuffer) {
+void RtpServerStream::buildDatagrams(const RtpPacketList &packetList, size_t first, size_t end) {
+    auto &packets = packetList.packets;
+    mDatagrams.clear();
+    mDatagramPackets.clear();
+    for (size_t i = first; i < end;) {
+        uint32_t length = packets[i].size;
+        size_t last = i + 1;
+        if (mUseSegmentation) {
+            // every segment but the last one has to be exactly the segment size
+            size_t maxSegments = std::min<size_t>(SOCKET_MAX_SEGMENTS,
+                                                  SOCKET_MAX_SEGMENTED_SIZE / length);
+            while (last < end && last - i < maxSegments && packets[last].size <= length) {
+                if (packets[last++].size != length) break;
+            }
+        }
+        // the packets' buffers follow each other
+        uint32_t bufferCount = 0;
+        for (size_t j = i; j < last; ++j) bufferCount += packets[j].bufferCount;
+        uint16_t segmentSize = last - i > 1 ? length : 0;
+        mDatagrams.push_back({&mBuffers[packets[i].firstBuffer], (int)bufferCount, segmentSize});
+        mDatagramPackets.push_back((uint32_t)(last - i));
+        i = last;
+    }
+}
+
+void RtpServerStream::sendPacketList(const std::shared_ptr<RtpPacketList> &packetList,
+                                     int64_t dueUs) {
     // for AAC, ADTS header size = 7
     // if (mIsSkipAdtsHeader) {
     //	data += 7;
     //	length -= 7;
     //}
-    mRtpProto->prepare(packetBuffer);
+    TRACE_SCOPE("send packet");
+    TRACE_FLOW_END("rtsp packet", packetList->packetBuffer->flowId());
 
-    int packetSize = 0;
-    uint8_t *pData = nullptr;
-    while (true) {
-        packetSize = mRtpProto->buildRtpPackage(&pData);
-        if (packetSize == 0) break;
-        sendto(mRtpSocket, (const char *)pData, packetSize, 0, (SOCKADDR *)&mRemoteRtpAddr,
-               sizeof(mRemoteRtpAddr));
+    int64_t intervalUs = mLastDueUs ? dueUs - mLastDueUs : PACE_DEFAULT_INTERVAL_US;
+
+    // the packets' dts is on the RTP clock already
+    mClockRate = packetList->packetBuffer->timescale();
+    mLastRtpTimestamp = mBaseTimestamp + (uint32_t)packetList->packetBuffer->dts();
+    mLastDueUs = dueUs;
+
+    if (mpInterleavedSink) {
+        sendInterleaved(packetList);
+    } else if (mPacing.frameFraction > 0) {
+        queuePaced(packetList, intervalUs);
+        sendPaced(timerNowUs());
+    } else {
+        sendDatagrams(*packetList, 0, packetList->packets.size());
+    }
+
+    // the first report goes out with the first access unit, so clients can sync right away
+    if (timerNowUs() >= mNextReportUs) sendSenderReport();
+}
+
+void RtpServerStream::queuePaced(const std::shared_ptr<RtpPacketList> &packetList,
+                                 int64_t intervalUs) {
+    static MetricGauge &paceQueuePackets =
+        MetricsRegistry::getInstance().gauge("rtsp.server.pacing_queue_packets");
+    static MetricHistogram &paceQueueDepth =
+        MetricsRegistry::getInstance().histogram("rtsp.server.pacing_queue_depth");
+
+    size_t bytes = 0;
+    for (auto &packet : packetList->packets) bytes += packet.size;
+    size_t count = packetList->packets.size();
+    mPaceQueue.push_back({packetList, 0, timerNowUs()});
+    mPaceQueuedBytes += bytes;
+    mPaceQueuedPackets += count;
+    paceQueuePackets.add((int64_t)count);
+    paceQueueDepth.record((int64_t)mPaceQueuedPackets);
+
+    // whatever is queued goes out within the fraction of a frame interval
+    intervalUs = std::clamp(intervalUs, PACE_MIN_INTERVAL_US, PACE_MAX_INTERVAL_US);
+    int64_t windowUs = std::max<int64_t>((int64_t)(intervalUs * mPacing.frameFraction), 1);
+    mPaceBytesPerSecond = std::max<int64_t>((int64_t)mPaceQueuedBytes * 1000000 / windowUs, 1);
+}
+
+void RtpServerStream::sendPaced(int64_t nowUs) {
+    static MetricGauge &paceQueuePackets =
+        MetricsRegistry::getInstance().gauge("rtsp.server.pacing_queue_packets");
+    static MetricHistogram &paceDelayUs =
+        MetricsRegistry::getInstance().histogram("rtsp.server.pacing_delay_us");
+    static MetricCounter &paceDropped =
+        MetricsRegistry::getInstance().counter("rtsp.server.pacing_dropped_packets");
+    static MetricCounter &keyframeSkips =
+        MetricsRegistry::getInstance().counter("rtsp.server.pacing_keyframe_skips");
+
+    mNextPaceUs = INT64_MAX;
+    if (mPaceQueue.empty()) return;
+
+    const int64_t nowNs = nowUs * 1000;
+    const int64_t burstBytes =
+        std::max<int64_t>(mPacing.burstBytes, RtpServerBaseProto::RTP_HEADER_SIZE + 1460);
+    const int64_t burstNs = burstBytes * 1000000000 / mPaceBytesPerSecond;
+
+    while (!mPaceQueue.empty()) {
+        PacedUnit &unit = mPaceQueue.front();
+        auto &packets = unit.packetList->packets;
+
+        size_t end = unit.next;
+        size_t bytes = 0;
+        bool unsent = unit.next == 0;
+        if (unsent && mPaceSkipToKeyframe && unit.packetList->packetBuffer->isKeyFrame()) {
+            mPaceSkipToKeyframe = false;
+        }
+        if (unsent && (mPaceSkipToKeyframe || nowUs - unit.queuedUs > PACE_MAX_DELAY_US)) {
+            // starved by the egress budget: only whole units are dropped, one on the wire is
+            // finished. video waits for its next keyframe, the units in between would not decode
+            if (mMediaType == MEDIA_CODEC_TYPE_VIDEO && !mPaceSkipToKeyframe) {
+                mPaceSkipToKeyframe = true;
+                keyframeSkips.add();
+            }
+            end = packets.size();
+            for (size_t i = unit.next; i < end; ++i) bytes += packets[i].size;
+            paceDropped.add(end - unit.next);
+        } else {
+            int64_t tatNs = mPaceTatNs;
+            while (end < packets.size()) {
+                int64_t nextNs = std::max(tatNs, nowNs) +
+                                 (int64_t)packets[end].size * 1000000000 / mPaceBytesPerSecond;
+                if (nextNs - nowNs > burstNs) {
+                    mNextPaceUs = (nextNs - burstNs) / 1000 + 1;
+                    break;
+                }
+                int64_t retryUs;
+                if (!RtpEgressBudget::getInstance().tryTake(packets[end].size, nowUs, retryUs)) {
+                    mNextPaceUs = retryUs;
+                    break;
+                }
+                tatNs = nextNs;
+                bytes += packets[end++].size;
+            }
+            mPaceTatNs = tatNs;
+            if (end > unit.next) {
+                paceDelayUs.record(nowUs - unit.queuedUs);
+                sendDatagrams(*unit.packetList, unit.next, end);
+            }
+        }
+
+        mPaceQueuedBytes -= bytes;
+        mPaceQueuedPackets -= end - unit.next;
+        paceQueuePackets.add(-(int64_t)(end - unit.next));
+        unit.next = end;
+        if (end < packets.size()) break;
+        mPaceQueue.pop_front();
+    }
+}
+
+void RtpServerStream::sendDatagrams(const RtpPacketList &packetList, size_t first, size_t end) {
+    static MetricCounter &packetsSent =
+        MetricsRegistry::getInstance().counter("rtsp.server.rtp_packets_sent");
+    static MetricCounter &bytesSent =
+        MetricsRegistry::getInstance().counter("rtsp.server.rtp_bytes_sent");
+    static MetricCounter &sendCalls =
+        MetricsRegistry::getInstance().counter("rtsp.server.rtp_send_calls");
+
+    // only the RTP headers are copied and patched, everything else is sent from the shared list
+    const size_t headerSize = RtpServerBaseProto::RTP_HEADER_SIZE;
+    auto &packets = packetList.packets;
+    mHeaders.resize(packets.size() * headerSize);
+    mBuffers.assign(packetList.buffers.begin(), packetList.buffers.end());
+    for (size_t i = first; i < end; ++i) {
+        uint8_t *header = mHeaders.data() + i * headerSize;
+        std::memcpy(header, packetList.headers.data() + packets[i].headerOffset, headerSize);
+        RtpServerBaseProto::patchHeader(header, ++mSeqNum, mBaseTimestamp, mSSRC);
+        mBuffers[packets[i].firstBuffer] = {header, headerSize};
+    }
+
+    while (first < end) {
+        buildDatagrams(packetList, first, end);
+        int ret = socketSendBatch(mRtpSocket, mDatagrams.data(), (int)mDatagrams.size(),
+                                  &mRemoteRtpAddr);
+        sendCalls.add();
+
+        int sent = std::max(ret, 0);
+        for (int i = 0; i < sent; ++i) {
+            size_t count = mDatagramPackets[i];
+            for (size_t j = first; j < first + count; ++j) {
+                bytesSent.add(packets[j].size);
+                mOctetCount += packets[j].size - headerSize;
+            }
+            packetsSent.add(count);
+            mPacketCount += count;
+            first += count;
+        }
+        if (sent == (int)mDatagrams.size()) break;
+
+        // without checksum offload a segmented send fails, go on with one datagram per packet
+        const SocketDatagram &failed = mDatagrams[sent];
+        int error = WSAGetLastError();
+        if (failed.segmentSize && (error == EIO || error == EINVAL)) {
+            LOGE("%s Segmented send failed, error code:%d, falling back\n", __PRETTY_FUNCTION__,
+                 error);
+            mUseSegmentation = false;
+            continue;
+        }
+        // as with one send per packet, a failed datagram is dropped and the rest still go out
+        first += mDatagramPackets[sent];
+    }
+}
+
+void RtpServerStream::sendInterleaved(const std::shared_ptr<RtpPacketList> &packetList) {
+    static MetricCounter &packetsSent =
+        MetricsRegistry::getInstance().counter("rtsp.server.rtp_packets_sent");
+    static MetricCounter &bytesSent =
+        MetricsRegistry::getInstance().counter("rtsp.server.rtp_bytes_sent");
+
+    // '$', channel, 16 bit length, then the patched RTP header, all owned by the frames
+    const size_t headerSize = 4 + RtpServerBaseProto::RTP_HEADER_SIZE;
+    struct InterleavedFrames {
+        std::shared_ptr<RtpPacketList> packetList;
+        std::vector<uint8_t> headers;
+    };
+    auto frames = std::make_shared<InterleavedFrames>();
+    frames->packetList = packetList;
+
+    auto &packets = packetList->packets;
+    frames->headers.resize(packets.size() * headerSize);
+    mBuffers.clear();
+    for (size_t i = 0; i < packets.size(); ++i) {
+        auto &packet = packets[i];
+        uint8_t *header = frames->headers.data() + i * headerSize;
+        header[0] = '$';
+        header[1] = mRtpChannel;
+        header[2] = (uint8_t)(packet.size >> 8);
+        header[3] = (uint8_t)packet.size;
+        std::memcpy(header + 4, packetList->headers.data() + packet.headerOffset,
+                    RtpServerBaseProto::RTP_HEADER_SIZE);
+        RtpServerBaseProto::patchHeader(header + 4, ++mSeqNum, mBaseTimestamp, mSSRC);
+
+        mBuffers.push_back({header, headerSize});
+        auto first = packetList->buffers.begin() + packet.firstBuffer;
+        mBuffers.insert(mBuffers.end(), first + 1, first + packet.bufferCount);
+
+        packetsSent.add();
+        bytesSent.add(packet.size);
+        mPacketCount++;
+        mOctetCount += packet.size - RtpServerBaseProto::RTP_HEADER_SIZE;
+    }
+
+    mpInterleavedSink->writeInterleaved(frames, mBuffers.data(), mBuffers.size());
+}
+
+RtcpSenderInfo RtpServerStream::senderInfo() const {
+    RtcpSenderInfo info;
+    info.ssrc = mSSRC;
+    info.ntpTimestamp = RtcpServerProto::ntpNow();
+    // now on the RTP clock, carried on from the latest access unit
+    info.rtpTimestamp = mLastRtpTimestamp;
+    if (mClockRate > 0) {
+        info.rtpTimestamp +=
+            (uint32_t)rescaleTimeStamp(timerNowUs() - mLastDueUs, 1000000, mClockRate);
+    }
+    info.packetCount = mPacketCount;
+    info.octetCount = mOctetCount;
+    return info;
+}
+
+void RtpServerStream::sendRtcp(const uint8_t *data, size_t size) {
+    if (mpInterleavedSink) {
+        auto frame = std::make_shared<std::vector<uint8_t>>(4 + size);
+        uint8_t *p = frame->data();
+        p[0] = '$';
+        p[1] = mRtcpChannel;
+        p[2] = (uint8_t)(size >> 8);
+        p[3] = (uint8_t)size;
+        std::memcpy(p + 4, data, size);
+        SocketBuffer buffer = {p, frame->size()};
+        mpInterleavedSink->writeInterleaved(frame, &buffer, 1);
+        return;
+    }
+
+    SocketBuffer buffer = {data, size};
+    if (socketSendGather(mRtcpSocket, &buffer, 1, &mRemoteRtcpAddr) == SOCKET_ERROR) {
+        LOGE("%s Failed to send rtcp packet, error code:%d\n", __PRETTY_FUNCTION__,
+             WSAGetLastError());
+    }
+}
+
+void RtpServerStream::sendSenderReport() {
+    static MetricCounter &reportsSent =
+        MetricsRegistry::getInstance().counter("rtsp.server.rtcp_sender_reports");
+
+    uint8_t data[RtcpServerProto::RTCP_MAX_PACKET_SIZE];
+    size_t size = RtcpServerProto::buildSenderReport(senderInfo(), rtcpCname(), data, sizeof(data));
+    if (size) {
+        sendRtcp(data, size);
+        reportsSent.add();
+    }
+    mNextReportUs = timerNowUs() + nextReportDelayUs();
+}
+
+void RtpServerStream::sendBye() {
+    uint8_t data[RtcpServerProto::RTCP_MAX_PACKET_SIZE];
+    size_t size = RtcpServerProto::buildBye(senderInfo(), rtcpCname(), data, sizeof(data));
+    if (size) sendRtcp(data, size);
+}
+
+int RtpServerStream::readRtcp() {
+    int reports = 0;
+    uint8_t buf[1500];
+    for (;;) {
+        SOCKADDR_IN fromAddr = {};
+        socklen_t fromLen = sizeof(fromAddr);
+        int recvLen = recvfrom(mRtcpSocket, (char *)buf, sizeof(buf), 0, (SOCKADDR *)&fromAddr,
+                               &fromLen);
+        // a failure other than would block shows again on the next readiness
+        if (recvLen == SOCKET_ERROR) break;
+        // only the client's own host, its port may be rewritten by a NAT
+        if (fromAddr.sin_addr.s_addr != mRemoteRtcpAddr.sin_addr.s_addr) continue;
+        if (processRtcp(buf, recvLen)) reports++;
+    }
+    return reports;
+}
+
+bool RtpServerStream::processRtcp(const uint8_t *data, size_t size) {
+    static MetricCounter &reportsReceived =
+        MetricsRegistry::getInstance().counter("rtsp.server.rtcp_receiver_reports");
+    static MetricHistogram &rttUs =
+        MetricsRegistry::getInstance().histogram("rtsp.server.rtcp_rtt_us");
+    static MetricHistogram &jitterUs =
+        MetricsRegistry::getInstance().histogram("rtsp.server.rtcp_jitter_us");
+    static MetricHistogram &lossPermille =
+        MetricsRegistry::getInstance().histogram("rtsp.server.rtcp_fraction_lost_permille");
+
+    std::vector<RtcpReportBlock> blocks;
+    if (!RtcpServerProto::parseReports(data, size, blocks)) {
+        LOGE("%s Malformed rtcp packet, size:%zu\n", __PRETTY_FUNCTION__, size);
+        return false;
+    }
+
+    bool reported = false;
+    for (auto &block : blocks) {
+        if (block.ssrc != mSSRC) continue;
+        reported = true;
+        reportsReceived.add();
+
+        mReceiverStats.reports++;
+        mReceiverStats.lastReportUs = timerNowUs();
+        mReceiverStats.fractionLost = block.fractionLost / 256.0;
+        mReceiverStats.cumulativeLost = block.cumulativeLost;
+        mReceiverStats.highestSeq = block.highestSeq;
+        if (mClockRate > 0) {
+            mReceiverStats.jitterUs = rescaleTimeStamp(block.jitter, mClockRate, 1000000);
+        }
+        // RFC 3550 6.4.1: arrival - LSR - DLSR, all in 1/65536 seconds
+        if (block.lastSr) {
+            uint32_t now = RtcpServerProto::ntpMiddle32(RtcpServerProto::ntpNow());
+            int32_t rtt = (int32_t)(now - block.lastSr - block.delaySinceLastSr);
+            if (rtt >= 0) {
+                mReceiverStats.rttUs = rescaleTimeStamp(rtt, 65536, 1000000);
+                rttUs.record(mReceiverStats.rttUs);
+            }
+        }
+
+        jitterUs.record(mReceiverStats.jitterUs);
+        lossPermille.record(block.fractionLost * 1000 / 256);
     }
+    return reported;
 }
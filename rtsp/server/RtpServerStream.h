@@ -2,15 +2,72 @@
 #define RTP_SERVER_STREAM_H
 
 #include "RtpServerProto.h"
+#include "RtcpServerProto.h"
 #include "foundation/Utils.h"
 #include "foundation/FFBuffer.h"
 
 #include <string>
 #include <memory>
 #include <vector>
+#include <deque>
+#include <atomic>
 
-#include <winsock2.h>
-#include <ws2tcpip.h>
+#include "foundation/Socket.h"
+
+// Takes the $-framed packets of an interleaved stream, RTP over the RTSP connection (RFC 2326
+// 10.12). owner keeps every buffer alive until it has been written.
+class RtpInterleavedSink {
+public:
+    virtual ~RtpInterleavedSink() {}
+    virtual void writeInterleaved(std::shared_ptr<const void> owner,
+                                  const SocketBuffer *buffers,
+                                  size_t count) = 0;
+};
+
+// Intra-frame pacing of UDP streams. Instead of leaving as one line rate burst, the packets of
+// an access unit are spread over frameFraction of the frame interval by a token bucket per
+// stream, at most burstBytes at a time. Off by default: 0 sends every access unit at once, as
+// before pacing existed. egressBytesPerSecond caps all paced streams of the process together, 0
+// for no cap.
+struct RtpPacingConfig {
+    double frameFraction = 0;
+    size_t burstBytes = 8 * 1472;
+    int64_t egressBytesPerSecond = 0;
+    size_t egressBurstBytes = 64 * 1024;
+};
+
+// Process wide egress budget, a token bucket in the virtual scheduling form (GCRA) so any loop
+// thread takes from it with one compare and swap.
+class RtpEgressBudget {
+public:
+    static RtpEgressBudget &getInstance();
+
+    // 0 bytesPerSecond lifts the cap, a new rate starts with a full bucket
+    void setRate(int64_t bytesPerSecond, size_t burstBytes);
+    // takes bytes when they fit now, otherwise returns false and when to try again
+    bool tryTake(size_t bytes, int64_t nowUs, int64_t &retryUs);
+
+private:
+    std::atomic<int64_t> mBytesPerSecond;
+    std::atomic<int64_t> mBurstNs;
+    // when the bucket would be empty again at the rate, ahead of now by what is in flight
+    std::atomic<int64_t> mTatNs;
+
+    RtpEgressBudget();
+    RtpEgressBudget(const RtpEgressBudget &) = delete;
+    RtpEgressBudget &operator=(const RtpEgressBudget &) = delete;
+};
+
+// what the client's receiver reports say about a stream, RFC 3550 6.4.1
+struct RtpReceiverStats {
+    uint32_t reports = 0;
+    int64_t lastReportUs = 0; // timerNowUs() of the latest one
+    double fractionLost = 0;  // since the client's previous report
+    int32_t cumulativeLost = 0;
+    uint32_t highestSeq = 0; // extended
+    int64_t jitterUs = 0;
+    int64_t rttUs = -1; // -1 until a report echoes one of our sender reports
+};
 
 class RtpServerStream {
 private:
@@ -29,7 +86,55 @@ private:
     SOCKADDR_IN mRemoteRtcpAddr;
     uint16_t mLocalRtcpPort;
 
-    std::shared_ptr<RtpServerBaseProto> mRtpProto;
+    // interleaved streams have no sockets, their packets go to the RTSP connection
+    RtpInterleavedSink *mpInterleavedSink;
+    uint8_t mRtpChannel;
+    uint8_t mRtcpChannel;
+
+    // per session header fields, the payloads are shared
+    uint16_t mSeqNum;
+    uint32_t mSSRC;
+    uint32_t mBaseTimestamp;
+
+    // sender report state: counts so far and the RTP timestamp of the latest access unit,
+    // with the program clock time it was due at
+    uint32_t mPacketCount;
+    uint32_t mOctetCount;
+    int mClockRate;
+    uint32_t mLastRtpTimestamp;
+    int64_t mLastDueUs;
+    int64_t mNextReportUs;
+    RtpReceiverStats mReceiverStats;
+
+    // access units waiting for the pacer, sent from the front in order
+    struct PacedUnit {
+        std::shared_ptr<RtpPacketList> packetList;
+        size_t next; // first packet not sent yet
+        int64_t queuedUs;
+    };
+    RtpPacingConfig mPacing;
+    std::deque<PacedUnit> mPaceQueue;
+    size_t mPaceQueuedBytes;
+    size_t mPaceQueuedPackets;
+    int64_t mPaceBytesPerSecond;
+    int64_t mPaceTatNs; // token bucket, as in RtpEgressBudget
+    int64_t mNextPaceUs;
+    bool mPaceSkipToKeyframe; // a video unit was dropped, the rest of its GOP goes too
+
+    // send scratch space reused across access units, the loop thread is the only sender
+    bool mUseSegmentation;
+    std::vector<uint8_t> mHeaders;
+    std::vector<SocketBuffer> mBuffers;
+    std::vector<SocketDatagram> mDatagrams;
+    std::vector<uint32_t> mDatagramPackets; // packets in each datagram
+
+    // groups packets [first, end) into datagrams, runs of equal sized ones into segmented ones
+    void buildDatagrams(const RtpPacketList &packetList, size_t first, size_t end);
+    void sendDatagrams(const RtpPacketList &packetList, size_t first, size_t end);
+    void queuePaced(const std::shared_ptr<RtpPacketList> &packetList, int64_t intervalUs);
+    void sendInterleaved(const std::shared_ptr<RtpPacketList> &packetList);
+    RtcpSenderInfo senderInfo() const;
+    void sendRtcp(const uint8_t *data, size_t size);
 
 public:
     RtpServerStream(int streamId, int payloadType, MediaCodecType mediaType, std::string mime);
@@ -38,15 +143,42 @@ public:
     virtual ~RtpServerStream();
 
     bool init(std::string ipAddr, uint16_t rtpPort, uint16_t rtcpPort);
-    void parseCsd(const uint8_t *data, int length);
+    // sends to a multicast group, interfaceAddr empty for the default interface
+    bool initMulticast(std::string groupAddr,
+                       uint16_t rtpPort,
+                       uint16_t rtcpPort,
+                       int ttl,
+                       const std::string &interfaceAddr);
+    bool initInterleaved(RtpInterleavedSink *sink, uint8_t rtpChannel, uint8_t rtcpChannel);
 
     void skipAdtsHeader();
+    // UDP streams only, before the first access unit
+    void setPacing(const RtpPacingConfig &pacing) { mPacing = pacing; }
     void sendCsd();
-    void sendPacket(std::shared_ptr<AVPacketBuffer> packetBuffer);
+    // packets of one access unit, packetized once by the program, due at dueUs on the program
+    // clock. Sends a sender report along when one is due.
+    void sendPacketList(const std::shared_ptr<RtpPacketList> &packetList, int64_t dueUs);
+    void sendSenderReport();
+    // sends what the pacer lets out by nowUs, nextPaceUs() is when to call it again
+    void sendPaced(int64_t nowUs);
+    int64_t nextPaceUs() const { return mNextPaceUs; }
+    // the last report of a stream that stops
+    void sendBye();
+
+    // reads what arrived on the RTCP socket, returns the receiver reports about this stream
+    int readRtcp();
+    // one compound RTCP packet from the client, true when it reported on this stream
+    bool processRtcp(const uint8_t *data, size_t size);
+    const RtpReceiverStats &getReceiverStats() const { return mReceiverStats; }
 
+    int getStreamId() const { return mStreamId; }
     MediaCodecType getMediaType() const { return mMediaType; }
     uint16_t getRtpPort() const { return mLocalRtpPort; }
     uint16_t getRtcpPort() const { return mLocalRtcpPort; }
+    SOCKET getRtcpSocket() const { return mRtcpSocket; }
+    bool isInterleaved() const { return mpInterleavedSink != nullptr; }
+    uint8_t getRtpChannel() const { return mRtpChannel; }
+    uint8_t getRtcpChannel() const { return mRtcpChannel; }
 };
 
 #endif
@@ -0,0 +1,630 @@
+#include "RtspConnection.h"
+#include "RtspServerHelper.h"
+
+#include "foundation/MD5.h"
+#include "foundation/Log.h"
+#include "foundation/Metrics.h"
+#include "foundation/Trace.h"
+
+#include <algorithm>
+#include <cstdarg>
+#include <ctime>
+#include <sstream>
+
+static const char *SERVER_NAME = "Andu RTSP server test";
+
+// RFC 2326 default
+static const int SESSION_TIMEOUT_S = 60;
+// a request larger than this is not RTSP
+static const size_t MAX_INPUT_SIZE = 64 * 1024;
+// unsent output past which interleaved access units are dropped, about a second at 4 Mbit/s
+static const size_t MAX_OUTPUT_BACKLOG = 512 * 1024;
+
+static void appendf(std::string &out, const char *fmt, ...) {
+    char buf[512];
+    va_list args;
+    va_start(args, fmt);
+    int n = std::vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    if (n > 0) out.append(buf, std::min<size_t>(n, sizeof(buf) - 1));
+}
+
+static MetricGauge &connectionsGauge() {
+    static MetricGauge &connections =
+        MetricsRegistry::getInstance().gauge("rtsp.server.connections");
+    return connections;
+}
+
+RtspConnection::RtspConnection(RtspServerHelper *server, EventLoop *loop, SOCKET s)
+    : mpServer(server), mpLoop(loop), mSocket(s), mState(RTSP_STATE_INIT), mLocalPort(0),
+      mOutputOffset(0), mOutputBytes(0), mWantWrite(false),
+      mSessionTimeoutUs(SESSION_TIMEOUT_S * 1000000ll), mLastActivityUs(0), mTimeoutTimer(0),
+      mReportsRtcp(false), mIsStreaming(false) {
+    char ipAddr[INET_ADDRSTRLEN] = {0};
+
+    SOCKADDR_IN localAddr = {};
+    socklen_t len = sizeof(localAddr);
+    if (getsockname(mSocket, (SOCKADDR *)&localAddr, &len) != SOCKET_ERROR) {
+        inet_ntop(AF_INET, &localAddr.sin_addr, ipAddr, sizeof(ipAddr));
+        mLocalIpAddr = ipAddr;
+        mLocalPort = ntohs(localAddr.sin_port);
+    }
+
+    SOCKADDR_IN peerAddr = {};
+    len = sizeof(peerAddr);
+    if (getpeername(mSocket, (SOCKADDR *)&peerAddr, &len) != SOCKET_ERROR) {
+        inet_ntop(AF_INET, &peerAddr.sin_addr, ipAddr, sizeof(ipAddr));
+        mPeerIpAddr = ipAddr;
+    }
+
+    connectionsGauge().add(1);
+}
+
+RtspConnection::~RtspConnection() {
+    // only when the server goes away with its loops already stopped
+    if (mState != RTSP_STATE_CLOSED) {
+        stopStreaming();
+        closesocket(mSocket);
+    }
+    connectionsGauge().add(-1);
+}
+
+bool RtspConnection::start() {
+    std::weak_ptr<RtspConnection> weakSelf = shared_from_this();
+    if (!mpLoop->add(mSocket, EventLoop::EVENT_READ, [weakSelf](int events) {
+            if (auto self = weakSelf.lock()) self->onEvents(events);
+        })) {
+        return false;
+    }
+
+    mLastActivityUs = timerNowUs();
+    armTimeout();
+    return true;
+}
+
+void RtspConnection::close() {
+    if (mState == RTSP_STATE_CLOSED) return;
+    mState = RTSP_STATE_CLOSED;
+
+    stopStreaming();
+    if (mTimeoutTimer) mpLoop->cancel(mTimeoutTimer);
+    mpLoop->remove(mSocket);
+    closesocket(mSocket);
+
+    if (mRtspSession) mpServer->removeSession(mRtspSession);
+    mpServer->removeConnection(this);
+}
+
+void RtspConnection::onEvents(int events) {
+    if (events & EventLoop::EVENT_READ) onReadable();
+    if (mState == RTSP_STATE_CLOSED) return;
+
+    if (events & EventLoop::EVENT_WRITE) {
+        if (!flush()) close();
+    } else if (events & EventLoop::EVENT_ERROR) {
+        close();
+    }
+}
+
+void RtspConnection::onReadable() {
+    char buf[4096];
+    for (;;) {
+        int recvLen = recv(mSocket, buf, sizeof(buf), 0);
+        if (recvLen > 0) {
+            mInput.append(buf, recvLen);
+            if (mInput.size() > MAX_INPUT_SIZE) {
+                LOGE("%s Request too large, closing\n", __PRETTY_FUNCTION__);
+                close();
+                return;
+            }
+            continue;
+        }
+        if (recvLen == 0) {
+            LOGD("%s Client socket closed\n", __PRETTY_FUNCTION__);
+            close();
+            return;
+        }
+        if (socketWouldBlock()) break;
+        LOGE("%s Failed to receive from client socket, error code:%d\n", __PRETTY_FUNCTION__,
+             WSAGetLastError());
+        close();
+        return;
+    }
+
+    // complete requests only, a header block plus its Content-Length body, or $-framed data
+    while (!mInput.empty()) {
+        if (mInput[0] == '$') {
+            if (mInput.size() < 4) break;
+            size_t frameLen = 4 + (((uint8_t)mInput[2] << 8) | (uint8_t)mInput[3]);
+            if (mInput.size() < frameLen) break;
+            mLastActivityUs = timerNowUs();
+            uint8_t channel = (uint8_t)mInput[1];
+            if (mRtspSession) {
+                for (auto &stream : mRtspSession->streams) {
+                    if (!stream->isInterleaved() || stream->getRtcpChannel() != channel) continue;
+                    if (stream->processRtcp((const uint8_t *)mInput.data() + 4, frameLen - 4))
+                        mReportsRtcp = true;
+                    break;
+                }
+            }
+            mInput.erase(0, frameLen);
+            continue;
+        }
+
+        size_t headerEnd = mInput.find("\r\n\r\n");
+        if (headerEnd == std::string::npos) break;
+        size_t headerLen = headerEnd + 4;
+        size_t bodyLen = 0;
+        size_t pos = mInput.find("Content-Length:");
+        if (pos != std::string::npos && pos < headerEnd) {
+            bodyLen = std::strtoul(mInput.c_str() + pos + 15, nullptr, 10);
+        }
+        if (mInput.size() < headerLen + bodyLen) break;
+
+        std::string request = mInput.substr(0, headerLen);
+        mInput.erase(0, headerLen + bodyLen);
+
+        if (!handleRequest(request)) {
+            flush();
+            close();
+            return;
+        }
+    }
+
+    if (!flush()) close();
+}
+
+bool RtspConnection::flush() {
+    while (!mOutput.empty()) {
+        SocketBuffer buffers[SOCKET_MAX_BUFFERS];
+        int count = 0;
+        for (auto iter = mOutput.begin(); iter != mOutput.end() && count < SOCKET_MAX_BUFFERS;
+             ++iter) {
+            buffers[count++] = {iter->data, iter->size};
+        }
+        buffers[0].data = mOutput.front().data + mOutputOffset;
+        buffers[0].size -= mOutputOffset;
+
+        int sendLen = socketSendGather(mSocket, buffers, count);
+        if (sendLen > 0) {
+            consumeOutput(sendLen);
+            continue;
+        }
+        if (sendLen == SOCKET_ERROR && socketWouldBlock()) break;
+        LOGE("%s Failed to send rtsp message, error code:%d\n", __PRETTY_FUNCTION__,
+             WSAGetLastError());
+        return false;
+    }
+    updateInterest();
+    return true;
+}
+
+void RtspConnection::consumeOutput(size_t bytes) {
+    mOutputBytes -= bytes;
+    while (bytes) {
+        size_t left = mOutput.front().size - mOutputOffset;
+        if (bytes < left) {
+            mOutputOffset += bytes;
+            return;
+        }
+        bytes -= left;
+        mOutput.pop_front();
+        mOutputOffset = 0;
+    }
+}
+
+void RtspConnection::writeInterleaved(std::shared_ptr<const void> owner,
+                                      const SocketBuffer *buffers,
+                                      size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        mOutput.push_back({owner, (const uint8_t *)buffers[i].data, buffers[i].size});
+        mOutputBytes += buffers[i].size;
+    }
+}
+
+void RtspConnection::updateInterest() {
+    bool wantWrite = !mOutput.empty();
+    if (wantWrite == mWantWrite) return;
+    mWantWrite = wantWrite;
+    mpLoop->modify(mSocket, EventLoop::EVENT_READ | (wantWrite ? EventLoop::EVENT_WRITE : 0));
+}
+
+void RtspConnection::reply(const RtspMessage &msg,
+                           const char *status,
+                           const std::string &headers,
+                           const std::string &body) {
+    auto out = std::make_shared<std::string>();
+    appendf(*out, "RTSP/1.0 %s\r\n", status);
+    appendf(*out, "CSeq: %d\r\n", msg.cseq);
+    appendf(*out, "Server: %s\r\n", SERVER_NAME);
+    *out += headers;
+    if (!body.empty()) appendf(*out, "Content-Length: %zu\r\n", body.size());
+    *out += "\r\n";
+    *out += body;
+
+    // queued behind any interleaved data, a reply never splits a frame
+    mOutput.push_back({out, (const uint8_t *)out->data(), out->size()});
+    mOutputBytes += out->size();
+}
+
+bool RtspConnection::handleRequest(const std::string &request) {
+    mLastActivityUs = timerNowUs();
+
+    RtspMessage msg;
+    {
+        std::stringstream ss(request);
+        std::string line;
+        while (std::getline(ss, line)) {
+            if (!parseLine(line, msg)) {
+                LOGE("%s Failed to parse line:%s\n", __PRETTY_FUNCTION__, line.c_str());
+                reply(msg, "400 Bad Request");
+                return false;
+            }
+        }
+    }
+
+    auto sessionMatches = [this, &msg]() {
+        return mRtspSession && msg.session == mRtspSession->session;
+    };
+
+    std::string headers;
+    switch (msg.msgId) {
+        case RTSP_MSG_OPTIONS: {
+            reply(msg, "200 OK",
+                  "Public: DESCRIBE,ANNOUNCE,SETUP,PLAY,RECORD,PAUSE,GET_PARAMETER,SET_PARAMETER,"
+                  "TEARDOWN\r\n");
+            break;
+        }
+        case RTSP_MSG_DESCRIBE: {
+            if (mState != RTSP_STATE_INIT && mState != RTSP_STATE_DESCRIBED) {
+                reply(msg, "455 Method Not Valid in This State");
+                break;
+            }
+            mRtspProgram = mpServer->getProgram(msg.programName);
+            if (!mRtspProgram) {
+                reply(msg, "404 Not Found");
+                break;
+            }
+
+            mRtspSession = std::make_shared<RtspSession>();
+            std::timespec ts;
+            [[maybe_unused]] auto v = std::timespec_get(&ts, TIME_UTC);
+            mRtspSession->session = md5Sum((const uint8_t *)&ts, sizeof(ts));
+            mRtspSession->program = mRtspProgram;
+
+            std::string sdpStr = mRtspProgram->getSdpString(mLocalIpAddr, mLocalPort);
+            appendf(headers, "Content-Base: rtsp://%s:%hu/%s\r\n", mLocalIpAddr.c_str(),
+                    mLocalPort, msg.programName.c_str());
+            appendf(headers, "Content-Type: %s\r\n", msg.acceptType.c_str());
+            reply(msg, "200 OK", headers, sdpStr);
+            mState = RTSP_STATE_DESCRIBED;
+            break;
+        }
+        case RTSP_MSG_SETUP: {
+            if (mState != RTSP_STATE_DESCRIBED && mState != RTSP_STATE_READY) {
+                reply(msg, "455 Method Not Valid in This State");
+                break;
+            }
+            if (!msg.session.empty() && !sessionMatches()) {
+                reply(msg, "454 Session Not Found");
+                break;
+            }
+
+            int programStreamId = msg.programStreamId;
+            if (msg.cast == "multicast") {
+                auto group = mpServer->getMulticastGroup(mRtspProgram, programStreamId);
+                if (!group) {
+                    reply(msg, "500 Internal Server Error");
+                    break;
+                }
+                if (std::find(mMulticastGroups.begin(), mMulticastGroups.end(), group) ==
+                    mMulticastGroups.end()) {
+                    mMulticastGroups.emplace_back(group);
+                }
+
+                appendf(headers, "Session: %s;timeout=%d\r\n", mRtspSession->session.c_str(),
+                        SESSION_TIMEOUT_S);
+                appendf(headers,
+                        "Transport: RTP/AVP;multicast;destination=%s;port=%hu-%hu;ttl=%d\r\n",
+                        group->getGroupAddr().c_str(), group->getRtpPort(), group->getRtcpPort(),
+                        group->getTtl());
+                reply(msg, "200 OK", headers);
+                mState = RTSP_STATE_READY;
+                break;
+            }
+
+            int payloadType = mRtspProgram->getPayloadType(programStreamId);
+            MediaCodecType mediaType = mRtspProgram->getMediaType(programStreamId);
+            std::string mime = mRtspProgram->getMime(programStreamId);
+            auto rtpStream =
+                std::make_shared<RtpServerStream>(programStreamId, payloadType, mediaType, mime);
+            bool interleaved = msg.protocol == "RTP/AVP/TCP";
+            bool initDone;
+            if (interleaved) {
+                // channels the client did not ask for: the first free pair
+                if (msg.interleaved[0] < 0) {
+                    auto inUse = [this](int channel) {
+                        for (auto &stream : mRtspSession->streams) {
+                            if (stream->isInterleaved() && (stream->getRtpChannel() == channel ||
+                                                            stream->getRtcpChannel() == channel))
+                                return true;
+                        }
+                        return false;
+                    };
+                    int channel = 0;
+                    while (inUse(channel) || inUse(channel + 1)) channel += 2;
+                    msg.interleaved[0] = channel;
+                    msg.interleaved[1] = channel + 1;
+                }
+                initDone = rtpStream->initInterleaved(this, msg.interleaved[0], msg.interleaved[1]);
+            } else {
+                initDone = rtpStream->init(mPeerIpAddr, msg.clientPort[0], msg.clientPort[1]);
+                rtpStream->setPacing(mpServer->getPacingConfig());
+            }
+            if (!initDone) {
+                reply(msg, "500 Internal Server Error");
+                break;
+            }
+            mRtspSession->streams.emplace_back(rtpStream);
+
+            appendf(headers, "Session: %s;timeout=%d\r\n", mRtspSession->session.c_str(),
+                    SESSION_TIMEOUT_S);
+            if (interleaved) {
+                appendf(headers, "Transport: RTP/AVP/TCP;unicast;interleaved=%d-%d\r\n",
+                        msg.interleaved[0], msg.interleaved[1]);
+            } else {
+                appendf(headers, "Transport: %s;%s;client_port=%hu-%hu;server_port=%hu-%hu\r\n",
+                        msg.protocol.c_str(), msg.cast.c_str(), msg.clientPort[0],
+                        msg.clientPort[1], rtpStream->getRtpPort(), rtpStream->getRtcpPort());
+            }
+            reply(msg, "200 OK", headers);
+            mState = RTSP_STATE_READY;
+            break;
+        }
+        case RTSP_MSG_PLAY: {
+            if (mState != RTSP_STATE_READY) {
+                reply(msg, "455 Method Not Valid in This State");
+                break;
+            }
+            if (!sessionMatches()) {
+                reply(msg, "454 Session Not Found");
+                break;
+            }
+
+            mpServer->addSession(mRtspSession);
+            appendf(headers, "Session: %s\r\n", msg.session.c_str());
+            reply(msg, "200 OK", headers);
+            mState = RTSP_STATE_PLAYING;
+            startStreaming();
+            break;
+        }
+        case RTSP_MSG_GET_PARAMETER:
+        case RTSP_MSG_SET_PARAMETER: {
+            // keep-alive
+            if (!msg.contentType.empty()) {
+                appendf(headers, "Content-Type: %s\r\n", msg.contentType.c_str());
+            }
+            appendf(headers, "Session: %s\r\n", msg.session.c_str());
+            reply(msg, "200 OK", headers);
+            break;
+        }
+        case RTSP_MSG_TEARDOWN: {
+            LOGD("%s Receive teardown message!\n", __PRETTY_FUNCTION__);
+            appendf(headers, "Session: %s\r\n", msg.session.c_str());
+            reply(msg, "200 OK", headers);
+            // interleaved ones go out behind the reply, with the final flush
+            if (mIsStreaming) {
+                for (auto &stream : mRtspSession->streams) stream->sendBye();
+            }
+            return false;
+        }
+        default:
+            reply(msg, "501 Not Implemented");
+            break;
+    }
+
+    return true;
+}
+
+bool RtspConnection::parseLine(std::string &line, RtspMessage &msg) {
+    if (line.empty() || line == "\r" || line == "\n" || line == "\r\n") return true;
+
+    char str[1024] = {0};
+
+    if (line.starts_with("OPTIONS")) {
+        msg.msgId = RTSP_MSG_OPTIONS;
+    } else if (line.starts_with("DESCRIBE")) {
+        msg.msgId = RTSP_MSG_DESCRIBE;
+        if (std::sscanf(line.c_str(), "DESCRIBE rtsp://%*[^/]/%1023[^ ] ", str) != 1) return false;
+        msg.programName = str;
+    } else if (line.starts_with("ANNOUNCE")) {
+        msg.msgId = RTSP_MSG_ANNOUNCE;
+    } else if (line.starts_with("SETUP")) {
+        msg.msgId = RTSP_MSG_SETUP;
+
+        std::stringstream ss(line);
+        std::string token;
+        while (std::getline(ss, token, ' ')) {
+            if (token.starts_with("rtsp")) {
+                int pos = token.find_last_of('/');
+                pos += 1;
+                if (pos < 0) return false;
+                if (std::sscanf(token.substr(pos, token.size() - pos).c_str(), "trackID=%d",
+                                &msg.programStreamId) != 1)
+                    return false;
+                else
+                    break;
+            }
+        }
+    } else if (line.starts_with("PLAY")) {
+        msg.msgId = RTSP_MSG_PLAY;
+    } else if (line.starts_with("PAUSE")) {
+        msg.msgId = RTSP_MSG_PAUSE;
+    } else if (line.starts_with("TEARDOWN")) {
+        msg.msgId = RTSP_MSG_TEARDOWN;
+    } else if (line.starts_with("GET_PARAMETER")) {
+        msg.msgId = RTSP_MSG_GET_PARAMETER;
+    } else if (line.starts_with("SET_PARAMETER")) {
+        msg.msgId = RTSP_MSG_SET_PARAMETER;
+    } else if (line.starts_with("REDIRECT")) {
+        msg.msgId = RTSP_MSG_REDIRECT;
+    } else if (line.starts_with("RECORD")) {
+        msg.msgId = RTSP_MSG_RECORD;
+    } else if (line.starts_with("CSeq")) {
+        if (std::sscanf(line.c_str(), "CSeq: %d\r", &msg.cseq) != 1) return false;
+    } else if (line.starts_with("User-Agent")) {
+        msg.userAgent = substr(line, ' ', '\r');
+    } else if (line.starts_with("Accept")) {
+        msg.acceptType = substr(line, ' ', '\r');
+    } else if (line.starts_with("Transport")) {
+        std::string transport = substr(line, ' ', '\r');
+        std::stringstream ss(transport);
+        std::string token;
+        while (std::getline(ss, token, ';')) {
+            trim(token);
+            if (token.starts_with("client_port")) {
+                if (std::sscanf(token.c_str(), "client_port=%hu-%hu", &msg.clientPort[0],
+                                &msg.clientPort[1]) != 2)
+                    return false;
+            } else if (token.starts_with("server_port")) {
+                if (std::sscanf(token.c_str(), "server_port=%hu-%hu", &msg.serverPort[0],
+                                &msg.serverPort[1]) != 2)
+                    return false;
+            } else if (token.starts_with("interleaved")) {
+                if (std::sscanf(token.c_str(), "interleaved=%d-%d", &msg.interleaved[0],
+                                &msg.interleaved[1]) != 2 ||
+                    msg.interleaved[0] < 0 || msg.interleaved[0] > 255 || msg.interleaved[1] < 0 ||
+                    msg.interleaved[1] > 255)
+                    return false;
+            } else if (token == "RTP/AVP" || token == "RTP/AVP/UDP" || token == "RTP/AVP/TCP") {
+                msg.protocol = token;
+            } else if (token == "unicast" || token == "multicast") {
+                msg.cast = token;
+            }
+        }
+    } else if (line.starts_with("Session")) {
+        std::string session = substr(line, ' ', '\r');
+        std::stringstream ss(session);
+        std::string token;
+        while (std::getline(ss, token, ';')) {
+            trim(token);
+            if (token.starts_with("timeout")) {
+                if (std::sscanf(token.c_str(), "timeout=%d", &msg.timeout) != 1) return false;
+            } else {
+                msg.session = token;
+            }
+        }
+    } else if (line.starts_with("Range")) {
+    } else if (line.starts_with("Content-type")) {
+        // Content-type: text/parameters
+        msg.contentType = substr(line, ' ', '\r');
+    } else if (line.starts_with("Content-Length")) {
+        // the body is split off before parsing
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+void RtspConnection::armTimeout() {
+    std::weak_ptr<RtspConnection> weakSelf = shared_from_this();
+    mTimeoutTimer = mpLoop->runAt(mLastActivityUs + mSessionTimeoutUs, [weakSelf]() {
+        if (auto self = weakSelf.lock()) self->onTimeout();
+    });
+}
+
+void RtspConnection::onTimeout() {
+    mTimeoutTimer = 0;
+    if (mState == RTSP_STATE_CLOSED) return;
+
+    // a playing client that never sent a receiver report may not speak RTCP at all, only one
+    // that did is expected to keep reporting
+    if ((mState != RTSP_STATE_PLAYING || mReportsRtcp) &&
+        timerNowUs() - mLastActivityUs >= mSessionTimeoutUs) {
+        LOGD("%s Session timed out, closing\n", __PRETTY_FUNCTION__);
+        close();
+        return;
+    }
+    armTimeout();
+}
+
+void RtspConnection::startStreaming() {
+    if (mIsStreaming) return;
+    mIsStreaming = true;
+    MetricsRegistry::getInstance().gauge("rtsp.server.active_sessions").add(1);
+
+    // receiver reports of the UDP streams, interleaved ones come in on the connection
+    std::weak_ptr<RtspConnection> weakSelf = shared_from_this();
+    for (auto &stream : mRtspSession->streams) {
+        if (stream->isInterleaved()) continue;
+        std::weak_ptr<RtpServerStream> weakStream = stream;
+        mpLoop->add(stream->getRtcpSocket(), EventLoop::EVENT_READ, [weakSelf, weakStream](int) {
+            auto self = weakSelf.lock();
+            auto stream = weakStream.lock();
+            if (self && stream && stream->readRtcp() > 0) {
+                self->mLastActivityUs = timerNowUs();
+                self->mReportsRtcp = true;
+            }
+        });
+    }
+
+    if (!mRtspSession->streams.empty()) {
+        mStreamPump = std::make_shared<RtspStreamPump>(mpLoop, mRtspProgram, mRtspSession->streams);
+        mStreamPump->setCatchUpRate(mpServer->getGopCacheConfig().catchUpRate);
+        mStreamPump->setAdmitHook([this](RtspStreamPump::SendStream &sendStream) {
+            return !sendStream.rtpStream->isInterleaved() || admitInterleaved(sendStream);
+        });
+        // interleaved packets of a round go out together
+        mStreamPump->setRoundHook([this]() {
+            if (mOutput.empty() || flush()) return true;
+            close();
+            return false;
+        });
+        mStreamPump->start(mpServer->getSendQueueLimits());
+    }
+
+    for (auto &group : mMulticastGroups) group->addViewer(mpServer->getSendQueueLimits());
+}
+
+void RtspConnection::stopStreaming() {
+    if (!mIsStreaming) return;
+    mIsStreaming = false;
+
+    if (mStreamPump) {
+        mStreamPump->stop();
+        mStreamPump.reset();
+    }
+    for (auto &stream : mRtspSession->streams) {
+        if (!stream->isInterleaved()) mpLoop->remove(stream->getRtcpSocket());
+    }
+    for (auto &group : mMulticastGroups) group->removeViewer();
+    MetricsRegistry::getInstance().gauge("rtsp.server.active_sessions").add(-1);
+}
+
+bool RtspConnection::admitInterleaved(RtspStreamPump::SendStream &sendStream) {
+    static MetricCounter &droppedUnits =
+        MetricsRegistry::getInstance().counter("rtsp.server.slow_client_dropped_units");
+    static MetricCounter &keyframeSkips =
+        MetricsRegistry::getInstance().counter("rtsp.server.slow_client_keyframe_skips");
+
+    bool isVideo = sendStream.rtpStream->getMediaType() == MEDIA_CODEC_TYPE_VIDEO;
+    // the cached GOP is held by the program anyway, queueing it costs no memory
+    if (mOutputBytes > MAX_OUTPUT_BACKLOG && !sendStream.pendingCached) {
+        if (isVideo && !sendStream.skipToKeyframe) {
+            sendStream.skipToKeyframe = true;
+            keyframeSkips.add();
+        }
+        droppedUnits.add();
+        return false;
+    }
+
+    if (sendStream.skipToKeyframe) {
+        if (!sendStream.pending->packetBuffer->isKeyFrame()) {
+            droppedUnits.add();
+            return false;
+        }
+        sendStream.skipToKeyframe = false;
+    }
+    return true;
+}
@@ -0,0 +1,164 @@
+#ifndef RTSP_CONNECTION_H
+#define RTSP_CONNECTION_H
+
+#include "rtsp/server/RtspProgram.h"
+#include "rtsp/server/RtpServerStream.h"
+#include "rtsp/server/RtspStreamPump.h"
+#include "rtsp/server/RtspMulticastGroup.h"
+#include "foundation/EventLoop.h"
+#include "foundation/RingQueue.h"
+#include "foundation/Socket.h"
+
+#include <cstdint>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+
+class RtspServerHelper;
+
+struct RtspSession {
+    std::string session;
+    std::shared_ptr<RtspProgram> program;
+    std::vector<std::shared_ptr<RtpServerStream>> streams;
+};
+
+// One RTSP control connection, owned by the server and driven by the event loop it was accepted
+// onto. Everything but the program callbacks runs on that loop thread: requests are parsed out of
+// a non-blocking input buffer, replies are queued and flushed whenever the socket is writable.
+//
+// States follow the handshake, INIT -> DESCRIBED -> READY (at least one SETUP) -> PLAYING, and
+// any request arriving out of order gets 455 Method Not Valid in This State. A connection that
+// stays silent for the session timeout is closed; while playing, receiver reports count as
+// activity, and a client that never sent one is not timed out at all.
+//
+// While playing the packets are sent from the loop too, by an RtspStreamPump subscribed to the
+// program, so a session costs no thread of its own. Streams set up as multicast are not sent by
+// the session at all, it only counts as a viewer of the program stream's shared group. The
+// streams send their own RTCP sender reports, the receiver reports coming back are read here
+// and kept per stream (RtpServerStream::getReceiverStats()).
+//
+// Streams set up with RTP/AVP/TCP are interleaved into the connection's own output. A client that
+// cannot keep up shows as a growing output backlog; past MAX_OUTPUT_BACKLOG its access units are
+// dropped, video until the next keyframe, so the program fan-out never waits for it.
+class RtspConnection : public std::enable_shared_from_this<RtspConnection>,
+                       public RtpInterleavedSink {
+public:
+    enum RtspState {
+        RTSP_STATE_INIT,
+        RTSP_STATE_DESCRIBED,
+        RTSP_STATE_READY,
+        RTSP_STATE_PLAYING,
+        RTSP_STATE_CLOSED,
+    };
+
+    RtspConnection(RtspServerHelper *server, EventLoop *loop, SOCKET s);
+    RtspConnection(const RtspConnection &) = delete;
+    RtspConnection &operator=(const RtspConnection &) = delete;
+    virtual ~RtspConnection();
+
+    // loop thread only
+    bool start();
+    void close();
+
+    EventLoop *getLoop() const { return mpLoop; }
+
+    // loop thread only, from the pump through RtpServerStream
+    virtual void writeInterleaved(std::shared_ptr<const void> owner,
+                                  const SocketBuffer *buffers,
+                                  size_t count) override;
+
+private:
+    enum RtspMsgType {
+        RTSP_MSG_UNKNOWN,
+        RTSP_MSG_OPTIONS,
+        RTSP_MSG_DESCRIBE,
+        RTSP_MSG_ANNOUNCE,
+        RTSP_MSG_SETUP,
+        RTSP_MSG_PLAY,
+        RTSP_MSG_PAUSE,
+        RTSP_MSG_TEARDOWN,
+        RTSP_MSG_GET_PARAMETER,
+        RTSP_MSG_SET_PARAMETER,
+        RTSP_MSG_REDIRECT,
+        RTSP_MSG_RECORD,
+    };
+
+    struct RtspMessage {
+        RtspMsgType msgId = RTSP_MSG_UNKNOWN;
+        int cseq = 0;
+        int timeout = 0;
+        int programStreamId = 0;
+        uint16_t clientPort[2] = {0, 0};
+        uint16_t serverPort[2] = {0, 0};
+        int interleaved[2] = {-1, -1};
+        std::string programName;
+        std::string acceptType;
+        std::string contentType;
+        std::string session;
+        std::string userAgent;
+        std::string protocol;
+        std::string cast; // unicast/multicast/broadcast
+    };
+
+    // a piece of output, owner keeps data alive
+    struct OutputPiece {
+        std::shared_ptr<const void> owner;
+        const uint8_t *data;
+        size_t size;
+    };
+
+    RtspServerHelper *mpServer;
+    EventLoop *mpLoop;
+    SOCKET mSocket;
+    RtspState mState;
+
+    std::string mLocalIpAddr;
+    uint16_t mLocalPort;
+    std::string mPeerIpAddr;
+
+    std::string mInput;
+    std::deque<OutputPiece> mOutput;
+    size_t mOutputOffset; // sent bytes of the first piece
+    size_t mOutputBytes;  // queued and not sent yet
+    bool mWantWrite;
+
+    int64_t mSessionTimeoutUs;
+    int64_t mLastActivityUs;
+    TimerService::TimerId mTimeoutTimer;
+    // the client sent a receiver report, from then on its RTCP keeps the session alive
+    bool mReportsRtcp;
+
+    std::shared_ptr<RtspProgram> mRtspProgram;
+    std::shared_ptr<RtspSession> mRtspSession;
+
+    // unicast and interleaved streams of the session
+    std::shared_ptr<RtspStreamPump> mStreamPump;
+    // multicast streams of the session, joined while playing
+    std::vector<std::shared_ptr<RtspMulticastGroup>> mMulticastGroups;
+    bool mIsStreaming;
+
+    void onEvents(int events);
+    void onReadable();
+    // gathers as many pieces as a send takes, false when the connection has to be closed
+    bool flush();
+    void consumeOutput(size_t bytes);
+    void updateInterest();
+
+    // returns false when the connection has to be closed
+    bool handleRequest(const std::string &request);
+    static bool parseLine(std::string &line, RtspMessage &msg);
+    void reply(const RtspMessage &msg, const char *status, const std::string &headers = "",
+               const std::string &body = "");
+
+    void armTimeout();
+    void onTimeout();
+
+    void startStreaming();
+    void stopStreaming();
+    // whether an interleaved stream's pending access unit goes out or is dropped
+    bool admitInterleaved(RtspStreamPump::SendStream &sendStream);
+};
+
+#endif
@@ -0,0 +1,57 @@
+#include "RtspMulticastGroup.h"
+
+#include "foundation/Log.h"
+#include "foundation/Metrics.h"
+
+RtspMulticastGroup::RtspMulticastGroup(EventLoop *loop,
+                                       std::shared_ptr<RtspProgram> program,
+                                       int streamId,
+                                       std::string groupAddr,
+                                       uint16_t port,
+                                       int ttl)
+    : mpLoop(loop), mRtspProgram(program), mStreamId(streamId), mGroupAddr(groupAddr),
+      mPort(port), mTtl(ttl), mViewers(0) {}
+
+RtspMulticastGroup::~RtspMulticastGroup() {}
+
+bool RtspMulticastGroup::init(const std::string &interfaceAddr, const RtpPacingConfig &pacing) {
+    mRtpStream = std::make_shared<RtpServerStream>(
+        mStreamId, mRtspProgram->getPayloadType(mStreamId), mRtspProgram->getMediaType(mStreamId),
+        mRtspProgram->getMime(mStreamId));
+    if (!mRtpStream->initMulticast(mGroupAddr, mPort, mPort + 1, mTtl, interfaceAddr)) {
+        LOGE("%s Failed to set up multicast group %s:%hu\n", __PRETTY_FUNCTION__,
+             mGroupAddr.c_str(), mPort);
+        return false;
+    }
+    mRtpStream->setPacing(pacing);
+
+    std::vector<std::shared_ptr<RtpServerStream>> rtpStreams = {mRtpStream};
+    mStreamPump = std::make_shared<RtspStreamPump>(mpLoop, mRtspProgram, rtpStreams);
+    return true;
+}
+
+void RtspMulticastGroup::addViewer(const QueueLimits &limits) {
+    static MetricGauge &viewers =
+        MetricsRegistry::getInstance().gauge("rtsp.server.multicast_viewers");
+    viewers.add(1);
+
+    auto self = shared_from_this();
+    mpLoop->dispatch([self, limits]() {
+        // the first viewer starts sending, the last one stops it
+        if (self->mViewers++ == 0) self->mStreamPump->start(limits);
+    });
+}
+
+void RtspMulticastGroup::removeViewer() {
+    static MetricGauge &viewers =
+        MetricsRegistry::getInstance().gauge("rtsp.server.multicast_viewers");
+    viewers.add(-1);
+
+    auto self = shared_from_this();
+    mpLoop->dispatch([self]() {
+        if (--self->mViewers == 0) {
+            self->mStreamPump->stop();
+            self->mRtpStream->sendBye();
+        }
+    });
+}
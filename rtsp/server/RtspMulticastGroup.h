@@ -0,0 +1,68 @@
+#ifndef RTSP_MULTICAST_GROUP_H
+#define RTSP_MULTICAST_GROUP_H
+
+#include "rtsp/server/RtspProgram.h"
+#include "rtsp/server/RtpServerStream.h"
+#include "rtsp/server/RtspStreamPump.h"
+#include "foundation/EventLoop.h"
+#include "foundation/RingQueue.h"
+
+#include <cstdint>
+
+#include <string>
+#include <memory>
+
+// How the server hands out multicast groups, one per program stream
+struct RtspMulticastConfig {
+    std::string baseAddr = "239.255.42.1"; // group addresses go up from here
+    uint16_t basePort = 30000;             // a port pair per group from here
+    int ttl = 16;
+    std::string interfaceAddr; // outgoing interface, empty for the system default
+};
+
+// Every multicast viewer of a program stream shares one group: a single RtpServerStream sending
+// to the group address, pumped from one event loop while at least one viewer plays. Server
+// egress is one copy per program stream whatever the number of viewers.
+//
+// Address, port and TTL are given by the server, which keeps one group per program stream.
+// addViewer/removeViewer are thread safe, the pump runs on the group's loop.
+//
+// Sends are looped back, so viewers on the server host join too: two
+// `ffplay -rtsp_transport udp_multicast rtsp://127.0.0.1:<port>/<program>` share one group.
+class RtspMulticastGroup : public std::enable_shared_from_this<RtspMulticastGroup> {
+public:
+    RtspMulticastGroup(EventLoop *loop,
+                       std::shared_ptr<RtspProgram> program,
+                       int streamId,
+                       std::string groupAddr,
+                       uint16_t port,
+                       int ttl);
+    RtspMulticastGroup(const RtspMulticastGroup &) = delete;
+    RtspMulticastGroup &operator=(const RtspMulticastGroup &) = delete;
+    virtual ~RtspMulticastGroup();
+
+    // interfaceAddr picks the outgoing interface, empty for the system default
+    bool init(const std::string &interfaceAddr, const RtpPacingConfig &pacing);
+
+    void addViewer(const QueueLimits &limits);
+    void removeViewer();
+
+    const std::string &getGroupAddr() const { return mGroupAddr; }
+    uint16_t getRtpPort() const { return mPort; }
+    uint16_t getRtcpPort() const { return mPort + 1; }
+    int getTtl() const { return mTtl; }
+
+private:
+    EventLoop *mpLoop;
+    std::shared_ptr<RtspProgram> mRtspProgram;
+    int mStreamId;
+    std::string mGroupAddr;
+    uint16_t mPort;
+    int mTtl;
+
+    std::shared_ptr<RtpServerStream> mRtpStream;
+    std::shared_ptr<RtspStreamPump> mStreamPump;
+    int mViewers; // loop thread only
+};
+
+#endif
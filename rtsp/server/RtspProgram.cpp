@@ -1,10 +1,113 @@
 #include "RtspProgram.h"
+#include "foundation/FFBufferPool.h"
+#include "foundation/Log.h"
+#include "foundation/Metrics.h"
+#include "foundation/TimerService.h"
+#include "foundation/Trace.h"
+
+#include <algorithm>
+
+// the reader runs this far ahead of the program clock, well below the subscriber queue budget
+static const int64_t READ_AHEAD_US = 500000;
+
+RtspSubscriber::RtspSubscriber(std::function<void()> notify)
+    : mNotify(std::move(notify)), mEnded(false) {}
+
+RtspSubscriber::~RtspSubscriber() {
+    abort();
+}
+
+std::shared_ptr<RtspSubscriber::BufferQueue> RtspSubscriber::getQueue(int streamId) {
+    for (auto &stream : mStreams) {
+        if (stream.streamId == streamId) return stream.queue;
+    }
+    return nullptr;
+}
+
+std::vector<std::shared_ptr<RtpPacketList>> RtspSubscriber::takeCached(int streamId) {
+    for (auto &stream : mStreams) {
+        if (stream.streamId == streamId) return std::move(stream.cached);
+    }
+    return {};
+}
+
+void RtspSubscriber::addStream(int streamId, MediaCodecType mediaType, const QueueLimits &limits) {
+    Stream stream;
+    stream.streamId = streamId;
+    stream.mediaType = mediaType;
+    stream.queue = std::make_shared<BufferQueue>(
+        limits, mediaType == MEDIA_CODEC_TYPE_VIDEO ? "rtsp.send.video" : "rtsp.send.audio");
+    // a decoder can not start in the middle of a GOP
+    stream.skipToKeyframe = mediaType == MEDIA_CODEC_TYPE_VIDEO;
+    mStreams.emplace_back(std::move(stream));
+}
+
+void RtspSubscriber::publish(int streamId, const std::shared_ptr<RtpPacketList> &packetList) {
+    static MetricCounter &droppedPackets =
+        MetricsRegistry::getInstance().counter("rtsp.program.dropped_packets");
+    static MetricCounter &keyframeSkips =
+        MetricsRegistry::getInstance().counter("rtsp.program.keyframe_skips");
+
+    for (auto &stream : mStreams) {
+        if (stream.streamId != streamId) continue;
+
+        if (stream.skipToKeyframe) {
+            if (!packetList->packetBuffer->isKeyFrame()) {
+                droppedPackets.add();
+                return;
+            }
+            stream.skipToKeyframe = false;
+        }
+
+        auto item = packetList;
+        if (!stream.queue->tryPush(std::move(item))) {
+            // slow consumer, audio loses this packet only, video the rest of the GOP
+            droppedPackets.add();
+            if (stream.mediaType == MEDIA_CODEC_TYPE_VIDEO) {
+                stream.skipToKeyframe = true;
+                keyframeSkips.add();
+            }
+            return;
+        }
+        if (mNotify) mNotify();
+        return;
+    }
+}
+
+void RtspSubscriber::addCached(int streamId, const std::shared_ptr<RtpPacketList> &packetList) {
+    for (auto &stream : mStreams) {
+        if (stream.streamId != streamId) continue;
+
+        // as for publish(), a stream not anchoring the cache may have to wait for its keyframe
+        if (stream.skipToKeyframe) {
+            if (!packetList->packetBuffer->isKeyFrame()) return;
+            stream.skipToKeyframe = false;
+        }
+        stream.cached.emplace_back(packetList);
+        return;
+    }
+}
+
+void RtspSubscriber::end() {
+    mEnded.store(true, std::memory_order_release);
+    if (mNotify) mNotify();
+}
+
+void RtspSubscriber::abort() {
+    for (auto &stream : mStreams) stream.queue->abort();
+}
 
 RtspProgram::RtspProgram(RtspProgramType type, std::string programName, std::string filePath)
     : mNextStreamId(0), mNextPayloadType(96), mProgramType(type), mProgramName(programName),
-      mProgramFilePath(filePath), mpFormatCtx(nullptr) {}
+      mProgramFilePath(filePath), mpFormatCtx(nullptr), mGopCacheBytes(0),
+      mGopCacheMaxBytes(RtspGopCacheConfig().maxBytes), mGopStreamId(-1),
+      mIsStarted(false), mNeedRewind(false), mStopReader(false), mBaseTimeUs(0) {
+    mSubscribers = std::make_shared<const std::vector<std::shared_ptr<RtspSubscriber>>>();
+}
 
 RtspProgram::~RtspProgram() {
+    mStopReader = true;
+    if (mReaderThread && mReaderThread->joinable()) mReaderThread->join();
     if (mpFormatCtx) {
         avformat_free_context(mpFormatCtx);
     }
@@ -85,6 +188,10 @@ void RtspProgram::init() {
             mSdpHelper->parseCsd(stream->streamId, stream->csdData.data(), stream->csdData.size());
         mTimescalePairs.emplace_back(
             std::make_pair(stream->timescale, mSdpHelper->getTimescale(stream->streamId)));
+
+        stream->rtpProto = RtpServerBaseProto::create(stream->mime, stream->payloadType);
+        if (stream->rtpProto && stream->csdData.size() > 0)
+            stream->rtpProto->parseCsd(stream->csdData.data(), stream->csdData.size());
     }
 }
 
@@ -120,47 +227,202 @@ void RtspProgram::getCsd(int streamId, std::vector<uint8_t> &csd) {
     if (stream) csd.insert(csd.end(), stream->csdData.begin(), stream->csdData.end());
 }
 
+std::shared_ptr<RtspSubscriber> RtspProgram::subscribe(const std::vector<int> &streamIds,
+                                                       const QueueLimits &limits,
+                                                       std::function<void()> notify) {
+    static MetricGauge &subscribers =
+        MetricsRegistry::getInstance().gauge("rtsp.program.subscribers");
+    static MetricCounter &cacheJoins =
+        MetricsRegistry::getInstance().counter("rtsp.program.gop_cache_joins");
+
+    auto subscriber = std::make_shared<RtspSubscriber>(std::move(notify));
+    for (int streamId : streamIds) {
+        auto stream = getProgramStream(streamId);
+        if (stream) subscriber->addStream(streamId, stream->mediaType, limits);
+    }
+
+    std::lock_guard<std::mutex> lock(mSubscriberMutex);
+    // the cached GOP first, then whatever the reader publishes from now on
+    trimGopCache(timerNowUs());
+    if (!mGopCache.empty()) {
+        for (auto &entry : mGopCache) subscriber->addCached(entry.streamId, entry.packetList);
+        cacheJoins.add();
+    }
+    auto list = std::make_shared<std::vector<std::shared_ptr<RtspSubscriber>>>(*mSubscribers);
+    list->emplace_back(subscriber);
+    mSubscribers = std::move(list);
+    subscribers.add(1);
+
+    if (!mIsStarted) start();
+
+    return subscriber;
+}
+
+void RtspProgram::unsubscribe(const std::shared_ptr<RtspSubscriber> &subscriber) {
+    static MetricGauge &subscribers =
+        MetricsRegistry::getInstance().gauge("rtsp.program.subscribers");
+
+    // wakes the consumer, later publishes to it fail
+    subscriber->abort();
+
+    std::lock_guard<std::mutex> lock(mSubscriberMutex);
+    auto iter = std::find(mSubscribers->begin(), mSubscribers->end(), subscriber);
+    if (iter == mSubscribers->end()) return;
+    auto list = std::make_shared<std::vector<std::shared_ptr<RtspSubscriber>>>(*mSubscribers);
+    list->erase(list->begin() + (iter - mSubscribers->begin()));
+    mSubscribers = std::move(list);
+    subscribers.add(-1);
+}
+
+void RtspProgram::setGopCacheLimit(size_t maxBytes) {
+    std::lock_guard<std::mutex> lock(mSubscriberMutex);
+    mGopCacheMaxBytes = maxBytes;
+    if (mGopCacheBytes > maxBytes) clearGopCache();
+}
+
+void RtspProgram::cachePacketList(int streamId,
+                                  int64_t dueUs,
+                                  const std::shared_ptr<RtpPacketList> &packetList) {
+    static MetricGauge &cacheBytes =
+        MetricsRegistry::getInstance().gauge("rtsp.program.gop_cache_bytes");
+    static MetricCounter &cacheOverflows =
+        MetricsRegistry::getInstance().counter("rtsp.program.gop_cache_overflows");
+
+    bool keyframe = streamId == mGopStreamId && packetList->packetBuffer->isKeyFrame();
+    // the cache always starts at a keyframe
+    if (!mGopCacheMaxBytes || (mGopCache.empty() && !keyframe)) return;
+
+    size_t bytes = QueueItemTraits<std::shared_ptr<RtpPacketList>>::bytes(packetList);
+    mGopCache.push_back({streamId, keyframe, dueUs, packetList});
+    mGopCacheBytes += bytes;
+    cacheBytes.add((int64_t)bytes);
+    trimGopCache(timerNowUs());
+
+    if (mGopCacheBytes > mGopCacheMaxBytes) {
+        // the GOP read ahead may fit alone, part of a GOP is of no use
+        trimGopCache(INT64_MAX);
+        if (mGopCacheBytes > mGopCacheMaxBytes) {
+            clearGopCache();
+            cacheOverflows.add();
+        }
+    }
+}
+
+void RtspProgram::trimGopCache(int64_t nowUs) {
+    static MetricGauge &cacheBytes =
+        MetricsRegistry::getInstance().gauge("rtsp.program.gop_cache_bytes");
+
+    size_t start = 0;
+    for (size_t i = 1; i < mGopCache.size() && mGopCache[i].dueUs <= nowUs; ++i) {
+        if (mGopCache[i].keyframe) start = i;
+    }
+    for (size_t i = 0; i < start; ++i) {
+        size_t bytes =
+            QueueItemTraits<std::shared_ptr<RtpPacketList>>::bytes(mGopCache.front().packetList);
+        mGopCacheBytes -= bytes;
+        cacheBytes.add(-(int64_t)bytes);
+        mGopCache.pop_front();
+    }
+}
+
+void RtspProgram::clearGopCache() {
+    static MetricGauge &cacheBytes =
+        MetricsRegistry::getInstance().gauge("rtsp.program.gop_cache_bytes");
+
+    cacheBytes.add(-(int64_t)mGopCacheBytes);
+    mGopCache.clear();
+    mGopCacheBytes = 0;
+}
+
+// called with mSubscriberMutex held
 void RtspProgram::start() {
-    auto readfile = [this]() {
-        if (mpFormatCtx) {
-            for (;;) {
-                auto packetBuffer = std::make_shared<AVPacketBuffer>();
-                AVPacket *packet = packetBuffer->get();
-                int ret = av_read_frame(mpFormatCtx, packet);
-                if (ret >= 0) {
-                    int streamIndex = packet->stream_index;
-                    packet->dts = rescaleTimeStamp(packet->dts, mTimescalePairs[streamIndex].first,
-                                                   mTimescalePairs[streamIndex].second);
-                    packet->pts = rescaleTimeStamp(packet->pts, mTimescalePairs[streamIndex].first,
-                                                   mTimescalePairs[streamIndex].second);
-                    packet->time_base = {1, mTimescalePairs[streamIndex].second};
-
-                    if (mVideoBufferReadyCB &&
-                        mProgramStreams[streamIndex]->mediaType == MEDIA_CODEC_TYPE_VIDEO) {
-                        mVideoBufferReadyCB(packetBuffer);
-                    } else if (mAudioBufferReadyCB &&
-                               mProgramStreams[streamIndex]->mediaType == MEDIA_CODEC_TYPE_AUDIO) {
-                        mAudioBufferReadyCB(packetBuffer);
-                    }
-                } else {
-                    if (mVideoBufferReadyCB) mVideoBufferReadyCB(nullptr);
-                    if (mAudioBufferReadyCB) mAudioBufferReadyCB(nullptr);
-                    break;
-                }
+    if (mProgramType != RTSP_PROGRAM_FILE || !mpFormatCtx) return;
+
+    // the first video stream anchors the GOP cache, audio only programs need none
+    mGopStreamId = -1;
+    for (auto &stream : mProgramStreams) {
+        if (stream->mediaType == MEDIA_CODEC_TYPE_VIDEO) {
+            mGopStreamId = stream->streamId;
+            break;
+        }
+    }
+
+    // a previous reader has already given up the program, it only has to return
+    if (mReaderThread && mReaderThread->joinable()) mReaderThread->join();
+
+    mIsStarted = true;
+    mReaderThread = std::make_unique<std::thread>(&RtspProgram::readThread, this);
+}
+
+void RtspProgram::readThread() {
+    static MetricGauge &subscribers =
+        MetricsRegistry::getInstance().gauge("rtsp.program.subscribers");
+
+    TRACE_THREAD_NAME("rtsp read");
+
+    if (mNeedRewind) {
+        av_seek_frame(mpFormatCtx, -1, 0, AVSEEK_FLAG_BACKWARD);
+        mNeedRewind = false;
+    }
+    mBaseTimeUs = timerNowUs();
+
+    std::shared_ptr<const std::vector<std::shared_ptr<RtspSubscriber>>> snapshot;
+    while (!mStopReader.load()) {
+        TRACE_SCOPE("read packet");
+        auto packetBuffer = FFBufferPool::getInstance().acquirePacket();
+        AVPacket *packet = packetBuffer->get();
+        int ret = av_read_frame(mpFormatCtx, packet);
+
+        std::unique_lock<std::mutex> lock(mSubscriberMutex);
+        if (ret < 0 || mSubscribers->empty()) {
+            // end of program, or nobody left: the next subscriber restarts from the beginning
+            snapshot = std::move(mSubscribers);
+            mSubscribers = std::make_shared<const std::vector<std::shared_ptr<RtspSubscriber>>>();
+            subscribers.add(-(int64_t)snapshot->size());
+            mIsStarted = false;
+            mNeedRewind = true;
+            // the cached packets are due on this run's clock
+            clearGopCache();
+            lock.unlock();
+
+            for (auto &subscriber : *snapshot) subscriber->end();
+            if (ret < 0 && ret != AVERROR_EOF) {
+                LOGE("%s Failed to read program %s, error code:%d\n", __PRETTY_FUNCTION__,
+                     mProgramName.c_str(), ret);
             }
+            return;
         }
-        mIsStarted = false;
-    };
+        lock.unlock();
 
-    if (mIsStarted) return;
+        int streamIndex = packet->stream_index;
+        packet->dts = rescaleTimeStamp(packet->dts, mTimescalePairs[streamIndex].first,
+                                       mTimescalePairs[streamIndex].second);
+        packet->pts = rescaleTimeStamp(packet->pts, mTimescalePairs[streamIndex].first,
+                                       mTimescalePairs[streamIndex].second);
+        packet->time_base = {1, mTimescalePairs[streamIndex].second};
 
-    if (mProgramType == RTSP_PROGRAM_FILE) {
-        auto readfileThread = std::make_unique<std::thread>(readfile);
-        readfileThread->detach();
-    } else if (mProgramType == RTSP_PROGRAM_SCREEN) {
+        // stay READ_AHEAD_US ahead of the clock the sessions send on
+        int64_t timestampUs =
+            rescaleTimeStamp(packet->dts, mTimescalePairs[streamIndex].second, 1000000);
+        TimerService::getInstance().sleepUntil(mBaseTimeUs + timestampUs - READ_AHEAD_US);
 
-    } else if (mProgramType == RTSP_PROGRAM_CAMERA) {
+        auto &programStream = mProgramStreams[streamIndex];
+        if (!programStream->rtpProto) continue;
+
+        TRACE_FLOW_NEW_ID(packet->opaque);
+        auto packetList = programStream->rtpProto->packetize(packetBuffer);
+        TRACE_FLOW_BEGIN("rtsp packet", (uint64_t)(uintptr_t)packet->opaque);
+        {
+            std::lock_guard<std::mutex> cacheLock(mSubscriberMutex);
+            cachePacketList(programStream->streamId, mBaseTimeUs + timestampUs, packetList);
+            snapshot = mSubscribers;
+        }
+        for (auto &subscriber : *snapshot) {
+            subscriber->publish(programStream->streamId, packetList);
+        }
     }
 
-    mIsStarted = true;
+    std::lock_guard<std::mutex> lock(mSubscriberMutex);
+    mIsStarted = false;
+    clearGopCache();
 }
@@ -3,20 +3,84 @@
 
 #include "foundation/Utils.h"
 #include "foundation/FFBuffer.h"
+#include "foundation/RingQueue.h"
 #include "vr/ScreenRecorder.h"
 #include "rtsp/server/SdpServerHelper.h"
+#include "rtsp/server/RtpServerProto.h"
 
 #include <cstdint>
 
 #include <vector>
+#include <deque>
 #include <memory>
 #include <functional>
 #include <atomic>
+#include <mutex>
+#include <thread>
 
 extern "C" {
 #include "libavformat/avformat.h"
 }
 
+// Late joiner start up. Each program keeps the packet lists of all its streams from the latest
+// video keyframe that is due on, up to maxBytes, and hands them to every new subscriber, so it
+// can decode right away instead of waiting for the next keyframe. The reader runs ahead of the
+// clock, so the budget covers a GOP plus that read ahead; a larger GOP is not cached.
+// The cached access units keep their RTP timestamps, they are just due in the past: with
+// catchUpRate 0 they are sent at once, otherwise at that multiple of real time until the viewer
+// has caught up with the live packets.
+struct RtspGopCacheConfig {
+    size_t maxBytes = 4 * 1024 * 1024;
+    double catchUpRate = 0;
+};
+
+// A viewer of a program: one bounded queue per subscribed stream, filled by the program reader
+// with access units already packetized into RTP, after the cached GOP it was subscribed with.
+// A full queue never holds the reader back, the viewer skips that stream to its next keyframe
+// instead (video also starts at a keyframe). notify runs on the reader thread after every push
+// and at the end of the program, it must not block.
+class RtspSubscriber {
+public:
+    using BufferQueue = SpscRingQueue<std::shared_ptr<RtpPacketList>>;
+
+    explicit RtspSubscriber(std::function<void()> notify);
+    RtspSubscriber(const RtspSubscriber &) = delete;
+    RtspSubscriber &operator=(const RtspSubscriber &) = delete;
+    virtual ~RtspSubscriber();
+
+    std::shared_ptr<BufferQueue> getQueue(int streamId);
+    // the cached access units of the stream, consumer only, due before anything in the queue
+    std::vector<std::shared_ptr<RtpPacketList>> takeCached(int streamId);
+    // the program has ended, nothing is pushed after what is queued
+    bool isEnded() const { return mEnded.load(std::memory_order_acquire); }
+
+private:
+    friend class RtspProgram;
+
+    struct Stream {
+        int streamId;
+        MediaCodecType mediaType;
+        std::shared_ptr<BufferQueue> queue;
+        bool skipToKeyframe; // reader thread only once subscribed
+        // filled before the subscriber is published to the reader
+        std::vector<std::shared_ptr<RtpPacketList>> cached;
+    };
+
+    std::vector<Stream> mStreams;
+    std::function<void()> mNotify;
+    std::atomic<bool> mEnded;
+
+    void addStream(int streamId, MediaCodecType mediaType, const QueueLimits &limits);
+    void publish(int streamId, const std::shared_ptr<RtpPacketList> &packetList);
+    void addCached(int streamId, const std::shared_ptr<RtpPacketList> &packetList);
+    void end();
+    void abort();
+};
+
+// A program is demuxed and packetized once, by one reader thread, and the resulting RTP packet
+// lists are fanned out to every subscriber. The reader runs while there are subscribers and
+// paces itself on the program clock, a little ahead of it, so all viewers watch the same live
+// timeline.
 class RtspProgram {
 public:
     enum RtspProgramType {
@@ -33,6 +97,8 @@ private:
         MediaCodecType mediaType = MEDIA_CODEC_TYPE_UNKNOWN;
         std::string mime;
         std::vector<uint8_t> csdData;
+        // packetizes each access unit once for all subscribers, reader thread only
+        std::shared_ptr<RtpServerBaseProto> rtpProto;
     };
 
     int mNextStreamId;
@@ -51,13 +117,39 @@ private:
     std::unique_ptr<SdpServerHelper> mSdpHelper;
     std::vector<std::pair<int, int>> mTimescalePairs;
 
-    std::function<void(std::shared_ptr<AVPacketBuffer>)> mVideoBufferReadyCB;
-    std::function<void(std::shared_ptr<AVPacketBuffer>)> mAudioBufferReadyCB;
-
-    std::atomic_bool mIsStarted = false;
+    std::mutex mSubscriberMutex;
+    // copy on write, the reader takes a snapshot per packet
+    std::shared_ptr<const std::vector<std::shared_ptr<RtspSubscriber>>> mSubscribers;
+    struct GopCacheEntry {
+        int streamId;
+        bool keyframe; // of mGopStreamId
+        int64_t dueUs;
+        std::shared_ptr<RtpPacketList> packetList;
+    };
+    // everything read since the latest due keyframe of mGopStreamId, guarded by
+    // mSubscriberMutex, so a packet is either cached for a new subscriber or published to it
+    std::deque<GopCacheEntry> mGopCache;
+    size_t mGopCacheBytes;
+    size_t mGopCacheMaxBytes;
+    int mGopStreamId; // first video stream, -1 without one
+    bool mIsStarted;   // guarded by mSubscriberMutex
+    bool mNeedRewind;  // reader thread only
+    std::atomic<bool> mStopReader;
+    std::atomic<int64_t> mBaseTimeUs;
+    std::unique_ptr<std::thread> mReaderThread;
 
     std::shared_ptr<ProgramStream> getProgramStream(int streamId);
 
+    void start();
+    void readThread();
+    // called with mSubscriberMutex held
+    void cachePacketList(int streamId,
+                         int64_t dueUs,
+                         const std::shared_ptr<RtpPacketList> &packetList);
+    // drops what comes before the latest keyframe due by nowUs
+    void trimGopCache(int64_t nowUs);
+    void clearGopCache();
+
 public:
     RtspProgram(RtspProgramType type, std::string programName, std::string filePath = "");
     RtspProgram(const RtspProgram &) = delete;
@@ -72,14 +164,15 @@ public:
     std::string getMime(int streamId);
     void getCsd(int streamId, std::vector<uint8_t> &csd);
 
-    void setVideoBufferReadyCB(std::function<void(std::shared_ptr<AVPacketBuffer>)> cb) {
-        mVideoBufferReadyCB = cb;
-    }
-    void setAudioBufferReadyCB(std::function<void(std::shared_ptr<AVPacketBuffer>)> cb) {
-        mAudioBufferReadyCB = cb;
-    }
-
-    void start();
+    // starts the reader with the first subscriber, stops it after the last one left
+    std::shared_ptr<RtspSubscriber> subscribe(const std::vector<int> &streamIds,
+                                              const QueueLimits &limits,
+                                              std::function<void()> notify);
+    void unsubscribe(const std::shared_ptr<RtspSubscriber> &subscriber);
+    // 0 disables the GOP cache
+    void setGopCacheLimit(size_t maxBytes);
+    // program clock, a packet is due at getBaseTimeUs() plus its dts in microseconds
+    int64_t getBaseTimeUs() const { return mBaseTimeUs.load(std::memory_order_relaxed); }
 };
 
 #endif
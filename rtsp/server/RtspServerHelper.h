@@ -2,77 +2,71 @@
 #define RTSP_SERVER_HELPER_H
 
 #include "rtsp/server/RtspProgram.h"
-#include "rtsp/server/RtpServerStream.h"
+#include "rtsp/server/RtspConnection.h"
+#include "rtsp/server/RtspMulticastGroup.h"
+#include "foundation/EventLoop.h"
+#include "foundation/RingQueue.h"
+#include "foundation/Socket.h"
 
 #include <cstdint>
 
 #include <string>
 #include <vector>
 #include <memory>
-#include <thread>
 #include <mutex>
+#include <map>
+#include <unordered_map>
 
-#include <winsock2.h>
-
+// Reactor based RTSP server: a fixed group of event loop threads serves every connection, the
+// listen socket is watched by the first loop and accepted connections are spread round robin.
+// Thread count stays the same whatever the number of viewers.
 class RtspServerHelper {
 private:
-    enum RtspMsgType {
-        RTSP_MSG_OPTIONS,
-        RTSP_MSG_DESCRIBE,
-        RTSP_MSG_ANNOUNCE,
-        RTSP_MSG_SETUP,
-        RTSP_MSG_PLAY,
-        RTSP_MSG_PAUSE,
-        RTSP_MSG_TEARDOWN,
-        RTSP_MSG_GET_PARAMETER,
-        RTSP_MSG_SET_PARAMETER,
-        RTSP_MSG_REDIRECT,
-        RTSP_MSG_RECORD,
-    };
-
-    struct RtspMessage {
-        RtspMsgType msgId;
-        int cseq;
-        int timeout;
-        int programStreamId;
-        uint16_t clientPort[2];
-        uint16_t serverPort[2];
-        std::string programName;
-        std::string acceptType;
-        std::string contentType;
-        std::string session;
-        std::string userAgent;
-        std::string protocol;
-        std::string cast; // unicast/multicast/broadcast
-    };
-
-    struct RtspSession {
-        std::string session;
-        std::shared_ptr<RtspProgram> program;
-        std::vector<std::shared_ptr<RtpServerStream>> streams;
-    };
+    friend class RtspConnection;
 
     SOCKET mRtspSocket;
     uint16_t mRtspPort;
 
+    std::unique_ptr<EventLoopGroup> mLoopGroup;
+
+    std::mutex mConnectionMutex;
+    std::unordered_map<RtspConnection *, std::shared_ptr<RtspConnection>> mConnections;
+
     std::mutex mProgramMutex;
     std::vector<std::shared_ptr<RtspProgram>> mRtspPrograms;
 
     std::mutex mSessionMutex;
     std::vector<std::shared_ptr<RtspSession>> mRtspSessions;
 
-    void addSession(std::shared_ptr<RtspSession> session);
+    // the setters may run while loop threads set up sessions, the getters hand out copies
+    mutable std::mutex mConfigMutex;
+    // per stream budget between the program reader and the rtp sender
+    QueueLimits mSendQueueLimits;
+    RtspGopCacheConfig mGopCacheConfig;
+    RtpPacingConfig mPacingConfig;
 
-    bool parseLine(std::string &line, RtspMessage &msg);
+    std::mutex mMulticastMutex;
+    RtspMulticastConfig mMulticastConfig;
+    // a group lives while a session holds it, its slot (address and ports) stays with the program
+    // stream so reconnecting viewers find the same group
+    std::map<std::pair<std::string, int>, std::weak_ptr<RtspMulticastGroup>> mMulticastGroups;
+    std::map<std::pair<std::string, int>, int> mMulticastSlots;
+
+    void addSession(std::shared_ptr<RtspSession> session);
+    void removeSession(std::shared_ptr<RtspSession> session);
 
     void addProgram(std::shared_ptr<RtspProgram> program);
     std::shared_ptr<RtspProgram> getProgram(std::string name);
 
-    std::unique_ptr<std::thread> mListenThread;
-    void listenThread();
+    QueueLimits getSendQueueLimits() const;
+    RtspGopCacheConfig getGopCacheConfig() const;
+    RtpPacingConfig getPacingConfig() const;
+
+    std::shared_ptr<RtspMulticastGroup> getMulticastGroup(std::shared_ptr<RtspProgram> program,
+                                                          int streamId);
 
-    void clientHandler(SOCKET clientSocket);
-    void sendThread(std::shared_ptr<RtspSession> session);
+    void onAccept();
+    void removeConnection(RtspConnection *connection);
 
 public:
     RtspServerHelper();
@@ -81,7 +75,16 @@ public:
     RtspServerHelper(RtspServerHelper &&) = delete;
     virtual ~RtspServerHelper();
 
-    bool init();
+    // loopThreads 0 runs one event loop per hardware thread
+    bool init(int loopThreads = 0);
+    // applies to sessions set up afterwards
+    void setSendQueueLimits(const QueueLimits &limits);
+    // applies to groups created afterwards
+    void setMulticastConfig(const RtspMulticastConfig &config);
+    // the cache limit applies to every program, the catch-up rate to sessions set up afterwards
+    void setGopCacheConfig(const RtspGopCacheConfig &config);
+    // the egress cap applies right away, the rest to sessions and groups set up afterwards
+    void setPacingConfig(const RtpPacingConfig &config);
 
     void addProgramFile(const std::string programName, const std::string filePath);
     void addProgramScreen(const std::string programName);
@@ -0,0 +1,181 @@
+#include "RtspStreamPump.h"
+
+#include "foundation/Metrics.h"
+
+#include <algorithm>
+
+RtspStreamPump::RtspStreamPump(EventLoop *loop,
+                               std::shared_ptr<RtspProgram> program,
+                               std::vector<std::shared_ptr<RtpServerStream>> rtpStreams)
+    : mpLoop(loop), mRtspProgram(program), mRtpStreams(std::move(rtpStreams)),
+      mPumpDeadlineUs(0), mPumpTimerId(0), mCatchUpRate(0), mCatchUpStartUs(0), mCatchUpFromUs(0),
+      mCatchUpEndUs(0) {}
+
+RtspStreamPump::~RtspStreamPump() {
+    if (mSubscriber) mRtspProgram->unsubscribe(mSubscriber);
+}
+
+void RtspStreamPump::start(const QueueLimits &limits) {
+    if (mSubscriber) return;
+
+    mPumpIdle = std::make_shared<std::atomic<bool>>(false);
+    mPumpDeadlineUs = 0;
+
+    std::weak_ptr<RtspStreamPump> weakSelf = shared_from_this();
+    EventLoop *loop = mpLoop;
+    std::shared_ptr<std::atomic<bool>> idle = mPumpIdle;
+    auto notify = [weakSelf, loop, idle]() {
+        if (idle->exchange(false)) {
+            loop->post([weakSelf]() {
+                if (auto self = weakSelf.lock()) self->pump();
+            });
+        }
+    };
+
+    std::vector<int> streamIds;
+    for (auto &rtpStream : mRtpStreams) streamIds.emplace_back(rtpStream->getStreamId());
+    mSubscriber = mRtspProgram->subscribe(streamIds, limits, notify);
+
+    for (auto &rtpStream : mRtpStreams) {
+        auto sendStream = std::make_shared<SendStream>();
+        sendStream->rtpStream = rtpStream;
+        sendStream->queue = mSubscriber->getQueue(rtpStream->getStreamId());
+        if (!sendStream->queue) continue;
+        auto cached = mSubscriber->takeCached(rtpStream->getStreamId());
+        sendStream->cached.assign(cached.begin(), cached.end());
+        mSendStreams.emplace_back(sendStream);
+    }
+
+    // the catch-up clock runs rate times faster than the program clock, so it meets it after
+    // rate / (rate - 1) times the backlog
+    mCatchUpEndUs = 0;
+    if (mCatchUpRate > 1) {
+        int64_t baseTimeUs = mRtspProgram->getBaseTimeUs();
+        int64_t fromUs = INT64_MAX;
+        for (auto &sendStream : mSendStreams) {
+            if (sendStream->cached.empty()) continue;
+            auto &packetBuffer = sendStream->cached.front()->packetBuffer;
+            fromUs = std::min(fromUs, baseTimeUs + rescaleTimeStamp(packetBuffer->dts(),
+                                                                    packetBuffer->timescale(),
+                                                                    1000000));
+        }
+        mCatchUpStartUs = timerNowUs();
+        if (fromUs < mCatchUpStartUs) {
+            mCatchUpFromUs = fromUs;
+            mCatchUpEndUs = fromUs + (int64_t)((mCatchUpStartUs - fromUs) * mCatchUpRate /
+                                               (mCatchUpRate - 1));
+        }
+    }
+
+    pump();
+}
+
+void RtspStreamPump::stop() {
+    if (!mSubscriber) return;
+
+    // wakes a pump waiting on the queues, the reader stops publishing to them
+    mRtspProgram->unsubscribe(mSubscriber);
+    mSubscriber.reset();
+    mSendStreams.clear();
+    if (mPumpTimerId) mpLoop->cancel(mPumpTimerId);
+    mPumpTimerId = 0;
+}
+
+void RtspStreamPump::postPump() {
+    std::weak_ptr<RtspStreamPump> weakSelf = shared_from_this();
+    mpLoop->post([weakSelf]() {
+        if (auto self = weakSelf.lock()) self->pump();
+    });
+}
+
+void RtspStreamPump::pump() {
+    if (!mSubscriber) return;
+    // a hook may stop and release the pump
+    auto self = shared_from_this();
+
+    // how far behind its deadline a packet is sent
+    static MetricHistogram &sendLatenessUs =
+        MetricsRegistry::getInstance().histogram("rtsp.server.send_lateness_us");
+
+    int64_t nowUs = timerNowUs();
+    int64_t baseTimeUs = mRtspProgram->getBaseTimeUs();
+    int64_t nextDeadlineUs = INT64_MAX;
+    bool starved = false;
+
+    for (auto &sendStream : mSendStreams) {
+        // what the pacer held back goes before anything new
+        sendStream->rtpStream->sendPaced(nowUs);
+        while (!sendStream->ended) {
+            if (!sendStream->pending) {
+                sendStream->pendingCached = !sendStream->cached.empty();
+                if (sendStream->pendingCached) {
+                    sendStream->pending = std::move(sendStream->cached.front());
+                    sendStream->cached.pop_front();
+                } else {
+                    // read before popping, everything pushed before the end is then visible
+                    bool ended = mSubscriber->isEnded();
+                    if (!sendStream->queue->tryPop(sendStream->pending)) {
+                        if (ended)
+                            sendStream->ended = true;
+                        else
+                            starved = true;
+                        break;
+                    }
+                }
+            }
+
+            // absolute deadlines, a late pump does not delay the packets after it
+            auto &packetBuffer = sendStream->pending->packetBuffer;
+            int64_t deadlineUs =
+                baseTimeUs +
+                rescaleTimeStamp(packetBuffer->dts(), packetBuffer->timescale(), 1000000);
+            int64_t sendAtUs = sendTimeUs(deadlineUs);
+            if (sendAtUs > nowUs) {
+                nextDeadlineUs = std::min(nextDeadlineUs, sendAtUs);
+                break;
+            }
+            // a cached GOP sent at once is as late as it is old
+            if (!sendStream->pendingCached || mCatchUpEndUs) {
+                sendLatenessUs.record(nowUs - sendAtUs);
+            }
+            if (!mAdmitHook || mAdmitHook(*sendStream)) {
+                sendStream->rtpStream->sendPacketList(sendStream->pending, deadlineUs);
+            }
+            sendStream->pending.reset();
+        }
+    }
+
+    for (auto &sendStream : mSendStreams) {
+        nextDeadlineUs = std::min(nextDeadlineUs, sendStream->rtpStream->nextPaceUs());
+    }
+
+    if (mRoundHook && !mRoundHook()) return;
+    if (!mSubscriber) return;
+
+    // at most one timer outstanding: a new one only when it is earlier or the last has fired,
+    // an earlier one cancels the one still queued
+    if (nextDeadlineUs != INT64_MAX &&
+        (mPumpDeadlineUs <= nowUs || nextDeadlineUs < mPumpDeadlineUs)) {
+        if (mPumpDeadlineUs > nowUs) mpLoop->cancel(mPumpTimerId);
+        mPumpDeadlineUs = nextDeadlineUs;
+        std::weak_ptr<RtspStreamPump> weakSelf = self;
+        mPumpTimerId = mpLoop->runAt(nextDeadlineUs, [weakSelf]() {
+            if (auto self = weakSelf.lock()) self->pump();
+        });
+    }
+
+    if (starved) {
+        // go idle, then look again so a push racing with the flag is not lost
+        mPumpIdle->store(true);
+        for (auto &sendStream : mSendStreams) {
+            if (sendStream->ended || sendStream->pending || sendStream->queue->empty()) continue;
+            if (mPumpIdle->exchange(false)) postPump();
+            break;
+        }
+    }
+}
+
+int64_t RtspStreamPump::sendTimeUs(int64_t deadlineUs) const {
+    if (deadlineUs >= mCatchUpEndUs) return deadlineUs;
+    return mCatchUpStartUs + (int64_t)((deadlineUs - mCatchUpFromUs) / mCatchUpRate);
+}
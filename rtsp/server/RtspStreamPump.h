@@ -0,0 +1,90 @@
+#ifndef RTSP_STREAM_PUMP_H
+#define RTSP_STREAM_PUMP_H
+
+#include "rtsp/server/RtspProgram.h"
+#include "rtsp/server/RtpServerStream.h"
+#include "foundation/EventLoop.h"
+#include "foundation/RingQueue.h"
+
+#include <cstdint>
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <deque>
+#include <functional>
+
+// Sends a set of RTP streams of one program from an event loop. It subscribes to the program,
+// whose reader fills a bounded queue per stream, sends what is due on the program clock and arms
+// a timer for the next deadline, so a sender costs no thread of its own.
+//
+// Used by the RTSP connections for their unicast streams and by the multicast groups.
+// start/stop and the hooks run on the loop thread.
+//
+// What the program hands a new subscriber from its GOP cache is due in the past. It goes out
+// first, at once or at the catch-up rate times real time, until the live deadlines are met.
+class RtspStreamPump : public std::enable_shared_from_this<RtspStreamPump> {
+public:
+    struct SendStream {
+        std::shared_ptr<RtpServerStream> rtpStream;
+        std::shared_ptr<RtspSubscriber::BufferQueue> queue;
+        // the subscriber's cached GOP, sent before the queue
+        std::deque<std::shared_ptr<RtpPacketList>> cached;
+        // popped, waiting for its deadline
+        std::shared_ptr<RtpPacketList> pending;
+        bool pendingCached = false;
+        bool ended = false;
+        // left to the admit hook, e.g. dropping up to the next keyframe
+        bool skipToKeyframe = false;
+    };
+
+    // false drops the pending access unit of the stream instead of sending it
+    using AdmitHook = std::function<bool(SendStream &sendStream)>;
+    // after every round of sends, false stops pumping
+    using RoundHook = std::function<bool()>;
+
+    RtspStreamPump(EventLoop *loop,
+                   std::shared_ptr<RtspProgram> program,
+                   std::vector<std::shared_ptr<RtpServerStream>> rtpStreams);
+    RtspStreamPump(const RtspStreamPump &) = delete;
+    RtspStreamPump &operator=(const RtspStreamPump &) = delete;
+    virtual ~RtspStreamPump();
+
+    void setAdmitHook(AdmitHook hook) { mAdmitHook = std::move(hook); }
+    void setRoundHook(RoundHook hook) { mRoundHook = std::move(hook); }
+    // above 1, anything else sends the cached GOP at once; set before start
+    void setCatchUpRate(double rate) { mCatchUpRate = rate; }
+
+    void start(const QueueLimits &limits);
+    void stop();
+    bool isStarted() const { return mSubscriber != nullptr; }
+
+private:
+    EventLoop *mpLoop;
+    std::shared_ptr<RtspProgram> mRtspProgram;
+    std::vector<std::shared_ptr<RtpServerStream>> mRtpStreams;
+
+    AdmitHook mAdmitHook;
+    RoundHook mRoundHook;
+
+    std::shared_ptr<RtspSubscriber> mSubscriber;
+    std::vector<std::shared_ptr<SendStream>> mSendStreams;
+    // set by the pump before it goes idle, the program reader posts a pump when it clears it
+    std::shared_ptr<std::atomic<bool>> mPumpIdle;
+    // deadline and id of the latest pump timer
+    int64_t mPumpDeadlineUs;
+    TimerService::TimerId mPumpTimerId;
+
+    // cached packets due from mCatchUpFromUs on are sent from mCatchUpStartUs on at the catch-up
+    // rate, until their deadlines reach mCatchUpEndUs where that meets real time (0 when done)
+    double mCatchUpRate;
+    int64_t mCatchUpStartUs;
+    int64_t mCatchUpFromUs;
+    int64_t mCatchUpEndUs;
+
+    void pump();
+    void postPump();
+    int64_t sendTimeUs(int64_t deadlineUs) const;
+};
+
+#endif
@@ -1,6 +1,28 @@
 #include "SdpServerHelper.h"
 
 #include "foundation/Base64.h"
+#include "foundation/Startcode.h"
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+
+// parameter sets make lines of any length, so each one is measured before it is formatted
+static void appendf(std::string &out, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    va_list measureArgs;
+    va_copy(measureArgs, args);
+    int n = std::vsnprintf(nullptr, 0, fmt, measureArgs);
+    va_end(measureArgs);
+    if (n > 0) {
+        size_t offset = out.size();
+        out.resize(offset + n + 1);
+        std::vsnprintf(&out[offset], n + 1, fmt, args);
+        out.resize(offset + n);
+    }
+    va_end(args);
+}
 
 std::string SdpServerMPEG4Stream::MIME = "AAC";
 
@@ -17,12 +39,12 @@ SdpServerMPEG4Stream::~SdpServerMPEG4Stream() {}
 
 void SdpServerMPEG4Stream::parseCsd(const uint8_t *data, int length) {
     // AudioSpecificConfig
-    char str[256] = {0};
-    int i = 0;
+    static const char HEX_DIGITS[] = "0123456789abcdef";
+    mConfigStr.clear();
     for (int j = 0; j < length; ++j) {
-        i += std::snprintf(str + i, sizeof(str) - i, "%02x", data[j]);
+        mConfigStr += HEX_DIGITS[data[j] >> 4];
+        mConfigStr += HEX_DIGITS[data[j] & 0x0f];
     }
-    mConfigStr = str;
 
     parseCsdMPEG4(data, length, mObjectType, mFrequency, mChannels);
     mTimescale = mFrequency;
@@ -46,24 +68,22 @@ void SdpServerH264Stream::parseCsd(const uint8_t *data, int length) {
 }
 
 std::string SdpServerH264Stream::getProfileLevelIdString() {
-    // first 3 bytes of SPS, skip SPS header: SPS[0]
+    // first 3 bytes of SPS RBSP, skip SPS header: SPS[0]
     char str[16] = {0};
-    if (mSps.size() >= 4) {
-        std::sprintf(str, "%02x%02x%02x", mSps[1], mSps[2], mSps[3]);
+    uint8_t rbsp[8];
+    size_t size = nalToRbsp(mSps.data(), std::min(mSps.size(), sizeof(rbsp)), rbsp);
+    if (size >= 4) {
+        std::sprintf(str, "%02x%02x%02x", rbsp[1], rbsp[2], rbsp[3]);
     }
     return std::string(str);
 }
 
 std::string SdpServerH264Stream::getSpsString() {
-    char str[1024] = {0};
-    encodeBase64(mSps.data(), mSps.size(), str);
-    return std::string(str);
+    return encodeBase64(mSps.data(), mSps.size());
 }
 
 std::string SdpServerH264Stream::getPpsString() {
-    char str[1024] = {0};
-    encodeBase64(mPps.data(), mPps.size(), str);
-    return std::string(str);
+    return encodeBase64(mPps.data(), mPps.size());
 }
 
 std::string SdpServerHEVCStream::MIME = "HEVC;H265";
@@ -84,21 +104,15 @@ void SdpServerHEVCStream::parseCsd(const uint8_t *data, int length) {
 }
 
 std::string SdpServerHEVCStream::getVpsString() {
-    char str[1024] = {0};
-    encodeBase64(mVps.data(), mVps.size(), str);
-    return std::string(str);
+    return encodeBase64(mVps.data(), mVps.size());
 }
 
 std::string SdpServerHEVCStream::getSpsString() {
-    char str[1024] = {0};
-    encodeBase64(mSps.data(), mSps.size(), str);
-    return std::string(str);
+    return encodeBase64(mSps.data(), mSps.size());
 }
 
 std::string SdpServerHEVCStream::getPpsString() {
-    char str[1024] = {0};
-    encodeBase64(mPps.data(), mPps.size(), str);
-    return std::string(str);
+    return encodeBase64(mPps.data(), mPps.size());
 }
 
 SdpServerHelper::SdpServerHelper() {}
@@ -141,8 +155,6 @@ int SdpServerHelper::getTimescale(int streamId) {
 }
 
 std::string SdpServerHelper::toString(std::string localIPAddr, uint16_t localPort) {
-    char sdpStr[2048] = {0};
-
     std::string addrType;
     if (isIPv4(localIPAddr))
         addrType = "IP4";
@@ -151,55 +163,49 @@ std::string SdpServerHelper::toString(std::string localIPAddr, uint16_t localPor
     else
         return "";
 
-    int i = 0;
-    i += std::snprintf(sdpStr + i, sizeof(sdpStr) - i, "v=0\r\n");
-    i += std::snprintf(sdpStr + i, sizeof(sdpStr) - i, "o=- 0 0 IN %s %s\r\n", addrType.c_str(),
-                       localIPAddr.c_str());
-    i += std::snprintf(sdpStr + i, sizeof(sdpStr) - i, "s=No Name\r\n");
-    i += std::snprintf(sdpStr + i, sizeof(sdpStr) - i, "c=IN %s %s\r\n", addrType.c_str(),
-                       localIPAddr.c_str());
-    i += std::snprintf(sdpStr + i, sizeof(sdpStr) - i, "t=0 0\r\n");
+    std::string sdpStr;
+    appendf(sdpStr, "v=0\r\n");
+    appendf(sdpStr, "o=- 0 0 IN %s %s\r\n", addrType.c_str(), localIPAddr.c_str());
+    appendf(sdpStr, "s=No Name\r\n");
+    appendf(sdpStr, "c=IN %s %s\r\n", addrType.c_str(), localIPAddr.c_str());
+    appendf(sdpStr, "t=0 0\r\n");
 
     for (auto &iter : mStreams) {
-        i += std::snprintf(sdpStr + i, sizeof(sdpStr) - i, "m=%s 0 RTP/AVP %d\r\n",
-                           iter->getMediaType().c_str(), iter->getPayloadType());
-        i += std::snprintf(sdpStr + i, sizeof(sdpStr) - i,
-                           "a=control:rtsp://%s:%hu/%s/trackID=%d\r\n", localIPAddr.c_str(),
-                           localPort, iter->getProgramName().c_str(), iter->getStreamId());
+        appendf(sdpStr, "m=%s 0 RTP/AVP %d\r\n", iter->getMediaType().c_str(),
+                iter->getPayloadType());
+        appendf(sdpStr, "a=control:rtsp://%s:%hu/%s/trackID=%d\r\n", localIPAddr.c_str(),
+                localPort, iter->getProgramName().c_str(), iter->getStreamId());
 
         if (iter->getEncodingName() == "mpeg4-generic") {
             auto stream = std::dynamic_pointer_cast<SdpServerMPEG4Stream>(iter);
-            i += std::snprintf(sdpStr + i, sizeof(sdpStr) - i, "a=rtpmap:%d %s/%d/%d\r\n",
-                               stream->getPayloadType(), stream->getEncodingName().c_str(),
-                               stream->getFrequency(), stream->getChannels());
-            i += std::snprintf(sdpStr + i, sizeof(sdpStr) - i,
-                               "a=fmtp:%d "
-                               "config=%s;profile-level-id=1;streamtype=5;mode=AAC-hbr;sizelength="
-                               "13;indexlength=3;indexdeltalength=3\r\n",
-                               stream->getPayloadType(), stream->getConfigString().c_str());
+            appendf(sdpStr, "a=rtpmap:%d %s/%d/%d\r\n", stream->getPayloadType(),
+                    stream->getEncodingName().c_str(), stream->getFrequency(),
+                    stream->getChannels());
+            appendf(sdpStr,
+                    "a=fmtp:%d "
+                    "config=%s;profile-level-id=1;streamtype=5;mode=AAC-hbr;sizelength="
+                    "13;indexlength=3;indexdeltalength=3\r\n",
+                    stream->getPayloadType(), stream->getConfigString().c_str());
         } else if (iter->getEncodingName() == "H264") {
             auto stream = std::dynamic_pointer_cast<SdpServerH264Stream>(iter);
-            i += std::snprintf(sdpStr + i, sizeof(sdpStr) - i, "a=rtpmap:%d %s/%d\r\n",
-                               stream->getPayloadType(), stream->getEncodingName().c_str(),
-                               stream->getTimescale());
-            i += std::snprintf(
-                sdpStr + i, sizeof(sdpStr) - i,
+            appendf(sdpStr, "a=rtpmap:%d %s/%d\r\n", stream->getPayloadType(),
+                    stream->getEncodingName().c_str(), stream->getTimescale());
+            appendf(
+                sdpStr,
                 "a=fmtp:%d packetization-mode=1;profile-level-id=%s;sprop-parameter-sets=%s,%s\r\n",
                 stream->getPayloadType(), stream->getProfileLevelIdString().c_str(),
                 stream->getSpsString().c_str(), stream->getPpsString().c_str());
         } else if (iter->getEncodingName() == "H265") {
             auto stream = std::dynamic_pointer_cast<SdpServerHEVCStream>(iter);
-            i += std::snprintf(sdpStr + i, sizeof(sdpStr) - i, "a=rtpmap:%d %s/%d\r\n",
-                               stream->getPayloadType(), stream->getEncodingName().c_str(),
-                               stream->getTimescale());
-            i += std::snprintf(sdpStr + i, sizeof(sdpStr) - i,
-                               "a=fmtp:%d sprop-vps=%s;sprop-sps=%s;sprop-pps=%s\r\n",
-                               stream->getPayloadType(), stream->getVpsString().c_str(),
-                               stream->getSpsString().c_str(), stream->getPpsString().c_str());
+            appendf(sdpStr, "a=rtpmap:%d %s/%d\r\n", stream->getPayloadType(),
+                    stream->getEncodingName().c_str(), stream->getTimescale());
+            appendf(sdpStr, "a=fmtp:%d sprop-vps=%s;sprop-sps=%s;sprop-pps=%s\r\n",
+                    stream->getPayloadType(), stream->getVpsString().c_str(),
+                    stream->getSpsString().c_str(), stream->getPpsString().c_str());
         }
     }
 
-    i += std::snprintf(sdpStr + i, sizeof(sdpStr) - i, "\r\n");
+    appendf(sdpStr, "\r\n");
 
-    return std::string(sdpStr);
-}
\ No newline at end of file
+    return sdpStr;
+}
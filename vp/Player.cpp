@@ -1,5 +1,8 @@
 #include "Player.h"
 #include "foundation/Log.h"
+#include "foundation/Metrics.h"
+#include "foundation/TimerService.h"
+#include "foundation/Trace.h"
 
 #include <chrono>
 
@@ -7,6 +10,7 @@
 #include <processthreadsapi.h>
 
 #include "foundation/Semaphore.h"
+#include "foundation/FFBufferPool.h"
 #include "vp/Render.h"
 
 // auto logStartTime = std::chrono::system_clock::now();
@@ -32,9 +36,13 @@ Player::Player() {
     mMessageThread =
         std::unique_ptr<std::thread>(new std::thread(&Player::messageHandleThread, this));
     // mVFifo = av_fifo_alloc2(10, sizeof(void *), 0);
-    mVideoInputBufferQueue = std::make_unique<CountingQueue<std::shared_ptr<AVPacketBuffer>>>(10);
+    // packet queues are budgeted by bytes and by demuxed duration, the slot count only caps
+    // tiny packets
+    mVideoInputBufferQueue = std::make_unique<SpscRingQueue<std::shared_ptr<AVPacketBuffer>>>(
+        QueueLimits{256, 16 * 1024 * 1024, 1000000}, "player.video.input");
     // mAFifo = av_fifo_alloc2(10, sizeof(void *), 0);
-    mAudioInputBufferQueue = std::make_unique<CountingQueue<std::shared_ptr<AVPacketBuffer>>>(10);
+    mAudioInputBufferQueue = std::make_unique<SpscRingQueue<std::shared_ptr<AVPacketBuffer>>>(
+        QueueLimits{256, 1024 * 1024, 1000000}, "player.audio.input");
 
     mRender = std::make_shared<Render>();
 }
@@ -81,6 +89,14 @@ void Player::setFileUrl(std::string fileUrl) {
     mFileUrl = fileUrl;
 }
 
+void Player::setVideoQueueLimits(size_t maxBytes, int64_t maxDurationUs) {
+    mVideoInputBufferQueue->setLimits(maxBytes, maxDurationUs);
+}
+
+void Player::setAudioQueueLimits(size_t maxBytes, int64_t maxDurationUs) {
+    mAudioInputBufferQueue->setLimits(maxBytes, maxDurationUs);
+}
+
 void Player::setVideoBufferReadyCallback(
     std::function<void(std::shared_ptr<AVFrameBuffer>)> callback) {
     mVideoBufferReadyCallback = callback;
@@ -254,6 +270,11 @@ void Player::extractThread() {
     AVCodecParameters *pPar = nullptr;
 
     // SetThreadDescription(GetCurrentThread(), L"ExtractThread");
+    TRACE_THREAD_NAME("extract");
+
+    MetricsRegistry &metrics = MetricsRegistry::getInstance();
+    MetricGauge &videoInputQueue = metrics.gauge("player.video.input_queue");
+    MetricGauge &audioInputQueue = metrics.gauge("player.audio.input_queue");
 
     if (mFileUrl.empty()) return;
 
@@ -279,6 +300,10 @@ void Player::extractThread() {
             mVDecoder = avcodec_find_decoder(pPar->codec_id);
             mVDecContext = avcodec_alloc_context3(mVDecoder);
             avcodec_parameters_to_context(mVDecContext, pPar);
+#if defined(ENABLE_TRACE) && defined(AV_CODEC_FLAG_COPY_OPAQUE)
+            // packet opaque (the trace flow id) goes to the frames decoded from it
+            mVDecContext->flags |= AV_CODEC_FLAG_COPY_OPAQUE;
+#endif
             avcodec_open2(mVDecContext, mVDecoder, nullptr);
         } else if (pPar->codec_type == AVMEDIA_TYPE_AUDIO) {
             audioStreamId = i;
@@ -331,7 +356,8 @@ void Player::extractThread() {
         }
 
         // pPacket = av_packet_alloc();
-        std::shared_ptr<AVPacketBuffer> pPacket = std::make_shared<AVPacketBuffer>();
+        TRACE_SCOPE("read packet");
+        std::shared_ptr<AVPacketBuffer> pPacket = FFBufferPool::getInstance().acquirePacket();
         ret = av_read_frame(pFmtCtx, pPacket->get());
         if (ret >= 0) {
             if ((*pPacket)->stream_index == videoStreamId) {
@@ -339,15 +365,25 @@ void Player::extractThread() {
                 //     ret = putInputBuffer(true, &pPacket);
                 // } while (ret < 0);
                 // int64_t pts = av_rescale_q(pPacket->dts, mpVideoStream->time_base, {1, 1000});
-                LOGD("read video packet, pts=%lld\n", (*pPacket)->pts);
-                mVideoInputBufferQueue->push(pPacket);
+                LOG_EVERY_MS(LOG_LEVEL_DEBUG, LOG_CAT_PLAYER, 1000, "read video packet, pts=%lld\n",
+                             (*pPacket)->pts);
+                (*pPacket)->time_base = mpVideoStream->time_base;
+                TRACE_FLOW_NEW_ID((*pPacket)->opaque);
+                TRACE_FLOW_BEGIN("video packet", (uint64_t)(uintptr_t)(*pPacket)->opaque);
+                mVideoInputBufferQueue->push(std::move(pPacket));
+                TRACE_COUNTER("video input queue", mVideoInputBufferQueue->size());
+                videoInputQueue.set(mVideoInputBufferQueue->size());
             } else if ((*pPacket)->stream_index == audioStreamId) {
                 // do {
                 //     ret = putInputBuffer(false, &pPacket);
                 // } while (ret < 0);
                 // int64_t pts = av_rescale_q(pPacket->dts, mpAudioStream->time_base, { 1, 1000 });
-                LOGD("read audio packet, pts=%lld\n", (*pPacket)->pts);
-                mAudioInputBufferQueue->push(pPacket);
+                LOG_EVERY_MS(LOG_LEVEL_DEBUG, LOG_CAT_PLAYER, 1000, "read audio packet, pts=%lld\n",
+                             (*pPacket)->pts);
+                (*pPacket)->time_base = mpAudioStream->time_base;
+                mAudioInputBufferQueue->push(std::move(pPacket));
+                TRACE_COUNTER("audio input queue", mAudioInputBufferQueue->size());
+                audioInputQueue.set(mAudioInputBufferQueue->size());
             }
         } else {
             mExtractThreadExit = true;
@@ -367,6 +403,10 @@ void Player::videoDecodeThread() {
     int ret;
 
     // SetThreadDescription(GetCurrentThread(), L"VideoDecodeThread");
+    TRACE_THREAD_NAME("video decode");
+
+    // time spent inside the decoder, excluding the wait for the next stage
+    MetricHistogram &decodeUs = MetricsRegistry::getInstance().histogram("player.video.decode_us");
 
     // auto getInputBuffer = [&]() -> void {
     //     int i;
@@ -416,12 +456,20 @@ void Player::videoDecodeThread() {
         // if (pPacket) {
         // printf("get video input buffer: 0x%x, pts: %lld\n",
         // (int)reinterpret_cast<intptr_t>(pPacket), pPacket->pts);
-        LOGD("get video input buffer, pts=%lld\n", (*pPacket)->pts);
+        LOG_EVERY_MS(LOG_LEVEL_DEBUG, LOG_CAT_PLAYER, 1000, "get video input buffer, pts=%lld\n",
+                     (*pPacket)->pts);
 
+        TRACE_SCOPE("decode video");
+        // the decoder copies the flow id to the frames of the packet, the render thread ends it
+        TRACE_FLOW_STEP("video packet", (uint64_t)(uintptr_t)(*pPacket)->opaque);
+        int64_t startUs = timerNowUs();
         ret = avcodec_send_packet(mVDecContext, pPacket->get());
+        int64_t elapsedUs = timerNowUs() - startUs;
         while (ret >= 0) {
-            std::shared_ptr<AVFrameBuffer> pFrame = std::make_shared<AVFrameBuffer>();
+            std::shared_ptr<AVFrameBuffer> pFrame = FFBufferPool::getInstance().acquireFrame();
+            startUs = timerNowUs();
             ret = avcodec_receive_frame(mVDecContext, pFrame->get());
+            elapsedUs += timerNowUs() - startUs;
             if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) break;
             if (mpVideoStream) (*pFrame)->time_base = mpVideoStream->time_base;
             if (mVideoBufferReadyCallback) {
@@ -431,6 +479,7 @@ void Player::videoDecodeThread() {
             }
             // av_frame_free(&pFrame);
         }
+        decodeUs.record(elapsedUs);
         // av_packet_free(&pPacket);
         // pPacket = nullptr;
         //}
@@ -446,6 +495,10 @@ void Player::audioDecodeThread() {
     int ret;
 
     // SetThreadDescription(GetCurrentThread(), L"AudioDecodeThread");
+    TRACE_THREAD_NAME("audio decode");
+
+    // time spent inside the decoder, excluding the wait for the next stage
+    MetricHistogram &decodeUs = MetricsRegistry::getInstance().histogram("player.audio.decode_us");
 
     // auto getInputBuffer = [&]() -> void {
     //     int i;
@@ -495,12 +548,18 @@ void Player::audioDecodeThread() {
         // if (pPacket) {
         // printf("get audio input buffer: 0x%x, pts: %lld\n",
         // (int)reinterpret_cast<intptr_t>(pPacket), pPacket->pts);
-        LOGD("get audio input buffer, pts=%lld\n", (*pPacket)->pts);
+        LOG_EVERY_MS(LOG_LEVEL_DEBUG, LOG_CAT_PLAYER, 1000, "get audio input buffer, pts=%lld\n",
+                     (*pPacket)->pts);
 
+        TRACE_SCOPE("decode audio");
+        int64_t startUs = timerNowUs();
         ret = avcodec_send_packet(mADecContext, pPacket->get());
+        int64_t elapsedUs = timerNowUs() - startUs;
         while (ret >= 0) {
-            std::shared_ptr<AVFrameBuffer> pFrame = std::make_shared<AVFrameBuffer>();
+            std::shared_ptr<AVFrameBuffer> pFrame = FFBufferPool::getInstance().acquireFrame();
+            startUs = timerNowUs();
             ret = avcodec_receive_frame(mADecContext, pFrame->get());
+            elapsedUs += timerNowUs() - startUs;
             if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) break;
             if (mpAudioStream) (*pFrame)->time_base = mpAudioStream->time_base;
             if (mAudioBufferReadyCallback) {
@@ -511,6 +570,7 @@ void Player::audioDecodeThread() {
 
             // av_frame_free(&pFrame);
         }
+        decodeUs.record(elapsedUs);
         // av_packet_free(&pPacket);
         // pPacket = nullptr;
         //}
@@ -8,12 +8,12 @@
 #include <queue>
 #include <mutex>
 
+#include "foundation/RingQueue.h"
+
 class AVFrameBuffer;
 class AVPacketBuffer;
 class Render;
 class Semaphore;
-template <typename T>
-class CountingQueue;
 
 extern "C" {
 #include "libavformat/avformat.h"
@@ -57,7 +57,7 @@ private:
     // AVFifo *mVFifo;
     // std::mutex mVMutex;
     // std::condition_variable mVCv;
-    std::unique_ptr<CountingQueue<std::shared_ptr<AVPacketBuffer>>> mVideoInputBufferQueue;
+    std::unique_ptr<SpscRingQueue<std::shared_ptr<AVPacketBuffer>>> mVideoInputBufferQueue;
     const AVCodec *mVDecoder = nullptr;
     AVCodecContext *mVDecContext = nullptr;
     AVStream *mpVideoStream = nullptr;
@@ -68,7 +68,7 @@ private:
     // AVFifo *mAFifo;
     // std::mutex mAMutex;
     // std::condition_variable mACv;
-    std::unique_ptr<CountingQueue<std::shared_ptr<AVPacketBuffer>>> mAudioInputBufferQueue;
+    std::unique_ptr<SpscRingQueue<std::shared_ptr<AVPacketBuffer>>> mAudioInputBufferQueue;
     const AVCodec *mADecoder = nullptr;
     AVCodecContext *mADecContext = nullptr;
     AVStream *mpAudioStream = nullptr;
@@ -98,6 +98,9 @@ public:
     ~Player();
 
     void setFileUrl(std::string fileUrl);
+    // byte and duration budget (0 means unbounded) of the demuxed packet queues
+    void setVideoQueueLimits(size_t maxBytes, int64_t maxDurationUs);
+    void setAudioQueueLimits(size_t maxBytes, int64_t maxDurationUs);
     void setVideoBufferReadyCallback(std::function<void(std::shared_ptr<AVFrameBuffer>)> callback);
     void setAudioBufferReadyCallback(std::function<void(std::shared_ptr<AVFrameBuffer>)> callback);
     void setRenderVideoBufferCallback(std::function<void(std::shared_ptr<AVFrameBuffer>)> callback);
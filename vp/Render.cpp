@@ -1,5 +1,8 @@
 #include "Render.h"
 #include "foundation/Log.h"
+#include "foundation/Metrics.h"
+#include "foundation/Trace.h"
+#include "foundation/TimerService.h"
 
 #include <iostream>
 #include <chrono>
@@ -16,17 +19,7 @@ extern "C" {
 static void sdlAudioCallback(void *userdata, uint8_t *stream, int len) {
     Render *pRender = (Render *)userdata;
     pRender->updateSystemClock();
-
-    Render::AudioPacket packet = pRender->dequeAudioBuffer();
-    int64_t pts = av_rescale_q(packet.pts, packet.timeBase, {1, AV_TIME_BASE});
-    pRender->updateAudioClock(pts);
-
-    SDL_memset(stream, 0, len);
-    auto pBuffer = packet.pBuffer;
-    if (pBuffer) {
-        len = std::min<uint32_t>(len, pBuffer->size());
-        SDL_MixAudioFormat(stream, pBuffer->data(), AUDIO_S16SYS, len, SDL_MIX_MAXVOLUME);
-    }
+    pRender->fillAudio(stream, len);
 }
 
 Render::Render() {
@@ -43,8 +36,11 @@ Render::Render() {
 
     mPaused = false;
 
-    mAudioBufferQueue = std::make_shared<CountingQueue<AudioPacket>>(10);
-    mVideoBufferQueue = std::make_shared<CountingQueue<std::shared_ptr<AVFrameBuffer>>>(10);
+    // decoded frames are large, budget them by bytes and by presentation time
+    mAudioBufferQueue = std::make_shared<SpscRingQueue<AudioPacket>>(QueueLimits{64, 0, 500000},
+                                                                     "render.audio");
+    mVideoBufferQueue = std::make_shared<SpscRingQueue<std::shared_ptr<AVFrameBuffer>>>(
+        QueueLimits{32, 64 * 1024 * 1024, 500000}, "render.video");
 }
 
 Render::~Render() {
@@ -98,9 +94,10 @@ void Render::start() {
         // this));
     } else {
         // Resume from paused state
-        SDL_PauseAudioDevice(mAudioDevID, 0);
+        // re-arm the queues before the audio callback (their consumer) starts popping again
         mAudioBufferQueue->init();
         mVideoBufferQueue->init();
+        SDL_PauseAudioDevice(mAudioDevID, 0);
         std::unique_lock<std::mutex> lock(mStateMutex);
         mPaused = false;
         mStateCv.notify_all();
@@ -128,14 +125,30 @@ void Render::flush() {
     LOGD("render flush\n");
     mAudioBufferQueue->abort();
     mVideoBufferQueue->abort();
+    // the callback is not running while the device is locked
+    SDL_LockAudioDevice(mAudioDevID);
+    mAudioPending = {};
+    SDL_UnlockAudioDevice(mAudioDevID);
 
     pause();
 }
 
+void Render::setVideoQueueLimits(size_t maxBytes, int64_t maxDurationUs) {
+    mVideoBufferQueue->setLimits(maxBytes, maxDurationUs);
+}
+
+void Render::setAudioQueueLimits(size_t maxBytes, int64_t maxDurationUs) {
+    mAudioBufferQueue->setLimits(maxBytes, maxDurationUs);
+}
+
 void Render::queueVideoBuffer(std::shared_ptr<AVFrameBuffer> pFrame) {
-    LOGD("queue video buffer, pts=%lld\n", (*pFrame)->pts);
+    LOG_EVERY_MS(LOG_LEVEL_DEBUG, LOG_CAT_RENDER, 1000, "queue video buffer, pts=%lld\n",
+                 (*pFrame)->pts);
     // AVFrame* frame = av_frame_clone(pFrame);
-    mVideoBufferQueue->push(pFrame);
+    mVideoBufferQueue->push(std::move(pFrame));
+    TRACE_COUNTER("render video queue", mVideoBufferQueue->size());
+    static MetricGauge &videoQueue = MetricsRegistry::getInstance().gauge("render.video.queue");
+    videoQueue.set(mVideoBufferQueue->size());
 #if 0
     SwsContext *pCtx = nullptr;
     AVPixelFormat srcFormat = (AVPixelFormat)pFrame->format;
@@ -191,7 +204,8 @@ void Render::queueVideoBuffer(std::shared_ptr<AVFrameBuffer> pFrame) {
 }
 
 void Render::queueAudioBuffer(std::shared_ptr<AVFrameBuffer> pFrame) {
-    LOGD("queue audio buffer, pts=%lld\n", (*pFrame)->pts);
+    LOG_EVERY_MS(LOG_LEVEL_DEBUG, LOG_CAT_RENDER, 1000, "queue audio buffer, pts=%lld\n",
+                 (*pFrame)->pts);
     SwrContext *pCtx = nullptr;
     AVChannelLayout chLayout;
 
@@ -211,12 +225,13 @@ void Render::queueAudioBuffer(std::shared_ptr<AVFrameBuffer> pFrame) {
     int outSampleCount = mAudioSamples * mAudioFreq / (*pFrame)->sample_rate + 256;
     int outSize = av_samples_get_buffer_size(nullptr, chLayout.nb_channels, outSampleCount,
                                              AV_SAMPLE_FMT_S16, 0);
-    uint8_t *pOutBuffer = new uint8_t[outSize];
+    // slab backed, recycled once the audio callback drops it
+    auto pBuffer = std::make_shared<PacketBuffer>(outSize);
+    uint8_t *pOutBuffer = pBuffer->base();
     int sampleCount =
         swr_convert(pCtx, &pOutBuffer, outSampleCount, (const uint8_t **)(*pFrame)->extended_data,
                     (*pFrame)->nb_samples);
     //    memcpy(pOutBuffer, pFrame->extended_data[0], outSize);
-    auto pBuffer = std::make_shared<PacketBuffer>((void *)pOutBuffer, outSize);
     int realSize =
         av_samples_get_buffer_size(nullptr, mAudioChannels, sampleCount, AV_SAMPLE_FMT_S16, 0);
     pBuffer->setRange(0, realSize);
@@ -232,6 +247,44 @@ Render::AudioPacket Render::dequeAudioBuffer() {
     return packet;
 }
 
+void Render::fillAudio(uint8_t *stream, int len) {
+    SDL_memset(stream, 0, len);
+    bool first = true;
+    while (len > 0) {
+        AudioPacket packet;
+        if (mAudioPending.pBuffer) {
+            packet = std::move(mAudioPending);
+            mAudioPending = {};
+        } else if (first) {
+            packet = dequeAudioBuffer();
+        } else if (!mAudioBufferQueue->tryPop(packet)) {
+            // do not wait for the decoder in the middle of a period, the rest stays silent
+            break;
+        }
+        if (!packet.pBuffer) break;
+        if (first) {
+            updateAudioClock(av_rescale_q(packet.pts, packet.timeBase, {1, AV_TIME_BASE}));
+            first = false;
+        }
+
+        int size = (int)packet.pBuffer->size();
+        int n = std::min(len, size);
+        SDL_MixAudioFormat(stream, packet.pBuffer->data(), AUDIO_S16SYS, n, SDL_MIX_MAXVOLUME);
+        stream += n;
+        len -= n;
+        if (n < size) {
+            // a resampled frame can be longer than the device period, the rest is played by the
+            // next callback from a view of the same slab
+            int64_t pts = packet.pts;
+            if (pts != AV_NOPTS_VALUE) {
+                int samples = n / (av_get_bytes_per_sample(AV_SAMPLE_FMT_S16) * mAudioChannels);
+                pts += av_rescale_q(samples, {1, mAudioFreq}, packet.timeBase);
+            }
+            mAudioPending = {packet.pBuffer->slice(n, size - n), packet.timeBase, pts};
+        }
+    }
+}
+
 std::shared_ptr<AVFrameBuffer> Render::dequeVideoBuffer() {
     std::shared_ptr<AVFrameBuffer> frame = nullptr;
     mVideoBufferQueue->pop(frame);
@@ -257,6 +310,14 @@ void Render::updateAudioClock(int64_t pts) {
 void Render::renderThread() {
 
     // SetThreadDescription(GetCurrentThread(), L"RenderThread");
+    TRACE_THREAD_NAME("render");
+
+    MetricsRegistry &metrics = MetricsRegistry::getInstance();
+    // positive while video is ahead of audio
+    MetricGauge &avDrift = metrics.gauge("render.av_drift_us");
+    MetricHistogram &avDriftAbs = metrics.histogram("render.av_drift_abs_us");
+    MetricCounter &framesRendered = metrics.counter("render.video.frames_rendered");
+    MetricCounter &framesLate = metrics.counter("render.video.frames_late");
 
     while (true) {
         if (mRenderThreadExit) break;
@@ -269,8 +330,12 @@ void Render::renderThread() {
         std::shared_ptr<AVFrameBuffer> pFrame = dequeVideoBuffer();
 
         if (pFrame) {
+            TRACE_SCOPE("render video");
+            // id 0 when the decoder can not copy packet opaque to frames, nothing is recorded
+            TRACE_FLOW_END("video packet", (uint64_t)(uintptr_t)(*pFrame)->opaque);
 
-            LOGD("render video buffer, pts=%lld\n", (*pFrame)->pts);
+            LOG_EVERY_MS(LOG_LEVEL_DEBUG, LOG_CAT_RENDER, 1000, "render video buffer, pts=%lld\n",
+                         (*pFrame)->pts);
 
             int64_t pts = av_rescale_q((*pFrame)->pts, (*pFrame)->time_base, {1, AV_TIME_BASE});
             auto now = std::chrono::high_resolution_clock::now();
@@ -278,11 +343,20 @@ void Render::renderThread() {
                 std::chrono::duration_cast<std::chrono::microseconds>(now - mSystemClock).count();
             int64_t audioClk = mAudioClock;
             int64_t delayUs = pts - audioClk - deltaUs - 1000; // 1000us for render process time
+            TRACE_COUNTER("render delay us", delayUs);
+            if (audioClk > 0) {
+                int64_t driftUs = pts - audioClk - deltaUs;
+                avDrift.set(driftUs);
+                avDriftAbs.record(driftUs < 0 ? -driftUs : driftUs);
+                // nothing is dropped, frames more than 40ms behind the audio are shown late
+                if (driftUs < -40000) framesLate.add();
+            }
             if (delayUs > 0 && audioClk > 0) {
-                std::this_thread::sleep_for(std::chrono::microseconds(delayUs));
+                TimerService::getInstance().sleepFor(delayUs);
             }
             mPlaytime = pts / 1000;
             if (mRenderVideoBufferCallback) mRenderVideoBufferCallback(pFrame);
+            framesRendered.add();
             // av_frame_free(&pFrame);
         }
     }
@@ -1,7 +1,7 @@
 #ifndef RENDER_H
 #define RENDER_H
 
-#include "foundation/CountingQueue.h"
+#include "foundation/RingQueue.h"
 #include "foundation/PacketBuffer.h"
 #include "foundation/FFBuffer.h"
 
@@ -16,6 +16,7 @@
 
 extern "C" {
 #include "libavutil/frame.h"
+#include "libavutil/mathematics.h"
 }
 
 class Render {
@@ -33,9 +34,14 @@ public:
     void stop();
     void pause();
     void flush();
+    // byte and duration budget (0 means unbounded) of the frame queues
+    void setVideoQueueLimits(size_t maxBytes, int64_t maxDurationUs);
+    void setAudioQueueLimits(size_t maxBytes, int64_t maxDurationUs);
     void queueVideoBuffer(std::shared_ptr<AVFrameBuffer> pFrame);
     void queueAudioBuffer(std::shared_ptr<AVFrameBuffer> pFrame);
     AudioPacket dequeAudioBuffer();
+    // mixes len bytes of queued audio into stream, from the audio device callback
+    void fillAudio(uint8_t *stream, int len);
     std::shared_ptr<AVFrameBuffer> dequeVideoBuffer();
     void setRenderVideoBufferCallback(std::function<void(std::shared_ptr<AVFrameBuffer>)> callback);
     void updateSystemClock();
@@ -58,7 +64,8 @@ private:
     uint32_t mAudioBufferSize; // buffer size in callback function
     uint32_t mAudioBytesPerSec;
     SDL_AudioDeviceID mAudioDevID;
-    std::shared_ptr<CountingQueue<AudioPacket>> mAudioBufferQueue;
+    std::shared_ptr<SpscRingQueue<AudioPacket>> mAudioBufferQueue;
+    AudioPacket mAudioPending; // what the last callback left of a packet, callback only
 
     int64_t mAudioClock; // microseconds
     std::chrono::time_point<std::chrono::high_resolution_clock> mSystemClock;
@@ -66,7 +73,7 @@ private:
     // Video
     int mVideoFrameWidth;
     int mVideoFrameHeight;
-    std::shared_ptr<CountingQueue<std::shared_ptr<AVFrameBuffer>>> mVideoBufferQueue;
+    std::shared_ptr<SpscRingQueue<std::shared_ptr<AVFrameBuffer>>> mVideoBufferQueue;
     std::function<void(std::shared_ptr<AVFrameBuffer>)> mRenderVideoBufferCallback;
     // std::shared_ptr<CountingQueue<std::shared_ptr<PacketBuffer> > > mVideoBufferQueue;
     // std::function<void(std::shared_ptr<PacketBuffer>)> mRenderVideoBufferCallback;
@@ -80,4 +87,16 @@ private:
     void renderThread();
 };
 
+template <>
+struct QueueItemTraits<Render::AudioPacket> {
+    static size_t bytes(const Render::AudioPacket &packet) {
+        return packet.pBuffer ? packet.pBuffer->size() : 0;
+    }
+    static int64_t timeUs(const Render::AudioPacket &packet) {
+        if (!packet.pBuffer || packet.pts == AV_NOPTS_VALUE || packet.timeBase.num <= 0)
+            return QUEUE_NO_TIME;
+        return av_rescale_q(packet.pts, packet.timeBase, {1, 1000000});
+    }
+};
+
 #endif // RENDER_H
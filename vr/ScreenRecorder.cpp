@@ -1,5 +1,10 @@
 #include "ScreenRecorder.h"
 #include "foundation/Log.h"
+#include "foundation/FFBufferPool.h"
+#include "foundation/Metrics.h"
+#include "foundation/TimerService.h"
+
+#include <algorithm>
 
 extern "C" {
 #include "libavformat/avformat.h"
@@ -31,16 +36,17 @@ ScreenRecorder::ScreenRecorder(int width, int height, int offsetX, int offsetY)
     mSDL2AvAudioFormatMap[AUDIO_S32SYS] = AV_SAMPLE_FMT_S32;
     mSDL2AvAudioFormatMap[AUDIO_F32SYS] = AV_SAMPLE_FMT_FLT;
 
-    mVideoFrameBufferQueue =
-        std::make_unique<CountingQueue<std::shared_ptr<AVFrameBuffer>>>(10);
-    mVideoPacketBufferQueue =
-        std::make_unique<CountingQueue<std::shared_ptr<AVPacketBuffer>>>(10);
+    // raw captured frames dominate memory, budget them by bytes
+    mVideoFrameBufferQueue = std::make_unique<SpscRingQueue<std::shared_ptr<AVFrameBuffer>>>(
+        QueueLimits{16, 64 * 1024 * 1024, 0}, "recorder.video.frame");
+    mVideoPacketBufferQueue = std::make_unique<SpscRingQueue<std::shared_ptr<AVPacketBuffer>>>(
+        QueueLimits{128, 16 * 1024 * 1024, 2000000}, "recorder.video.packet");
     mVideoNextPts = 0;
 
-    mAudioFrameBufferQueue =
-        std::make_unique<CountingQueue<std::shared_ptr<AVFrameBuffer>>>(10);
-    mAudioPacketBufferQueue =
-        std::make_unique<CountingQueue<std::shared_ptr<AVPacketBuffer>>>(10);
+    mAudioFrameBufferQueue = std::make_unique<SpscRingQueue<std::shared_ptr<AVFrameBuffer>>>(
+        QueueLimits{64, 4 * 1024 * 1024, 0}, "recorder.audio.frame");
+    mAudioPacketBufferQueue = std::make_unique<SpscRingQueue<std::shared_ptr<AVPacketBuffer>>>(
+        QueueLimits{128, 1024 * 1024, 2000000}, "recorder.audio.packet");
     mAudioNextPts = 0;
 
     mAudioFreq    = 48000;
@@ -204,24 +210,34 @@ void ScreenRecorder::stop() {
 }
 
 void ScreenRecorder::queueVideoBuffer(std::shared_ptr<AVFrameBuffer> pFrame) {
-    mVideoFrameBufferQueue->push(pFrame);
+    // capture time for the encoder, opaque is reset when the pooled frame is unreferenced
+    (*pFrame)->opaque = (void *)(intptr_t)timerNowUs();
+    mVideoFrameBufferQueue->push(std::move(pFrame));
 }
 
 void ScreenRecorder::queueAudioBuffer(std::shared_ptr<AVFrameBuffer> pFrame) {
-    mAudioFrameBufferQueue->push(pFrame);
+    mAudioFrameBufferQueue->push(std::move(pFrame));
 }
 
 void ScreenRecorder::queueAudioBuffer(uint8_t *buffer, int len) {
     if (!buffer) return;
 
-    std::shared_ptr<AVFrameBuffer> pFrame = std::make_shared<AVFrameBuffer>();
-    pFrame->get()->format                 = mAudioFormat;
-    pFrame->get()->ch_layout              = mAudioLayout;
-    pFrame->get()->nb_samples             = mAudioSamples;
-    pFrame->get()->sample_rate            = mAudioFreq;
-    av_frame_get_buffer(pFrame->get(), 1);
+    std::shared_ptr<AVFrameBuffer> pFrame =
+        FFBufferPool::getInstance().acquireAudioFrame(mAudioSamples, mAudioFormat, &mAudioLayout);
+    if (!pFrame) return;
+    pFrame->get()->sample_rate = mAudioFreq;
+    len = std::min(len, av_samples_get_buffer_size(nullptr, mAudioLayout.nb_channels,
+                                                   mAudioSamples, mAudioFormat, 1));
     memcpy(pFrame->get()->data[0], buffer, len);
-    mAudioFrameBufferQueue->push(pFrame);
+    mAudioFrameBufferQueue->push(std::move(pFrame));
+}
+
+void ScreenRecorder::setVideoQueueLimits(size_t maxBytes, int64_t maxDurationUs) {
+    mVideoFrameBufferQueue->setLimits(maxBytes, maxDurationUs);
+}
+
+void ScreenRecorder::setAudioQueueLimits(size_t maxBytes, int64_t maxDurationUs) {
+    mAudioFrameBufferQueue->setLimits(maxBytes, maxDurationUs);
 }
 
 int ScreenRecorder::getVideoTimescale() {
@@ -405,23 +421,24 @@ void ScreenRecorder::videoRecordThread() {
 
     auto receiveFrame = [this, &ret, &pDecContext]() {
         while (true) {
-            std::shared_ptr<AVFrameBuffer> pFrame = std::make_shared<AVFrameBuffer>();
+            std::shared_ptr<AVFrameBuffer> pFrame = FFBufferPool::getInstance().acquireFrame();
             ret = avcodec_receive_frame(pDecContext, pFrame->get());
             if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) break;
             if (ret < 0) break;
 
             // fwrite(pFrame->get()->data[0], 1, pFrame->get()->linesize[0] *
             // pFrame->get()->height, pFile);
-            LOGD("get frame width:%d height:%d format:%d\n", pFrame->get()->width,
-                 pFrame->get()->height, pFrame->get()->format);
+            LOG_EVERY_MS(LOG_LEVEL_DEBUG, LOG_CAT_RECORDER, 1000,
+                         "get frame width:%d height:%d format:%d\n", pFrame->get()->width,
+                         pFrame->get()->height, pFrame->get()->format);
             queueVideoBuffer(pFrame);
         }
     };
 
     while (true) {
         if (mVideoRecordThreadExit) break;
-        std::shared_ptr<AVPacketBuffer> pPacket = std::make_shared<AVPacketBuffer>();
-        ret                                     = av_read_frame(pFmtCtx, pPacket->get());
+        std::shared_ptr<AVPacketBuffer> pPacket = FFBufferPool::getInstance().acquirePacket();
+        ret = av_read_frame(pFmtCtx, pPacket->get());
         if (ret < 0) {
             LOGD("%s failed to read frame\n", pInputFmt->name);
         }
@@ -454,9 +471,16 @@ void ScreenRecorder::videoEncodeThread() {
     pConvertFrame->get()->height                 = mHeight;
     av_frame_get_buffer(pConvertFrame->get(), 1);
 
+    MetricsRegistry &metrics = MetricsRegistry::getInstance();
+    MetricHistogram &captureToEncodeUs = metrics.histogram("recorder.video.capture_to_encode_us");
+    MetricCounter &framesEncoded = metrics.counter("recorder.video.frames_encoded");
+    MetricGauge &encodeFps = metrics.gauge("recorder.video.encode_fps");
+    int64_t fpsStartUs = timerNowUs();
+    int fpsFrames = 0;
+
     auto receivePacket = [this, &ret]() {
         while (true) {
-            std::shared_ptr<AVPacketBuffer> pPacket = std::make_shared<AVPacketBuffer>();
+            std::shared_ptr<AVPacketBuffer> pPacket = FFBufferPool::getInstance().acquirePacket();
             ret = avcodec_receive_packet(mpVideoEncoderCtx, pPacket->get());
             if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
                 break;
@@ -465,9 +489,11 @@ void ScreenRecorder::videoEncodeThread() {
                 LOGD("failed to receive video packet\n");
                 break;
             }
-            LOGD("get video packet, size=%d, dts=%d pts=%d\n", pPacket->get()->size,
-                 pPacket->get()->dts, pPacket->get()->pts);
-            mVideoPacketBufferQueue->push(pPacket);
+            LOG_EVERY_MS(LOG_LEVEL_DEBUG, LOG_CAT_RECORDER, 1000,
+                         "get video packet, size=%d, dts=%d pts=%d\n", pPacket->get()->size,
+                         pPacket->get()->dts, pPacket->get()->pts);
+            pPacket->get()->time_base = mpVideoEncoderCtx->time_base;
+            mVideoPacketBufferQueue->push(std::move(pPacket));
         }
     };
 
@@ -490,6 +516,16 @@ void ScreenRecorder::videoEncodeThread() {
             LOGD("failed to send video frame\n");
             break;
         }
+
+        int64_t nowUs = timerNowUs();
+        captureToEncodeUs.record(nowUs - (int64_t)(intptr_t)(*pFrame)->opaque);
+        framesEncoded.add();
+        ++fpsFrames;
+        if (nowUs - fpsStartUs >= 1000000) {
+            encodeFps.set(fpsFrames * 1000000ll / (nowUs - fpsStartUs));
+            fpsStartUs = nowUs;
+            fpsFrames = 0;
+        }
         receivePacket();
     }
 
@@ -529,7 +565,7 @@ void ScreenRecorder::audioEncodeThread() {
 
     auto receivePacket = [this, &ret]() {
         while (true) {
-            std::shared_ptr<AVPacketBuffer> pPacket = std::make_shared<AVPacketBuffer>();
+            std::shared_ptr<AVPacketBuffer> pPacket = FFBufferPool::getInstance().acquirePacket();
             ret = avcodec_receive_packet(mpAudioEncoderCtx, pPacket->get());
             if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
                 break;
@@ -538,9 +574,11 @@ void ScreenRecorder::audioEncodeThread() {
                 LOGD("failed to receive audio packet\n");
                 break;
             }
-            LOGD("get audio packet, size=%d, dts=%d pts=%d\n", pPacket->get()->size,
-                 pPacket->get()->dts, pPacket->get()->pts);
-            mAudioPacketBufferQueue->push(pPacket);
+            LOG_EVERY_MS(LOG_LEVEL_DEBUG, LOG_CAT_RECORDER, 1000,
+                         "get audio packet, size=%d, dts=%d pts=%d\n", pPacket->get()->size,
+                         pPacket->get()->dts, pPacket->get()->pts);
+            pPacket->get()->time_base = mpAudioEncoderCtx->time_base;
+            mAudioPacketBufferQueue->push(std::move(pPacket));
         }
     };
 
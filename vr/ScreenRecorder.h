@@ -8,7 +8,7 @@
 #include <map>
 #include <vector>
 
-#include "foundation/CountingQueue.h"
+#include "foundation/RingQueue.h"
 #include "foundation/FFBuffer.h"
 
 #define SDL_MAIN_HANDLED
@@ -24,8 +24,8 @@ private:
     std::unique_ptr<std::thread> mVideoRecordThread;
     std::atomic<bool> mVideoEncodeThreadExit;
     std::unique_ptr<std::thread> mVideoEncodeThread;
-    std::unique_ptr<CountingQueue<std::shared_ptr<AVFrameBuffer>>> mVideoFrameBufferQueue;
-    std::unique_ptr<CountingQueue<std::shared_ptr<AVPacketBuffer>>> mVideoPacketBufferQueue;
+    std::unique_ptr<SpscRingQueue<std::shared_ptr<AVFrameBuffer>>> mVideoFrameBufferQueue;
+    std::unique_ptr<SpscRingQueue<std::shared_ptr<AVPacketBuffer>>> mVideoPacketBufferQueue;
     uint32_t mVideoNextPts;
     AVCodecContext *mpVideoEncoderCtx = nullptr;
     std::atomic<bool> mVideoInitDone;
@@ -34,8 +34,8 @@ private:
 
     std::atomic<bool> mAudioEncodeThreadExit;
     std::unique_ptr<std::thread> mAudioEncodeThread;
-    std::unique_ptr<CountingQueue<std::shared_ptr<AVFrameBuffer>>> mAudioFrameBufferQueue;
-    std::unique_ptr<CountingQueue<std::shared_ptr<AVPacketBuffer>>> mAudioPacketBufferQueue;
+    std::unique_ptr<SpscRingQueue<std::shared_ptr<AVFrameBuffer>>> mAudioFrameBufferQueue;
+    std::unique_ptr<SpscRingQueue<std::shared_ptr<AVPacketBuffer>>> mAudioPacketBufferQueue;
     uint32_t mAudioNextPts;
     AVCodecContext *mpAudioEncoderCtx = nullptr;
     std::atomic<bool> mAudioInitDone;
@@ -66,6 +66,9 @@ public:
     void queueVideoBuffer(std::shared_ptr<AVFrameBuffer> pFrame);
     void queueAudioBuffer(std::shared_ptr<AVFrameBuffer> pFrame);
     void queueAudioBuffer(uint8_t *buffer, int len);
+    // byte and duration budget (0 means unbounded) of the raw frame queues
+    void setVideoQueueLimits(size_t maxBytes, int64_t maxDurationUs);
+    void setAudioQueueLimits(size_t maxBytes, int64_t maxDurationUs);
 
     int getVideoTimescale();
     std::string getVideoMime();
@@ -1,11 +1,19 @@
 add_rules("mode.debug", "mode.release")
 
+option("trace")
+    set_default(false)
+    set_showmenu(true)
+    set_description("Record pipeline trace events, see foundation/Trace.h")
+    add_defines("ENABLE_TRACE")
+option_end()
+
 target("VideoToolBox")
     set_kind("binary")
     set_toolchains("msvc")
     set_languages("c++20")
     add_cxxflags("/Zc:__cplusplus")
     add_cxxflags("/await")
+    add_options("trace")
 
     add_rules("qt.widgetapp")
     add_frameworks("QtOpenGL", "QtOpenGLWidgets")
@@ -33,4 +41,165 @@ target("VideoToolBox")
     add_links("SDL2")
     add_links("OleAut32")
     add_links("d3d11", "d3dcompiler")
-    add_links("yuv")
\ No newline at end of file
+    add_links("yuv")
+
+-- standalone benchmarks on foundation code, no Qt or FFmpeg needed and not built by default:
+-- xmake build -g bench, then xmake run <name>
+target("RingQueueBench")
+    set_kind("binary")
+    set_default(false)
+    set_group("bench")
+    set_languages("c++20")
+    add_includedirs(".")
+    add_files("bench/RingQueueBench.cpp", "foundation/Metrics.cpp", "foundation/Log.cpp")
+    if is_plat("linux") then
+        add_syslinks("pthread")
+    end
+
+target("BitReaderBench")
+    set_kind("binary")
+    set_default(false)
+    set_group("bench")
+    set_languages("c++20")
+    add_includedirs(".")
+    add_files("bench/BitReaderBench.cpp", "bench/LegacyBitReader.cpp", "foundation/BitReader.cpp")
+
+target("BitWriterBench")
+    set_kind("binary")
+    set_default(false)
+    set_group("bench")
+    set_languages("c++20")
+    add_includedirs(".")
+    add_files("bench/BitWriterBench.cpp", "bench/LegacyBitWriter.cpp", "foundation/BitWriter.cpp")
+
+target("StartcodeBench")
+    set_kind("binary")
+    set_default(false)
+    set_group("bench")
+    set_languages("c++20")
+    add_includedirs(".")
+    add_files("bench/StartcodeBench.cpp", "foundation/Startcode.cpp", "foundation/CpuFeatures.cpp")
+    add_files("foundation/PacketBuffer.cpp")
+
+target("EmulationPreventionBench")
+    set_kind("binary")
+    set_default(false)
+    set_group("bench")
+    set_languages("c++20")
+    add_includedirs(".")
+    add_files("bench/EmulationPreventionBench.cpp", "foundation/Startcode.cpp")
+    add_files("foundation/CpuFeatures.cpp", "foundation/PacketBuffer.cpp")
+
+target("TimerJitterBench")
+    set_kind("binary")
+    set_default(false)
+    set_group("bench")
+    set_languages("c++20")
+    add_includedirs(".")
+    add_files("bench/TimerJitterBench.cpp", "foundation/TimerService.cpp")
+    add_files("foundation/Log.cpp", "foundation/Metrics.cpp")
+    if is_plat("windows") then
+        add_syslinks("winmm")
+    elseif is_plat("linux") then
+        add_syslinks("pthread")
+    end
+
+target("UdpBatchBench")
+    set_kind("binary")
+    set_default(false)
+    set_group("bench")
+    set_languages("c++20")
+    add_includedirs(".")
+    add_files("bench/UdpBatchBench.cpp", "foundation/Socket.cpp")
+    if is_plat("windows") then
+        add_syslinks("ws2_32")
+    elseif is_plat("linux") then
+        add_syslinks("pthread")
+    end
+
+target("Base64Bench")
+    set_kind("binary")
+    set_default(false)
+    set_group("bench")
+    set_languages("c++20")
+    add_includedirs(".")
+    -- includes foundation/Base64.cpp itself
+    add_files("bench/Base64Bench.cpp", "foundation/CpuFeatures.cpp")
+
+-- benchmarks on the RTSP server code, Windows only like the server: they link FFmpeg from the same
+-- place as the application
+target("MulticastLoopbackBench")
+    set_kind("binary")
+    set_default(false)
+    set_group("bench")
+    set_languages("c++20")
+    add_includedirs(".")
+    add_includedirs("D:/msys64/usr/local/include")
+    add_linkdirs("D:/msys64/usr/local/bin")
+    add_files("bench/MulticastLoopbackBench.cpp")
+    add_files("rtsp/server/RtpServerStream.cpp", "rtsp/server/RtpServerProto.cpp")
+    add_files("rtsp/server/RtcpServerProto.cpp")
+    add_files("foundation/FFBuffer.cpp", "foundation/Socket.cpp", "foundation/TimerService.cpp")
+    add_files("foundation/Log.cpp", "foundation/Metrics.cpp", "foundation/Utils.cpp")
+    add_files("foundation/BitReader.cpp", "foundation/BitWriter.cpp", "foundation/Startcode.cpp")
+    add_files("foundation/CpuFeatures.cpp", "foundation/PacketBuffer.cpp")
+    add_links("avutil", "avcodec")
+    add_syslinks("ws2_32", "winmm")
+
+target("PacingBench")
+    set_kind("binary")
+    set_default(false)
+    set_group("bench")
+    set_languages("c++20")
+    add_includedirs(".")
+    add_includedirs("D:/msys64/usr/local/include")
+    add_linkdirs("D:/msys64/usr/local/bin")
+    add_files("bench/PacingBench.cpp")
+    add_files("rtsp/server/RtpServerStream.cpp", "rtsp/server/RtpServerProto.cpp")
+    add_files("rtsp/server/RtcpServerProto.cpp")
+    add_files("foundation/FFBuffer.cpp", "foundation/Socket.cpp", "foundation/TimerService.cpp")
+    add_files("foundation/Log.cpp", "foundation/Metrics.cpp", "foundation/Utils.cpp")
+    add_files("foundation/BitReader.cpp", "foundation/BitWriter.cpp", "foundation/Startcode.cpp")
+    add_files("foundation/CpuFeatures.cpp", "foundation/PacketBuffer.cpp")
+    add_links("avutil", "avcodec")
+    add_syslinks("ws2_32", "winmm")
+
+target("GopCacheBench")
+    set_kind("binary")
+    set_default(false)
+    set_group("bench")
+    set_languages("c++20")
+    add_includedirs(".")
+    add_includedirs("E:/ffmpeg/SDL2-devel-2.28.4-VC/include")
+    add_includedirs("D:/msys64/usr/local/include")
+    add_linkdirs("E:/ffmpeg/SDL2-devel-2.28.4-VC/lib/x64")
+    add_linkdirs("D:/msys64/usr/local/bin")
+    add_files("bench/GopCacheBench.cpp")
+    -- RtspProgram also serves the screen, so the recorder comes along
+    add_files("rtsp/server/RtspProgram.cpp", "rtsp/server/SdpServerHelper.cpp")
+    add_files("rtsp/server/RtpServerProto.cpp", "vr/ScreenRecorder.cpp")
+    add_files("foundation/FFBuffer.cpp", "foundation/FFBufferPool.cpp", "foundation/Base64.cpp")
+    add_files("foundation/TimerService.cpp", "foundation/Log.cpp", "foundation/Metrics.cpp")
+    add_files("foundation/Utils.cpp", "foundation/BitReader.cpp", "foundation/BitWriter.cpp")
+    add_files("foundation/Startcode.cpp", "foundation/CpuFeatures.cpp")
+    add_files("foundation/PacketBuffer.cpp")
+    add_links("avdevice", "avutil", "avcodec", "avformat", "swresample", "swscale")
+    add_links("SDL2")
+    add_syslinks("ws2_32", "winmm")
+
+target("RtpProtoBench")
+    set_kind("binary")
+    set_default(false)
+    set_group("bench")
+    set_languages("c++20")
+    add_includedirs(".")
+    add_includedirs("D:/msys64/usr/local/include")
+    add_linkdirs("D:/msys64/usr/local/bin")
+    add_files("bench/RtpProtoBench.cpp")
+    add_files("rtsp/server/RtpServerProto.cpp", "rtsp/server/RtcpServerProto.cpp")
+    add_files("foundation/FFBuffer.cpp", "foundation/Socket.cpp", "foundation/TimerService.cpp")
+    add_files("foundation/Log.cpp", "foundation/Metrics.cpp", "foundation/Utils.cpp")
+    add_files("foundation/BitReader.cpp", "foundation/BitWriter.cpp", "foundation/Startcode.cpp")
+    add_files("foundation/CpuFeatures.cpp", "foundation/PacketBuffer.cpp")
+    add_links("avutil", "avcodec")
+    add_syslinks("ws2_32", "winmm")